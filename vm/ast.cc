@@ -1,5 +1,7 @@
 #include "ast.h"
 
+#include "assertions.h"
+
 namespace Katsu
 {
     void UnaryOpExpr::accept(ExprVisitor& visitor)
@@ -47,12 +49,32 @@ namespace Katsu
         visitor.visit(*this);
     }
 
-    std::vector<std::unique_ptr<Expr>>* Expr::sequence_components()
+    std::vector<Expr*>* Expr::sequence_components()
     {
         return nullptr;
     }
-    std::vector<std::unique_ptr<Expr>>* SequenceExpr::sequence_components()
+    std::vector<Expr*>* SequenceExpr::sequence_components()
     {
         return &this->components;
     }
+
+    ExprArena::~ExprArena()
+    {
+        for (auto it = this->exprs.rbegin(); it != this->exprs.rend(); ++it) {
+            (*it)->~Expr();
+        }
+    }
+
+    void* ExprArena::allocate(size_t size, size_t alignment)
+    {
+        ASSERT(size <= BLOCK_SIZE && alignment <= alignof(std::max_align_t));
+        size_t start = (this->spot + alignment - 1) & ~(alignment - 1);
+        if (this->blocks.empty() || start + size > this->limit) {
+            this->blocks.push_back(std::make_unique_for_overwrite<uint8_t[]>(BLOCK_SIZE));
+            start = 0;
+            this->limit = BLOCK_SIZE;
+        }
+        this->spot = start + size;
+        return &this->blocks.back()[start];
+    }
 };
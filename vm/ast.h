@@ -1,7 +1,12 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <new>
 #include <optional>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "span.h"
@@ -11,12 +16,14 @@ namespace Katsu
 {
     class ExprVisitor;
 
+    // Expressions are allocated from an ExprArena (see ExprArena::make()), which owns them, so
+    // each expression just points to its subexpressions.
     struct Expr
     {
         SourceSpan span;
 
         Expr(SourceSpan _span)
-            : span(_span)
+            : span(std::move(_span))
         {}
 
         virtual ~Expr() = default;
@@ -24,18 +31,18 @@ namespace Katsu
         virtual void accept(ExprVisitor& visitor) = 0;
 
         // nullptr if no sequence components (default!).
-        virtual std::vector<std::unique_ptr<Expr>>* sequence_components();
+        virtual std::vector<Expr*>* sequence_components();
     };
 
     struct UnaryOpExpr : public Expr
     {
         Token op;
-        std::unique_ptr<Expr> arg;
+        Expr* arg;
 
-        UnaryOpExpr(SourceSpan _span, Token _op, std::unique_ptr<Expr> _arg)
-            : Expr(_span)
-            , op(_op)
-            , arg(std::move(_arg))
+        UnaryOpExpr(SourceSpan _span, Token _op, Expr* _arg)
+            : Expr(std::move(_span))
+            , op(std::move(_op))
+            , arg(_arg)
         {}
 
         void accept(ExprVisitor& visitor) override;
@@ -44,15 +51,14 @@ namespace Katsu
     struct BinaryOpExpr : public Expr
     {
         Token op;
-        std::unique_ptr<Expr> left;
-        std::unique_ptr<Expr> right;
-
-        BinaryOpExpr(SourceSpan _span, Token _op, std::unique_ptr<Expr> _left,
-                     std::unique_ptr<Expr> _right)
-            : Expr(_span)
-            , op(_op)
-            , left(std::move(_left))
-            , right(std::move(_right))
+        Expr* left;
+        Expr* right;
+
+        BinaryOpExpr(SourceSpan _span, Token _op, Expr* _left, Expr* _right)
+            : Expr(std::move(_span))
+            , op(std::move(_op))
+            , left(_left)
+            , right(_right)
         {}
 
         void accept(ExprVisitor& visitor) override;
@@ -63,8 +69,8 @@ namespace Katsu
         Token name;
 
         NameExpr(SourceSpan _span, Token _name)
-            : Expr(_span)
-            , name(_name)
+            : Expr(std::move(_span))
+            , name(std::move(_name))
         {}
 
         void accept(ExprVisitor& visitor) override;
@@ -75,8 +81,8 @@ namespace Katsu
         Token literal;
 
         LiteralExpr(SourceSpan _span, Token _literal)
-            : Expr(_span)
-            , literal(_literal)
+            : Expr(std::move(_span))
+            , literal(std::move(_literal))
         {}
 
         void accept(ExprVisitor& visitor) override;
@@ -84,13 +90,13 @@ namespace Katsu
 
     struct UnaryMessageExpr : public Expr
     {
-        std::unique_ptr<Expr> target;
+        Expr* target;
         Token message;
 
-        UnaryMessageExpr(SourceSpan _span, std::unique_ptr<Expr> _target, Token _message)
-            : Expr(_span)
-            , target(std::move(_target))
-            , message(_message)
+        UnaryMessageExpr(SourceSpan _span, Expr* _target, Token _message)
+            : Expr(std::move(_span))
+            , target(_target)
+            , message(std::move(_message))
         {}
 
         void accept(ExprVisitor& visitor) override;
@@ -98,15 +104,15 @@ namespace Katsu
 
     struct NAryMessageExpr : public Expr
     {
-        std::optional<std::unique_ptr<Expr>> target;
+        std::optional<Expr*> target;
         std::vector<Token> messages;
-        std::vector<std::unique_ptr<Expr>> args;
+        std::vector<Expr*> args;
 
-        NAryMessageExpr(SourceSpan _span, std::optional<std::unique_ptr<Expr>> _target,
-                        std::vector<Token> _messages, std::vector<std::unique_ptr<Expr>> _args)
-            : Expr(_span)
-            , target(std::move(_target))
-            , messages(_messages)
+        NAryMessageExpr(SourceSpan _span, std::optional<Expr*> _target,
+                        std::vector<Token> _messages, std::vector<Expr*> _args)
+            : Expr(std::move(_span))
+            , target(_target)
+            , messages(std::move(_messages))
             , args(std::move(_args))
         {}
 
@@ -115,11 +121,11 @@ namespace Katsu
 
     struct ParenExpr : public Expr
     {
-        std::unique_ptr<Expr> inner;
+        Expr* inner;
 
-        ParenExpr(SourceSpan _span, std::unique_ptr<Expr> _inner)
-            : Expr(_span)
-            , inner(std::move(_inner))
+        ParenExpr(SourceSpan _span, Expr* _inner)
+            : Expr(std::move(_span))
+            , inner(_inner)
         {}
 
         void accept(ExprVisitor& visitor) override;
@@ -128,13 +134,12 @@ namespace Katsu
     struct BlockExpr : public Expr
     {
         std::vector<std::string> parameters;
-        std::unique_ptr<Expr> body;
+        Expr* body;
 
-        BlockExpr(SourceSpan _span, std::vector<std::string> _parameters,
-                  std::unique_ptr<Expr> _body)
-            : Expr(_span)
-            , parameters(_parameters)
-            , body(std::move(_body))
+        BlockExpr(SourceSpan _span, std::vector<std::string> _parameters, Expr* _body)
+            : Expr(std::move(_span))
+            , parameters(std::move(_parameters))
+            , body(_body)
         {}
 
         void accept(ExprVisitor& visitor) override;
@@ -142,10 +147,10 @@ namespace Katsu
 
     struct DataExpr : public Expr
     {
-        std::vector<std::unique_ptr<Expr>> components;
+        std::vector<Expr*> components;
 
-        DataExpr(SourceSpan _span, std::vector<std::unique_ptr<Expr>> _components)
-            : Expr(_span)
+        DataExpr(SourceSpan _span, std::vector<Expr*> _components)
+            : Expr(std::move(_span))
             , components(std::move(_components))
         {}
 
@@ -154,30 +159,68 @@ namespace Katsu
 
     struct SequenceExpr : public Expr
     {
-        std::vector<std::unique_ptr<Expr>> components;
+        std::vector<Expr*> components;
 
-        SequenceExpr(SourceSpan _span, std::vector<std::unique_ptr<Expr>> _components)
-            : Expr(_span)
+        SequenceExpr(SourceSpan _span, std::vector<Expr*> _components)
+            : Expr(std::move(_span))
             , components(std::move(_components))
         {}
 
         void accept(ExprVisitor& visitor) override;
 
-        std::vector<std::unique_ptr<Expr>>* sequence_components() override;
+        std::vector<Expr*>* sequence_components() override;
     };
 
     struct TupleExpr : public Expr
     {
-        std::vector<std::unique_ptr<Expr>> components;
+        std::vector<Expr*> components;
 
-        TupleExpr(SourceSpan _span, std::vector<std::unique_ptr<Expr>> _components)
-            : Expr(_span)
+        TupleExpr(SourceSpan _span, std::vector<Expr*> _components)
+            : Expr(std::move(_span))
             , components(std::move(_components))
         {}
 
         void accept(ExprVisitor& visitor) override;
     };
 
+    // Owns the expressions parsed from (typically) a single top-level form, which are allocated
+    // from a few large blocks rather than one by one, and all destroyed together with the arena.
+    class ExprArena
+    {
+    public:
+        ExprArena()
+            : blocks{}
+            , spot(0)
+            , limit(0)
+            , exprs{}
+        {}
+
+        ~ExprArena();
+
+        ExprArena(const ExprArena&) = delete;
+        ExprArena& operator=(const ExprArena&) = delete;
+
+        template <typename T, typename... Args> T* make(Args&&... args)
+        {
+            static_assert(std::is_base_of_v<Expr, T>);
+            T* expr = new (this->allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            this->exprs.push_back(expr);
+            return expr;
+        }
+
+    private:
+        static const size_t BLOCK_SIZE = 16 * 1024;
+
+        void* allocate(size_t size, size_t alignment);
+
+        std::vector<std::unique_ptr<uint8_t[]>> blocks;
+        // Free space in the last block.
+        size_t spot;
+        size_t limit;
+        // Everything allocated, in order, to be destroyed in reverse.
+        std::vector<Expr*> exprs;
+    };
+
     class ExprVisitor
     {
     public:
@@ -0,0 +1,243 @@
+// Benchmarks for the VM's hot paths: a few measured directly from C++ (the GC, Assoc lookup, and
+// the lexer / parser over src/core), and the rest written in Katsu, as the programs in src/bench/
+// using the bench.harness module.
+//
+// Usage: ./bench [filter...]
+// With filters, only runs the C++ benchmarks whose names contain one of them, and the Katsu
+// programs whose file names (without .katsu) do. Must be run from the repository root.
+//
+// Each benchmark prints one line:
+//   <name>: <nanoseconds> ns/<unit>
+// being the fastest of several runs (after an untimed warm-up run), so that results are stable
+// enough to compare from one build to the next. Katsu programs may print other (deterministic)
+// lines too, such as what they computed.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "assertions.h"
+#include "compile.h"
+#include "condition.h"
+#include "gc.h"
+#include "katsu.h"
+#include "lexer.h"
+#include "parser.h"
+#include "value.h"
+#include "value_utils.h"
+
+using namespace Katsu;
+
+// Keep in sync with *bench-runs* in src/bench/harness.katsu.
+const int BENCH_RUNS = 5;
+
+std::vector<std::string> filters;
+
+bool selected(const std::string& name)
+{
+    if (filters.empty()) {
+        return true;
+    }
+    for (const std::string& filter : filters) {
+        if (name.find(filter) != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Time `body`, which should perform `ops` operations (of the given unit) each time it's called,
+// and print its fastest time per operation.
+void bench(const std::string& name, uint64_t ops, const std::function<void()>& body,
+           const std::string& unit = "op")
+{
+    if (!selected(name)) {
+        return;
+    }
+    body();
+    auto best = std::chrono::nanoseconds::max();
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        best = std::min(best, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  std::chrono::steady_clock::now() - start));
+    }
+    std::cout << name << ": " << std::fixed << std::setprecision(1)
+              << static_cast<double>(best.count()) / ops << " ns/" << unit << "\n";
+}
+
+// Fill an array with enough 4-tuples to keep about `bytes` live.
+Array* make_live_set(GC& gc, uint64_t bytes)
+{
+    uint64_t count = bytes / align_up(Tuple::size(4), TAG_BITS);
+    Root<Array> r_live(gc, make_array(gc, count));
+    for (uint64_t i = 0; i < count; i++) {
+        Tuple* tuple = make_tuple(gc, 4);
+        r_live->components()[i] = Value::object(tuple);
+    }
+    return *r_live;
+}
+
+void bench_gc()
+{
+    for (uint64_t live_mb : {0, 1, 16}) {
+        std::string live = std::to_string(live_mb) + "M-live";
+        if (!selected("gc/alloc-" + live) && !selected("gc/collect-" + live)) {
+            continue;
+        }
+        // Sized as katsu runs by default (see RunOptions).
+        RunOptions defaults;
+        GC gc(defaults.heap_size, defaults.nursery_size, defaults.max_heap_size);
+        Root<Array> r_live(gc, make_live_set(gc, live_mb * 1024 * 1024));
+
+        // Short-lived allocations, including the (minor) collections they bring on.
+        const uint64_t allocs = 100000;
+        bench("gc/alloc-" + live, allocs, [&] {
+            for (uint64_t i = 0; i < allocs; i++) {
+                make_tuple(gc, 2);
+            }
+        });
+        bench("gc/collect-" + live, 1, [&] { gc.collect(); });
+    }
+}
+
+void bench_assoc()
+{
+    for (uint64_t size : {8, 64, 512}) {
+        std::string name = "assoc/native-lookup-" + std::to_string(size);
+        if (!selected(name)) {
+            continue;
+        }
+        GC gc(1024 * 1024);
+        Root<Assoc> r_assoc(gc, make_assoc(gc, size));
+        for (uint64_t i = 0; i < size; i++) {
+            ValueRoot r_key(gc, Value::object(make_string(gc, "key-" + std::to_string(i))));
+            ValueRoot r_value(gc, Value::fixnum(i));
+            append(gc, r_assoc, r_key, r_value);
+        }
+        // The last key added, as the worst case for a linear search.
+        std::string key = "key-" + std::to_string(size - 1);
+        const uint64_t lookups = 10000;
+        bench(name, lookups, [&] {
+            for (uint64_t i = 0; i < lookups; i++) {
+                ALWAYS_ASSERT(assoc_lookup(*r_assoc, key));
+            }
+        });
+    }
+}
+
+void bench_lexer_and_parser()
+{
+    if (!selected("lexer/src-core") && !selected("parser/src-core")) {
+        return;
+    }
+    std::vector<std::string> paths;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator("src/core")) {
+        if (entry.is_regular_file() && entry.path().extension() == ".katsu") {
+            paths.push_back(entry.path().string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    std::vector<SourceFile> sources;
+    uint64_t total_bytes = 0;
+    for (const std::string& path : paths) {
+        std::ifstream file(path);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        sources.push_back(SourceFile{.path = std::make_shared<std::string>(path),
+                                     .source = std::make_shared<std::string>(contents.str())});
+        total_bytes += sources.back().source->size();
+    }
+
+    bench(
+        "lexer/src-core",
+        total_bytes,
+        [&] {
+            for (const SourceFile& source : sources) {
+                Lexer lexer(source);
+                while (lexer.next().type != TokenType::END) {
+                }
+            }
+        },
+        "byte");
+    bench(
+        "parser/src-core",
+        total_bytes,
+        [&] {
+            for (const SourceFile& source : sources) {
+                Lexer lexer(source);
+                TokenStream stream(lexer);
+                std::unique_ptr<PrattParser> parser = make_default_parser();
+                while (true) {
+                    while (stream.current_has_type(TokenType::SEMICOLON) ||
+                           stream.current_has_type(TokenType::NEWLINE)) {
+                        stream.consume();
+                    }
+                    if (stream.current_has_type(TokenType::END)) {
+                        break;
+                    }
+                    ExprArena arena;
+                    parser->parse(stream, arena, 0 /* precedence */, true /* is_toplevel */);
+                }
+            }
+        },
+        "byte");
+}
+
+// Run each Katsu benchmark program (bench.<name> in src/bench/<name>.katsu); they time
+// themselves. Returns whether they all ran to completion.
+bool bench_katsu_programs()
+{
+    std::vector<std::string> names;
+    for (const auto& entry : std::filesystem::directory_iterator("src/bench")) {
+        std::string name = entry.path().stem().string();
+        if (entry.path().extension() == ".katsu" && name != "harness" && selected(name)) {
+            names.push_back(name);
+        }
+    }
+    std::sort(names.begin(), names.end());
+
+    bool ok = true;
+    for (const std::string& name : names) {
+        std::string path = "src/bench/" + name + ".katsu";
+        try {
+            bootstrap_and_run_file(path, "bench." + name);
+        } catch (const std::ios_base::failure& e) {
+            std::cerr << "Error: could not run '" << path << "': " << e.what() << "\n";
+            ok = false;
+        } catch (const parse_error& e) {
+            std::cerr << "Parse error in '" << path << "': " << e.what() << "\n";
+            ok = false;
+        } catch (const compile_error& e) {
+            std::cerr << "Compilation error in '" << path << "': " << e.what() << "\n";
+            ok = false;
+        } catch (const terminate_error& e) {
+            std::cerr << "'" << path << "' terminated: " << e.what() << "\n";
+            ok = false;
+        }
+        std::cout.flush();
+    }
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        filters.push_back(argv[i]);
+    }
+
+    bench_gc();
+    bench_assoc();
+    bench_lexer_and_parser();
+    return bench_katsu_programs() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
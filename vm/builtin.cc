@@ -2,13 +2,20 @@
 
 #include "assert.h"
 #include "builtin_ffi.h"
+#include "builtin_io.h"
+#include "builtin_numeric.h"
+#include "builtin_sequence.h"
+#include "builtin_worker.h"
+#include "bytecode_cache.h"
 #include "compile.h"
 #include "condition.h"
+#include "cpu_profiler.h"
 #include "parser.h"
 #include "value_utils.h"
 #include "vm.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <fstream>
 #include <iostream>
@@ -17,11 +24,13 @@
 namespace Katsu
 {
     // TODO: return type
-    void _add_handler(GC& gc, Value& v_multimethods, bool global, Root<Assoc>& r_module,
-                      const std::string& name, uint32_t num_params, Root<Array>& r_param_matchers,
+    void _add_handler(VM& vm, bool global, Root<Assoc>& r_module, const std::string& name,
+                      uint32_t num_params, Root<Array>& r_param_matchers,
                       NativeHandler native_handler, IntrinsicHandler intrinsic_handler)
     {
-        Root<String> r_name(gc, make_string(gc, name));
+        GC& gc = vm.gc;
+        Value& v_multimethods = vm.v_multimethods;
+        Root<String> r_name(gc, intern(vm, name));
 
         Value* v_existing = assoc_lookup(*r_module, *r_name);
         MultiMethod* multi;
@@ -81,14 +90,23 @@ namespace Katsu
                                           intrinsic_handler));
 
         add_method(gc, r_multi, r_method, /* require_unique */ true);
+
+        // Name each handler after its multimethod, along with which of the multimethod's methods
+        // it is.
+        std::string handler_name =
+            name + "/" + std::to_string(r_multi->v_methods.obj_vector()->length - 1);
+        if (native_handler) {
+            vm.builtin_names.natives.emplace_back(handler_name, native_handler);
+        } else {
+            vm.builtin_names.intrinsics.emplace_back(handler_name, intrinsic_handler);
+        }
     }
 
-    void add_native(GC& gc, Value& v_multimethods, bool global, Root<Assoc>& r_module,
-                    const std::string& name, uint32_t num_params, Root<Array>& r_param_matchers,
+    void add_native(VM& vm, bool global, Root<Assoc>& r_module, const std::string& name,
+                    uint32_t num_params, Root<Array>& r_param_matchers,
                     NativeHandler native_handler)
     {
-        _add_handler(gc,
-                     v_multimethods,
+        _add_handler(vm,
                      global,
                      r_module,
                      name,
@@ -98,12 +116,11 @@ namespace Katsu
                      /* intrinsic_handler */ nullptr);
     }
 
-    void add_intrinsic(GC& gc, Value& v_multimethods, bool global, Root<Assoc>& r_module,
-                       const std::string& name, uint32_t num_params, Root<Array>& r_param_matchers,
+    void add_intrinsic(VM& vm, bool global, Root<Assoc>& r_module, const std::string& name,
+                       uint32_t num_params, Root<Array>& r_param_matchers,
                        IntrinsicHandler intrinsic_handler)
     {
-        _add_handler(gc,
-                     v_multimethods,
+        _add_handler(vm,
                      global,
                      r_module,
                      name,
@@ -322,17 +339,12 @@ namespace Katsu
     void call_impl(OpenVM& vm, bool tail_call, Value v_callable, int64_t nargs, Value* args,
                    Value v_marker = Value::null(), Value v_dynamic = Value::null())
     {
-        // In case of tail-call, we need to temporarily store the args as we unwind the current
-        // frame and replace it with a new frame.
-        Value args_copy[nargs];
+        // In case of tail-call, the new frame replaces the current one, and the args slide down
+        // into place as its first regs().
         if (tail_call) {
             Frame* frame = vm.frame();
             frame->inst_spot++;
-            for (uint32_t i = 0; i < nargs; i++) {
-                args_copy[i] = args[i];
-            }
-            vm.unwind_frame(/* tail_call */ true);
-            args = args_copy;
+            args = vm.unwind_frame_for_tail_call(args, nargs);
         }
 
         if (v_callable.is_obj_closure()) {
@@ -363,17 +375,8 @@ namespace Katsu
             // - upreg_map points where to load upregs
             // - all other regs null-initialized
             ASSERT(next->num_regs > 0);
-            // Copy arguments:
-            if (nargs == 0) {
-                next->regs()[0] = Value::null();
-            }
-            for (uint32_t i = 0; i < nargs; i++) {
-                next->regs()[i] = args[i];
-            }
-            // Null-initialize the rest (since we don't know which are upregs):
-            for (uint32_t i = nargs; i < next->num_regs; i++) {
-                next->regs()[i] = Value::null();
-            }
+            // Copy arguments, and null-initialize the rest (since we don't know which are upregs):
+            next->init_regs(args, nargs);
             // Finally, load upregs:
             for (uint64_t i = 0; i < upreg_map->length; i++) {
                 Value upreg = upregs->components()[i];
@@ -389,30 +392,22 @@ namespace Katsu
             vm.set_frame(next);
         } else if (v_callable.is_obj_call_segment()) {
             CallSegment* segment = v_callable.obj_call_segment();
-            // Place the segment's frames on top of the stack, and push the one argument provided.
+            // Place the continuation's frames on top of the stack, and push the one argument
+            // provided.
             if (nargs != 1) {
                 throw condition_error(
                     "argument-count-mismatch",
                     "called a call-segment with wrong number of arguments (should be 1)");
             }
-            ASSERT_MSG(!tail_call, "tail-call call segment not implemented");
-            Frame* old_top = vm.frame();
-            old_top->inst_spot++;
-            Frame* past_old_top = old_top->next();
-            Frame* past_new_top = vm.alloc_frames(segment->length);
-            memcpy(past_old_top, segment->frames(), segment->length);
-            // Set up caller-pointers throughout the new stack region.
-            Frame* prev = old_top;
-            Frame* cur = past_old_top;
-            while (cur < past_new_top) {
-                cur->caller = prev;
-                prev = cur;
-                cur = cur->next();
+            if (segment->state == CallSegment::State::ON_STACK) {
+                throw condition_error("continuation-already-resumed",
+                                      "cannot resume a one-shot continuation more than once");
             }
-            ASSERT(cur == past_new_top);
-            Frame* new_top = prev;
-            vm.set_frame(new_top);
-            new_top->push(args[0]);
+            ASSERT_MSG(!tail_call, "tail-call call segment not implemented");
+            Value arg = args[0];
+            vm.frame()->inst_spot++;
+            vm.resume_continuation(segment);
+            vm.frame()->push(arg);
         } else if (v_callable.is_obj_code()) {
             Code* code = v_callable.obj_code();
             if (!code->v_upreg_map.is_null()) {
@@ -439,17 +434,8 @@ namespace Katsu
             // - there are no upregs to deal with!
             // - all other regs null-initialized
             ASSERT(next->num_regs > 0);
-            // Copy arguments:
-            if (nargs == 0) {
-                next->regs()[0] = Value::null();
-            }
-            for (uint32_t i = 0; i < nargs; i++) {
-                next->regs()[i] = args[i];
-            }
-            // Null-initialize the rest:
-            for (uint32_t i = nargs; i < next->num_regs; i++) {
-                next->regs()[i] = Value::null();
-            }
+            // Copy arguments, and null-initialize the rest:
+            next->init_regs(args, nargs);
 
             if (!tail_call) {
                 Frame* frame = vm.frame();
@@ -539,6 +525,22 @@ namespace Katsu
         return Value::_bool(is_instance(vm, args[0], args[1].obj_type()));
     }
 
+    Value native__set_linearization_(VM& vm, int64_t nargs, Value* args)
+    {
+        // type set-linearization: linearization
+        ASSERT(nargs == 2);
+        for (Value v_type : args[1].obj_array()) {
+            if (!v_type.is_obj_type()) {
+                throw condition_error("invalid-argument", "linearization must contain only types");
+            }
+        }
+        Root<Type> r_type(vm.gc, args[0].obj_type());
+        Root<Array> r_linearization(vm.gc, args[1].obj_array());
+        set_linearization(vm.gc, r_type, r_linearization);
+        vm.type_hierarchy_version++;
+        return Value::null();
+    }
+
     Value native__make_method_with_return_type_code_attrs_(VM& vm, int64_t nargs, Value* args)
     {
         // param-matchers make-method-with-return-type: type code: code attrs: attrs
@@ -558,6 +560,21 @@ namespace Katsu
                                          /* intrinsic_handler */ nullptr));
     }
 
+    Value native__make_method_with_return_type_lazy_code_attrs_(VM& vm, int64_t nargs,
+                                                                Value* args)
+    {
+        // param-matchers make-method-with-return-type: type lazy-code: stub attrs: attrs
+        ASSERT(nargs == 4);
+        ASSERT(args[1].is_obj_type() || args[1].is_null());
+        Root<Array> r_param_matchers(vm.gc, args[0].obj_array());
+        OptionalRoot<Type> r_return_type(vm.gc,
+                                         args[1].is_obj_type() ? args[1].obj_type() : nullptr);
+        Root<Tuple> r_stub(vm.gc, args[2].obj_tuple());
+        Root<Vector> r_attributes(vm.gc, args[3].obj_vector());
+        return Value::object(
+            make_lazy_method(vm.gc, r_param_matchers, r_return_type, r_stub, r_attributes));
+    }
+
     Value native__add_method_to_require_unique_(VM& vm, int64_t nargs, Value* args)
     {
         // method add-method-to: multimethod require-unique: unique
@@ -583,9 +600,15 @@ namespace Katsu
     }
 
     template <typename T>
-    inline void unsafe_write_at_offset(Object* object, int64_t offset, T value)
+    inline void unsafe_write_at_offset(GC& gc, Object* object, int64_t offset, T value)
     {
         *(T*)((uint8_t*)object + offset) = value;
+        if constexpr (std::is_same_v<T, Value>) {
+            gc.write_barrier(object, value);
+        } else {
+            // Raw writes could be assembling a reference, for all we know.
+            gc.write_barrier(object);
+        }
     }
 
     Value native__unsafe_read_u8_at_offset_(VM& vm, int64_t nargs, Value* args)
@@ -601,7 +624,8 @@ namespace Katsu
         ASSERT(nargs == 3);
         ASSERT(args[0].is_object());
         // TODO: check range
-        unsafe_write_at_offset<uint8_t>(args[0].object(),
+        unsafe_write_at_offset<uint8_t>(vm.gc,
+                                        args[0].object(),
                                         args[1].fixnum(),
                                         (uint8_t)args[2].fixnum());
         return Value::null();
@@ -620,7 +644,8 @@ namespace Katsu
         ASSERT(nargs == 3);
         ASSERT(args[0].is_object());
         // TODO: check range
-        unsafe_write_at_offset<uint32_t>(args[0].object(),
+        unsafe_write_at_offset<uint32_t>(vm.gc,
+                                         args[0].object(),
                                          args[1].fixnum(),
                                          (uint32_t)args[2].fixnum());
         return Value::null();
@@ -642,7 +667,7 @@ namespace Katsu
         ASSERT(args[0].is_object());
         ASSERT(args[2].fixnum() >= 0);
         uint64_t write = (uint64_t)args[2].fixnum();
-        unsafe_write_at_offset<uint64_t>(args[0].object(), args[1].fixnum(), write);
+        unsafe_write_at_offset<uint64_t>(vm.gc, args[0].object(), args[1].fixnum(), write);
         return Value::null();
     }
 
@@ -658,7 +683,7 @@ namespace Katsu
         // obj unsafe-write-value-at-offset: offset value: value
         ASSERT(nargs == 3);
         ASSERT(args[0].is_object());
-        unsafe_write_at_offset<Value>(args[0].object(), args[1].fixnum(), args[2]);
+        unsafe_write_at_offset<Value>(vm.gc, args[0].object(), args[1].fixnum(), args[2]);
         return Value::null();
     }
 
@@ -666,12 +691,26 @@ namespace Katsu
     {
         // _ get-call-stack
         ASSERT(nargs == 1);
-        Frame* past_top = vm.frame()->next();
-        Frame* bottom = vm.bottom_frame();
-        uint64_t total_stack_length =
-            reinterpret_cast<uint8_t*>(past_top) - reinterpret_cast<uint8_t*>(bottom);
-        vm.frame()->push(
-            Value::object(make_call_segment(vm.gc, vm.bottom_frame(), total_stack_length)));
+        // Rather than copying the frames, just note where each one is, as a code and instruction
+        // spot, from the bottom of the stack up.
+        uint64_t num_frames = 0;
+        for (Frame* frame = vm.frame(); frame; frame = frame->caller) {
+            num_frames++;
+        }
+        Array* trace = make_array(vm.gc, 2 * num_frames);
+        uint64_t i = 2 * num_frames;
+        for (Frame* frame = vm.frame(); frame; frame = frame->caller) {
+            uint32_t inst_spot = frame->inst_spot;
+            if (frame != vm.frame()) {
+                // Go back one instruction; each frame indicates where to _return_ to, and the
+                // previous op is the caller.
+                ASSERT(inst_spot > 0);
+                inst_spot--;
+            }
+            trace->components()[--i] = Value::fixnum(inst_spot);
+            trace->components()[--i] = frame->v_code;
+        }
+        vm.frame()->push(Value::object(trace));
         vm.frame()->inst_spot++;
     }
 
@@ -684,16 +723,12 @@ namespace Katsu
         call_impl(vm, tail_call, v_callable, /* nargs */ 0, /* args */ &v_marker, v_marker);
     }
 
-    void intrinsic__call_dc_(OpenVM& vm, bool tail_call, int64_t nargs, Value* args)
+    void call_dc_impl(OpenVM& vm, Value* args, CallSegment::State state)
     {
-        // TODO: tail-call call/dc:?
-        ASSERT_MSG(!tail_call, "call/dc: tail-call not implemented");
-        // value call/dc: marker
-        ASSERT(nargs == 2);
-        ValueRoot r_callable(vm.gc, std::move(args[0]));
+        Value v_callable = args[0];
         Value v_marker = args[1];
-        // Search call stack (from top) for the marker, move that portion of the stack into a
-        // CallSegment, and then call the callable value with that CallSegment.
+        // Search call stack (from top) for the marker, detach that portion of the stack as a
+        // continuation, and then call the callable value with that continuation.
         Frame* marked = vm.frame();
         while (marked && marked->v_marker != v_marker) {
             marked = marked->caller;
@@ -702,26 +737,51 @@ namespace Katsu
             throw condition_error("marker-not-found", "did not find marker in call stack");
         }
         vm.frame()->inst_spot++;
-        Frame* past_top = vm.frame()->next();
-        uint64_t total_length =
-            reinterpret_cast<uint8_t*>(past_top) - reinterpret_cast<uint8_t*>(marked);
-        Value v_segment = Value::object(make_call_segment(vm.gc, marked, total_length));
-        vm.set_frame(marked->caller);
+        Value v_segment = Value::null();
+        if (v_callable.is_obj_closure() || v_callable.is_obj_code() ||
+            v_callable.is_obj_call_segment()) {
+            if (state == CallSegment::State::MULTI_SHOT) {
+                vm.box_mut_bindings(marked);
+            }
+            v_segment = Value::object(vm.detach_continuation(marked, state));
+        } else {
+            // Anything else just returns itself, so nothing could resume the continuation.
+            vm.drop_continuation(marked);
+        }
         // Rewind the new top frame; we are pretending that it is about to call the segment.
         vm.frame()->inst_spot--;
         call_impl(vm,
                   /* tail_call */ false,
-                  /* v_callable */ *r_callable,
+                  v_callable,
                   /* nargs */ 1,
                   /* args */ &v_segment,
                   /* v_marker */ Value::null());
     }
 
+    void intrinsic__call_dc_(OpenVM& vm, bool tail_call, int64_t nargs, Value* args)
+    {
+        // TODO: tail-call call/dc:?
+        ASSERT_MSG(!tail_call, "call/dc: tail-call not implemented");
+        // value call/dc: marker
+        ASSERT(nargs == 2);
+        call_dc_impl(vm, args, CallSegment::State::MULTI_SHOT);
+    }
+
+    void intrinsic__call_dc_once_(OpenVM& vm, bool tail_call, int64_t nargs, Value* args)
+    {
+        ASSERT_MSG(!tail_call, "call/dc-once: tail-call not implemented");
+        // value call/dc-once: marker
+        ASSERT(nargs == 2);
+        call_dc_impl(vm, args, CallSegment::State::ONE_SHOT);
+    }
+
     void intrinsic__frame_set_dynamic_(OpenVM& vm, bool tail_call, int64_t nargs, Value* args)
     {
         // _ frame-set-dynamic: value
         ASSERT(nargs == 2);
         vm.frame()->v_dynamic = args[1];
+        // Only the top frame sees its own binding, so no other frame needs updating.
+        vm.frame()->update_dynamic_frame();
         vm.frame()->push(Value::null());
         vm.frame()->inst_spot++;
     }
@@ -730,12 +790,8 @@ namespace Katsu
     {
         // _ frame-search-dynamic
         ASSERT(nargs == 1);
-        // Search call stack (from top) for the first non-null dynamic value, and return it
-        // (or else null).
-        Frame* frame = vm.frame();
-        while (frame && frame->v_dynamic.is_null()) {
-            frame = frame->caller;
-        }
+        // Return the first non-null dynamic value in the call stack (from top), or else null.
+        Frame* frame = vm.frame()->dynamic_frame;
         vm.frame()->push(frame ? frame->v_dynamic : Value::null());
         vm.frame()->inst_spot++;
     }
@@ -773,13 +829,14 @@ namespace Katsu
             std::ifstream file_stream;
             // Raise exceptions on logical error or read/write error.
             file_stream.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-            file_stream.open(filepath.c_str());
-
-            std::stringstream str_stream;
-            str_stream << file_stream.rdbuf();
-            std::string file_contents = str_stream.str();
-
-            return Value::object(make_string(vm.gc, file_contents));
+            file_stream.open(filepath.c_str(), std::ios::binary | std::ios::ate);
+            std::streamsize size = file_stream.tellg();
+            file_stream.seekg(0);
+
+            // Read straight into the String, rather than through an intermediate std::string.
+            String* str = make_string_nofill(vm.gc, size);
+            file_stream.read(reinterpret_cast<char*>(str->contents()), size);
+            return Value::object(str);
         } catch (const std::ios_base::failure& e) {
             throw condition_error("io-error", e.what());
         }
@@ -822,6 +879,101 @@ namespace Katsu
         return Value::object(vector_to_array(vm.gc, r_vector));
     }
 
+    Value native__make_empty_deque(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ make-empty-deque
+        ASSERT(nargs == 1);
+        return Value::object(make_deque(vm.gc, 0));
+    }
+
+    Value native__deque_push_back_(VM& vm, int64_t nargs, Value* args)
+    {
+        // deque deque-push-back: value
+        ASSERT(nargs == 2);
+        Root<Deque> r_deque(vm.gc, args[0].obj_deque());
+        Value v_value = args[1];
+        ValueRoot r_value(vm.gc, std::move(v_value));
+        return Value::object(deque_push_back(vm.gc, r_deque, r_value));
+    }
+
+    Value native__deque_push_front_(VM& vm, int64_t nargs, Value* args)
+    {
+        // deque deque-push-front: value
+        ASSERT(nargs == 2);
+        Root<Deque> r_deque(vm.gc, args[0].obj_deque());
+        Value v_value = args[1];
+        ValueRoot r_value(vm.gc, std::move(v_value));
+        return Value::object(deque_push_front(vm.gc, r_deque, r_value));
+    }
+
+    Value native__deque_pop_front(VM& vm, int64_t nargs, Value* args)
+    {
+        // deque deque-pop-front
+        ASSERT(nargs == 1);
+        Deque* deque = args[0].obj_deque();
+        if (deque->length == 0) {
+            throw condition_error("empty-deque", "cannot pop from an empty deque");
+        }
+        return deque_pop_front(deque);
+    }
+
+    Value native__deque_pop_back(VM& vm, int64_t nargs, Value* args)
+    {
+        // deque deque-pop-back
+        ASSERT(nargs == 1);
+        Deque* deque = args[0].obj_deque();
+        if (deque->length == 0) {
+            throw condition_error("empty-deque", "cannot pop from an empty deque");
+        }
+        return deque_pop_back(deque);
+    }
+
+    Value native__deque_at_(VM& vm, int64_t nargs, Value* args)
+    {
+        // deque deque-at: index
+        ASSERT(nargs == 2);
+        Deque* deque = args[0].obj_deque();
+        int64_t index = args[1].fixnum();
+        if (index < 0 || static_cast<uint64_t>(index) >= deque->length) {
+            throw condition_error("invalid-argument", "deque index out of bounds");
+        }
+        return deque_at(deque, index);
+    }
+
+    Value native__make_empty_identity_set(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ make-empty-identity-set
+        ASSERT(nargs == 1);
+        return Value::object(make_identity_set(vm.gc, 0));
+    }
+
+    Value native__identity_set_add_(VM& vm, int64_t nargs, Value* args)
+    {
+        // set identity-set-add: value
+        ASSERT(nargs == 2);
+        if (args[1].is_null()) {
+            throw condition_error("invalid-argument", "identity sets cannot contain #null");
+        }
+        Root<IdentitySet> r_set(vm.gc, args[0].obj_identity_set());
+        Value v_value = args[1];
+        ValueRoot r_value(vm.gc, std::move(v_value));
+        return Value::_bool(identity_set_add(vm.gc, r_set, r_value));
+    }
+
+    Value native__identity_set_remove_(VM& vm, int64_t nargs, Value* args)
+    {
+        // set identity-set-remove: value
+        ASSERT(nargs == 2);
+        return Value::_bool(identity_set_remove(vm.gc, args[0].obj_identity_set(), args[1]));
+    }
+
+    Value native__identity_set_contains_(VM& vm, int64_t nargs, Value* args)
+    {
+        // set identity-set-contains?: value
+        ASSERT(nargs == 2);
+        return Value::_bool(identity_set_contains(vm.gc, args[0].obj_identity_set(), args[1]));
+    }
+
     Value native__byte_array_to_string(VM& vm, int64_t nargs, Value* args)
     {
         // byte-array byte-array>string
@@ -865,16 +1017,33 @@ namespace Katsu
         return Value::object(make_byte_array(vm.gc, n));
     }
 
+    Value native__pinned_zeros_byte_array(VM& vm, int64_t nargs, Value* args)
+    {
+        // n pinned-zeros-byte-array
+        ASSERT(nargs == 1);
+        int64_t n = args[0].fixnum();
+        if (n < 0) {
+            throw condition_error("invalid-argument",
+                                  "pinned-zeros-byte-array must have nonnegative length");
+        }
+        return Value::object(make_pinned_byte_array(vm.gc, n));
+    }
+
+    Value native__byte_array_pinned_p(VM& vm, int64_t nargs, Value* args)
+    {
+        // byte-array pinned?
+        ASSERT(nargs == 1);
+        // Large objects are never moved, whether or not they were allocated as pinned.
+        return Value::_bool(args[0].obj_byte_array()->is_large());
+    }
+
+    // A TopLevelCompiler, as a Foreign value for run-file:contents:imports:.
     struct RunContext
     {
-        Lexer lexer;
-        TokenStream stream;
-        std::unique_ptr<PrattParser> parser;
+        TopLevelCompiler compiler;
 
-        RunContext(const SourceFile& source)
-            : lexer(source)
-            , stream(lexer)
-            , parser(make_default_parser())
+        RunContext(VM& vm, const SourceFile& source)
+            : compiler(vm, source, vm.bytecode_cache_dir)
         {}
 
         Value to_value(GC& gc)
@@ -892,20 +1061,11 @@ namespace Katsu
     {
         // _ make-run-context-for-path: path contents: contents
         ASSERT(nargs == 3);
-        Root<String> r_path(vm.gc, args[1].obj_string());
-        Root<String> r_contents(vm.gc, args[2].obj_string());
 
         SourceFile source = {
             .path = std::make_shared<std::string>(native_str(args[1].obj_string())),
             .source = std::make_shared<std::string>(native_str(args[2].obj_string()))};
-        RunContext* context = new RunContext(source);
-
-        // Skip any leading semicolons / newlines to get to the meat.
-        while (context->stream.current_has_type(TokenType::SEMICOLON) ||
-               context->stream.current_has_type(TokenType::NEWLINE)) {
-            context->stream.consume();
-        }
-
+        RunContext* context = new RunContext(vm, source);
         return context->to_value(vm.gc);
     }
     Value native__parse_and_compile_in_module_imports_(VM& vm, int64_t nargs, Value* args)
@@ -917,26 +1077,8 @@ namespace Katsu
         Root<Assoc> r_module(vm.gc, args[1].obj_assoc());
         Root<Vector> r_imports(vm.gc, args[2].obj_vector());
 
-        if (context->stream.current_has_type(TokenType::END)) {
-            return Value::null();
-        }
-
-        std::unique_ptr<Expr> top_level_expr =
-            context->parser->parse(context->stream, 0 /* precedence */, true /* is_toplevel */);
-
-        std::vector<std::unique_ptr<Expr>> top_level_exprs;
-        top_level_exprs.emplace_back(std::move(top_level_expr));
-        Code* code =
-            compile_into_module(vm, r_module, r_imports, top_level_exprs[0]->span, top_level_exprs);
-
-        // Ratchet past any semicolons and newlines, since the parser explicitly stops
-        // when it sees either of these at the top level.
-        while (context->stream.current_has_type(TokenType::SEMICOLON) ||
-               context->stream.current_has_type(TokenType::NEWLINE)) {
-            context->stream.consume();
-        }
-
-        return Value::object(code);
+        Code* code = context->compiler.next(r_module, r_imports);
+        return code ? Value::object(code) : Value::null();
     }
     Value native__free_run_context(VM& vm, int64_t nargs, Value* args)
     {
@@ -952,9 +1094,8 @@ namespace Katsu
     {
         // _ set-condition-handler-from-module
         ASSERT(nargs == 1);
-        String* name = make_string(vm.gc, "handle-raw-condition-with-message:");
         Assoc* module = vm.frame()->v_module.obj_assoc();
-        Value* handler = assoc_lookup(module, name);
+        Value* handler = assoc_lookup(module, "handle-raw-condition-with-message:");
         ASSERT(handler);
         vm.vm.v_condition_handler = *handler;
         vm.frame()->push(Value::null());
@@ -969,6 +1110,94 @@ namespace Katsu
         throw terminate_error(native_str(message));
     }
 
+    Value native__gc_stats(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ gc-stats
+        ASSERT(nargs == 1);
+        GC& gc = vm.gc;
+        // Snapshot first, since building the result allocates.
+        GCStats stats = gc.stats;
+        uint64_t bytes_allocated = gc.bytes_allocated();
+        uint64_t heap_size = gc.heap_size();
+        uint64_t large_space_size = gc.large_space_size();
+
+        Root<Array> r_histogram(gc, make_array(gc, GCStats::NUM_PAUSE_BUCKETS));
+        for (int i = 0; i < GCStats::NUM_PAUSE_BUCKETS; i++) {
+            r_histogram->components()[i] = Value::fixnum(stats.pause_histogram[i]);
+        }
+
+        Root<Assoc> r_stats(gc, make_assoc(gc, 12));
+        const auto add = [&vm, &r_stats](const std::string& name, Value value) {
+            ValueRoot r_value(vm.gc, std::move(value));
+            ValueRoot r_key(vm.gc, Value::object(intern(vm, name)));
+            append(vm.gc, r_stats, r_key, r_value);
+        };
+        add("minor-collections", Value::fixnum(stats.num_minor_collections));
+        add("full-collections", Value::fixnum(stats.num_full_collections));
+        add("parallel-collections", Value::fixnum(stats.num_parallel_collections));
+        add("total-pause-ns", Value::fixnum(stats.total_pause_ns));
+        add("max-pause-ns", Value::fixnum(stats.max_pause_ns));
+        add("pause-histogram", r_histogram.value());
+        add("bytes-allocated", Value::fixnum(bytes_allocated));
+        add("bytes-survived", Value::fixnum(stats.bytes_survived));
+        add("last-survived", Value::fixnum(stats.last_survived));
+        add("heap-size", Value::fixnum(heap_size));
+        add("large-space-size", Value::fixnum(large_space_size));
+        add("peak-heap-size", Value::fixnum(stats.peak_heap_size));
+        return r_stats.value();
+    }
+
+    Value native__heap_image_point(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ heap-image-point
+        ASSERT(nargs == 1);
+        vm.reached_heap_image_point = true;
+        return Value::null();
+    }
+
+    Value native__start_cpu_profile_(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ start-cpu-profile: interval-microseconds
+        ASSERT(nargs == 2);
+        int64_t interval = args[1].fixnum();
+        if (interval <= 0) {
+            throw condition_error("invalid-argument", "profiling interval must be positive");
+        }
+        if (vm.cpu_profiler) {
+            throw condition_error("profiler-error", "already profiling");
+        }
+        try {
+            vm.cpu_profiler = std::make_unique<CpuProfiler>(vm, interval);
+        } catch (const std::runtime_error& e) {
+            throw condition_error("profiler-error", e.what());
+        }
+        return Value::null();
+    }
+
+    Value native__stop_cpu_profile(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ stop-cpu-profile
+        ASSERT(nargs == 1);
+        if (!vm.cpu_profiler) {
+            throw condition_error("profiler-error", "not profiling");
+        }
+        std::stringstream folded;
+        vm.cpu_profiler->report_folded(folded);
+        vm.cpu_profiler.reset();
+        return Value::object(make_string(vm.gc, folded.str()));
+    }
+
+    Value native__monotonic_nanos(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ monotonic-nanos
+        ASSERT(nargs == 1);
+        // Nanoseconds since some arbitrary point, which never goes backwards; only good for
+        // measuring elapsed time.
+        return Value::fixnum(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now().time_since_epoch())
+                                 .count());
+    }
+
     Value make_base_type(GC& gc, Root<String>& r_name)
     {
         Root<Array> r_bases(gc, make_array(gc, 0));
@@ -993,7 +1222,7 @@ namespace Katsu
                    Value value)
     {
         ValueRoot r_value(vm.gc, std::move(value));
-        Root<String> r_name(vm.gc, make_string(vm.gc, name));
+        Root<String> r_name(vm.gc, intern(vm, name));
         _register(vm, id, r_name, r_module, r_value);
     }
 
@@ -1003,27 +1232,41 @@ namespace Katsu
         // * core.builtin.default - automatically imported by every module
         // * core.builtin.misc - grab-bag of opt-in builtins
         // * core.builtin.ffi - builtins related to libffi / C function calls
+        // * core.builtin.io - builtins related to (Linux) I/O readiness
+        // * core.builtin.worker - builtins related to workers (VMs on other threads) and channels
         Root<Assoc> r_default(vm.gc, make_assoc(vm.gc, /* capacity */ 0));
         Root<Assoc> r_misc(vm.gc, make_assoc(vm.gc, /* capacity */ 0));
         Root<Assoc> r_ffi(vm.gc, make_assoc(vm.gc, /* capacity */ 0));
+        Root<Assoc> r_io(vm.gc, make_assoc(vm.gc, /* capacity */ 0));
+        Root<Assoc> r_worker(vm.gc, make_assoc(vm.gc, /* capacity */ 0));
         {
-            ValueRoot r_name(vm.gc, Value::object(make_string(vm.gc, "core.builtin.default")));
+            ValueRoot r_name(vm.gc, Value::object(intern(vm, "core.builtin.default")));
             ValueRoot rv_core_builtin(vm.gc, r_default.value());
             append(vm.gc, r_modules, r_name, rv_core_builtin);
         }
         {
-            ValueRoot r_name(vm.gc, Value::object(make_string(vm.gc, "core.builtin.misc")));
+            ValueRoot r_name(vm.gc, Value::object(intern(vm, "core.builtin.misc")));
             ValueRoot rv_core_builtin(vm.gc, r_misc.value());
             append(vm.gc, r_modules, r_name, rv_core_builtin);
         }
         {
-            ValueRoot r_name(vm.gc, Value::object(make_string(vm.gc, "core.builtin.ffi")));
+            ValueRoot r_name(vm.gc, Value::object(intern(vm, "core.builtin.ffi")));
             ValueRoot rv_core_builtin(vm.gc, r_ffi.value());
             append(vm.gc, r_modules, r_name, rv_core_builtin);
         }
+        {
+            ValueRoot r_name(vm.gc, Value::object(intern(vm, "core.builtin.io")));
+            ValueRoot rv_core_builtin(vm.gc, r_io.value());
+            append(vm.gc, r_modules, r_name, rv_core_builtin);
+        }
+        {
+            ValueRoot r_name(vm.gc, Value::object(intern(vm, "core.builtin.worker")));
+            ValueRoot rv_core_builtin(vm.gc, r_worker.value());
+            append(vm.gc, r_modules, r_name, rv_core_builtin);
+        }
 
         const auto register_base_type = [&vm, &r_default](BuiltinId id, const std::string& name) {
-            Root<String> r_name(vm.gc, make_string(vm.gc, name));
+            Root<String> r_name(vm.gc, intern(vm, name));
             ValueRoot r_type(vm.gc, make_base_type(vm.gc, r_name));
             _register(vm, id, r_name, r_default, r_type);
         };
@@ -1040,8 +1283,7 @@ namespace Katsu
             for (size_t i = 0; i < matchers.size(); i++) {
                 r_matchers->components()[i] = matchers[i]();
             }
-            add_native(vm.gc,
-                       vm.v_multimethods,
+            add_native(vm,
                        true /* global */,
                        r_module,
                        name,
@@ -1057,8 +1299,7 @@ namespace Katsu
             for (size_t i = 0; i < matchers.size(); i++) {
                 r_matchers->components()[i] = matchers[i]();
             }
-            add_intrinsic(vm.gc,
-                          vm.v_multimethods,
+            add_intrinsic(vm,
                           true /* global */,
                           r_module,
                           name,
@@ -1090,6 +1331,10 @@ namespace Katsu
         register_base_type(BuiltinId::_CallSegment, "CallSegment");
         register_base_type(BuiltinId::_Foreign, "Foreign");
         register_base_type(BuiltinId::_ByteArray, "ByteArray");
+        register_base_type(BuiltinId::_Deque, "Deque");
+        register_base_type(BuiltinId::_IdentitySet, "IdentitySet");
+        register_base_type(BuiltinId::_F64Array, "F64Array");
+        register_base_type(BuiltinId::_I64Array, "I64Array");
 
         // Use shorthand for builtin IDs just to reduce noise and make it easier to read.
         register_native("~:",
@@ -1167,6 +1412,17 @@ namespace Katsu
                         {matches_type(_Fixnum), matches_type(_Fixnum)},
                         &native__lte_);
 
+        // The VM can also compute these inline for fixnum arguments, unless they're overridden.
+        vm.register_fast_path(OpCode::FIXNUM_ADD, &native__add_);
+        vm.register_fast_path(OpCode::FIXNUM_SUB, &native__sub_);
+        vm.register_fast_path(OpCode::FIXNUM_MUL, &native__mult_);
+        vm.register_fast_path(OpCode::FIXNUM_LT, &native__lt_);
+        vm.register_fast_path(OpCode::FIXNUM_LTE, &native__lte_);
+        vm.register_fast_path(OpCode::FIXNUM_GT, &native__gt_);
+        vm.register_fast_path(OpCode::FIXNUM_GTE, &native__gte_);
+        vm.register_fast_path(OpCode::FIXNUM_EQ, &native__id_eq_);
+        vm.register_fast_path(OpCode::FIXNUM_NE, &native__id_ne_);
+
         register_native("and:",
                         r_default,
                         {matches_type(_Bool), matches_type(_Bool)},
@@ -1213,6 +1469,13 @@ namespace Katsu
                          matches_type(_Code),
                          matches_type(_Vector)},
                         &native__make_method_with_return_type_code_attrs_);
+        register_native("make-method-with-return-type:lazy-code:attrs:",
+                        r_default, // needed for lazily compiled method definitions
+                        {matches_type(_Array),
+                         matches_any, // TODO: Type or Null
+                         matches_type(_Tuple),
+                         matches_type(_Vector)},
+                        &native__make_method_with_return_type_lazy_code_attrs_);
         register_native("add-method-to:require-unique:",
                         r_default, // needed for method definitions
                         {matches_type(_Method), matches_type(_MultiMethod), matches_type(_Bool)},
@@ -1255,6 +1518,10 @@ namespace Katsu
                         r_misc,
                         {matches_any, matches_type(_Fixnum), matches_any},
                         &native__unsafe_write_value_at_offset_value_);
+        register_native("set-linearization:",
+                        r_misc,
+                        {matches_type(_Type), matches_type(_Array)},
+                        &native__set_linearization_);
 
         register_intrinsic("get-call-stack", r_misc, {matches_any}, &intrinsic__get_call_stack);
 
@@ -1263,6 +1530,10 @@ namespace Katsu
                            {matches_any, matches_any},
                            &intrinsic__call_marked_);
         register_intrinsic("call/dc:", r_misc, {matches_any, matches_any}, &intrinsic__call_dc_);
+        register_intrinsic("call/dc-once:",
+                           r_misc,
+                           {matches_any, matches_any},
+                           &intrinsic__call_dc_once_);
 
         register_intrinsic("frame-set-dynamic:",
                            r_misc,
@@ -1297,6 +1568,42 @@ namespace Katsu
                         &native__add_value_);
 
         register_native("vector>array", r_misc, {matches_type(_Vector)}, &native__vector_to_array);
+
+        register_native("make-empty-deque", r_misc, {matches_any}, &native__make_empty_deque);
+        register_native("deque-push-back:",
+                        r_misc,
+                        {matches_type(_Deque), matches_any},
+                        &native__deque_push_back_);
+        register_native("deque-push-front:",
+                        r_misc,
+                        {matches_type(_Deque), matches_any},
+                        &native__deque_push_front_);
+        register_native("deque-pop-front",
+                        r_misc,
+                        {matches_type(_Deque)},
+                        &native__deque_pop_front);
+        register_native("deque-pop-back", r_misc, {matches_type(_Deque)}, &native__deque_pop_back);
+        register_native("deque-at:",
+                        r_misc,
+                        {matches_type(_Deque), matches_type(_Fixnum)},
+                        &native__deque_at_);
+
+        register_native("make-empty-identity-set",
+                        r_misc,
+                        {matches_any},
+                        &native__make_empty_identity_set);
+        register_native("identity-set-add:",
+                        r_misc,
+                        {matches_type(_IdentitySet), matches_any},
+                        &native__identity_set_add_);
+        register_native("identity-set-remove:",
+                        r_misc,
+                        {matches_type(_IdentitySet), matches_any},
+                        &native__identity_set_remove_);
+        register_native("identity-set-contains?:",
+                        r_misc,
+                        {matches_type(_IdentitySet), matches_any},
+                        &native__identity_set_contains_);
         register_native("byte-array>string",
                         r_misc,
                         {matches_type(_ByteArray)},
@@ -1311,6 +1618,14 @@ namespace Katsu
                         r_misc,
                         {matches_type(_Fixnum)},
                         &native__zeros_byte_array);
+        register_native("pinned-zeros-byte-array",
+                        r_misc,
+                        {matches_type(_Fixnum)},
+                        &native__pinned_zeros_byte_array);
+        register_native("pinned?",
+                        r_misc,
+                        {matches_type(_ByteArray)},
+                        &native__byte_array_pinned_p);
 
         // TODO: this is super hacky. figure out a different way to do this.
         register_native("make-run-context-for-path:contents:",
@@ -1333,8 +1648,22 @@ namespace Katsu
                         {matches_any, matches_type(_String)},
                         &native__terminate_);
 
-        // Farm out to builtin_ffi.cc for additional builtins.
+        register_native("gc-stats", r_misc, {matches_any}, &native__gc_stats);
+        register_native("heap-image-point", r_misc, {matches_any}, &native__heap_image_point);
+        register_native("start-cpu-profile:",
+                        r_misc,
+                        {matches_any, matches_type(_Fixnum)},
+                        &native__start_cpu_profile_);
+        register_native("stop-cpu-profile", r_misc, {matches_any}, &native__stop_cpu_profile);
+        register_native("monotonic-nanos", r_misc, {matches_any}, &native__monotonic_nanos);
+
+        // Farm out to builtin_ffi.cc, builtin_io.cc, builtin_numeric.cc, builtin_sequence.cc and
+        // builtin_worker.cc for additional builtins.
         register_ffi_builtins(vm, r_ffi);
+        register_io_builtins(vm, r_io);
+        register_numeric_builtins(vm, r_misc);
+        register_sequence_builtins(vm, r_misc);
+        register_worker_builtins(vm, r_worker);
 
         /*
          * TODO: move / add some things to compile-time builtins:
@@ -9,11 +9,11 @@ namespace Katsu
     // Add builtins to the VM's builtin array and to various core.builtin.* modules.
     void register_builtins(VM& vm, Root<Assoc>& r_modules);
 
-    // Helper functions:
-    void add_native(GC& gc, Value& v_multimethods, bool global, Root<Assoc>& r_module,
-                    const std::string& name, uint32_t num_params, Root<Array>& r_param_matchers,
+    // Helper functions. These add to the VM's global multimethods if `global`, and intern `name`.
+    void add_native(VM& vm, bool global, Root<Assoc>& r_module, const std::string& name,
+                    uint32_t num_params, Root<Array>& r_param_matchers,
                     NativeHandler native_handler);
-    void add_intrinsic(GC& gc, Value& v_multimethods, bool global, Root<Assoc>& r_module,
-                       const std::string& name, uint32_t num_params, Root<Array>& r_param_matchers,
+    void add_intrinsic(VM& vm, bool global, Root<Assoc>& r_module, const std::string& name,
+                       uint32_t num_params, Root<Array>& r_param_matchers,
                        IntrinsicHandler intrinsic_handler);
 };
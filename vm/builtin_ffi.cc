@@ -14,6 +14,9 @@
 
 namespace Katsu
 {
+    // Most arguments taken by the fixed-arity ffi-invoke natives; use ffi-invoke*: beyond that.
+    static const int MAX_FFI_INVOKE_ARITY = 6;
+
     Value ffi__malloc_(VM& vm, int64_t nargs, Value* args)
     {
         // _ malloc: size
@@ -123,6 +126,164 @@ namespace Katsu
         return Value::null();
     }
 
+    // A foreign function bound to its prepared CIF and argument / return value buffers, so that it
+    // can be called with Katsu values directly; see ffi__ffi_invoke(). None of the pointers are
+    // owned by the binding.
+    struct BoundForeignFunction
+    {
+        ffi_cif* cif;
+        void (*fn)();
+        void* rvalue;
+        void** avalues;
+    };
+
+    Value ffi__bind_ffi_call_fn_rvalue_avalues_(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ bind-ffi-call: cif fn: fn rvalue: rvalue avalues: avalues
+        ASSERT(nargs == 5);
+        auto bound = reinterpret_cast<BoundForeignFunction*>(malloc(sizeof(BoundForeignFunction)));
+        if (!bound) {
+            throw condition_error("out-of-memory", "could not allocate requsted memory");
+        }
+        bound->cif = reinterpret_cast<ffi_cif*>(args[1].obj_foreign()->value);
+        bound->fn = reinterpret_cast<void (*)()>(args[2].obj_foreign()->value);
+        bound->rvalue = args[3].obj_foreign()->value;
+        bound->avalues = reinterpret_cast<void**>(args[4].obj_foreign()->value);
+        return Value::object(make_foreign(vm.gc, bound));
+    }
+
+    [[noreturn]] void ffi_arg_mismatch(unsigned int index, const std::string& expected)
+    {
+        throw condition_error("invalid-argument",
+                              "foreign argument " + std::to_string(index) + " must be " + expected);
+    }
+
+    // Write a Katsu value into an argument slot of the given type.
+    void marshal_ffi_arg(ffi_type* type, void* slot, Value value, unsigned int index)
+    {
+        switch (type->type) {
+            case FFI_TYPE_UINT8:
+            case FFI_TYPE_SINT8:
+            case FFI_TYPE_UINT16:
+            case FFI_TYPE_SINT16:
+            case FFI_TYPE_UINT32:
+            case FFI_TYPE_SINT32:
+            case FFI_TYPE_INT:
+            case FFI_TYPE_UINT64:
+            case FFI_TYPE_SINT64: {
+                if (!value.is_fixnum()) {
+                    ffi_arg_mismatch(index, "a fixnum");
+                }
+                int64_t n = value.fixnum();
+                // Little-endian: copying the low bytes truncates to the slot's width.
+                memcpy(slot, &n, type->size);
+                return;
+            }
+            case FFI_TYPE_FLOAT:
+            case FFI_TYPE_DOUBLE: {
+                double d;
+                if (value.is_float()) {
+                    d = value._float();
+                } else if (value.is_fixnum()) {
+                    d = value.fixnum();
+                } else {
+                    ffi_arg_mismatch(index, "a number");
+                }
+                if (type->type == FFI_TYPE_FLOAT) {
+                    *reinterpret_cast<float*>(slot) = d;
+                } else {
+                    *reinterpret_cast<double*>(slot) = d;
+                }
+                return;
+            }
+            case FFI_TYPE_POINTER: {
+                void* p;
+                if (value.is_obj_foreign()) {
+                    p = value.obj_foreign()->value;
+                } else if (value.is_obj_byte_array()) {
+                    // Safe since nothing can collect between here and the call itself.
+                    p = value.obj_byte_array()->contents();
+                } else if (value.is_null()) {
+                    p = nullptr;
+                } else {
+                    ffi_arg_mismatch(index, "a foreign pointer, byte-array, or #null");
+                }
+                *reinterpret_cast<void**>(slot) = p;
+                return;
+            }
+            case FFI_TYPE_STRUCT: {
+                if (!value.is_obj_foreign()) {
+                    ffi_arg_mismatch(index, "a foreign pointer to the struct");
+                }
+                memcpy(slot, value.obj_foreign()->value, type->size);
+                return;
+            }
+            default:
+                throw condition_error("invalid-argument",
+                                      "foreign argument " + std::to_string(index) +
+                                          " has an unsupported type");
+        }
+    }
+
+    // Read the return value of a call into a Katsu value. Small integral return values take up a
+    // whole ffi_arg (see the libffi docs for ffi_call), so those are read at that width.
+    Value unmarshal_ffi_result(VM& vm, ffi_type* type, void* rvalue)
+    {
+        switch (type->type) {
+            case FFI_TYPE_VOID: return Value::null();
+            case FFI_TYPE_UINT8:
+            case FFI_TYPE_UINT16:
+            case FFI_TYPE_UINT32: return Value::fixnum(*reinterpret_cast<ffi_arg*>(rvalue));
+            case FFI_TYPE_SINT8:
+            case FFI_TYPE_SINT16:
+            case FFI_TYPE_SINT32:
+            case FFI_TYPE_INT: return Value::fixnum(*reinterpret_cast<ffi_sarg*>(rvalue));
+            case FFI_TYPE_UINT64:
+            case FFI_TYPE_SINT64: return Value::fixnum(*reinterpret_cast<int64_t*>(rvalue));
+            case FFI_TYPE_FLOAT: return Value::_float(*reinterpret_cast<float*>(rvalue));
+            case FFI_TYPE_DOUBLE: return Value::_float(*reinterpret_cast<double*>(rvalue));
+            case FFI_TYPE_POINTER:
+                return Value::object(make_foreign(vm.gc, *reinterpret_cast<void**>(rvalue)));
+            // Anything else stays in the rvalue buffer for the caller to read.
+            default: return Value::null();
+        }
+    }
+
+    // Call a bound foreign function with `args`, marshalling them straight into the preallocated
+    // argument slots. The whole call happens without any GC activity until the result is read,
+    // so byte-array arguments can be passed by pointer.
+    Value ffi_invoke(VM& vm, BoundForeignFunction* bound, int64_t nargs, Value* args)
+    {
+        ffi_cif* cif = bound->cif;
+        if (nargs != static_cast<int64_t>(cif->nargs)) {
+            throw condition_error("argument-count-mismatch",
+                                  "foreign function takes " + std::to_string(cif->nargs) +
+                                      " arguments but got " + std::to_string(nargs));
+        }
+        for (unsigned int i = 0; i < cif->nargs; i++) {
+            marshal_ffi_arg(cif->arg_types[i], bound->avalues[i], args[i], i);
+        }
+        ffi_call(cif, bound->fn, bound->rvalue, bound->avalues);
+        return unmarshal_ffi_result(vm, cif->rtype, bound->rvalue);
+    }
+
+    Value ffi__ffi_invoke(VM& vm, int64_t nargs, Value* args)
+    {
+        // bound ffi-invoke: arg with: arg with: ...
+        ASSERT(nargs >= 1);
+        auto bound = reinterpret_cast<BoundForeignFunction*>(args[0].obj_foreign()->value);
+        return ffi_invoke(vm, bound, nargs - 1, args + 1);
+    }
+
+    Value ffi__ffi_invoke_star_(VM& vm, int64_t nargs, Value* args)
+    {
+        // bound ffi-invoke*: tuple
+        ASSERT(nargs == 2);
+        auto bound = reinterpret_cast<BoundForeignFunction*>(args[0].obj_foreign()->value);
+        Tuple* tuple = args[1].obj_tuple();
+        return ffi_invoke(vm, bound, tuple->length, tuple->components());
+    }
+
     template <typename T> T inline foreign_read_at_offset(ForeignValue* foreign, int64_t offset)
     {
         return *(T*)((uint8_t*)foreign->value + offset);
@@ -366,6 +527,36 @@ namespace Katsu
         return Value::object(str);
     }
 
+    Value ffi__foreign_to_byte_array_offset_length_(VM& vm, int64_t nargs, Value* args)
+    {
+        // foreign foreign>byte-array/offset: offset length: length
+        ASSERT(nargs == 3);
+        int64_t length = args[2].fixnum();
+        if (length < 0) {
+            throw condition_error("invalid-argument", "length must be nonnegative");
+        }
+        Root<ForeignValue> r_foreign(vm.gc, args[0].obj_foreign());
+        ByteArray* array = make_byte_array_nofill(vm.gc, length);
+        const uint8_t* src = reinterpret_cast<const uint8_t*>(r_foreign->value);
+        memcpy(array->contents(), src + args[1].fixnum(), length);
+        return Value::object(array);
+    }
+
+    Value ffi__foreign_to_string_offset_length_(VM& vm, int64_t nargs, Value* args)
+    {
+        // foreign foreign>string/offset: offset length: length
+        ASSERT(nargs == 3);
+        int64_t length = args[2].fixnum();
+        if (length < 0) {
+            throw condition_error("invalid-argument", "length must be nonnegative");
+        }
+        Root<ForeignValue> r_foreign(vm.gc, args[0].obj_foreign());
+        String* str = make_string_nofill(vm.gc, length);
+        const uint8_t* src = reinterpret_cast<const uint8_t*>(r_foreign->value);
+        memcpy(str->contents(), src + args[1].fixnum(), length);
+        return Value::object(str);
+    }
+
     // NOTE: caller must ensure that there is no GC activity while this is handed to foreign
     // functions.
     Value ffi__byte_array_to_foreign_offset_(VM& vm, int64_t nargs, Value* args)
@@ -390,8 +581,7 @@ namespace Katsu
             for (size_t i = 0; i < matchers.size(); i++) {
                 r_matchers->components()[i] = matchers[i]();
             }
-            add_native(vm.gc,
-                       vm.v_multimethods,
+            add_native(vm,
                        true /* global */,
                        r_ffi,
                        name,
@@ -400,8 +590,12 @@ namespace Katsu
                        handler);
         };
         const auto register_const = [&vm, &r_ffi](const std::string& name, Value value) -> void {
-            ValueRoot r_name(vm.gc, Value::object(make_string(vm.gc, name)));
+            if (value.is_obj_foreign()) {
+                vm.builtin_names.foreign_constants.emplace_back(name,
+                                                                value.obj_foreign()->value);
+            }
             ValueRoot r_value(vm.gc, std::move(value));
+            ValueRoot r_name(vm.gc, Value::object(intern(vm, name)));
             append(vm.gc, r_ffi, r_name, r_value);
         };
 
@@ -487,6 +681,11 @@ namespace Katsu
         register_const("&ffi_type_complex_longdouble",
                        Value::object(make_foreign(vm.gc, &ffi_type_complex_longdouble)));
 
+        // ffi_type.type codes.
+        register_const("FFI_TYPE_VOID", Value::fixnum(FFI_TYPE_VOID));
+        register_const("FFI_TYPE_STRUCT", Value::fixnum(FFI_TYPE_STRUCT));
+        register_const("FFI_TYPE_POINTER", Value::fixnum(FFI_TYPE_POINTER));
+
         register_const("ffi_status.FFI_OK", Value::fixnum(FFI_OK));
         register_const("ffi_status.FFI_BAD_TYPEDEF", Value::fixnum(FFI_BAD_TYPEDEF));
         register_const("ffi_status.FFI_BAD_ABI", Value::fixnum(FFI_BAD_ABI));
@@ -514,6 +713,27 @@ namespace Katsu
         },
                   &ffi__ffi_call_fn_rvalue_avalues_);
 
+        _register("bind-ffi-call:fn:rvalue:avalues:",
+                  {matches_any,
+                   matches_type(_Foreign) /* cif */,
+                   matches_type(_Foreign) /* fn */,
+                   matches_type(_Foreign) /* rvalue */,
+                   matches_type(_Foreign) /* avalues */},
+                  &ffi__bind_ffi_call_fn_rvalue_avalues_);
+        // Fixed arities, so that calls don't allocate argument tuples.
+        {
+            std::string name = "ffi-invoke";
+            std::vector<std::function<Value()>> matchers = {matches_type(_Foreign)};
+            for (int arity = 0; arity <= MAX_FFI_INVOKE_ARITY; arity++) {
+                _register(name, matchers, &ffi__ffi_invoke);
+                name += arity == 0 ? ":" : "with:";
+                matchers.push_back(matches_any);
+            }
+        }
+        _register("ffi-invoke*:",
+                  {matches_type(_Foreign), matches_type(_Tuple)},
+                  &ffi__ffi_invoke_star_);
+
         _register("foreign-read-u8-at-offset:",
                   {matches_type(_Foreign), matches_type(_Fixnum)},
                   &ffi__foreign_read_u8_at_offset_);
@@ -596,6 +816,12 @@ namespace Katsu
 
         // TODO: c-string to byte-array?
         _register("c-string>string", {matches_type(_Foreign)}, &ffi__c_string_to_string);
+        _register("foreign>byte-array/offset:length:",
+                  {matches_type(_Foreign), matches_type(_Fixnum), matches_type(_Fixnum)},
+                  &ffi__foreign_to_byte_array_offset_length_);
+        _register("foreign>string/offset:length:",
+                  {matches_type(_Foreign), matches_type(_Fixnum), matches_type(_Fixnum)},
+                  &ffi__foreign_to_string_offset_length_);
         _register("byte-array>foreign/offset:",
                   {matches_type(_ByteArray), matches_type(_Fixnum)},
                   &ffi__byte_array_to_foreign_offset_);
@@ -0,0 +1,274 @@
+#include "builtin_io.h"
+
+#include "builtin.h"
+#include "condition.h"
+#include "value_utils.h"
+
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Katsu
+{
+    // Most events handled by a single reactor-wait:timeout:. Any more are left for the next wait.
+    static const int REACTOR_MAX_EVENTS = 128;
+
+    [[noreturn]] void throw_errno(const std::string& what)
+    {
+        throw condition_error("io-error", what + ": " + strerror(errno));
+    }
+
+    /*
+     * A reactor is an epoll file descriptor, used to wait for readiness of many other file
+     * descriptors at once. Each registered fd may have (at most) one waiter: some value, normally
+     * a suspended fiber, held at index fd of a waiters Vector which the caller keeps. A wait
+     * hands back all the waiters of ready fds at once, in a single native call.
+     */
+
+    Value io__reactor_create(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ reactor-create
+        ASSERT(nargs == 1);
+        int epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd < 0) {
+            throw_errno("epoll_create1");
+        }
+        return Value::fixnum(epfd);
+    }
+
+    Value io__reactor_close(VM& vm, int64_t nargs, Value* args)
+    {
+        // reactor reactor-close
+        ASSERT(nargs == 1);
+        if (close(args[0].fixnum()) < 0) {
+            throw_errno("close");
+        }
+        return Value::null();
+    }
+
+    Value io__reactor_add_events_(VM& vm, int64_t nargs, Value* args)
+    {
+        // reactor reactor-add: fd events: events
+        ASSERT(nargs == 3);
+        int fd = args[1].fixnum();
+        epoll_event event{};
+        event.events = static_cast<uint32_t>(args[2].fixnum());
+        event.data.fd = fd;
+        if (epoll_ctl(args[0].fixnum(), EPOLL_CTL_ADD, fd, &event) < 0) {
+            throw_errno("epoll_ctl");
+        }
+        return Value::null();
+    }
+
+    Value io__reactor_del_(VM& vm, int64_t nargs, Value* args)
+    {
+        // reactor reactor-del: fd
+        ASSERT(nargs == 2);
+        if (epoll_ctl(args[0].fixnum(), EPOLL_CTL_DEL, args[1].fixnum(), nullptr) < 0) {
+            throw_errno("epoll_ctl");
+        }
+        return Value::null();
+    }
+
+    Value io__reactor_wait_timeout_(VM& vm, int64_t nargs, Value* args)
+    {
+        // reactor reactor-wait: waiters timeout: timeout-ms
+        ASSERT(nargs == 3);
+        epoll_event events[REACTOR_MAX_EVENTS];
+        int num_events =
+            epoll_wait(args[0].fixnum(), events, REACTOR_MAX_EVENTS, args[2].fixnum());
+        if (num_events < 0) {
+            if (errno != EINTR) {
+                throw_errno("epoll_wait");
+            }
+            // Interrupted by a signal; just report nothing ready.
+            num_events = 0;
+        }
+
+        Root<Vector> r_waiters(vm.gc, args[1].obj_vector());
+        const auto waiter = [&r_waiters](int fd) -> Value* {
+            Vector* waiters = *r_waiters;
+            if (fd < 0 || static_cast<uint64_t>(fd) >= waiters->length) {
+                return nullptr;
+            }
+            Value* slot = &waiters->v_array.obj_array()->components()[fd];
+            return slot->is_null() ? nullptr : slot;
+        };
+
+        uint64_t num_ready = 0;
+        for (int i = 0; i < num_events; i++) {
+            if (waiter(events[i].data.fd)) {
+                num_ready++;
+            }
+        }
+        Array* ready = make_array_nofill(vm.gc, num_ready);
+        uint64_t j = 0;
+        for (int i = 0; i < num_events; i++) {
+            if (Value* slot = waiter(events[i].data.fd)) {
+                ready->components()[j++] = *slot;
+                // Each waiter is woken once; it must wait again to be woken again.
+                *slot = Value::null();
+            }
+        }
+        return Value::object(ready);
+    }
+
+    /*
+     * Syscalls directly on a slice of a ByteArray. Nothing allocates between taking the pointer
+     * and making the call, so the array needn't be pinned. Like the libc calls, these return -1
+     * on failure and leave errno set, so callers check results just as for FFI syscalls.
+     */
+
+    // Check that `count` bytes at `offset` lie within `v_buf`, and return a pointer to them.
+    static uint8_t* byte_array_slice(Value v_buf, Value v_offset, Value v_count)
+    {
+        ByteArray* buf = v_buf.obj_byte_array();
+        int64_t offset = v_offset.fixnum();
+        int64_t count = v_count.fixnum();
+        if (offset < 0 || count < 0 || static_cast<uint64_t>(offset) > buf->length ||
+            static_cast<uint64_t>(count) > buf->length - offset) {
+            throw condition_error("invalid-argument", "byte-array slice is out of bounds");
+        }
+        return buf->contents() + offset;
+    }
+
+    Value io__fd_read_at_count_(VM& vm, int64_t nargs, Value* args)
+    {
+        // fd fd-read: buf at: offset count: count
+        ASSERT(nargs == 4);
+        uint8_t* p = byte_array_slice(args[1], args[2], args[3]);
+        return Value::fixnum(read(args[0].fixnum(), p, args[3].fixnum()));
+    }
+
+    Value io__fd_write_at_count_(VM& vm, int64_t nargs, Value* args)
+    {
+        // fd fd-write: buf at: offset count: count
+        ASSERT(nargs == 4);
+        uint8_t* p = byte_array_slice(args[1], args[2], args[3]);
+        return Value::fixnum(write(args[0].fixnum(), p, args[3].fixnum()));
+    }
+
+    Value io__fd_recv_at_count_flags_(VM& vm, int64_t nargs, Value* args)
+    {
+        // fd fd-recv: buf at: offset count: count flags: flags
+        ASSERT(nargs == 5);
+        uint8_t* p = byte_array_slice(args[1], args[2], args[3]);
+        return Value::fixnum(recv(args[0].fixnum(), p, args[3].fixnum(), args[4].fixnum()));
+    }
+
+    Value io__fd_send_at_count_flags_(VM& vm, int64_t nargs, Value* args)
+    {
+        // fd fd-send: buf at: offset count: count flags: flags
+        ASSERT(nargs == 5);
+        uint8_t* p = byte_array_slice(args[1], args[2], args[3]);
+        return Value::fixnum(send(args[0].fixnum(), p, args[3].fixnum(), args[4].fixnum()));
+    }
+
+    /*
+     * Read-only file mappings. The mapped bytes live outside the GC heap entirely, so a mapping
+     * costs no heap space and is never copied by a collection; it stays valid until unmapped.
+     */
+
+    Value io__mmap_file_(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ mmap-file: path
+        ASSERT(nargs == 2);
+        std::string path = native_str(args[1].obj_string());
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw_errno("open " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            throw_errno("fstat " + path);
+        }
+        // mmap() rejects empty mappings; an empty file just maps to nothing.
+        void* address = nullptr;
+        if (st.st_size > 0) {
+            address = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        int saved = errno;
+        // The mapping holds its own reference to the file.
+        close(fd);
+        if (address == MAP_FAILED) {
+            errno = saved;
+            throw_errno("mmap " + path);
+        }
+
+        ValueRoot r_address(vm.gc, Value::object(make_foreign(vm.gc, address)));
+        Tuple* mapping = make_tuple_nofill(vm.gc, 2);
+        mapping->components()[0] = *r_address;
+        mapping->components()[1] = Value::fixnum(st.st_size);
+        return Value::object(mapping);
+    }
+
+    Value io__munmap_length_(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ munmap: address length: length
+        ASSERT(nargs == 3);
+        int64_t length = args[2].fixnum();
+        if (length > 0 && munmap(args[1].obj_foreign()->value, length) < 0) {
+            throw_errno("munmap");
+        }
+        return Value::null();
+    }
+
+    void register_io_builtins(VM& vm, Root<Assoc>& r_io)
+    {
+        const std::function<Value()> matches_any = []() { return Value::null(); };
+        const auto matches_type = [&vm](BuiltinId id) -> std::function<Value()> {
+            return [&vm, id]() { return vm.builtin(id); };
+        };
+        const auto _register = [&vm, &r_io](const std::string& name,
+                                            const std::vector<std::function<Value()>>& matchers,
+                                            NativeHandler handler) -> void {
+            Root<Array> r_matchers(vm.gc, make_array(vm.gc, matchers.size()));
+            for (size_t i = 0; i < matchers.size(); i++) {
+                r_matchers->components()[i] = matchers[i]();
+            }
+            add_native(vm,
+                       true /* global */,
+                       r_io,
+                       name,
+                       matchers.size(),
+                       r_matchers,
+                       handler);
+        };
+
+        _register("reactor-create", {matches_any}, &io__reactor_create);
+        _register("reactor-close", {matches_type(_Fixnum)}, &io__reactor_close);
+        _register("reactor-add:events:",
+                  {matches_type(_Fixnum), matches_type(_Fixnum), matches_type(_Fixnum)},
+                  &io__reactor_add_events_);
+        _register("reactor-del:",
+                  {matches_type(_Fixnum), matches_type(_Fixnum)},
+                  &io__reactor_del_);
+        _register("reactor-wait:timeout:",
+                  {matches_type(_Fixnum), matches_type(_Vector), matches_type(_Fixnum)},
+                  &io__reactor_wait_timeout_);
+
+        const std::vector<std::function<Value()>> slice_args = {matches_type(_Fixnum),
+                                                                matches_type(_ByteArray),
+                                                                matches_type(_Fixnum),
+                                                                matches_type(_Fixnum)};
+        std::vector<std::function<Value()>> socket_slice_args = slice_args;
+        socket_slice_args.push_back(matches_type(_Fixnum));
+        _register("fd-read:at:count:", slice_args, &io__fd_read_at_count_);
+        _register("fd-write:at:count:", slice_args, &io__fd_write_at_count_);
+        _register("fd-recv:at:count:flags:", socket_slice_args, &io__fd_recv_at_count_flags_);
+        _register("fd-send:at:count:flags:", socket_slice_args, &io__fd_send_at_count_flags_);
+
+        _register("mmap-file:", {matches_any, matches_type(_String)}, &io__mmap_file_);
+        _register("munmap:length:",
+                  {matches_any, matches_type(_Foreign), matches_type(_Fixnum)},
+                  &io__munmap_length_);
+    }
+};
@@ -0,0 +1,328 @@
+#include "builtin_numeric.h"
+
+#include "builtin.h"
+#include "condition.h"
+#include "numeric_array.h"
+#include "value_utils.h"
+
+#include <cmath>
+
+namespace Katsu
+{
+    Value checked_fixnum(int64_t n)
+    {
+        if (n < FIXNUM_MIN || n > FIXNUM_MAX) {
+            throw condition_error("out-of-range", "result does not fit in a fixnum");
+        }
+        return Value::fixnum(n);
+    }
+
+    // How the elements of each unboxed array convert to and from Values.
+    template <typename A> struct Unboxed;
+    template <> struct Unboxed<F64Array>
+    {
+        typedef double Elem;
+        static F64Array* of(Value v)
+        {
+            return v.obj_f64_array();
+        }
+        // A Float only holds a float32, so this rounds to the nearest one.
+        static Value box(double x)
+        {
+            return Value::_float(static_cast<float>(x));
+        }
+        // From a Fixnum or a Float.
+        static double unbox(Value v)
+        {
+            return v.is_fixnum() ? static_cast<double>(v.fixnum()) : v._float();
+        }
+    };
+    template <> struct Unboxed<I64Array>
+    {
+        typedef int64_t Elem;
+        static I64Array* of(Value v)
+        {
+            return v.obj_i64_array();
+        }
+        static Value box(int64_t x)
+        {
+            return checked_fixnum(x);
+        }
+        static int64_t unbox(Value v)
+        {
+            return v.fixnum();
+        }
+    };
+    template <> struct Unboxed<ByteArray>
+    {
+        typedef uint8_t Elem;
+        static ByteArray* of(Value v)
+        {
+            return v.obj_byte_array();
+        }
+        static Value box(uint64_t x)
+        {
+            return checked_fixnum(static_cast<int64_t>(x));
+        }
+        static uint8_t unbox(Value v)
+        {
+            int64_t n = v.fixnum();
+            if (n < 0 || n > 255) {
+                throw condition_error("invalid-argument", "byte must be in the range [0, 256)");
+            }
+            return n;
+        }
+    };
+
+    template <typename A> void check_index(A* a, Value v_index)
+    {
+        int64_t index = v_index.fixnum();
+        if (index < 0 || static_cast<uint64_t>(index) >= a->length) {
+            throw condition_error("invalid-argument", "array index out of bounds");
+        }
+    }
+
+    template <typename A> void check_same_length(A* a, A* b)
+    {
+        if (a->length != b->length) {
+            throw condition_error("invalid-argument", "arrays must have the same length");
+        }
+    }
+
+    template <typename A> void check_nonempty(A* a)
+    {
+        if (a->length == 0) {
+            throw condition_error("invalid-argument", "array must not be empty");
+        }
+    }
+
+    int64_t check_length(Value v_length)
+    {
+        int64_t n = v_length.fixnum();
+        if (n < 0) {
+            throw condition_error("invalid-argument", "array must have nonnegative length");
+        }
+        return n;
+    }
+
+    Value numeric__zeros_f64_array(VM& vm, int64_t nargs, Value* args)
+    {
+        // n zeros-f64-array
+        ASSERT(nargs == 1);
+        return Value::object(make_f64_array(vm.gc, check_length(args[0])));
+    }
+
+    Value numeric__zeros_i64_array(VM& vm, int64_t nargs, Value* args)
+    {
+        // n zeros-i64-array
+        ASSERT(nargs == 1);
+        return Value::object(make_i64_array(vm.gc, check_length(args[0])));
+    }
+
+    template <typename A> Value numeric__at_(VM& vm, int64_t nargs, Value* args)
+    {
+        // array f64-array-at: index
+        // array i64-array-at: index
+        ASSERT(nargs == 2);
+        A* a = Unboxed<A>::of(args[0]);
+        check_index(a, args[1]);
+        return Unboxed<A>::box(a->contents()[args[1].fixnum()]);
+    }
+
+    template <typename A> Value numeric__at_put_(VM& vm, int64_t nargs, Value* args)
+    {
+        // array f64-array-at: index put: value
+        // array i64-array-at: index put: value
+        ASSERT(nargs == 3);
+        A* a = Unboxed<A>::of(args[0]);
+        check_index(a, args[1]);
+        // Nothing here for the GC to trace, so no write barrier.
+        a->contents()[args[1].fixnum()] = Unboxed<A>::unbox(args[2]);
+        return Value::null();
+    }
+
+    template <typename A> Value numeric__bulk_sum(VM& vm, int64_t nargs, Value* args)
+    {
+        // array bulk-sum
+        ASSERT(nargs == 1);
+        A* a = Unboxed<A>::of(args[0]);
+        return Unboxed<A>::box(bulk_sum(a->contents(), a->length));
+    }
+
+    template <typename A> Value numeric__bulk_dot_(VM& vm, int64_t nargs, Value* args)
+    {
+        // array bulk-dot: array
+        ASSERT(nargs == 2);
+        A* a = Unboxed<A>::of(args[0]);
+        A* b = Unboxed<A>::of(args[1]);
+        check_same_length(a, b);
+        return Unboxed<A>::box(bulk_dot(a->contents(), b->contents(), a->length));
+    }
+
+    template <typename A> Value numeric__bulk_add_scaled_by_(VM& vm, int64_t nargs, Value* args)
+    {
+        // array bulk-add: array scaled-by: scalar
+        ASSERT(nargs == 3);
+        A* ys = Unboxed<A>::of(args[0]);
+        A* xs = Unboxed<A>::of(args[1]);
+        check_same_length(ys, xs);
+        bulk_axpy(Unboxed<A>::unbox(args[2]), xs->contents(), ys->contents(), ys->length);
+        return Value::null();
+    }
+
+    template <typename A> Value numeric__bulk_min(VM& vm, int64_t nargs, Value* args)
+    {
+        // array bulk-min
+        ASSERT(nargs == 1);
+        A* a = Unboxed<A>::of(args[0]);
+        check_nonempty(a);
+        return Unboxed<A>::box(bulk_min(a->contents(), a->length));
+    }
+
+    template <typename A> Value numeric__bulk_max(VM& vm, int64_t nargs, Value* args)
+    {
+        // array bulk-max
+        ASSERT(nargs == 1);
+        A* a = Unboxed<A>::of(args[0]);
+        check_nonempty(a);
+        return Unboxed<A>::box(bulk_max(a->contents(), a->length));
+    }
+
+    template <typename A> Value numeric__bulk_fill_(VM& vm, int64_t nargs, Value* args)
+    {
+        // array bulk-fill: scalar
+        ASSERT(nargs == 2);
+        A* a = Unboxed<A>::of(args[0]);
+        bulk_fill(a->contents(), a->length, Unboxed<A>::unbox(args[1]));
+        return Value::null();
+    }
+
+    enum class Comparison
+    {
+        LESS,
+        EQUAL,
+    };
+
+    // Compare an array elementwise against another array (of the same kind and length) or against
+    // a scalar, into a new ByteArray of 1s (where the comparison holds) and 0s.
+    template <typename A, Comparison comparison, bool scalar>
+    Value numeric__bulk_compare_(VM& vm, int64_t nargs, Value* args)
+    {
+        // array bulk<: array-or-scalar
+        // array bulk=: array-or-scalar
+        ASSERT(nargs == 2);
+        typename Unboxed<A>::Elem y{};
+        if constexpr (scalar) {
+            y = Unboxed<A>::unbox(args[1]);
+        } else {
+            check_same_length(Unboxed<A>::of(args[0]), Unboxed<A>::of(args[1]));
+        }
+        uint64_t n = Unboxed<A>::of(args[0])->length;
+        ValuesRoot r_args(vm.gc, args, nargs);
+        ByteArray* mask = make_byte_array_nofill(vm.gc, n);
+
+        auto compare = [&](auto ys) {
+            if constexpr (comparison == Comparison::LESS) {
+                bulk_less(Unboxed<A>::of(args[0])->contents(), ys, mask->contents(), n);
+            } else {
+                bulk_equal(Unboxed<A>::of(args[0])->contents(), ys, mask->contents(), n);
+            }
+        };
+        if constexpr (scalar) {
+            compare(y);
+        } else {
+            compare(Unboxed<A>::of(args[1])->contents());
+        }
+        return Value::object(mask);
+    }
+
+    Value numeric__fixnum_to_float(VM& vm, int64_t nargs, Value* args)
+    {
+        // n fixnum>float
+        ASSERT(nargs == 1);
+        return Value::_float(static_cast<float>(args[0].fixnum()));
+    }
+
+    Value numeric__float_to_fixnum(VM& vm, int64_t nargs, Value* args)
+    {
+        // x float>fixnum
+        ASSERT(nargs == 1);
+        float x = std::trunc(args[0]._float());
+        // The bounds are both powers of two (less one, for FIXNUM_MAX), so convert exactly.
+        if (!(x >= static_cast<float>(FIXNUM_MIN) && x < -static_cast<float>(FIXNUM_MIN))) {
+            throw condition_error("out-of-range", "float does not fit in a fixnum");
+        }
+        return Value::fixnum(static_cast<int64_t>(x));
+    }
+
+    // Register the kernels which every kind of unboxed array has, given which types of scalar it
+    // takes.
+    template <typename A>
+    void register_kernels(const auto& _register, BuiltinId type,
+                          const std::vector<BuiltinId>& scalars)
+    {
+        _register("bulk-sum", {type}, &numeric__bulk_sum<A>);
+        _register("bulk-min", {type}, &numeric__bulk_min<A>);
+        _register("bulk-max", {type}, &numeric__bulk_max<A>);
+        _register("bulk<:", {type, type}, &numeric__bulk_compare_<A, Comparison::LESS, false>);
+        _register("bulk=:", {type, type}, &numeric__bulk_compare_<A, Comparison::EQUAL, false>);
+        for (BuiltinId scalar : scalars) {
+            _register("bulk-fill:", {type, scalar}, &numeric__bulk_fill_<A>);
+            _register("bulk<:", {type, scalar}, &numeric__bulk_compare_<A, Comparison::LESS, true>);
+            _register("bulk=:",
+                      {type, scalar},
+                      &numeric__bulk_compare_<A, Comparison::EQUAL, true>);
+        }
+    }
+
+    void register_numeric_builtins(VM& vm, Root<Assoc>& r_misc)
+    {
+        const auto _register = [&vm, &r_misc](const std::string& name,
+                                              const std::vector<BuiltinId>& types,
+                                              NativeHandler handler) -> void {
+            Root<Array> r_matchers(vm.gc, make_array(vm.gc, types.size()));
+            for (size_t i = 0; i < types.size(); i++) {
+                r_matchers->components()[i] = vm.builtin(types[i]);
+            }
+            add_native(vm,
+                       true /* global */,
+                       r_misc,
+                       name,
+                       types.size(),
+                       r_matchers,
+                       handler);
+        };
+
+        _register("zeros-f64-array", {_Fixnum}, &numeric__zeros_f64_array);
+        _register("zeros-i64-array", {_Fixnum}, &numeric__zeros_i64_array);
+
+        // F64Arrays take either kind of number, wherever they take a scalar.
+        _register("f64-array-at:", {_F64Array, _Fixnum}, &numeric__at_<F64Array>);
+        for (BuiltinId number : {_Fixnum, _Float}) {
+            _register("f64-array-at:put:",
+                      {_F64Array, _Fixnum, number},
+                      &numeric__at_put_<F64Array>);
+            _register("bulk-add:scaled-by:",
+                      {_F64Array, _F64Array, number},
+                      &numeric__bulk_add_scaled_by_<F64Array>);
+        }
+        _register("bulk-dot:", {_F64Array, _F64Array}, &numeric__bulk_dot_<F64Array>);
+        register_kernels<F64Array>(_register, _F64Array, {_Fixnum, _Float});
+
+        _register("i64-array-at:", {_I64Array, _Fixnum}, &numeric__at_<I64Array>);
+        _register("i64-array-at:put:",
+                  {_I64Array, _Fixnum, _Fixnum},
+                  &numeric__at_put_<I64Array>);
+        _register("bulk-add:scaled-by:",
+                  {_I64Array, _I64Array, _Fixnum},
+                  &numeric__bulk_add_scaled_by_<I64Array>);
+        _register("bulk-dot:", {_I64Array, _I64Array}, &numeric__bulk_dot_<I64Array>);
+        register_kernels<I64Array>(_register, _I64Array, {_Fixnum});
+
+        // ByteArrays double as u8 arrays.
+        register_kernels<ByteArray>(_register, _ByteArray, {_Fixnum});
+
+        _register("fixnum>float", {_Fixnum}, &numeric__fixnum_to_float);
+        _register("float>fixnum", {_Float}, &numeric__float_to_fixnum);
+    }
+};
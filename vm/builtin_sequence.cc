@@ -0,0 +1,324 @@
+#include "builtin_sequence.h"
+
+#include "builtin.h"
+#include "condition.h"
+#include "value_utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string_view>
+
+namespace Katsu
+{
+    // What the elements of a flat sequence are, as raw memory.
+    enum class Flat
+    {
+        VALUES,
+        BYTES,
+        F64S,
+        I64S,
+    };
+
+    // The elements of a flat sequence: an Array, Vector (up to its length), ByteArray, String,
+    // F64Array or I64Array. These are what the primitive-* natives below work on directly.
+    struct FlatView
+    {
+        Flat kind;
+        uint8_t* data;
+        uint64_t length;
+        // The object to write-barrier after storing Values into the elements.
+        Object* holder;
+        // Strings are interned, so never write into them.
+        bool writable;
+
+        uint64_t elem_size() const
+        {
+            return this->kind == Flat::BYTES ? 1 : 8;
+        }
+    };
+
+    static bool flat_view(Value v, FlatView& view)
+    {
+        if (v.is_obj_array()) {
+            Array* array = v.obj_array();
+            view = {Flat::VALUES,
+                    reinterpret_cast<uint8_t*>(array->components()),
+                    array->length,
+                    array,
+                    true};
+        } else if (v.is_obj_vector()) {
+            Array* array = v.obj_vector()->v_array.obj_array();
+            view = {Flat::VALUES,
+                    reinterpret_cast<uint8_t*>(array->components()),
+                    v.obj_vector()->length,
+                    array,
+                    true};
+        } else if (v.is_obj_byte_array()) {
+            ByteArray* bytes = v.obj_byte_array();
+            view = {Flat::BYTES, bytes->contents(), bytes->length, bytes, true};
+        } else if (v.is_obj_string()) {
+            String* str = v.obj_string();
+            view = {Flat::BYTES, str->contents(), str->length, str, false};
+        } else if (v.is_obj_f64_array()) {
+            F64Array* a = v.obj_f64_array();
+            view = {Flat::F64S, reinterpret_cast<uint8_t*>(a->contents()), a->length, a, true};
+        } else if (v.is_obj_i64_array()) {
+            I64Array* a = v.obj_i64_array();
+            view = {Flat::I64S, reinterpret_cast<uint8_t*>(a->contents()), a->length, a, true};
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // The callers (in core.sequence) have already checked ranges against the logical sequences,
+    // so these only keep memory safe.
+    static void check_range(const FlatView& view, int64_t start, int64_t end)
+    {
+        if (start < 0 || start > end || static_cast<uint64_t>(end) > view.length) {
+            throw condition_error("invalid-argument", "range out of bounds");
+        }
+    }
+
+    // Whether a Fixnum or Float, for F64S, or a Fixnum, for I64S, or a byte, for BYTES.
+    static bool fits_in(Flat kind, Value v)
+    {
+        switch (kind) {
+            case Flat::VALUES: return true;
+            case Flat::BYTES: return v.is_fixnum() && v.fixnum() >= 0 && v.fixnum() < 256;
+            case Flat::F64S: return v.is_fixnum() || v.is_float();
+            case Flat::I64S: return v.is_fixnum();
+        }
+        return false;
+    }
+
+    Value native__primitive_copy_from_to_at_(VM& vm, int64_t nargs, Value* args)
+    {
+        // dst primitive-copy: src from: start to<: end at: dst-start
+        // Returns #f (having done nothing) if the copy can't be done natively.
+        ASSERT(nargs == 5);
+        FlatView dst, src;
+        if (!flat_view(args[0], dst) || !flat_view(args[1], src) || !dst.writable ||
+            dst.kind != src.kind) {
+            return Value::_bool(false);
+        }
+        int64_t start = args[2].fixnum();
+        int64_t end = args[3].fixnum();
+        int64_t dst_start = args[4].fixnum();
+        check_range(src, start, end);
+        if (dst_start < 0) {
+            throw condition_error("invalid-argument", "range out of bounds");
+        }
+        check_range(dst, dst_start, dst_start + (end - start));
+
+        // The two may be the same storage, so memmove.
+        uint64_t elem_size = dst.elem_size();
+        memmove(dst.data + dst_start * elem_size,
+                src.data + start * elem_size,
+                (end - start) * elem_size);
+        if (dst.kind == Flat::VALUES) {
+            vm.gc.write_barrier(dst.holder);
+        }
+        return Value::_bool(true);
+    }
+
+    Value native__primitive_fill_from_to_(VM& vm, int64_t nargs, Value* args)
+    {
+        // dst primitive-fill: value from: start to<: end
+        // Returns #f (having done nothing) if the fill can't be done natively.
+        ASSERT(nargs == 4);
+        FlatView dst;
+        if (!flat_view(args[0], dst) || !dst.writable) {
+            return Value::_bool(false);
+        }
+        Value value = args[1];
+        if (!fits_in(dst.kind, value)) {
+            if (dst.kind == Flat::BYTES) {
+                throw condition_error("invalid-argument", "byte must be in the range [0, 256)");
+            }
+            return Value::_bool(false);
+        }
+        int64_t start = args[2].fixnum();
+        int64_t end = args[3].fixnum();
+        check_range(dst, start, end);
+
+        switch (dst.kind) {
+            case Flat::VALUES: {
+                Value* values = reinterpret_cast<Value*>(dst.data);
+                std::fill(values + start, values + end, value);
+                vm.gc.write_barrier(dst.holder, value);
+                break;
+            }
+            case Flat::BYTES: memset(dst.data + start, value.fixnum(), end - start); break;
+            case Flat::F64S: {
+                double* xs = reinterpret_cast<double*>(dst.data);
+                double x = value.is_fixnum() ? static_cast<double>(value.fixnum()) : value._float();
+                std::fill(xs + start, xs + end, x);
+                break;
+            }
+            case Flat::I64S: {
+                int64_t* xs = reinterpret_cast<int64_t*>(dst.data);
+                std::fill(xs + start, xs + end, value.fixnum());
+                break;
+            }
+        }
+        return Value::_bool(true);
+    }
+
+    Value native__primitive_index_of_from_to_(VM& vm, int64_t nargs, Value* args)
+    {
+        // seq primitive-index-of: x from: start to<: end
+        // Returns the first index of x in the range, or -1 if there is none, or #null if the
+        // search can't be done natively. It can only be done for a Fixnum x in bytes or I64s,
+        // which = compares by identity; anything else might define = for itself, and Floats read
+        // out of F64s are rounded.
+        ASSERT(nargs == 4);
+        FlatView seq;
+        Value x = args[1];
+        if (!flat_view(args[0], seq) || !x.is_fixnum() ||
+            (seq.kind != Flat::BYTES && seq.kind != Flat::I64S)) {
+            return Value::null();
+        }
+        int64_t start = args[2].fixnum();
+        int64_t end = args[3].fixnum();
+        check_range(seq, start, end);
+
+        if (seq.kind == Flat::BYTES) {
+            if (x.fixnum() < 0 || x.fixnum() > 255) {
+                return Value::fixnum(-1);
+            }
+            const void* found = memchr(seq.data + start, x.fixnum(), end - start);
+            return Value::fixnum(found ? static_cast<const uint8_t*>(found) - seq.data : -1);
+        } else {
+            int64_t* xs = reinterpret_cast<int64_t*>(seq.data);
+            int64_t* found = std::find(xs + start, xs + end, x.fixnum());
+            return Value::fixnum(found != xs + end ? found - xs : -1);
+        }
+    }
+
+    Value native__primitive_eq_count_(VM& vm, int64_t nargs, Value* args)
+    {
+        // a primitive=: b count: n
+        // Whether the first n elements of each are equal, or #null if that can't be decided
+        // natively. It can be for bytes and I64s, whose elements read out as Fixnums; anything
+        // else might define = for itself, and Floats read out of F64s are rounded.
+        ASSERT(nargs == 3);
+        FlatView a, b;
+        if (!flat_view(args[0], a) || !flat_view(args[1], b) || a.kind != b.kind ||
+            (a.kind != Flat::BYTES && a.kind != Flat::I64S)) {
+            return Value::null();
+        }
+        int64_t n = args[2].fixnum();
+        check_range(a, 0, n);
+        check_range(b, 0, n);
+        return Value::_bool(memcmp(a.data, b.data, n * a.elem_size()) == 0);
+    }
+
+    static std::string_view bytes_of(Value v)
+    {
+        if (v.is_obj_string()) {
+            String* str = v.obj_string();
+            return std::string_view(reinterpret_cast<const char*>(str->contents()), str->length);
+        } else {
+            ByteArray* bytes = v.obj_byte_array();
+            return std::string_view(reinterpret_cast<const char*>(bytes->contents()),
+                                    bytes->length);
+        }
+    }
+
+    Value native__find_starting_at_(VM& vm, int64_t nargs, Value* args)
+    {
+        // haystack find: needle starting-at: index
+        // The first index (at least `index`) where the bytes of needle appear in haystack, or
+        // #null if there is none.
+        ASSERT(nargs == 3);
+        std::string_view haystack = bytes_of(args[0]);
+        std::string_view needle = bytes_of(args[1]);
+        int64_t start = args[2].fixnum();
+        if (start < 0 || static_cast<uint64_t>(start) > haystack.size()) {
+            throw condition_error("invalid-argument", "index out of bounds");
+        }
+        size_t found = haystack.find(needle, start);
+        return found == std::string_view::npos ? Value::null() : Value::fixnum(found);
+    }
+
+    Value native__vector_reserve_(VM& vm, int64_t nargs, Value* args)
+    {
+        // v vector-reserve: capacity
+        ASSERT(nargs == 2);
+        int64_t capacity = args[1].fixnum();
+        if (capacity < 0) {
+            throw condition_error("invalid-argument", "capacity must be nonnegative");
+        }
+        Root<Vector> r_vector(vm.gc, args[0].obj_vector());
+        vector_reserve(vm.gc, r_vector, capacity);
+        return Value::null();
+    }
+
+    Value native__vector_grow_by_(VM& vm, int64_t nargs, Value* args)
+    {
+        // v vector-grow-by: count
+        ASSERT(nargs == 2);
+        int64_t count = args[1].fixnum();
+        if (count < 0) {
+            throw condition_error("invalid-argument", "count must be nonnegative");
+        }
+        Root<Vector> r_vector(vm.gc, args[0].obj_vector());
+        vector_grow_by(vm.gc, r_vector, count);
+        return Value::null();
+    }
+
+    void register_sequence_builtins(VM& vm, Root<Assoc>& r_misc)
+    {
+        const std::function<Value()> matches_any = []() { return Value::null(); };
+        const auto matches_type = [&vm](BuiltinId id) -> std::function<Value()> {
+            return [&vm, id]() { return vm.builtin(id); };
+        };
+        const auto _register = [&vm, &r_misc](const std::string& name,
+                                              const std::vector<std::function<Value()>>& matchers,
+                                              NativeHandler handler) -> void {
+            Root<Array> r_matchers(vm.gc, make_array(vm.gc, matchers.size()));
+            for (size_t i = 0; i < matchers.size(); i++) {
+                r_matchers->components()[i] = matchers[i]();
+            }
+            add_native(vm,
+                       true /* global */,
+                       r_misc,
+                       name,
+                       matchers.size(),
+                       r_matchers,
+                       handler);
+        };
+        const auto fixnum = matches_type(_Fixnum);
+
+        _register("primitive-copy:from:to<:at:",
+                  {matches_any, matches_any, fixnum, fixnum, fixnum},
+                  &native__primitive_copy_from_to_at_);
+        _register("primitive-fill:from:to<:",
+                  {matches_any, matches_any, fixnum, fixnum},
+                  &native__primitive_fill_from_to_);
+        _register("primitive-index-of:from:to<:",
+                  {matches_any, matches_any, fixnum, fixnum},
+                  &native__primitive_index_of_from_to_);
+        _register("primitive=:count:",
+                  {matches_any, matches_any, fixnum},
+                  &native__primitive_eq_count_);
+
+        for (BuiltinId haystack : {_String, _ByteArray}) {
+            _register("find:starting-at:",
+                      {matches_type(haystack), matches_type(haystack), fixnum},
+                      &native__find_starting_at_);
+        }
+        _register("find:starting-at:",
+                  {matches_type(_ByteArray), matches_type(_String), fixnum},
+                  &native__find_starting_at_);
+
+        _register("vector-reserve:",
+                  {matches_type(_Vector), fixnum},
+                  &native__vector_reserve_);
+        _register("vector-grow-by:",
+                  {matches_type(_Vector), fixnum},
+                  &native__vector_grow_by_);
+    }
+};
@@ -0,0 +1,146 @@
+#include "builtin_worker.h"
+
+#include "builtin.h"
+#include "value_utils.h"
+#include "worker.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+namespace Katsu
+{
+    /*
+     * Channels and workers (see worker.h), by id. Messages are copied in and out of this VM's
+     * heap; nothing here holds onto any object.
+     */
+
+    Value worker__channel_create(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ channel-create
+        ASSERT(nargs == 1);
+        return Value::fixnum(channel_create());
+    }
+
+    Value worker__channel_send_(VM& vm, int64_t nargs, Value* args)
+    {
+        // channel channel-send: value
+        ASSERT(nargs == 2);
+        channel_send(args[0].fixnum(), encode_message(args[1]));
+        return Value::null();
+    }
+
+    Value worker__channel_try_receive_closed_(VM& vm, int64_t nargs, Value* args)
+    {
+        // channel channel-try-receive: if-empty closed: if-closed
+        // Returns the next message, or else whichever of the two markers applies.
+        ASSERT(nargs == 3);
+        std::string message;
+        switch (channel_try_receive(args[0].fixnum(), message)) {
+            case Receive::MESSAGE: return decode_message(vm.gc, message);
+            case Receive::EMPTY: return args[1];
+            case Receive::CLOSED: return args[2];
+        }
+        return Value::null();
+    }
+
+    Value worker__channel_receive_(VM& vm, int64_t nargs, Value* args)
+    {
+        // channel channel-receive: if-closed
+        // Blocks the whole thread (fibers and all) until there's a message.
+        ASSERT(nargs == 2);
+        std::string message;
+        if (!channel_receive(args[0].fixnum(), message)) {
+            return args[1];
+        }
+        return decode_message(vm.gc, message);
+    }
+
+    Value worker__channel_wait_fd(VM& vm, int64_t nargs, Value* args)
+    {
+        // channel channel-wait-fd
+        ASSERT(nargs == 1);
+        return Value::fixnum(channel_wait_fd(args[0].fixnum()));
+    }
+
+    Value worker__channel_close(VM& vm, int64_t nargs, Value* args)
+    {
+        // channel channel-close
+        ASSERT(nargs == 1);
+        channel_close(args[0].fixnum());
+        return Value::null();
+    }
+
+    Value worker__worker_spawn_module_channel_(VM& vm, int64_t nargs, Value* args)
+    {
+        // worker-spawn: path module: module-name channel: channel
+        ASSERT(nargs == 4);
+        return Value::fixnum(worker_spawn(native_str(args[1].obj_string()),
+                                          native_str(args[2].obj_string()),
+                                          args[3].fixnum()));
+    }
+
+    Value worker__worker_join(VM& vm, int64_t nargs, Value* args)
+    {
+        // worker worker-join
+        ASSERT(nargs == 1);
+        return Value::_bool(worker_join(args[0].fixnum()));
+    }
+
+    Value worker__worker_channel_id(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ worker-channel-id
+        ASSERT(nargs == 1);
+        int64_t channel = worker_channel();
+        return channel == 0 ? Value::null() : Value::fixnum(channel);
+    }
+
+    Value worker__hardware_thread_count(VM& vm, int64_t nargs, Value* args)
+    {
+        // _ hardware-thread-count
+        ASSERT(nargs == 1);
+        // (Which may be unknown, reported as 0.)
+        return Value::fixnum(std::max(1u, std::thread::hardware_concurrency()));
+    }
+
+    void register_worker_builtins(VM& vm, Root<Assoc>& r_worker)
+    {
+        const std::function<Value()> matches_any = []() { return Value::null(); };
+        const auto matches_type = [&vm](BuiltinId id) -> std::function<Value()> {
+            return [&vm, id]() { return vm.builtin(id); };
+        };
+        const auto _register = [&vm, &r_worker](const std::string& name,
+                                                const std::vector<std::function<Value()>>& matchers,
+                                                NativeHandler handler) -> void {
+            Root<Array> r_matchers(vm.gc, make_array(vm.gc, matchers.size()));
+            for (size_t i = 0; i < matchers.size(); i++) {
+                r_matchers->components()[i] = matchers[i]();
+            }
+            add_native(vm,
+                       true /* global */,
+                       r_worker,
+                       name,
+                       matchers.size(),
+                       r_matchers,
+                       handler);
+        };
+        const auto fixnum = matches_type(_Fixnum);
+        const auto string = matches_type(_String);
+
+        _register("channel-create", {matches_any}, &worker__channel_create);
+        _register("channel-send:", {fixnum, matches_any}, &worker__channel_send_);
+        _register("channel-try-receive:closed:",
+                  {fixnum, matches_any, matches_any},
+                  &worker__channel_try_receive_closed_);
+        _register("channel-receive:", {fixnum, matches_any}, &worker__channel_receive_);
+        _register("channel-wait-fd", {fixnum}, &worker__channel_wait_fd);
+        _register("channel-close", {fixnum}, &worker__channel_close);
+
+        _register("worker-spawn:module:channel:",
+                  {matches_any, string, string, fixnum},
+                  &worker__worker_spawn_module_channel_);
+        _register("worker-join", {fixnum}, &worker__worker_join);
+        _register("worker-channel-id", {matches_any}, &worker__worker_channel_id);
+        _register("hardware-thread-count", {matches_any}, &worker__hardware_thread_count);
+    }
+};
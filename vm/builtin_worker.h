@@ -0,0 +1,10 @@
+#pragma once
+
+#include "gc.h"
+#include "value.h"
+#include "vm.h"
+
+namespace Katsu
+{
+    void register_worker_builtins(VM& vm, Root<Assoc>& r_worker);
+};
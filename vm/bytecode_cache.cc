@@ -0,0 +1,773 @@
+#include "bytecode_cache.h"
+
+#include "assertions.h"
+#include "value_utils.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Katsu
+{
+    uint64_t source_hash(const std::string& contents)
+    {
+        uint64_t hash = 0xcbf29ce484222325;
+        for (char c : contents) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    std::string default_bytecode_cache_dir()
+    {
+        if (const char* dir = std::getenv("XDG_CACHE_HOME"); dir && *dir) {
+            return std::string(dir) + "/katsu";
+        }
+        if (const char* home = std::getenv("HOME"); home && *home) {
+            return std::string(home) + "/.cache/katsu";
+        }
+        return "";
+    }
+
+    void build_stamp(uint64_t* mtime, uint64_t* size)
+    {
+        struct stat exe;
+        if (stat("/proc/self/exe", &exe) != 0) {
+            *mtime = 0;
+            *size = 0;
+            return;
+        }
+        *mtime = exe.st_mtim.tv_sec * 1000000000ull + exe.st_mtim.tv_nsec;
+        *size = exe.st_size;
+    }
+
+    enum class RecordKind : uint8_t
+    {
+        // A top-level expression which is always compiled from source.
+        SOURCE,
+        // Definitions, names, and then the code of a top-level expression.
+        COMPILED,
+    };
+
+    enum class CachedValueKind : uint8_t
+    {
+        _NULL,
+        TRUE,
+        FALSE,
+        FIXNUM,
+        FLOAT,
+        // An object which appeared earlier in the same record (numbered in the order each one
+        // finished decoding).
+        BACKREF,
+        // An object from the record's table of names.
+        NAMED,
+        STRING,
+        BYTE_ARRAY,
+        ARRAY,
+        TUPLE,
+        // Code in the current module.
+        CODE,
+    };
+
+    static void put_u8(std::string& out, uint8_t value)
+    {
+        out.push_back(static_cast<char>(value));
+    }
+    static void put_u32(std::string& out, uint32_t value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    static void put_u64(std::string& out, uint64_t value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    static void put_bytes(std::string& out, const uint8_t* bytes, uint64_t length)
+    {
+        put_u64(out, length);
+        out.append(reinterpret_cast<const char*>(bytes), length);
+    }
+    static void put_str(std::string& out, const std::string& str)
+    {
+        put_bytes(out, reinterpret_cast<const uint8_t*>(str.data()), str.size());
+    }
+    static void put_span(std::string& out, const SourceSpan& span)
+    {
+        for (const SourceLocation& loc : {span.start, span.end}) {
+            put_u32(out, loc.index);
+            put_u32(out, loc.line);
+            put_u32(out, loc.column);
+        }
+    }
+
+    // Reads back what the put_*() functions wrote. The whole cache file is checked against a hash
+    // before any of it is read, so running off the end means the format itself is broken.
+    struct CacheReader
+    {
+        const std::string& data;
+        size_t& offset;
+
+        const char* take(uint64_t length)
+        {
+            ALWAYS_ASSERT_MSG(length <= this->data.size() - this->offset,
+                              "malformed bytecode cache");
+            const char* bytes = this->data.data() + this->offset;
+            this->offset += length;
+            return bytes;
+        }
+        uint8_t u8()
+        {
+            return static_cast<uint8_t>(*this->take(1));
+        }
+        uint32_t u32()
+        {
+            uint32_t value;
+            memcpy(&value, this->take(sizeof(value)), sizeof(value));
+            return value;
+        }
+        uint64_t u64()
+        {
+            uint64_t value;
+            memcpy(&value, this->take(sizeof(value)), sizeof(value));
+            return value;
+        }
+        std::string str()
+        {
+            uint64_t length = this->u64();
+            return std::string(this->take(length), length);
+        }
+        SourceSpan span(const SourceFile& file)
+        {
+            SourceSpan span{.file = file, .start = {}, .end = {}};
+            for (SourceLocation* loc : {&span.start, &span.end}) {
+                loc->index = this->u32();
+                loc->line = this->u32();
+                loc->column = this->u32();
+            }
+            return span;
+        }
+    };
+
+    static void put_definition(std::string& out, const CompileDefinition& definition)
+    {
+        put_u8(out, static_cast<uint8_t>(definition.kind));
+        put_str(out, definition.name);
+        put_span(out, definition.span);
+        put_span(out, definition.name_span);
+        put_u32(out, definition.num_params);
+        put_u8(out,
+               (definition.allow_existing ? 1 : 0) | (definition.global ? 2 : 0) |
+                   (definition.decl_only ? 4 : 0));
+        put_u32(out, definition.bases.size());
+        for (size_t i = 0; i < definition.bases.size(); i++) {
+            put_str(out, definition.bases[i]);
+            put_span(out, definition.base_spans[i]);
+        }
+        put_u32(out, definition.slots.size());
+        for (const std::string& slot : definition.slots) {
+            put_str(out, slot);
+        }
+    }
+    static CompileDefinition read_definition(CacheReader& in, const SourceFile& file)
+    {
+        CompileDefinition definition{.kind = static_cast<CompileDefinition::Kind>(in.u8())};
+        definition.name = in.str();
+        definition.span = in.span(file);
+        definition.name_span = in.span(file);
+        definition.num_params = in.u32();
+        uint8_t flags = in.u8();
+        definition.allow_existing = flags & 1;
+        definition.global = flags & 2;
+        definition.decl_only = flags & 4;
+        uint32_t num_bases = in.u32();
+        for (uint32_t i = 0; i < num_bases; i++) {
+            definition.bases.push_back(in.str());
+            definition.base_spans.push_back(in.span(file));
+        }
+        uint32_t num_slots = in.u32();
+        for (uint32_t i = 0; i < num_slots; i++) {
+            definition.slots.push_back(in.str());
+        }
+        return definition;
+    }
+
+    // Writes out the code of one top-level expression. Doesn't allocate, so the objects being
+    // written don't move.
+    struct CodeWriter
+    {
+        Assoc* module;
+        Vector* imports;
+        std::string out;
+        // Name for each object the code got by looking up a name (see CompileJournal).
+        std::unordered_map<Object*, std::string> lookups;
+        // (ObjectTag, name) for each object written by name.
+        std::vector<std::pair<ObjectTag, std::string>> names;
+        std::unordered_map<Object*, uint32_t> backref_indices;
+        std::unordered_set<Object*> in_progress;
+        uint32_t num_objects = 0;
+
+        // Note what each looked-up name refers to now, after compiling. (A name which referred to
+        // something else at the time -- say, a module variable shadowing an import it was defined
+        // in terms of -- leaves the earlier object nameless, so the code just isn't saved.)
+        void add_lookups(const std::vector<std::string>& names)
+        {
+            for (const std::string& name : names) {
+                Value result;
+                if (lookup_module_name(this->module, this->imports, name, &result) == SUCCESS &&
+                    result.is_object()) {
+                    this->lookups.emplace(result.object(), name);
+                }
+            }
+        }
+
+        void finish_object(Object* object)
+        {
+            this->in_progress.erase(object);
+            this->backref_indices.emplace(object, this->num_objects++);
+        }
+
+        // Returns false if the value can't be written.
+        bool write(Value value)
+        {
+            switch (value.tag()) {
+                case Tag::_NULL: put_u8(this->out, (uint8_t)CachedValueKind::_NULL); return true;
+                case Tag::BOOL:
+                    put_u8(this->out,
+                           (uint8_t)(value._bool() ? CachedValueKind::TRUE
+                                                   : CachedValueKind::FALSE));
+                    return true;
+                case Tag::FIXNUM:
+                    put_u8(this->out, (uint8_t)CachedValueKind::FIXNUM);
+                    put_u64(this->out, value.fixnum());
+                    return true;
+                case Tag::FLOAT: {
+                    float f = value._float();
+                    uint32_t bits;
+                    memcpy(&bits, &f, sizeof(bits));
+                    put_u8(this->out, (uint8_t)CachedValueKind::FLOAT);
+                    put_u32(this->out, bits);
+                    return true;
+                }
+                case Tag::OBJECT: return this->write_object(value.object());
+                default: return false;
+            }
+        }
+
+        bool write_object(Object* object)
+        {
+            auto backref = this->backref_indices.find(object);
+            if (backref != this->backref_indices.end()) {
+                put_u8(this->out, (uint8_t)CachedValueKind::BACKREF);
+                put_u32(this->out, backref->second);
+                return true;
+            }
+            if (this->in_progress.count(object)) {
+                // Cycles can't be written (and don't come up in compiled code).
+                return false;
+            }
+            this->in_progress.insert(object);
+
+            auto lookup = this->lookups.find(object);
+            if (lookup != this->lookups.end()) {
+                // (Later references to the object are backrefs, so each name is listed once.)
+                put_u8(this->out, (uint8_t)CachedValueKind::NAMED);
+                put_u32(this->out, this->names.size());
+                this->names.emplace_back(object->tag(), lookup->second);
+                this->finish_object(object);
+                return true;
+            }
+
+            switch (object->tag()) {
+                case ObjectTag::STRING: {
+                    String* s = static_cast<String*>(object);
+                    put_u8(this->out, (uint8_t)CachedValueKind::STRING);
+                    put_bytes(this->out, s->contents(), s->length);
+                    break;
+                }
+                case ObjectTag::BYTE_ARRAY: {
+                    ByteArray* b = static_cast<ByteArray*>(object);
+                    put_u8(this->out, (uint8_t)CachedValueKind::BYTE_ARRAY);
+                    put_bytes(this->out, b->contents(), b->length);
+                    break;
+                }
+                case ObjectTag::ARRAY: {
+                    Array* a = static_cast<Array*>(object);
+                    put_u8(this->out, (uint8_t)CachedValueKind::ARRAY);
+                    put_u64(this->out, a->length);
+                    for (uint64_t i = 0; i < a->length; i++) {
+                        if (!this->write(a->components()[i])) {
+                            return false;
+                        }
+                    }
+                    break;
+                }
+                case ObjectTag::TUPLE: {
+                    Tuple* t = static_cast<Tuple*>(object);
+                    put_u8(this->out, (uint8_t)CachedValueKind::TUPLE);
+                    put_u64(this->out, t->length);
+                    for (uint64_t i = 0; i < t->length; i++) {
+                        if (!this->write(t->components()[i])) {
+                            return false;
+                        }
+                    }
+                    break;
+                }
+                case ObjectTag::CODE: {
+                    Code* code = static_cast<Code*>(object);
+                    if (code->v_module != Value::object(this->module)) {
+                        return false;
+                    }
+                    put_u8(this->out, (uint8_t)CachedValueKind::CODE);
+                    put_u32(this->out, code->num_params);
+                    put_u32(this->out, code->num_regs);
+                    put_u32(this->out, code->num_data);
+                    for (Value component : {code->v_upreg_map,
+                                            code->v_insts,
+                                            code->v_args,
+                                            code->v_span,
+                                            code->v_inst_spans}) {
+                        if (!this->write(component)) {
+                            return false;
+                        }
+                    }
+                    break;
+                }
+                default: {
+                    // Anything else in compiled code comes from looking up a name.
+                    return false;
+                }
+            }
+            this->finish_object(object);
+            return true;
+        }
+    };
+
+    // Reads back the code of one top-level expression.
+    struct CodeReader
+    {
+        VM& vm;
+        CacheReader& in;
+        Root<Assoc>& r_module;
+        Root<Vector>& r_named;
+        // Each object decoded so far, for backrefs.
+        Root<Array> r_objects;
+        uint64_t num_objects;
+
+        CodeReader(VM& vm, CacheReader& in, Root<Assoc>& r_module, Root<Vector>& r_named,
+                   uint32_t num_objects)
+            : vm(vm)
+            , in(in)
+            , r_module(r_module)
+            , r_named(r_named)
+            , r_objects(vm.gc, make_array(vm.gc, num_objects))
+            , num_objects(0)
+        {}
+
+        Value finish_object(Value object)
+        {
+            ALWAYS_ASSERT_MSG(this->num_objects < this->r_objects->length,
+                              "malformed bytecode cache");
+            this->r_objects->components()[this->num_objects++] = object;
+            return object;
+        }
+
+        // Decode the next value (which may move any unrooted objects).
+        Value read()
+        {
+            GC& gc = this->vm.gc;
+            switch (static_cast<CachedValueKind>(this->in.u8())) {
+                case CachedValueKind::_NULL: return Value::null();
+                case CachedValueKind::TRUE: return Value::_bool(true);
+                case CachedValueKind::FALSE: return Value::_bool(false);
+                case CachedValueKind::FIXNUM: return Value::fixnum(this->in.u64());
+                case CachedValueKind::FLOAT: {
+                    uint32_t bits = this->in.u32();
+                    float f;
+                    memcpy(&f, &bits, sizeof(f));
+                    return Value::_float(f);
+                }
+                case CachedValueKind::BACKREF: {
+                    uint32_t index = this->in.u32();
+                    ALWAYS_ASSERT_MSG(index < this->num_objects, "malformed bytecode cache");
+                    return this->r_objects->components()[index];
+                }
+                case CachedValueKind::NAMED: {
+                    uint32_t index = this->in.u32();
+                    ALWAYS_ASSERT_MSG(index < this->r_named->length, "malformed bytecode cache");
+                    return this->finish_object(
+                        this->r_named->v_array.obj_array()->components()[index]);
+                }
+                case CachedValueKind::STRING: {
+                    uint64_t length = this->in.u64();
+                    const char* contents = this->in.take(length);
+                    String* str = make_string_nofill(gc, length);
+                    memcpy(str->contents(), contents, length);
+                    return this->finish_object(Value::object(str));
+                }
+                case CachedValueKind::BYTE_ARRAY: {
+                    uint64_t length = this->in.u64();
+                    const char* contents = this->in.take(length);
+                    ByteArray* b = make_byte_array_nofill(gc, length);
+                    memcpy(b->contents(), contents, length);
+                    return this->finish_object(Value::object(b));
+                }
+                case CachedValueKind::ARRAY: {
+                    Root<Array> r_array(gc, make_array(gc, this->in.u64()));
+                    for (uint64_t i = 0; i < r_array->length; i++) {
+                        Value component = this->read();
+                        r_array->components()[i] = component;
+                    }
+                    return this->finish_object(r_array.value());
+                }
+                case CachedValueKind::TUPLE: {
+                    Root<Tuple> r_tuple(gc, make_tuple(gc, this->in.u64()));
+                    for (uint64_t i = 0; i < r_tuple->length; i++) {
+                        Value component = this->read();
+                        r_tuple->components()[i] = component;
+                    }
+                    return this->finish_object(r_tuple.value());
+                }
+                case CachedValueKind::CODE: {
+                    uint32_t num_params = this->in.u32();
+                    uint32_t num_regs = this->in.u32();
+                    uint32_t num_data = this->in.u32();
+                    ValueRoot r_upreg_map_value(gc, this->read());
+                    ValueRoot r_insts_value(gc, this->read());
+                    ValueRoot r_args_value(gc, this->read());
+                    ValueRoot r_span_value(gc, this->read());
+                    ValueRoot r_inst_spans_value(gc, this->read());
+                    ALWAYS_ASSERT_MSG(
+                        (r_upreg_map_value->is_null() || r_upreg_map_value->is_obj_array()) &&
+                            r_insts_value->is_obj_byte_array() && r_args_value->is_obj_array() &&
+                            r_span_value->is_obj_tuple() && r_inst_spans_value->is_obj_array(),
+                        "malformed bytecode cache");
+                    OptionalRoot<Array> r_upreg_map(gc,
+                                                    r_upreg_map_value->is_null()
+                                                        ? nullptr
+                                                        : r_upreg_map_value->obj_array());
+                    Root<ByteArray> r_insts(gc, r_insts_value->obj_byte_array());
+                    Root<Array> r_args(gc, r_args_value->obj_array());
+                    Root<Tuple> r_span(gc, r_span_value->obj_tuple());
+                    Root<Array> r_inst_spans(gc, r_inst_spans_value->obj_array());
+                    Code* code = make_code(gc,
+                                           this->r_module,
+                                           num_params,
+                                           num_regs,
+                                           num_data,
+                                           r_upreg_map,
+                                           r_insts,
+                                           r_args,
+                                           r_span,
+                                           r_inst_spans);
+                    return this->finish_object(Value::object(code));
+                }
+                default: ALWAYS_ASSERT_MSG(false, "malformed bytecode cache");
+            }
+            return Value::null();
+        }
+    };
+
+    // A cache file starts with this header, which identifies exactly which source and executable
+    // it's for, and then the hash and contents of its records.
+    static std::string cache_header(const SourceFile& source)
+    {
+        uint64_t mtime, size;
+        build_stamp(&mtime, &size);
+        std::string header(BYTECODE_CACHE_MAGIC, sizeof(BYTECODE_CACHE_MAGIC));
+        put_u32(header, BYTECODE_CACHE_VERSION);
+        put_u64(header, mtime);
+        put_u64(header, size);
+        put_str(header, *source.path);
+        put_u64(header, source.source->size());
+        put_u64(header, source_hash(*source.source));
+        return header;
+    }
+
+    TopLevelCompiler::TopLevelCompiler(VM& vm, const SourceFile& source,
+                                       const std::string& cache_dir)
+        : vm(vm)
+        , source(source)
+        , cache_path()
+        , cached()
+        , cached_offset(0)
+        , using_cached(false)
+        , recorded()
+        , recording(false)
+        , dirty(false)
+        , lexer()
+        , stream()
+        , parser()
+        , num_parsed(0)
+        , num_done(0)
+    {
+        vm.source_paths.push_back(*source.path);
+        if (cache_dir.empty()) {
+            return;
+        }
+        std::error_code ec;
+        std::filesystem::path path = std::filesystem::absolute(*source.path, ec);
+        if (ec) {
+            return;
+        }
+        char key[17];
+        snprintf(key, sizeof(key), "%016llx", (unsigned long long)source_hash(path.string()));
+        this->cache_path = cache_dir + "/" + key + ".kbc";
+        this->recording = true;
+        this->dirty = true;
+
+        std::ifstream file(this->cache_path, std::ios::binary);
+        if (!file) {
+            return;
+        }
+        std::string contents((std::istreambuf_iterator<char>(file)),
+                             std::istreambuf_iterator<char>());
+        std::string header = cache_header(source);
+        if (contents.size() < header.size() + sizeof(uint64_t) ||
+            contents.compare(0, header.size(), header) != 0) {
+            return;
+        }
+        uint64_t body_hash;
+        memcpy(&body_hash, contents.data() + header.size(), sizeof(body_hash));
+        this->cached = contents.substr(header.size() + sizeof(body_hash));
+        if (source_hash(this->cached) != body_hash) {
+            this->cached.clear();
+            return;
+        }
+        this->using_cached = true;
+        this->dirty = false;
+    }
+
+    TopLevelCompiler::~TopLevelCompiler() = default;
+
+    void TopLevelCompiler::skip(size_t count)
+    {
+        ASSERT(this->num_done == 0);
+        this->using_cached = false;
+        this->recording = false;
+        this->num_done = count;
+    }
+
+    Code* TopLevelCompiler::next(Root<Assoc>& r_module, Root<Vector>& r_imports)
+    {
+        if (this->using_cached) {
+            if (this->cached_offset == this->cached.size()) {
+                return nullptr;
+            }
+            size_t record_start = this->cached_offset;
+            bool from_source;
+            Code* code = this->load_next(r_module, r_imports, &from_source);
+            if (code) {
+                this->recorded.append(
+                    this->cached, record_start, this->cached_offset - record_start);
+                this->num_done++;
+                return code;
+            }
+            if (!from_source) {
+                // The rest of the cache is no good.
+                this->using_cached = false;
+                this->dirty = true;
+            }
+        }
+
+        size_t recorded_size = this->recorded.size();
+        Code* code = this->compile_next(r_module, r_imports);
+        if (!code) {
+            if (this->recording && this->dirty) {
+                this->write_cache_file();
+            }
+            return nullptr;
+        }
+        if (this->using_cached &&
+            static_cast<RecordKind>(this->recorded[recorded_size]) != RecordKind::SOURCE) {
+            // It can be saved now, even though it couldn't before.
+            this->dirty = true;
+        }
+        return code;
+    }
+
+    Code* TopLevelCompiler::load_next(Root<Assoc>& r_module, Root<Vector>& r_imports,
+                                      bool* from_source)
+    {
+        GC& gc = this->vm.gc;
+        size_t offset = this->cached_offset;
+        CacheReader in{.data = this->cached, .offset = offset};
+
+        if (static_cast<RecordKind>(in.u8()) == RecordKind::SOURCE) {
+            this->cached_offset = offset;
+            *from_source = true;
+            return nullptr;
+        }
+        *from_source = false;
+
+        std::vector<CompileDefinition> definitions;
+        uint32_t num_definitions = in.u32();
+        for (uint32_t i = 0; i < num_definitions; i++) {
+            definitions.push_back(read_definition(in, this->source));
+        }
+        std::vector<std::pair<ObjectTag, std::string>> names;
+        uint32_t num_names = in.u32();
+        for (uint32_t i = 0; i < num_names; i++) {
+            ObjectTag tag = static_cast<ObjectTag>(in.u8());
+            names.emplace_back(tag, in.str());
+        }
+
+        // Check that each name still means the same kind of thing -- except for those about to be
+        // defined, which are checked once they are.
+        const auto resolves = [&r_module, &r_imports](const std::pair<ObjectTag, std::string>& name,
+                                                      Value* result) -> bool {
+            return lookup_module_name(*r_module, *r_imports, name.second, result) == SUCCESS &&
+                   result->is_object() && result->object()->tag() == name.first;
+        };
+        for (const auto& name : names) {
+            bool defined = false;
+            for (const CompileDefinition& definition : definitions) {
+                defined = defined || definition.name == name.second;
+            }
+            Value result;
+            if (!defined && !resolves(name, &result)) {
+                return nullptr;
+            }
+        }
+
+        // Definitions can raise compile errors, just as they would when compiling from source.
+        for (const CompileDefinition& definition : definitions) {
+            apply_definition(this->vm, r_module, r_imports, definition);
+        }
+
+        Root<Vector> r_named(gc, make_vector(gc, names.size()));
+        for (const auto& name : names) {
+            Value result;
+            // A definition which doesn't define what it did when compiling (which would take quite
+            // the coincidence) has already been made, so there's no falling back to compiling.
+            ALWAYS_ASSERT_MSG(resolves(name, &result),
+                              "bytecode cache definition no longer resolves: " + name.second);
+            ValueRoot r_result(gc, std::move(result));
+            append(gc, r_named, r_result);
+        }
+
+        uint32_t num_objects = in.u32();
+        CodeReader reader(this->vm, in, r_module, r_named, num_objects);
+        Value v_code = reader.read();
+        ALWAYS_ASSERT_MSG(v_code.is_obj_code(), "malformed bytecode cache");
+        this->cached_offset = offset;
+        return v_code.obj_code();
+    }
+
+    void TopLevelCompiler::skip_separators()
+    {
+        while (this->stream->current_has_type(TokenType::SEMICOLON) ||
+               this->stream->current_has_type(TokenType::NEWLINE)) {
+            this->stream->consume();
+        }
+    }
+
+    bool TopLevelCompiler::parse_up_to(size_t index)
+    {
+        if (!this->parser) {
+            this->lexer = std::make_unique<Lexer>(this->source);
+            this->stream = std::make_unique<TokenStream>(*this->lexer);
+            this->parser = make_default_parser();
+            // Skip any leading semicolons / newlines to get to the meat.
+            this->skip_separators();
+        }
+        while (this->num_parsed < index) {
+            if (this->stream->current_has_type(TokenType::END)) {
+                return false;
+            }
+            ExprArena arena;
+            this->parser->parse(*this->stream, arena, 0 /* precedence */, true /* is_toplevel */);
+            this->num_parsed++;
+            this->skip_separators();
+        }
+        return !this->stream->current_has_type(TokenType::END);
+    }
+
+    Code* TopLevelCompiler::compile_next(Root<Assoc>& r_module, Root<Vector>& r_imports)
+    {
+        if (!this->parse_up_to(this->num_done)) {
+            return nullptr;
+        }
+        // The expression is only needed until it's compiled -- which for method bodies compiled
+        // lazily, is once they're invoked.
+        auto arena = std::make_shared<ExprArena>();
+        std::vector<Expr*> top_level_exprs;
+        top_level_exprs.push_back(
+            this->parser->parse(*this->stream, *arena, 0 /* precedence */, true /* is_toplevel */));
+        this->num_parsed++;
+
+        // Code for the cache must be complete, and loading it will beat compiling lazily anyway.
+        bool lazy = this->vm.lazy_method_compilation && !this->recording;
+        CompileJournal journal;
+        Code* code = compile_into_module(this->vm,
+                                         r_module,
+                                         r_imports,
+                                         top_level_exprs[0]->span,
+                                         top_level_exprs,
+                                         this->recording ? &journal : nullptr,
+                                         lazy ? arena : nullptr);
+        this->num_done++;
+
+        if (this->recording) {
+            // Save the code as it was compiled, before running it fills in any inline caches.
+            CodeWriter writer{.module = *r_module, .imports = *r_imports};
+            writer.add_lookups(journal.lookups);
+            if (writer.write(Value::object(code))) {
+                put_u8(this->recorded, (uint8_t)RecordKind::COMPILED);
+                put_u32(this->recorded, journal.definitions.size());
+                for (const CompileDefinition& definition : journal.definitions) {
+                    put_definition(this->recorded, definition);
+                }
+                put_u32(this->recorded, writer.names.size());
+                for (const auto& [tag, name] : writer.names) {
+                    put_u8(this->recorded, (uint8_t)tag);
+                    put_str(this->recorded, name);
+                }
+                put_u32(this->recorded, writer.num_objects);
+                this->recorded.append(writer.out);
+            } else {
+                put_u8(this->recorded, (uint8_t)RecordKind::SOURCE);
+            }
+        }
+
+        // Ratchet past any semicolons and newlines, since the parser explicitly stops
+        // when it sees either of these at the top level.
+        this->skip_separators();
+        return code;
+    }
+
+    void TopLevelCompiler::write_cache_file()
+    {
+        std::string contents = cache_header(this->source);
+        put_u64(contents, source_hash(this->recorded));
+        contents.append(this->recorded);
+
+        // Write to a temporary file first, so that nothing ever reads a partially written one. (One
+        // per thread, as each worker's VM may be writing the same cache file at once.)
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(this->cache_path).parent_path(),
+                                            ec);
+        std::string tmp_path = this->cache_path + ".tmp" + std::to_string(gettid());
+        {
+            std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                return;
+            }
+            file.write(contents.data(), contents.size());
+            if (!file) {
+                file.close();
+                std::filesystem::remove(tmp_path, ec);
+                return;
+            }
+        }
+        std::filesystem::rename(tmp_path, this->cache_path, ec);
+        if (ec) {
+            std::filesystem::remove(tmp_path, ec);
+        }
+    }
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "compile.h"
+#include "gc.h"
+#include "lexer.h"
+#include "parser.h"
+#include "span.h"
+#include "value.h"
+#include "vm.h"
+
+#include <memory>
+#include <string>
+
+namespace Katsu
+{
+    // Bytecode cache files start with this, followed by a format version.
+    const char BYTECODE_CACHE_MAGIC[8] = {'K', 'A', 'T', 'S', 'U', 'B', 'C', '\0'};
+    const uint32_t BYTECODE_CACHE_VERSION = 1;
+
+    // FNV-1a hash, for telling whether a cached source file has changed.
+    uint64_t source_hash(const std::string& contents);
+
+    // Identify the running executable by its file's modification time and size, for telling
+    // whether anything it saved (which is only good for the exact same build) is stale.
+    void build_stamp(uint64_t* mtime, uint64_t* size);
+
+    // Directory to cache compiled bytecode in by default: $XDG_CACHE_HOME/katsu, or else
+    // $HOME/.cache/katsu, or else none (empty).
+    std::string default_bytecode_cache_dir();
+
+    // Compiles a source file into a module one top-level expression at a time, so that each can be
+    // run before the next is compiled (see run_source() and run-file:contents:imports:).
+    //
+    // Given a cache directory, the compiled code is also saved to a cache file for the source path,
+    // and loaded from it instead of lexing, parsing and compiling whenever the source is unchanged.
+    // Each top-level expression is saved as:
+    // - its compile-time definitions (see CompileDefinition), which are made again when loading;
+    // - and its code, where multimethods, types, module variables and so on are saved by the name
+    //   they were compiled from (and are looked up by that name again when loading), and other
+    //   objects are saved by value.
+    // If a saved name doesn't resolve the same way any more (say, the module imports something
+    // else this time), that expression and all those after it are compiled from source as usual.
+    // Code which refers to an object that can't be saved either way is not saved; loading compiles
+    // that one expression from source.
+    //
+    // The module and imports must be the same on each call to next(). Anything wrong with the
+    // cache (a missing, stale or malformed file, or an unwritable directory) just means compiling
+    // from source.
+    //
+    // If the VM's lazy_method_compilation is set, method bodies compiled from source are left to
+    // compile on first invocation (see LazyMethodBody) -- except those being saved to the cache,
+    // which must be compiled in full.
+    class TopLevelCompiler
+    {
+    public:
+        // An empty `cache_dir` means not to use the cache.
+        TopLevelCompiler(VM& vm, const SourceFile& source, const std::string& cache_dir);
+        ~TopLevelCompiler();
+
+        // Compile the next top-level expression into the module, or return nullptr (and write
+        // the cache file, if it needs updating) if there are none left.
+        Code* next(Root<Assoc>& r_module, Root<Vector>& r_imports);
+
+        // How many expressions have been compiled (or loaded) so far.
+        size_t position() const
+        {
+            return this->num_done;
+        }
+
+        // Carry on from the `count`th expression, when the ones before it were compiled (and run)
+        // some other time, such as before saving a heap image. Nothing must have been compiled
+        // yet. The rest is compiled from source, without the cache.
+        void skip(size_t count);
+
+    private:
+        // Load the next expression from the cache, or return nullptr if it must be compiled from
+        // source instead.
+        Code* load_next(Root<Assoc>& r_module, Root<Vector>& r_imports, bool* from_source);
+        // Compile the next expression from source, recording it for the cache if `recording`.
+        Code* compile_next(Root<Assoc>& r_module, Root<Vector>& r_imports);
+        // Parse up to just before the `index`th expression, or return false if there isn't one.
+        bool parse_up_to(size_t index);
+        void skip_separators();
+        void write_cache_file();
+
+        VM& vm;
+        SourceFile source;
+        // Empty if not using the cache.
+        std::string cache_path;
+
+        // Contents of a fresh cache file (past its header), if there is one.
+        std::string cached;
+        size_t cached_offset;
+        bool using_cached;
+
+        // Records to write to the cache file, and whether they differ from `cached`.
+        std::string recorded;
+        bool recording;
+        bool dirty;
+
+        // Created only once something needs to be compiled from source.
+        std::unique_ptr<Lexer> lexer;
+        std::unique_ptr<TokenStream> stream;
+        std::unique_ptr<PrattParser> parser;
+        // How many expressions the parser is past.
+        size_t num_parsed;
+
+        // How many expressions have been compiled (or loaded) so far.
+        size_t num_done;
+    };
+};
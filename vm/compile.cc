@@ -5,8 +5,10 @@
 #include "value_utils.h"
 #include "vm.h"
 
+#include <algorithm>
 #include <cstring>
 #include <map>
+#include <set>
 #include <vector>
 
 #include <iostream>
@@ -19,6 +21,10 @@ namespace Katsu
         std::string name;
         bool _mutable;
         uint32_t local_index;
+        // Whether the register holds a Ref to the value, rather than the value itself. Only a mut:
+        // binding which closures capture needs one, so that they share it. (Any other mut: binding
+        // is boxed only if a multi-shot continuation captures it; see INIT_REG.)
+        bool boxed = false;
     };
 
     struct CodeBuilder
@@ -37,7 +43,7 @@ namespace Katsu
         // Mapping from upreg index to local index, for initializing locals when invoking a closure
         // instance.
         OptionalRoot<Vector>& r_upreg_map;
-        // The OpCode instructions...
+        // The OpCode instructions (as fixnums, until packed into a ByteArray by finalize())...
         Root<Vector>& r_insts;
         // their arguments...
         Root<Vector>& r_args;
@@ -50,6 +56,18 @@ namespace Katsu
 
         std::map<std::string, Binding> bindings;
         CodeBuilder* base;
+        // If given, each name which the code refers to the module-level value of is appended to it
+        // (see CompileJournal).
+        std::vector<std::string>* lookups = nullptr;
+        // If given, method bodies are left to compile on first invocation, keeping this arena
+        // (which holds them) alive until then. See LazyMethodBody.
+        std::shared_ptr<ExprArena> lazy_arena = nullptr;
+        // How many of the module's entries the code may refer to: all of them, unless this is a
+        // lazily compiled method body, which sees just those there were at its definition.
+        uint64_t module_length = UINT64_MAX;
+        // The names which closures within the code refer to (see collect_captured_names()), so
+        // which mut: bindings need boxing.
+        std::set<std::string> captured_names = {};
 
         uint32_t stack_height;
         void bump_stack(int64_t delta)
@@ -62,13 +80,20 @@ namespace Katsu
             }
         }
 
+        // Emit an instruction whose operand is the offset of its (following) arguments.
         void emit_op(GC& gc, OpCode op, int64_t stack_height_delta, SourceSpan& span)
+        {
+            this->emit_op_with_immediate(gc, op, this->r_args->length, stack_height_delta, span);
+        }
+        // Emit an instruction whose operand is an immediate value (and which has no arguments).
+        void emit_op_with_immediate(GC& gc, OpCode op, uint64_t immediate,
+                                    int64_t stack_height_delta, SourceSpan& span)
         {
             // Instruction encoding:
-            // <3 bytes arg-offset> <1 byte opcode>
+            // <3 bytes operand> <1 byte opcode>
             ASSERT((op & ~0xFF) == 0);
-            ASSERT((this->r_args->length & ~0xFFFFFF) == 0);
-            uint32_t inst = (this->r_args->length << 8) | op;
+            ASSERT(immediate <= MAX_INST_OPERAND);
+            uint32_t inst = encode_inst(op, immediate);
             this->bump_stack(stack_height_delta);
             ValueRoot r_op(gc, Value::fixnum(inst));
             append(gc, this->r_insts, r_op);
@@ -86,6 +111,24 @@ namespace Katsu
             ValueRoot r_arg(gc, std::move(arg));
             append(gc, this->r_args, r_arg);
         }
+        // Emit an empty inline cache, as the last argument of an INVOKE / INVOKE_TAIL.
+        void emit_inline_cache(GC& gc, uint32_t num_args)
+        {
+            this->emit_arg(gc, Value::object(make_array(gc, inline_cache_length(num_args))));
+        }
+
+        void note_lookup(const std::string& name)
+        {
+            if (this->lookups) {
+                this->lookups->push_back(name);
+            }
+        }
+        void note_lookup(String* name)
+        {
+            if (this->lookups) {
+                this->lookups->push_back(native_str(name));
+            }
+        }
 
         Binding* lookup(const std::string& name, size_t* depth)
         {
@@ -127,8 +170,21 @@ namespace Katsu
 
         Tuple* convert_span(GC& gc, SourceSpan& span)
         {
-            // TODO: should intern strings. This is hugely inefficient.
-            Root<String> r_source(gc, make_string(gc, *span.file.path));
+            // TODO: should intern strings. For now, at least share the file path with the previous
+            // instruction's span when possible, since it's nearly always the same.
+            String* source = nullptr;
+            if (this->r_inst_spans->length > 0) {
+                Value v_last = this->r_inst_spans->v_array.obj_array()
+                                   ->components()[this->r_inst_spans->length - 1];
+                String* last_source = v_last.obj_tuple()->components()[0].obj_string();
+                if (string_eq(last_source, *span.file.path)) {
+                    source = last_source;
+                }
+            }
+            if (!source) {
+                source = make_string(gc, *span.file.path);
+            }
+            Root<String> r_source(gc, std::move(source));
             Tuple* tuple = make_tuple(gc, 7);
             tuple->components()[0] = r_source.value();
             tuple->components()[1] = Value::fixnum(span.start.index);
@@ -140,8 +196,109 @@ namespace Katsu
             return tuple;
         }
 
+        // Peephole pass over the emitted instructions, fusing common pairs into superinstructions
+        // and removing values which are pushed only to be dropped right away. Bytecode has no
+        // jumps, so instructions can be merged or removed freely as long as each remaining
+        // instruction keeps a span; a fused instruction takes the span of the part which can fail
+        // or call out (so stack traces still point at the right source). Doesn't allocate on the
+        // GC heap.
+        void peephole_optimize()
+        {
+            Array* insts = this->r_insts->v_array.obj_array();
+            Array* spans = this->r_inst_spans->v_array.obj_array();
+            auto inst_at = [insts](uint64_t i) -> uint32_t {
+                return insts->components()[i].fixnum();
+            };
+            auto is_pure_push = [](OpCode op) -> bool {
+                return op == OpCode::LOAD_REG || op == OpCode::LOAD_REF ||
+                       op == OpCode::LOAD_VALUE || op == OpCode::LOAD_MODULE;
+            };
+            // Registers of unboxed mut: bindings are left unfused, so that each of their loads and
+            // stores can be swapped for its Ref counterpart (see VM::box_mut_bindings()).
+            std::vector<bool> mut_regs(this->num_regs, false);
+            for (uint64_t i = 0; i < this->r_insts->length; i++) {
+                uint32_t inst = inst_at(i);
+                if (inst_opcode(inst) == OpCode::INIT_REG) {
+                    mut_regs[inst_operand(inst)] = true;
+                }
+            }
+
+            // (None of these patterns separate a FIXNUM_* guard from the INVOKE it must precede.)
+            // Instructions are compacted in place; [0, out) is the optimized prefix. Matching
+            // against the last _output_ instruction lets fusions cascade, e.g. STORE_REG @x;
+            // LOAD_REG @x; DROP becomes just STORE_REG @x.
+            uint64_t out = 0;
+            for (uint64_t i = 0; i < this->r_insts->length; i++) {
+                uint32_t inst = inst_at(i);
+                OpCode op = inst_opcode(inst);
+                uint32_t operand = inst_operand(inst);
+                Value v_span = spans->components()[i];
+
+                if (out > 0) {
+                    uint32_t prev = inst_at(out - 1);
+                    OpCode prev_op = inst_opcode(prev);
+                    uint32_t prev_operand = inst_operand(prev);
+                    uint32_t fused = 0;
+                    bool keep_prev_span = false;
+                    bool matched = true;
+
+                    if (op == OpCode::DROP && is_pure_push(prev_op)) {
+                        // <push>; DROP -> nothing
+                        out--;
+                        continue;
+                    } else if (op == OpCode::DROP && prev_op == OpCode::STORE_REG_KEEP) {
+                        // STORE_REG_KEEP @x; DROP -> STORE_REG @x
+                        fused = encode_inst(OpCode::STORE_REG, prev_operand);
+                        keep_prev_span = true;
+                    } else if (op == OpCode::LOAD_REG && prev_op == OpCode::STORE_REG &&
+                               operand == prev_operand && !mut_regs[operand]) {
+                        // STORE_REG @x; LOAD_REG @x -> STORE_REG_KEEP @x
+                        fused = encode_inst(OpCode::STORE_REG_KEEP, operand);
+                        keep_prev_span = true;
+                    } else if (op == OpCode::GET_SLOT && prev_op == OpCode::LOAD_REG &&
+                               prev_operand <= MAX_FUSED_REG && operand <= MAX_FUSED_SLOT &&
+                               !mut_regs[prev_operand]) {
+                        // LOAD_REG @x; GET_SLOT $y -> LOAD_REG_GET_SLOT @x $y
+                        fused = encode_inst(OpCode::LOAD_REG_GET_SLOT,
+                                            encode_reg_and_slot(prev_operand, operand));
+                    } else if ((op == OpCode::INVOKE || op == OpCode::INVOKE_TAIL) &&
+                               prev_op == OpCode::LOAD_VALUE && operand == prev_operand + 1) {
+                        // LOAD_VALUE <value>; INVOKE ... -> LOAD_VALUE_INVOKE <value> ...
+                        // (only when the INVOKE's arguments directly follow the value)
+                        fused = encode_inst(op == OpCode::INVOKE ? OpCode::LOAD_VALUE_INVOKE
+                                                                 : OpCode::LOAD_VALUE_INVOKE_TAIL,
+                                            prev_operand);
+                    } else {
+                        matched = false;
+                    }
+
+                    if (matched) {
+                        insts->components()[out - 1] = Value::fixnum(fused);
+                        if (!keep_prev_span) {
+                            spans->components()[out - 1] = v_span;
+                        }
+                        continue;
+                    }
+                }
+
+                insts->components()[out] = Value::fixnum(inst);
+                spans->components()[out] = v_span;
+                out++;
+            }
+
+            // Don't keep the leftovers alive.
+            for (uint64_t i = out; i < this->r_insts->length; i++) {
+                insts->components()[i] = Value::null();
+                spans->components()[i] = Value::null();
+            }
+            this->r_insts->length = out;
+            this->r_inst_spans->length = out;
+        }
+
         Code* finalize(GC& gc, SourceSpan& code_span)
         {
+            this->peephole_optimize();
+
             Array* maybe_upreg_map;
             if (r_upreg_map) {
                 Vector* upreg_map_vec = *this->r_upreg_map;
@@ -152,7 +309,12 @@ namespace Katsu
             }
             OptionalRoot<Array> r_upreg_map_arr(gc, std::move(maybe_upreg_map));
 
-            Root<Array> r_insts_arr(gc, vector_to_array(gc, this->r_insts));
+            Root<ByteArray> r_insts_arr(
+                gc, make_byte_array_nofill(gc, this->r_insts->length * INST_SIZE));
+            Array* insts_vec = this->r_insts->v_array.obj_array();
+            for (uint64_t i = 0; i < this->r_insts->length; i++) {
+                write_inst(*r_insts_arr, i, insts_vec->components()[i].fixnum());
+            }
             Root<Array> r_args_arr(gc, vector_to_array(gc, this->r_args));
 
             Root<Tuple> r_span(gc, convert_span(gc, code_span));
@@ -171,17 +333,21 @@ namespace Katsu
         }
     };
 
-    enum LookupResult
-    {
-        SUCCESS,
-        NOT_FOUND,
-        AMBIGUOUS,
-    };
     // The out-var `result` is only populated on SUCCESS, and can be nullptr if the actual looked-up
-    // Value is not needed.
-    LookupResult lookup_name(Assoc* module, Vector* imports, String* name, Value* result = nullptr)
+    // Value is not needed. `Name` is String* or std::string (see assoc_lookup()). Only the first
+    // `module_length` entries of the module are considered.
+    template <typename Name>
+    LookupResult lookup_name(Assoc* module, Vector* imports, const Name& name,
+                             Value* result = nullptr, uint64_t module_length = UINT64_MAX)
     {
         Value* lookup = assoc_lookup(module, name);
+        if (lookup && module_length < module->length) {
+            // Entries are only ever appended, so an entry's index tells whether it was there yet.
+            Assoc::Entry* entry = reinterpret_cast<Assoc::Entry*>(lookup - 1);
+            if ((uint64_t)(entry - module->entries()) >= module_length) {
+                lookup = nullptr;
+            }
+        }
         for (Value import : imports) {
             // Silently ignore non-Assoc imports.
             if (!import.is_obj_assoc()) {
@@ -212,15 +378,20 @@ namespace Katsu
             return NOT_FOUND;
         }
     }
-    LookupResult lookup_name(CodeBuilder& builder, String* name, Value* result = nullptr)
+    template <typename Name>
+    LookupResult lookup_name(CodeBuilder& builder, const Name& name, Value* result = nullptr)
     {
-        return lookup_name(*builder.r_module, *builder.r_imports, name, result);
+        builder.note_lookup(name);
+        return lookup_name(
+            *builder.r_module, *builder.r_imports, name, result, builder.module_length);
     }
     // Variants which just throw an appropriate compile_error and return the result value.
-    Value lookup_name(Assoc* module, Vector* imports, String* name, const SourceSpan& span)
+    template <typename Name>
+    Value lookup_name(Assoc* module, Vector* imports, const Name& name, const SourceSpan& span,
+                      uint64_t module_length = UINT64_MAX)
     {
         Value lookup;
-        LookupResult result = lookup_name(module, imports, name, &lookup);
+        LookupResult result = lookup_name(module, imports, name, &lookup, module_length);
         switch (result) {
             case SUCCESS: return lookup;
             case NOT_FOUND:
@@ -230,23 +401,31 @@ namespace Katsu
                                     span);
         }
     }
-    Value lookup_name(CodeBuilder& builder, String* name, const SourceSpan& span)
+    template <typename Name>
+    Value lookup_name(CodeBuilder& builder, const Name& name, const SourceSpan& span)
+    {
+        builder.note_lookup(name);
+        return lookup_name(
+            *builder.r_module, *builder.r_imports, name, span, builder.module_length);
+    }
+
+    LookupResult lookup_module_name(Assoc* module, Vector* imports, const std::string& name,
+                                    Value* result)
     {
-        return lookup_name(*builder.r_module, *builder.r_imports, name, span);
+        return lookup_name(module, imports, name, result);
     }
 
     // Ensures that a name is either a local or in module scope, but is not a positive-depth upvar.
     // If local/upvar, returns the new binding; else returns nullptr.
     const Binding* raise_upvar(GC& gc, CodeBuilder& builder, const std::string& name)
     {
-        Root<String> r_name(gc, make_string(gc, name));
         size_t var_depth;
-        const Binding* local_or_upvar = builder.lookup(*r_name, &var_depth);
+        const Binding* local_or_upvar = builder.lookup(name, &var_depth);
         Value lookup;
         if (local_or_upvar) {
             if (var_depth > 1) {
                 raise_upvar(gc, *builder.base, name);
-                local_or_upvar = builder.lookup(*r_name, &var_depth);
+                local_or_upvar = builder.lookup(name, &var_depth);
                 ASSERT(var_depth == 1);
             }
 
@@ -269,6 +448,7 @@ namespace Katsu
                                              .name = name,
                                              ._mutable = upvar->_mutable,
                                              .local_index = builder.num_regs++,
+                                             .boxed = upvar->boxed,
                                          });
                 const Binding* local = &builder.bindings[name];
 
@@ -286,22 +466,89 @@ namespace Katsu
         }
     }
 
+    // Look up the guarded fast-path opcode for a binary operator, if it has one.
+    bool fixnum_fast_path_op(const std::string& op_name, OpCode* op)
+    {
+        static const std::map<std::string, OpCode> fast_path_ops = {
+            {"+:", OpCode::FIXNUM_ADD},
+            {"-:", OpCode::FIXNUM_SUB},
+            {"*:", OpCode::FIXNUM_MUL},
+            {"<:", OpCode::FIXNUM_LT},
+            {"<=:", OpCode::FIXNUM_LTE},
+            {">:", OpCode::FIXNUM_GT},
+            {">=:", OpCode::FIXNUM_GTE},
+            {"=:", OpCode::FIXNUM_EQ},
+            {"!=:", OpCode::FIXNUM_NE},
+        };
+        auto it = fast_path_ops.find(op_name);
+        if (it == fast_path_ops.end()) {
+            return false;
+        }
+        *op = it->second;
+        return true;
+    }
+
+    // Collect the names which closures (blocks) within an expression refer to: either reading them
+    // or, as with `x: value`, assigning to them. A local is only captured by a closure which names
+    // it, so any mut: binding not named here can't escape its code. (This overapproximates, by
+    // ignoring scoping, which is fine for that purpose.)
+    void collect_captured_names(Expr& _expr, bool in_block, std::set<std::string>& names)
+    {
+        if (UnaryOpExpr* expr = dynamic_cast<UnaryOpExpr*>(&_expr)) {
+            collect_captured_names(*expr->arg, in_block, names);
+        } else if (BinaryOpExpr* expr = dynamic_cast<BinaryOpExpr*>(&_expr)) {
+            collect_captured_names(*expr->left, in_block, names);
+            collect_captured_names(*expr->right, in_block, names);
+        } else if (NameExpr* expr = dynamic_cast<NameExpr*>(&_expr)) {
+            if (in_block) {
+                names.emplace(std::get<std::string_view>(expr->name.value));
+            }
+        } else if (UnaryMessageExpr* expr = dynamic_cast<UnaryMessageExpr*>(&_expr)) {
+            collect_captured_names(*expr->target, in_block, names);
+        } else if (NAryMessageExpr* expr = dynamic_cast<NAryMessageExpr*>(&_expr)) {
+            if (in_block && expr->messages.size() == 1 && !expr->target) {
+                names.emplace(std::get<std::string_view>(expr->messages[0].value));
+            }
+            if (expr->target) {
+                collect_captured_names(**expr->target, in_block, names);
+            }
+            for (Expr* arg : expr->args) {
+                collect_captured_names(*arg, in_block, names);
+            }
+        } else if (ParenExpr* expr = dynamic_cast<ParenExpr*>(&_expr)) {
+            collect_captured_names(*expr->inner, in_block, names);
+        } else if (BlockExpr* expr = dynamic_cast<BlockExpr*>(&_expr)) {
+            collect_captured_names(*expr->body, /* in_block */ true, names);
+        } else if (DataExpr* expr = dynamic_cast<DataExpr*>(&_expr)) {
+            for (Expr* component : expr->components) {
+                collect_captured_names(*component, in_block, names);
+            }
+        } else if (SequenceExpr* expr = dynamic_cast<SequenceExpr*>(&_expr)) {
+            for (Expr* component : expr->components) {
+                collect_captured_names(*component, in_block, names);
+            }
+        } else if (TupleExpr* expr = dynamic_cast<TupleExpr*>(&_expr)) {
+            for (Expr* component : expr->components) {
+                collect_captured_names(*component, in_block, names);
+            }
+        }
+    }
+
     void compile_expr(GC& gc, CodeBuilder& builder, Expr& _expr, bool tail_position, bool tail_call)
     {
         OpCode invoke_op = tail_call ? OpCode::INVOKE_TAIL : OpCode::INVOKE;
         if (UnaryOpExpr* expr = dynamic_cast<UnaryOpExpr*>(&_expr)) {
-            const std::string& op_name = std::get<std::string>(expr->op.value);
-            Root<String> r_name(gc, make_string(gc, op_name));
-            ValueRoot r_existing(gc, lookup_name(builder, *r_name, expr->op.span));
+            std::string op_name(std::get<std::string_view>(expr->op.value));
+            ValueRoot r_existing(gc, lookup_name(builder, op_name, expr->op.span));
             compile_expr(gc, builder, *expr->arg, /* tail_position */ false, /* tail_call */ false);
-            // INVOKE: <multimethod>, <num args>
+            // INVOKE: <multimethod>, <num args>, <inline cache>
             builder.emit_op(gc, invoke_op, /* stack_height_delta */ -1 + 1, _expr.span);
             builder.emit_arg(gc, *r_existing);
             builder.emit_arg(gc, Value::fixnum(1));
+            builder.emit_inline_cache(gc, 1);
         } else if (BinaryOpExpr* expr = dynamic_cast<BinaryOpExpr*>(&_expr)) {
-            const std::string& op_name = std::get<std::string>(expr->op.value) + ":";
-            Root<String> r_name(gc, make_string(gc, op_name));
-            ValueRoot r_existing(gc, lookup_name(builder, *r_name, expr->op.span));
+            std::string op_name = std::string(std::get<std::string_view>(expr->op.value)) + ":";
+            ValueRoot r_existing(gc, lookup_name(builder, op_name, expr->op.span));
             compile_expr(gc,
                          builder,
                          *expr->left,
@@ -312,38 +559,55 @@ namespace Katsu
                          *expr->right,
                          /* tail_position */ false,
                          /* tail_call */ false);
-            // INVOKE: <multimethod>, <num args>
+            OpCode fast_path_op;
+            if (fixnum_fast_path_op(op_name, &fast_path_op)) {
+                // FIXNUM_*: <fast-path state>
+                // (Must be directly followed by the INVOKE.)
+                builder.emit_op(gc, fast_path_op, /* stack_height_delta */ 0, _expr.span);
+                builder.emit_arg(gc, Value::null());
+            }
+            // INVOKE: <multimethod>, <num args>, <inline cache>
             builder.emit_op(gc, invoke_op, /* stack_height_delta */ -2 + 1, _expr.span);
             builder.emit_arg(gc, *r_existing);
             builder.emit_arg(gc, Value::fixnum(2));
+            builder.emit_inline_cache(gc, 2);
         } else if (NameExpr* expr = dynamic_cast<NameExpr*>(&_expr)) {
-            const std::string& name = std::get<std::string>(expr->name.value);
-            Root<String> r_name(gc, make_string(gc, name));
+            std::string name(std::get<std::string_view>(expr->name.value));
             const Binding* local = raise_upvar(gc, builder, name);
             Value lookup;
             if (local) {
-                if (local->_mutable) {
+                if (local->boxed) {
                     // LOAD_REF: <local index>
-                    builder.emit_op(gc, OpCode::LOAD_REF, /* stack_height_delta */ +1, _expr.span);
-                    builder.emit_arg(gc, Value::fixnum(local->local_index));
+                    builder.emit_op_with_immediate(gc,
+                                                   OpCode::LOAD_REF,
+                                                   /* immediate */ local->local_index,
+                                                   /* stack_height_delta */ +1,
+                                                   _expr.span);
                 } else {
                     // LOAD_REG: <local index>
-                    builder.emit_op(gc, OpCode::LOAD_REG, /* stack_height_delta */ +1, _expr.span);
-                    builder.emit_arg(gc, Value::fixnum(local->local_index));
+                    builder.emit_op_with_immediate(gc,
+                                                   OpCode::LOAD_REG,
+                                                   /* immediate */ local->local_index,
+                                                   /* stack_height_delta */ +1,
+                                                   _expr.span);
                 }
-            } else if (lookup_name(builder, *r_name, &lookup) == SUCCESS) {
+            } else if (lookup_name(builder, name, &lookup) == SUCCESS) {
                 ValueRoot r_lookup(gc, std::move(lookup));
                 if (r_lookup->is_obj_multimethod()) {
                     Value v_name = r_lookup->obj_multimethod()->v_name;
                     ValueRoot r_name(gc, std::move(v_name));
                     // Load the default receiver, which is always register 0.
                     // LOAD_REG: <local index>
-                    builder.emit_op(gc, OpCode::LOAD_REG, /* stack_height_delta */ +1, _expr.span);
-                    builder.emit_arg(gc, Value::fixnum(0));
-                    // INVOKE: <multimethod>, <num args>
+                    builder.emit_op_with_immediate(gc,
+                                                   OpCode::LOAD_REG,
+                                                   /* immediate */ 0,
+                                                   /* stack_height_delta */ +1,
+                                                   _expr.span);
+                    // INVOKE: <multimethod>, <num args>, <inline cache>
                     builder.emit_op(gc, invoke_op, /* stack_height_delta */ -1 + 1, _expr.span);
                     builder.emit_arg(gc, *r_lookup);
                     builder.emit_arg(gc, Value::fixnum(1));
+                    builder.emit_inline_cache(gc, 1);
                 } else if (r_lookup->is_obj_ref()) {
                     // LOAD_MODULE: <ref value>
                     builder.emit_op(gc,
@@ -380,9 +644,9 @@ namespace Katsu
                                     OpCode::LOAD_VALUE,
                                     /* stack_height_delta */ +1,
                                     _expr.span);
-                    builder.emit_arg(
-                        gc,
-                        Value::object(make_string(gc, std::get<std::string>(expr->literal.value))));
+                    builder.emit_arg(gc,
+                                     Value::object(make_string(
+                                         gc, std::get<std::string_view>(expr->literal.value))));
                     break;
                 }
                 case TokenType::SYMBOL: {
@@ -396,40 +660,24 @@ namespace Katsu
                 }
             }
         } else if (UnaryMessageExpr* expr = dynamic_cast<UnaryMessageExpr*>(&_expr)) {
-            const std::string& name = std::get<std::string>(expr->message.value);
-            Root<String> r_name(gc, make_string(gc, name));
-            ValueRoot r_existing(gc, lookup_name(builder, *r_name, expr->message.span));
+            std::string name(std::get<std::string_view>(expr->message.value));
+            ValueRoot r_existing(gc, lookup_name(builder, name, expr->message.span));
             compile_expr(gc,
                          builder,
                          *expr->target,
                          /* tail_position */ false,
                          /* tail_call */ false);
-            // INVOKE: <multimethod>, <num args>
+            // INVOKE: <multimethod>, <num args>, <inline cache>
             builder.emit_op(gc, invoke_op, /* stack_height_delta */ -1 + 1, _expr.span);
             builder.emit_arg(gc, r_existing);
             builder.emit_arg(gc, Value::fixnum(1));
+            builder.emit_inline_cache(gc, 1);
         } else if (NAryMessageExpr* expr = dynamic_cast<NAryMessageExpr*>(&_expr)) {
-            String* combined_name;
-            {
-                size_t total_len = 0;
-                for (const Token& token_part : expr->messages) {
-                    const std::string& part = std::get<std::string>(token_part.value);
-                    total_len += part.size() + 1 /* for `:` */;
-                }
-                combined_name = gc.alloc<String>(total_len);
-                combined_name->length = total_len;
-                size_t offset = 0;
-                for (const Token& token_part : expr->messages) {
-                    const std::string& part = std::get<std::string>(token_part.value);
-                    const size_t len = part.size();
-                    memcpy(combined_name->contents() + offset, part.c_str(), len);
-                    offset += len;
-                    combined_name->contents()[offset++] = ':';
-                }
+            std::string combined_name;
+            for (const Token& token_part : expr->messages) {
+                combined_name += std::get<std::string_view>(token_part.value);
+                combined_name += ':';
             }
-            // Establish a root in case the recursive `compile_expr` calls perform any more
-            // allocations.
-            Root<String> r_name(gc, std::move(combined_name));
 
             // Ensure the message is:
             // * `<name>:` where <name> is a local mutable variable (in which case expr.target
@@ -437,7 +685,7 @@ namespace Katsu
             // * or else in the module under construction.
             if (expr->messages.size() == 1 && !expr->target) {
                 // Check for local mutable variables.
-                const std::string& name = std::get<std::string>(expr->messages[0].value);
+                std::string name(std::get<std::string_view>(expr->messages[0].value));
                 const Binding* maybe_local = raise_upvar(gc, builder, name);
                 if (maybe_local) {
                     const Binding& local = *maybe_local;
@@ -448,11 +696,13 @@ namespace Katsu
                                      /* tail_position */ false,
                                      /* tail_call */ false);
                         // STORE_REF: <local index>
-                        builder.emit_op(gc,
-                                        OpCode::STORE_REF,
-                                        /* stack_height_delta */ -1,
-                                        _expr.span);
-                        builder.emit_arg(gc, Value::fixnum(local.local_index));
+                        // STORE_REG: <local index>
+                        builder.emit_op_with_immediate(gc,
+                                                       local.boxed ? OpCode::STORE_REF
+                                                                   : OpCode::STORE_REG,
+                                                       /* immediate */ local.local_index,
+                                                       /* stack_height_delta */ -1,
+                                                       _expr.span);
                         // LOAD_VALUE: null
                         builder.emit_op(gc,
                                         OpCode::LOAD_VALUE,
@@ -468,18 +718,17 @@ namespace Katsu
             }
             // TODO: handle this as a builtin within the module.
             if (expr->messages.size() == 1 &&
-                (std::get<std::string>(expr->messages[0].value) == "let" ||
-                 std::get<std::string>(expr->messages[0].value) == "mut")) {
-                bool _mutable = std::get<std::string>(expr->messages[0].value) == "mut";
+                (std::get<std::string_view>(expr->messages[0].value) == "let" ||
+                 std::get<std::string_view>(expr->messages[0].value) == "mut")) {
+                bool _mutable = std::get<std::string_view>(expr->messages[0].value) == "mut";
                 if (expr->target) {
                     throw compile_error("let: / mut: require no target", expr->span);
                 }
-                if (BinaryOpExpr* b = dynamic_cast<BinaryOpExpr*>(expr->args[0].get())) {
-                    if (std::get<std::string>(b->op.value) == "=") {
-                        if (NameExpr* n = dynamic_cast<NameExpr*>(b->left.get())) {
-                            const std::string& name = std::get<std::string>(n->name.value);
-                            Root<String> r_name(gc, make_string(gc, name));
-                            if (_mutable && builder.lookup(*r_name, nullptr)) {
+                if (BinaryOpExpr* b = dynamic_cast<BinaryOpExpr*>(expr->args[0])) {
+                    if (std::get<std::string_view>(b->op.value) == "=") {
+                        if (NameExpr* n = dynamic_cast<NameExpr*>(b->left)) {
+                            std::string name(std::get<std::string_view>(n->name.value));
+                            if (_mutable && builder.lookup(name, nullptr)) {
                                 // TODO: maybe just allow?
                                 throw compile_error(
                                     "cannot shadow mut: binding with another mut: binding",
@@ -493,27 +742,34 @@ namespace Katsu
                                          /* tail_call */ false);
                             // Then add the binding.
                             uint32_t local_index = builder.num_regs++;
+                            // A mut: binding which no closure captures can live in its register
+                            // like any other, rather than behind a Ref, until a multi-shot
+                            // continuation captures it.
+                            bool boxed = _mutable && builder.captured_names.count(name) > 0;
                             builder.bindings[name] = Binding{
                                 .name = name,
                                 ._mutable = _mutable,
                                 .local_index = local_index,
+                                .boxed = boxed,
                             };
                             // Store the value (generated by the RHS generated code) into the newly
                             // allocated register.
-                            if (_mutable) {
+                            if (boxed) {
                                 // INIT_REF: <local index>
-                                builder.emit_op(gc,
-                                                OpCode::INIT_REF,
-                                                /* stack_height_delta */ -1,
-                                                _expr.span);
-                                builder.emit_arg(gc, Value::fixnum(local_index));
+                                builder.emit_op_with_immediate(gc,
+                                                               OpCode::INIT_REF,
+                                                               /* immediate */ local_index,
+                                                               /* stack_height_delta */ -1,
+                                                               _expr.span);
                             } else {
+                                // INIT_REG: <local index>
                                 // STORE_REG: <local index>
-                                builder.emit_op(gc,
-                                                OpCode::STORE_REG,
-                                                /* stack_height_delta */ -1,
-                                                _expr.span);
-                                builder.emit_arg(gc, Value::fixnum(local_index));
+                                builder.emit_op_with_immediate(
+                                    gc,
+                                    _mutable ? OpCode::INIT_REG : OpCode::STORE_REG,
+                                    /* immediate */ local_index,
+                                    /* stack_height_delta */ -1,
+                                    _expr.span);
                             }
                             // LOAD:VALUE: null
                             builder.emit_op(gc,
@@ -527,7 +783,7 @@ namespace Katsu
                 }
             }
             if (expr->messages.size() == 1 &&
-                std::get<std::string>(expr->messages[0].value) == "TAIL-CALL") {
+                std::get<std::string_view>(expr->messages[0].value) == "TAIL-CALL") {
                 if (expr->target) {
                     throw compile_error("TAIL-CALL: requires no target", expr->span);
                 }
@@ -543,13 +799,13 @@ namespace Katsu
             }
             Value v_existing;
             LookupResult lookup;
-            if ((lookup = lookup_name(builder, *r_name, &v_existing)) != SUCCESS) {
+            if ((lookup = lookup_name(builder, combined_name, &v_existing)) != SUCCESS) {
                 std::stringstream ss;
                 if (lookup == NOT_FOUND) {
-                    ss << "name '" << native_str(*r_name)
+                    ss << "name '" << combined_name
                        << "' is not defined in module (and is also not <a mutable local>:)";
                 } else {
-                    ss << "name '" << native_str(*r_name)
+                    ss << "name '" << combined_name
                        << "' is ambiguous in the current module and imports";
                 }
                 throw compile_error(ss.str(), expr->span);
@@ -565,19 +821,23 @@ namespace Katsu
             } else {
                 // Load the default receiver, which is always register 0.
                 // LOAD_REG: <local index>
-                builder.emit_op(gc, OpCode::LOAD_REG, /* stack_height_delta */ +1, _expr.span);
-                builder.emit_arg(gc, Value::fixnum(0));
+                builder.emit_op_with_immediate(gc,
+                                               OpCode::LOAD_REG,
+                                               /* immediate */ 0,
+                                               /* stack_height_delta */ +1,
+                                               _expr.span);
             }
-            for (const std::unique_ptr<Expr>& arg : expr->args) {
+            for (Expr* arg : expr->args) {
                 compile_expr(gc, builder, *arg, /* tail_position */ false, /* tail_call */ false);
             }
-            // INVOKE: <multimethod>, <num args>
+            // INVOKE: <multimethod>, <num args>, <inline cache>
             builder.emit_op(gc,
                             invoke_op,
                             /* stack_height_delta */ -(int64_t)expr->args.size(),
                             _expr.span);
             builder.emit_arg(gc, *r_existing);
             builder.emit_arg(gc, Value::fixnum(1 + expr->args.size()));
+            builder.emit_inline_cache(gc, 1 + expr->args.size());
         } else if (ParenExpr* expr = dynamic_cast<ParenExpr*>(&_expr)) {
             compile_expr(gc, builder, *expr->inner, tail_position, tail_call);
         } else if (BlockExpr* expr = dynamic_cast<BlockExpr*>(&_expr)) {
@@ -605,7 +865,11 @@ namespace Katsu
                 .r_upreg_loading = r_upreg_loading,
                 .bindings = {},
                 .base = &builder,
+                .lookups = builder.lookups,
+                .module_length = builder.module_length,
             };
+            collect_captured_names(
+                *expr->body, /* in_block */ false, closure_builder.captured_names);
             // Add param names as (immutable) bindings.
             uint32_t local_index = 0;
             if (expr->parameters.empty()) {
@@ -633,8 +897,11 @@ namespace Katsu
                     closure_builder.r_upreg_loading->v_array.obj_array()->components()[i].fixnum();
                 // TODO: check range
                 // LOAD_REG: <local index>
-                builder.emit_op(gc, OpCode::LOAD_REG, /* stack_height_delta */ +1, _expr.span);
-                builder.emit_arg(gc, Value::fixnum(load_index));
+                builder.emit_op_with_immediate(gc,
+                                               OpCode::LOAD_REG,
+                                               /* immediate */ load_index,
+                                               /* stack_height_delta */ +1,
+                                               _expr.span);
             }
             builder.emit_op(gc,
                             OpCode::MAKE_CLOSURE,
@@ -642,7 +909,7 @@ namespace Katsu
                             _expr.span);
             builder.emit_arg(gc, *r_closure_code);
         } else if (DataExpr* expr = dynamic_cast<DataExpr*>(&_expr)) {
-            for (const std::unique_ptr<Expr>& component : expr->components) {
+            for (Expr* component : expr->components) {
                 compile_expr(gc,
                              builder,
                              *component,
@@ -650,11 +917,12 @@ namespace Katsu
                              /* tail_call */ false);
             }
             // MAKE_VECTOR: <num components>
-            builder.emit_op(gc,
-                            OpCode::MAKE_VECTOR,
-                            /* stack_height_delta */ -(int64_t)expr->components.size() + 1,
-                            _expr.span);
-            builder.emit_arg(gc, Value::fixnum(expr->components.size()));
+            int64_t num_components = expr->components.size();
+            builder.emit_op_with_immediate(gc,
+                                           OpCode::MAKE_VECTOR,
+                                           /* immediate */ num_components,
+                                           /* stack_height_delta */ -num_components + 1,
+                                           _expr.span);
         } else if (SequenceExpr* expr = dynamic_cast<SequenceExpr*>(&_expr)) {
             if (expr->components.empty()) {
                 // Empty sequence -> just load null.
@@ -680,7 +948,7 @@ namespace Katsu
                 }
             }
         } else if (TupleExpr* expr = dynamic_cast<TupleExpr*>(&_expr)) {
-            for (const std::unique_ptr<Expr>& component : expr->components) {
+            for (Expr* component : expr->components) {
                 compile_expr(gc,
                              builder,
                              *component,
@@ -688,25 +956,223 @@ namespace Katsu
                              /* tail_call */ false);
             }
             // MAKE_TUPLE: <num components>
-            builder.emit_op(gc,
-                            OpCode::MAKE_TUPLE,
-                            /* stack_height_delta */ -(int64_t)expr->components.size() + 1,
-                            _expr.span);
-            builder.emit_arg(gc, Value::fixnum(expr->components.size()));
+            int64_t num_components = expr->components.size();
+            builder.emit_op_with_immediate(gc,
+                                           OpCode::MAKE_TUPLE,
+                                           /* immediate */ num_components,
+                                           /* stack_height_delta */ -num_components + 1,
+                                           _expr.span);
         } else {
             ASSERT_MSG(false, "forgot an Expr subtype");
         }
     }
 
+    // Find or make the multimethod which a method definition adds to (see compile_method()).
+    MultiMethod* define_method_multimethod(VM& vm, Root<Assoc>& r_module, Root<Vector>& r_imports,
+                                           Root<String>& r_method_name, uint32_t num_params,
+                                           bool allow_existing, bool global, bool decl_only,
+                                           const SourceSpan& span)
+    {
+        GC& gc = vm.gc;
+        Value& v_multimethods = vm.v_multimethods;
+
+        MultiMethod* multimethod;
+        Value existing;
+        LookupResult lookup = lookup_name(*r_module, *r_imports, *r_method_name, &existing);
+        if (lookup == SUCCESS) {
+            if (existing.is_obj_multimethod()) {
+                if (!allow_existing) {
+                    throw compile_error("multimethod is already defined in the current context",
+                                        span);
+                }
+                multimethod = existing.obj_multimethod();
+            } else {
+                throw compile_error("method name is already defined in the current context, "
+                                    "but not as a multimethod",
+                                    span);
+            }
+        } else if (lookup == NOT_FOUND) {
+            // If `global`, make sure the multimethod exists in v_multimethods.
+            // Regardless, add it to the current module.
+            if (global) {
+                Value* existing_global =
+                    assoc_lookup(v_multimethods.obj_assoc(), *r_method_name);
+                if (existing_global) {
+                    ASSERT(existing_global->is_obj_multimethod());
+                    multimethod = existing_global->obj_multimethod();
+                } else {
+                    Root<Vector> r_methods(gc,
+                                           make_vector(gc, /* capacity */ decl_only ? 0 : 1));
+                    Root<Vector> r_attributes(gc, make_vector(gc, 0));
+                    multimethod = make_multimethod(
+                        gc, r_method_name, num_params, r_methods, r_attributes);
+                    ValueRoot r_multimethod(gc, Value::object(multimethod));
+                    ValueRoot r_key(gc, r_method_name.value());
+                    {
+                        Root<Assoc> r_multimethods(gc, v_multimethods.obj_assoc());
+                        append(gc, r_multimethods, r_key, r_multimethod);
+                        v_multimethods = r_multimethods.value();
+                    }
+                    multimethod = r_multimethod->obj_multimethod();
+                }
+            } else {
+                Root<Vector> r_methods(gc, make_vector(gc, /* capacity */ decl_only ? 0 : 1));
+                Root<Vector> r_attributes(gc, make_vector(gc, 0));
+                multimethod = make_multimethod(
+                    gc, r_method_name, num_params, r_methods, r_attributes);
+            }
+
+            ValueRoot r_multimethod(gc, Value::object(multimethod));
+            ValueRoot r_key(gc, r_method_name.value());
+            append(gc, r_module, r_key, r_multimethod);
+            multimethod = r_multimethod->obj_multimethod();
+        } else {
+            throw compile_error(
+                "ambiguous lookup for multimethod name in module and its current imports",
+                span);
+        }
+        return multimethod;
+    }
+
+    // Compile a method body, given its parameters' names (starting with the receiver's). It may
+    // only refer to the first `module_length` entries of the module.
+    Code* compile_method_body(GC& gc, Root<Assoc>& r_module, Root<Vector>& r_imports,
+                              const std::vector<std::string>& param_names, Expr& body,
+                              SourceSpan& span, std::vector<std::string>* lookups,
+                              uint64_t module_length = UINT64_MAX)
+    {
+        OptionalRoot<Vector> r_upreg_map(gc, nullptr); // not a closure!
+        Root<Vector> r_insts(gc, make_vector(gc, 0));
+        Root<Vector> r_args(gc, make_vector(gc, 0));
+        Root<Vector> r_inst_spans(gc, make_vector(gc, 0));
+        Root<Vector> r_upreg_loading(gc, make_vector(gc, 0));
+        CodeBuilder builder{
+            .r_module = r_module,
+            .r_imports = r_imports,
+            .num_params = (uint32_t)param_names.size(), // TODO: check size_t?
+            .num_regs = (uint32_t)param_names.size(),   // TODO: check size_t?
+            .num_data = 0,
+            .r_upreg_map = r_upreg_map,
+            .r_insts = r_insts,
+            .r_args = r_args,
+            .r_inst_spans = r_inst_spans,
+            .r_upreg_loading = r_upreg_loading,
+            .bindings = {},
+            .base = nullptr,
+            .lookups = lookups,
+            .module_length = module_length,
+        };
+        // Add param names as (immutable) bindings.
+        uint32_t local_index = 0;
+        for (const std::string& param_name : param_names) {
+            builder.bindings.emplace(param_name,
+                                     Binding{
+                                         .name = param_name,
+                                         ._mutable = false,
+                                         .local_index = local_index++,
+                                     });
+        }
+        collect_captured_names(body, /* in_block */ false, builder.captured_names);
+        compile_expr(gc, builder, body, /* tail_position */ true, /* tail_call */ false);
+        return builder.finalize(gc, span);
+    }
+
+    // Make the stub code for a method whose body is left to compile on first invocation.
+    Tuple* make_lazy_code_stub(VM& vm, CodeBuilder& module_builder,
+                               const std::vector<std::string>& param_names, Expr* body,
+                               SourceSpan& span)
+    {
+        GC& gc = vm.gc;
+
+        // Imports added after the definition shouldn't change what the body refers to.
+        Root<Vector> r_imports(gc, make_vector(gc, module_builder.r_imports->length));
+        for (uint64_t i = 0; i < module_builder.r_imports->length; i++) {
+            Value v_import = module_builder.r_imports->v_array.obj_array()->components()[i];
+            ValueRoot r_import(gc, std::move(v_import));
+            append(gc, r_imports, r_import);
+        }
+
+        Tuple* stub = make_tuple(gc, 3);
+        stub->components()[0] = Value::fixnum(vm.lazy_method_bodies.size());
+        stub->components()[1] = module_builder.r_module.value();
+        stub->components()[2] = r_imports.value();
+        vm.lazy_method_bodies.push_back(std::make_unique<LazyMethodBody>(LazyMethodBody{
+            .v_stub = Value::object(stub),
+            .arena = module_builder.lazy_arena,
+            .body = body,
+            .param_names = param_names,
+            .span = span,
+            .module_length = std::min(module_builder.module_length,
+                                      module_builder.r_module->length),
+        }));
+        return stub;
+    }
+
+    // Compile the body a lazy stub stands for, unless that's been done already, and return its
+    // code.
+    Code* compile_lazy_code_stub(VM& vm, Root<Tuple>& r_stub)
+    {
+        GC& gc = vm.gc;
+        Value v_state = r_stub->components()[0];
+        if (v_state.is_obj_code()) {
+            return v_state.obj_code();
+        }
+
+        // The body stays waiting until it compiles, so that if it doesn't, the next invocation
+        // raises the same error.
+        uint64_t id = v_state.fixnum();
+        LazyMethodBody* body = vm.lazy_method_bodies[id].get();
+        ASSERT(body);
+        Root<Assoc> r_module(gc, r_stub->components()[1].obj_assoc());
+        Root<Vector> r_imports(gc, r_stub->components()[2].obj_vector());
+        Code* code = compile_method_body(gc,
+                                         r_module,
+                                         r_imports,
+                                         body->param_names,
+                                         *body->body,
+                                         body->span,
+                                         /* lookups */ nullptr,
+                                         body->module_length);
+        r_stub->components()[0] = Value::object(code);
+        gc.write_barrier(*r_stub, Value::object(code));
+        vm.lazy_method_bodies[id].reset();
+        return code;
+    }
+
+    Method* compile_lazy_method(VM& vm, Method* method, int64_t num_args, Value* args)
+    {
+        GC& gc = vm.gc;
+        ValuesRoot r_args(gc, args, num_args);
+        Root<Method> r_method(gc, std::move(method));
+        Root<Tuple> r_stub(gc, r_method->v_code.obj_tuple());
+        Code* code = compile_lazy_code_stub(vm, r_stub);
+        r_method->v_code = Value::object(code);
+        gc.write_barrier(*r_method, Value::object(code));
+        return *r_method;
+    }
+
+    void compile_lazy_methods(VM& vm)
+    {
+        for (size_t id = 0; id < vm.lazy_method_bodies.size(); id++) {
+            if (LazyMethodBody* body = vm.lazy_method_bodies[id].get()) {
+                Root<Tuple> r_stub(vm.gc, body->v_stub.obj_tuple());
+                compile_lazy_code_stub(vm, r_stub);
+            }
+        }
+    }
+
     // receiver, body, attrs are optional
     // allow_existing:
     // - if true, allow adding to an existing multimethod in the module (and its current imports)
     // - if false, raise a compile_error if the declaration matches a multimethod in scope
     // global: if true, add to v_multimethods
-    void compile_method(GC& gc, Value& v_multimethods, bool allow_existing, bool global,
-                        CodeBuilder& module_builder, const std::string& message, SourceSpan& span,
-                        Expr* receiver, Expr& _decl, Expr* _body, Expr* attrs)
+    // definitions: if given, the multimethod definition is appended to it
+    void compile_method(VM& vm, bool allow_existing, bool global, CodeBuilder& module_builder,
+                        const std::string& message, SourceSpan& span, Expr* receiver, Expr& _decl,
+                        Expr* _body, Expr* attrs, std::vector<CompileDefinition>* definitions)
     {
+        GC& gc = vm.gc;
+
         if (receiver) {
             std::stringstream ss;
             ss << message << " takes no receiver";
@@ -719,7 +1185,7 @@ namespace Katsu
         Expr* decl = &_decl;
 
         while (ParenExpr* p = dynamic_cast<ParenExpr*>(decl)) {
-            decl = p->inner.get();
+            decl = p->inner;
         }
 
         std::vector<std::string> method_name_parts{};
@@ -730,7 +1196,7 @@ namespace Katsu
             [&gc, &module_builder, has_body, &param_names](Expr& param_decl,
                                                            const std::string& error_msg) -> void {
             if (NameExpr* d = dynamic_cast<NameExpr*>(&param_decl)) {
-                param_names.push_back(std::get<std::string>(d->name.value));
+                param_names.emplace_back(std::get<std::string_view>(d->name.value));
                 if (has_body) {
                     // Add an any-matcher by loading null.
                     // LOAD_VALUE: <value>
@@ -742,9 +1208,9 @@ namespace Katsu
                 }
                 return;
             } else if (ParenExpr* d = dynamic_cast<ParenExpr*>(&param_decl)) {
-                if (NAryMessageExpr* n = dynamic_cast<NAryMessageExpr*>(d->inner.get())) {
+                if (NAryMessageExpr* n = dynamic_cast<NAryMessageExpr*>(d->inner)) {
                     if (!n->target && n->messages.size() == 1) {
-                        param_names.push_back(std::get<std::string>(n->messages[0].value));
+                        param_names.emplace_back(std::get<std::string_view>(n->messages[0].value));
 
                         if (has_body) {
                             // Add a type-matcher evaluated from n->args[0];
@@ -770,7 +1236,7 @@ namespace Katsu
 
         if (NameExpr* d = dynamic_cast<NameExpr*>(decl)) {
             unary = true;
-            method_name_parts.push_back(std::get<std::string>(d->name.value));
+            method_name_parts.emplace_back(std::get<std::string_view>(d->name.value));
             param_names.push_back("self");
             if (has_body) {
                 // Add an any-matcher by loading null.
@@ -788,7 +1254,7 @@ namespace Katsu
                << "it must be a simple unary message of the form [target-name message-name] "
                << "or else a unary message of the form [(target-name: matcher) message-name]";
             const std::string& error_msg = ss.str();
-            method_name_parts.push_back(std::get<std::string>(d->message.value));
+            method_name_parts.emplace_back(std::get<std::string_view>(d->message.value));
             add_param_name_and_matcher(*d->target, error_msg);
         } else if (NAryMessageExpr* d = dynamic_cast<NAryMessageExpr*>(decl)) {
             unary = false;
@@ -801,7 +1267,7 @@ namespace Katsu
             const std::string& error_msg = ss.str();
 
             for (const Token& message : d->messages) {
-                method_name_parts.push_back(std::get<std::string>(message.value));
+                method_name_parts.emplace_back(std::get<std::string_view>(message.value));
             }
 
             if (d->target) {
@@ -819,7 +1285,7 @@ namespace Katsu
                 }
             }
 
-            for (const std::unique_ptr<Expr>& arg : d->args) {
+            for (Expr* arg : d->args) {
                 add_param_name_and_matcher(*arg, error_msg);
             }
         } else {
@@ -829,9 +1295,15 @@ namespace Katsu
             throw compile_error(ss.str(), decl->span);
         }
 
-        Root<String> r_method_name(gc,
-                                   unary ? make_string(gc, method_name_parts[0])
-                                         : concat_with_suffix(gc, method_name_parts, ":"));
+        std::string method_name;
+        if (unary) {
+            method_name = method_name_parts[0];
+        } else {
+            for (const std::string& part : method_name_parts) {
+                method_name += part + ":";
+            }
+        }
+        Root<String> r_method_name(gc, intern(vm, method_name));
 
         Expr* body;
         if (_body) {
@@ -841,7 +1313,7 @@ namespace Katsu
                     ss << message << " 'body' argument should not specify any parameters";
                     throw compile_error(ss.str(), _body->span);
                 }
-                body = b->body.get();
+                body = b->body;
             } else {
                 std::stringstream ss;
                 ss << message << " 'body' argument should be a block";
@@ -851,68 +1323,25 @@ namespace Katsu
             body = nullptr;
         }
 
-        MultiMethod* multimethod;
-        {
-            Value existing;
-            LookupResult lookup = lookup_name(module_builder, *r_method_name, &existing);
-            if (lookup == SUCCESS) {
-                if (existing.is_obj_multimethod()) {
-                    if (!allow_existing) {
-                        throw compile_error("multimethod is already defined in the current context",
-                                            span);
-                    }
-                    multimethod = existing.obj_multimethod();
-                } else {
-                    throw compile_error("method name is already defined in the current context, "
-                                        "but not as a multimethod",
-                                        span);
-                }
-            } else if (lookup == NOT_FOUND) {
-                // If `global`, make sure the multimethod exists in v_multimethods.
-                // Regardless, add it to the current module.
-                if (global) {
-                    Value* existing_global =
-                        assoc_lookup(v_multimethods.obj_assoc(), *r_method_name);
-                    if (existing_global) {
-                        ASSERT(existing_global->is_obj_multimethod());
-                        multimethod = existing_global->obj_multimethod();
-                    } else {
-                        Root<Vector> r_methods(gc,
-                                               make_vector(gc, /* capacity */ decl_only ? 0 : 1));
-                        Root<Vector> r_attributes(gc, make_vector(gc, 0));
-                        multimethod = make_multimethod(gc,
-                                                       r_method_name,
-                                                       param_names.size(),
-                                                       r_methods,
-                                                       r_attributes);
-                        ValueRoot r_multimethod(gc, Value::object(multimethod));
-                        ValueRoot r_key(gc, r_method_name.value());
-                        {
-                            Root<Assoc> r_multimethods(gc, v_multimethods.obj_assoc());
-                            append(gc, r_multimethods, r_key, r_multimethod);
-                            v_multimethods = r_multimethods.value();
-                        }
-                        multimethod = r_multimethod->obj_multimethod();
-                    }
-                } else {
-                    Root<Vector> r_methods(gc, make_vector(gc, /* capacity */ decl_only ? 0 : 1));
-                    Root<Vector> r_attributes(gc, make_vector(gc, 0));
-                    multimethod = make_multimethod(gc,
-                                                   r_method_name,
-                                                   param_names.size(),
-                                                   r_methods,
-                                                   r_attributes);
-                }
-
-                ValueRoot r_multimethod(gc, Value::object(multimethod));
-                ValueRoot r_key(gc, r_method_name.value());
-                append(gc, module_builder.r_module, r_key, r_multimethod);
-                multimethod = r_multimethod->obj_multimethod();
-            } else {
-                throw compile_error(
-                    "ambiguous lookup for multimethod name in module and its current imports",
-                    span);
-            }
+        MultiMethod* multimethod = define_method_multimethod(vm,
+                                                             module_builder.r_module,
+                                                             module_builder.r_imports,
+                                                             r_method_name,
+                                                             param_names.size(),
+                                                             allow_existing,
+                                                             global,
+                                                             decl_only,
+                                                             span);
+        if (definitions) {
+            definitions->push_back(CompileDefinition{
+                .kind = CompileDefinition::Kind::MULTIMETHOD,
+                .name = method_name,
+                .span = span,
+                .num_params = (uint32_t)param_names.size(),
+                .allow_existing = allow_existing,
+                .global = global,
+                .decl_only = decl_only,
+            });
         }
 
         if (decl_only) {
@@ -922,37 +1351,21 @@ namespace Katsu
 
         Root<MultiMethod> r_multimethod(gc, std::move(multimethod));
 
-        // Compile the body.
-        OptionalRoot<Vector> r_upreg_map(gc, nullptr); // not a closure!
-        Root<Vector> r_insts(gc, make_vector(gc, 0));
-        Root<Vector> r_args(gc, make_vector(gc, 0));
-        Root<Vector> r_inst_spans(gc, make_vector(gc, 0));
-        Root<Vector> r_upreg_loading(gc, make_vector(gc, 0));
-        CodeBuilder builder{
-            .r_module = module_builder.r_module,
-            .r_imports = module_builder.r_imports,
-            .num_params = (uint32_t)param_names.size(), // TODO: check size_t?
-            .num_regs = (uint32_t)param_names.size(),   // TODO: check size_t?
-            .num_data = 0,
-            .r_upreg_map = r_upreg_map,
-            .r_insts = r_insts,
-            .r_args = r_args,
-            .r_inst_spans = r_inst_spans,
-            .r_upreg_loading = r_upreg_loading,
-            .bindings = {},
-            .base = nullptr,
-        };
-        // Add param names as (immutable) bindings.
-        uint32_t local_index = 0;
-        for (const std::string& param_name : param_names) {
-            builder.bindings.emplace(param_name,
-                                     Binding{
-                                         .name = param_name,
-                                         ._mutable = false,
-                                         .local_index = local_index++,
-                                     });
+        // Compile the body, or leave it for later.
+        bool lazy = module_builder.lazy_arena != nullptr;
+        ValueRoot r_code(gc, Value::null());
+        if (lazy) {
+            *r_code =
+                Value::object(make_lazy_code_stub(vm, module_builder, param_names, body, span));
+        } else {
+            *r_code = Value::object(compile_method_body(gc,
+                                                        module_builder.r_module,
+                                                        module_builder.r_imports,
+                                                        param_names,
+                                                        *body,
+                                                        span,
+                                                        module_builder.lookups));
         }
-        compile_expr(gc, builder, *body, /* tail_position */ true, /* tail_call */ false);
 
         // Generate the method. This has to be at runtime, since parameter matchers are evaluated at
         // runtime. At this point, the matchers have been calculated and are at the top of the data
@@ -971,22 +1384,22 @@ namespace Katsu
 
         // Parameter matchers:
         // MAKE_ARRAY: <length>
-        module_builder.emit_op(gc,
-                               OpCode::MAKE_ARRAY,
-                               /* stack_height_delta */ -(int64_t)param_names.size() + 1,
-                               decl->span);
-        module_builder.emit_arg(gc, Value::fixnum(param_names.size()));
+        module_builder.emit_op_with_immediate(gc,
+                                              OpCode::MAKE_ARRAY,
+                                              /* immediate */ param_names.size(),
+                                              /* stack_height_delta */
+                                              -(int64_t)param_names.size() + 1,
+                                              decl->span);
 
         // Return type: (TODO: support return types for methods)
         // LOAD_VALUE: <value>
         module_builder.emit_op(gc, OpCode::LOAD_VALUE, /* stack_height_delta */ +1, span);
         module_builder.emit_arg(gc, Value::null());
 
-        // Code:
+        // Code (or lazy stub):
         // LOAD_VALUE: <value>
-        Root<Code> r_code(gc, builder.finalize(gc, span));
         module_builder.emit_op(gc, OpCode::LOAD_VALUE, /* stack_height_delta */ +1, body->span);
-        module_builder.emit_arg(gc, r_code.value());
+        module_builder.emit_arg(gc, r_code);
 
         // Attributes:
         if (attrs) {
@@ -998,23 +1411,30 @@ namespace Katsu
         } else {
             // Generate a 0-length vector.
             // MAKE_VECTOR: <length>
-            module_builder.emit_op(gc, OpCode::MAKE_VECTOR, /* stack_height_delta */ +1, span);
-            module_builder.emit_arg(gc, Value::fixnum(0));
+            module_builder.emit_op_with_immediate(gc,
+                                                  OpCode::MAKE_VECTOR,
+                                                  /* immediate */ 0,
+                                                  /* stack_height_delta */ +1,
+                                                  span);
         }
 
         // Create the method.
-        // INVOKE: <multimethod>, <num args>
+        // INVOKE: <multimethod>, <num args>, <inline cache>
         module_builder.emit_op(gc, OpCode::INVOKE, /* stack_height_delta */ -4 + 1, span);
-        {
-            Root<String> r_name(gc, make_string(gc, "make-method-with-return-type:code:attrs:"));
-            module_builder.emit_arg(gc, lookup_name(module_builder, *r_name, span));
-        }
+        module_builder.emit_arg(
+            gc,
+            lookup_name(module_builder,
+                        std::string(lazy ? "make-method-with-return-type:lazy-code:attrs:"
+                                         : "make-method-with-return-type:code:attrs:"),
+                        span));
         module_builder.emit_arg(gc, Value::fixnum(4));
+        module_builder.emit_inline_cache(gc, 4);
 
         // Multimethod:
         // LOAD_VALUE: <value>
         module_builder.emit_op(gc, OpCode::LOAD_VALUE, /* stack_height_delta */ +1, decl->span);
         module_builder.emit_arg(gc, r_multimethod.value());
+        module_builder.note_lookup(method_name);
 
         // Require unique = true
         // TODO: allow user to specify redefinition?
@@ -1023,13 +1443,12 @@ namespace Katsu
         module_builder.emit_arg(gc, Value::_bool(true));
 
         // Add the method.
-        // INVOKE: <multimethod>, <num args>
+        // INVOKE: <multimethod>, <num args>, <inline cache>
         module_builder.emit_op(gc, OpCode::INVOKE, /* stack_height_delta */ -3 + 1, span);
-        {
-            Root<String> r_name(gc, make_string(gc, "add-method-to:require-unique:"));
-            module_builder.emit_arg(gc, lookup_name(module_builder, *r_name, span));
-        }
+        module_builder.emit_arg(
+            gc, lookup_name(module_builder, std::string("add-method-to:require-unique:"), span));
         module_builder.emit_arg(gc, Value::fixnum(3));
+        module_builder.emit_inline_cache(gc, 3);
     }
 
     void aggregate_slots(GC& gc, Root<Vector>& r_slots, Type* type)
@@ -1058,75 +1477,52 @@ namespace Katsu
         }
     }
 
-    // receiver, extends are optional
-    void compile_dataclass(GC& gc, Value& v_multimethods, Root<Assoc>& r_module,
-                           Root<Vector>& r_imports, const std::string& message, SourceSpan& span,
-                           Expr* receiver, Expr& name, Expr* extends, Expr& has)
+    // Make a dataclass type and its predicate, constructor, and slot accessor methods, adding
+    // them all to the module (see compile_dataclass()).
+    void define_dataclass(VM& vm, Root<Assoc>& r_module, Root<Vector>& r_imports,
+                          const std::string& message, const CompileDefinition& definition)
     {
-        if (receiver) {
-            std::stringstream ss;
-            ss << message << " takes no receiver";
-            throw compile_error(ss.str(), span);
-        }
+        GC& gc = vm.gc;
+        Value& v_multimethods = vm.v_multimethods;
+        SourceSpan span = definition.span;
+        SourceSpan name_span = definition.name_span;
 
-        NameExpr* name_expr = dynamic_cast<NameExpr*>(&name);
-        if (!name_expr) {
-            std::stringstream ss;
-            ss << message << " 'name' argument must be a name";
-            throw compile_error(ss.str(), name.span);
-        }
-        const std::string& class_name = std::get<std::string>(name_expr->name.value);
-        Root<String> r_class_name(gc, make_string(gc, class_name));
-        LookupResult lookup = lookup_name(*r_module, *r_imports, *r_class_name);
+        const std::string& class_name = definition.name;
+        LookupResult lookup = lookup_name(*r_module, *r_imports, class_name);
         if (lookup == SUCCESS || lookup == AMBIGUOUS) {
             std::stringstream ss;
             ss << message << " class name '" << class_name
                << "' already exists in module scope or in imports";
-            throw compile_error(ss.str(), name.span);
+            throw compile_error(ss.str(), name_span);
         }
 
         Root<Vector> r_extends(gc, make_vector(gc, 0));
-        if (extends) {
-            bool saw_dataclass = false;
-            DataExpr* data_expr = dynamic_cast<DataExpr*>(extends);
-            if (!data_expr) {
+        bool saw_dataclass = false;
+        for (size_t i = 0; i < definition.bases.size(); i++) {
+            const std::string& base_name = definition.bases[i];
+            const SourceSpan& base_span = definition.base_spans[i];
+            Value lookup = lookup_name(*r_module, *r_imports, base_name, base_span);
+            if (!lookup.is_obj_type()) {
                 std::stringstream ss;
-                ss << message << " 'extends' argument must be a vector of names";
-                throw compile_error(ss.str(), extends->span);
+                ss << "Value '" << base_name << "' must be a Type";
+                throw compile_error(ss.str(), base_span);
             }
-            for (std::unique_ptr<Expr>& base_expr : data_expr->components) {
-                NameExpr* base_name_expr = dynamic_cast<NameExpr*>(base_expr.get());
-                if (!base_name_expr) {
-                    std::stringstream ss;
-                    ss << message << " 'extends' argument must be a sequence of names";
-                    throw compile_error(ss.str(), base_expr->span);
-                }
-                const std::string& base_name = std::get<std::string>(base_name_expr->name.value);
-                Root<String> r_base_name(gc, make_string(gc, base_name));
-                Value lookup = lookup_name(*r_module, *r_imports, *r_base_name, base_expr->span);
-                if (!lookup.is_obj_type()) {
-                    std::stringstream ss;
-                    ss << "Value '" << base_name << "' must be a Type";
-                    throw compile_error(ss.str(), base_expr->span);
-                }
 
-                Type* base = lookup.obj_type();
-                if (base->sealed) {
-                    std::stringstream ss;
-                    ss << "Cannot extend from sealed type '" << base_name << "'";
-                    throw compile_error(ss.str(), base_expr->span);
-                }
-                // TODO: This feels a bit hacky. Better way? Maybe separate args.
-                if (base->kind == Type::Kind::DATACLASS) {
-                    if (saw_dataclass) {
-                        throw compile_error("Cannot extend from multiple dataclasses",
-                                            base_expr->span);
-                    }
-                    saw_dataclass = true;
+            Type* base = lookup.obj_type();
+            if (base->sealed) {
+                std::stringstream ss;
+                ss << "Cannot extend from sealed type '" << base_name << "'";
+                throw compile_error(ss.str(), base_span);
+            }
+            // TODO: This feels a bit hacky. Better way? Maybe separate args.
+            if (base->kind == Type::Kind::DATACLASS) {
+                if (saw_dataclass) {
+                    throw compile_error("Cannot extend from multiple dataclasses", base_span);
                 }
-                ValueRoot r_base(gc, Value::object(base));
-                append(gc, r_extends, r_base);
+                saw_dataclass = true;
             }
+            ValueRoot r_base(gc, Value::object(base));
+            append(gc, r_extends, r_base);
         }
         Root<Array> r_bases(gc, vector_to_array(gc, r_extends));
         Type* base_dataclass = nullptr;
@@ -1149,29 +1545,15 @@ namespace Katsu
             num_base_slots = r_all_slots->length;
         }
         // Collect slots from the direct dataclass definition.
-        {
-            DataExpr* data_expr = dynamic_cast<DataExpr*>(&has);
-            if (!data_expr) {
-                std::stringstream ss;
-                ss << message << " 'has' argument must be a vector of names";
-                throw compile_error(ss.str(), has.span);
-            }
-            for (std::unique_ptr<Expr>& slot_expr : data_expr->components) {
-                NameExpr* slot_name_expr = dynamic_cast<NameExpr*>(slot_expr.get());
-                if (!slot_name_expr) {
-                    std::stringstream ss;
-                    ss << message << " 'has' argument must be a sequence of names";
-                    throw compile_error(ss.str(), slot_expr->span);
-                }
-                const std::string& slot_name = std::get<std::string>(slot_name_expr->name.value);
-                ValueRoot r_slot_name(gc, Value::object(make_string(gc, slot_name)));
-                append(gc, r_all_slots, r_slot_name);
-                append(gc, r_leaf_slots, r_slot_name);
-            }
+        for (const std::string& slot_name : definition.slots) {
+            ValueRoot r_slot_name(gc, Value::object(intern(vm, slot_name)));
+            append(gc, r_all_slots, r_slot_name);
+            append(gc, r_leaf_slots, r_slot_name);
         }
         // TODO: warn (or error) if there's a leaf slot shadowing a derived slot.
 
         OptionalRoot<Array> r_slots(gc, vector_to_array(gc, r_leaf_slots));
+        Root<String> r_class_name(gc, intern(vm, class_name));
         Root<Type> r_type(gc,
                           make_type(gc,
                                     r_class_name,
@@ -1185,9 +1567,11 @@ namespace Katsu
         append(gc, r_module, r_key, rv_type);
 
         const auto lookup_or_create =
-            [&gc, &v_multimethods, &r_module, &r_imports](Root<String>& r_name,
+            [&vm, &v_multimethods, &r_module, &r_imports](Root<String>& r_fresh_name,
                                                           uint32_t num_params,
                                                           SourceSpan err_span) -> MultiMethod* {
+            GC& gc = vm.gc;
+            Root<String> r_name(gc, intern(vm, r_fresh_name));
             Value existing;
             LookupResult lookup = lookup_name(*r_module, *r_imports, *r_name, &existing);
             if (lookup == SUCCESS) {
@@ -1249,7 +1633,7 @@ namespace Katsu
             Root<String> r_method_name(gc, concat(gc, r_class_name, "?"));
             Root<MultiMethod> r_multimethod(
                 gc,
-                lookup_or_create(r_method_name, /* num_params */ 1, name.span));
+                lookup_or_create(r_method_name, /* num_params */ 1, name_span));
 
             OptionalRoot<Vector> r_upreg_map(gc, nullptr); // not a closure!
             Root<Vector> r_insts(gc, make_vector(gc, 0));
@@ -1272,23 +1656,24 @@ namespace Katsu
                 .base = nullptr,
             };
             // LOAD_REG: <local index>
-            builder.emit_op(gc, OpCode::LOAD_REG, /* stack_height_delta */ +1, name.span);
-            builder.emit_arg(gc, Value::fixnum(0));
+            builder.emit_op_with_immediate(gc,
+                                           OpCode::LOAD_REG,
+                                           /* immediate */ 0,
+                                           /* stack_height_delta */ +1,
+                                           name_span);
             // LOAD_VALUE: <value>
-            builder.emit_op(gc, OpCode::LOAD_VALUE, /* stack_height_delta */ +1, name.span);
+            builder.emit_op(gc, OpCode::LOAD_VALUE, /* stack_height_delta */ +1, name_span);
             builder.emit_arg(gc, rv_type);
-            // INVOKE: <multimethod>, <num args>
-            builder.emit_op(gc, OpCode::INVOKE, /* stack_height_delta */ -2 + 1, name.span);
-            {
-                Root<String> r_name(gc, make_string(gc, "instance?:"));
-                builder.emit_arg(gc, lookup_name(builder, *r_name, span));
-            }
+            // INVOKE: <multimethod>, <num args>, <inline cache>
+            builder.emit_op(gc, OpCode::INVOKE, /* stack_height_delta */ -2 + 1, name_span);
+            builder.emit_arg(gc, lookup_name(builder, std::string("instance?:"), span));
             builder.emit_arg(gc, Value::fixnum(2));
+            builder.emit_inline_cache(gc, 2);
 
             Root<Array> r_param_matchers(gc, make_array(gc, 1));
             r_param_matchers->components()[0] = Value::null(); // 'any' matcher
             OptionalRoot<Type> r_return_type(gc, nullptr);     // TODO: return type
-            OptionalRoot<Code> r_code(gc, builder.finalize(gc, name.span));
+            OptionalRoot<Code> r_code(gc, builder.finalize(gc, name_span));
             Root<Vector> r_attributes(gc, make_vector(gc, 0));
             Root<Method> r_method(gc,
                                   make_method(gc,
@@ -1312,10 +1697,10 @@ namespace Katsu
             Root<String> r_method_name(gc,
                                        r_all_slots->length > 0
                                            ? concat_with_suffix(gc, r_all_slots, ":")
-                                           : make_string(gc, "new"));
+                                           : intern(vm, "new"));
             Root<MultiMethod> r_multimethod(
                 gc,
-                lookup_or_create(r_method_name, /* num_params */ 1 + num_slots, name.span));
+                lookup_or_create(r_method_name, /* num_params */ 1 + num_slots, name_span));
 
             Root<Vector> r_imports(gc, make_vector(gc, 0)); // not actually used in this case
             OptionalRoot<Vector> r_upreg_map(gc, nullptr);  // not a closure!
@@ -1339,15 +1724,18 @@ namespace Katsu
             };
             for (uint32_t i = 0; i <= num_slots; i++) {
                 // LOAD_REG: <local index>
-                builder.emit_op(gc, OpCode::LOAD_REG, /* stack_height_delta */ +1, span);
-                builder.emit_arg(gc, Value::fixnum(i));
+                builder.emit_op_with_immediate(gc,
+                                               OpCode::LOAD_REG,
+                                               /* immediate */ i,
+                                               /* stack_height_delta */ +1,
+                                               span);
             }
             // MAKE_INSTANCE: <num slots>
-            builder.emit_op(gc,
-                            OpCode::MAKE_INSTANCE,
-                            /* stack_height_delta */ -1 - (int64_t)num_slots + 1,
-                            span);
-            builder.emit_arg(gc, Value::fixnum(num_slots));
+            builder.emit_op_with_immediate(gc,
+                                           OpCode::MAKE_INSTANCE,
+                                           /* immediate */ num_slots,
+                                           /* stack_height_delta */ -1 - (int64_t)num_slots + 1,
+                                           span);
 
             Root<Array> r_param_matchers(gc, make_array(gc, 1 + num_slots));
             r_param_matchers->components()[0] =
@@ -1382,7 +1770,7 @@ namespace Katsu
                 Root<String> r_method_name(gc, concat(gc, ".", r_slot));
                 Root<MultiMethod> r_multimethod(
                     gc,
-                    lookup_or_create(r_method_name, /* num_params */ 1, name.span));
+                    lookup_or_create(r_method_name, /* num_params */ 1, name_span));
 
                 Root<Vector> r_imports(gc, make_vector(gc, 0)); // not actually used in this case
                 OptionalRoot<Vector> r_upreg_map(gc, nullptr);  // not a closure!
@@ -1405,11 +1793,17 @@ namespace Katsu
                     .base = nullptr,
                 };
                 // LOAD_REG: <local index>
-                builder.emit_op(gc, OpCode::LOAD_REG, /* stack_height_delta */ +1, span);
-                builder.emit_arg(gc, Value::fixnum(0));
+                builder.emit_op_with_immediate(gc,
+                                               OpCode::LOAD_REG,
+                                               /* immediate */ 0,
+                                               /* stack_height_delta */ +1,
+                                               span);
                 // GET_SLOT: <slot index>
-                builder.emit_op(gc, OpCode::GET_SLOT, /* stack_height_delta */ 0, span);
-                builder.emit_arg(gc, Value::fixnum(num_base_slots + i));
+                builder.emit_op_with_immediate(gc,
+                                               OpCode::GET_SLOT,
+                                               /* immediate */ num_base_slots + i,
+                                               /* stack_height_delta */ 0,
+                                               span);
 
                 Root<Array> r_param_matchers(gc, make_array(gc, 1));
                 r_param_matchers->components()[0] = r_type.value(); // type matcher on the dataclass
@@ -1438,7 +1832,7 @@ namespace Katsu
                 Root<String> r_method_name(gc, concat(gc, r_slot, ":"));
                 Root<MultiMethod> r_multimethod(
                     gc,
-                    lookup_or_create(r_method_name, /* num_params */ 2, name.span));
+                    lookup_or_create(r_method_name, /* num_params */ 2, name_span));
 
                 Root<Vector> r_imports(gc, make_vector(gc, 0)); // not actually used in this case
                 OptionalRoot<Vector> r_upreg_map(gc, nullptr);  // not a closure!
@@ -1461,17 +1855,29 @@ namespace Katsu
                     .base = nullptr,
                 };
                 // LOAD_REG: <local index>
-                builder.emit_op(gc, OpCode::LOAD_REG, /* stack_height_delta */ +1, span);
-                builder.emit_arg(gc, Value::fixnum(0));
+                builder.emit_op_with_immediate(gc,
+                                               OpCode::LOAD_REG,
+                                               /* immediate */ 0,
+                                               /* stack_height_delta */ +1,
+                                               span);
                 // LOAD_REG: <local index>
-                builder.emit_op(gc, OpCode::LOAD_REG, /* stack_height_delta */ +1, span);
-                builder.emit_arg(gc, Value::fixnum(1));
+                builder.emit_op_with_immediate(gc,
+                                               OpCode::LOAD_REG,
+                                               /* immediate */ 1,
+                                               /* stack_height_delta */ +1,
+                                               span);
                 // GET_SLOT: <slot index>
-                builder.emit_op(gc, OpCode::SET_SLOT, /* stack_height_delta */ -2, span);
-                builder.emit_arg(gc, Value::fixnum(num_base_slots + i));
+                builder.emit_op_with_immediate(gc,
+                                               OpCode::SET_SLOT,
+                                               /* immediate */ num_base_slots + i,
+                                               /* stack_height_delta */ -2,
+                                               span);
                 // LOAD_REG: <local index>
-                builder.emit_op(gc, OpCode::LOAD_REG, /* stack_height_delta */ +1, span);
-                builder.emit_arg(gc, Value::fixnum(0));
+                builder.emit_op_with_immediate(gc,
+                                               OpCode::LOAD_REG,
+                                               /* immediate */ 0,
+                                               /* stack_height_delta */ +1,
+                                               span);
 
                 Root<Array> r_param_matchers(gc, make_array(gc, 2));
                 r_param_matchers->components()[0] = r_type.value(); // type matcher on the dataclass
@@ -1494,9 +1900,11 @@ namespace Katsu
     }
 
     // receiver, extends are optional
-    void compile_mixin(GC& gc, Root<Assoc>& r_module, Root<Vector>& r_imports,
-                       const std::string& message, SourceSpan& span, Expr* receiver, Expr& name,
-                       Expr* extends)
+    // definitions: if given, the dataclass definition is appended to it
+    void compile_dataclass(VM& vm, Root<Assoc>& r_module, Root<Vector>& r_imports,
+                           const std::string& message, SourceSpan& span, Expr* receiver,
+                           Expr& name, Expr* extends, Expr& has,
+                           std::vector<CompileDefinition>* definitions)
     {
         if (receiver) {
             std::stringstream ss;
@@ -1510,17 +1918,12 @@ namespace Katsu
             ss << message << " 'name' argument must be a name";
             throw compile_error(ss.str(), name.span);
         }
-        const std::string& mixin_name = std::get<std::string>(name_expr->name.value);
-        Root<String> r_mixin_name(gc, make_string(gc, mixin_name));
-        LookupResult lookup = lookup_name(*r_module, *r_imports, *r_mixin_name);
-        if (lookup == SUCCESS || lookup == AMBIGUOUS) {
-            std::stringstream ss;
-            ss << message << " mixin name '" << mixin_name
-               << "' already exists in module scope or in imports";
-            throw compile_error(ss.str(), name.span);
-        }
-
-        Root<Vector> r_extends(gc, make_vector(gc, 0));
+        CompileDefinition definition{
+            .kind = CompileDefinition::Kind::DATACLASS,
+            .name = std::string(std::get<std::string_view>(name_expr->name.value)),
+            .span = span,
+            .name_span = name.span,
+        };
         if (extends) {
             DataExpr* data_expr = dynamic_cast<DataExpr*>(extends);
             if (!data_expr) {
@@ -1528,39 +1931,86 @@ namespace Katsu
                 ss << message << " 'extends' argument must be a vector of names";
                 throw compile_error(ss.str(), extends->span);
             }
-            for (std::unique_ptr<Expr>& base_expr : data_expr->components) {
-                NameExpr* base_name_expr = dynamic_cast<NameExpr*>(base_expr.get());
+            for (Expr* base_expr : data_expr->components) {
+                NameExpr* base_name_expr = dynamic_cast<NameExpr*>(base_expr);
                 if (!base_name_expr) {
                     std::stringstream ss;
                     ss << message << " 'extends' argument must be a sequence of names";
                     throw compile_error(ss.str(), base_expr->span);
                 }
-                const std::string& base_name = std::get<std::string>(base_name_expr->name.value);
-                Root<String> r_base_name(gc, make_string(gc, base_name));
-                Value lookup = lookup_name(*r_module, *r_imports, *r_base_name, base_expr->span);
-                if (!lookup.is_obj_type()) {
+                definition.bases.emplace_back(
+                    std::get<std::string_view>(base_name_expr->name.value));
+                definition.base_spans.push_back(base_expr->span);
+            }
+        }
+        {
+            DataExpr* data_expr = dynamic_cast<DataExpr*>(&has);
+            if (!data_expr) {
+                std::stringstream ss;
+                ss << message << " 'has' argument must be a vector of names";
+                throw compile_error(ss.str(), has.span);
+            }
+            for (Expr* slot_expr : data_expr->components) {
+                NameExpr* slot_name_expr = dynamic_cast<NameExpr*>(slot_expr);
+                if (!slot_name_expr) {
                     std::stringstream ss;
-                    ss << "Value '" << base_name << "' must be a Type";
-                    throw compile_error(ss.str(), base_expr->span);
+                    ss << message << " 'has' argument must be a sequence of names";
+                    throw compile_error(ss.str(), slot_expr->span);
                 }
+                definition.slots.emplace_back(
+                    std::get<std::string_view>(slot_name_expr->name.value));
+            }
+        }
 
-                Type* base = lookup.obj_type();
-                if (base->sealed) {
-                    std::stringstream ss;
-                    ss << "Cannot extend from sealed type '" << base_name << "'";
-                    throw compile_error(ss.str(), base_expr->span);
-                }
-                if (base->kind != Type::Kind::MIXIN) {
-                    throw compile_error("Mixins can only extend from mixins", base_expr->span);
-                }
-                ValueRoot r_base(gc, Value::object(base));
-                append(gc, r_extends, r_base);
+        define_dataclass(vm, r_module, r_imports, message, definition);
+        if (definitions) {
+            definitions->push_back(std::move(definition));
+        }
+    }
+
+    // Make a mixin type, adding it to the module (see compile_mixin()).
+    void define_mixin(VM& vm, Root<Assoc>& r_module, Root<Vector>& r_imports,
+                      const std::string& message, const CompileDefinition& definition)
+    {
+        GC& gc = vm.gc;
+
+        const std::string& mixin_name = definition.name;
+        LookupResult lookup = lookup_name(*r_module, *r_imports, mixin_name);
+        if (lookup == SUCCESS || lookup == AMBIGUOUS) {
+            std::stringstream ss;
+            ss << message << " mixin name '" << mixin_name
+               << "' already exists in module scope or in imports";
+            throw compile_error(ss.str(), definition.name_span);
+        }
+
+        Root<Vector> r_extends(gc, make_vector(gc, 0));
+        for (size_t i = 0; i < definition.bases.size(); i++) {
+            const std::string& base_name = definition.bases[i];
+            const SourceSpan& base_span = definition.base_spans[i];
+            Value lookup = lookup_name(*r_module, *r_imports, base_name, base_span);
+            if (!lookup.is_obj_type()) {
+                std::stringstream ss;
+                ss << "Value '" << base_name << "' must be a Type";
+                throw compile_error(ss.str(), base_span);
+            }
+
+            Type* base = lookup.obj_type();
+            if (base->sealed) {
+                std::stringstream ss;
+                ss << "Cannot extend from sealed type '" << base_name << "'";
+                throw compile_error(ss.str(), base_span);
+            }
+            if (base->kind != Type::Kind::MIXIN) {
+                throw compile_error("Mixins can only extend from mixins", base_span);
             }
+            ValueRoot r_base(gc, Value::object(base));
+            append(gc, r_extends, r_base);
         }
         Root<Array> r_bases(gc, vector_to_array(gc, r_extends));
 
         // TODO: allow specifying required methods? (i.e. checker for when we are later mixing-in)
         OptionalRoot<Array> r_slots(gc, nullptr);
+        Root<String> r_mixin_name(gc, intern(vm, mixin_name));
         Root<Type> r_type(gc,
                           make_type(gc,
                                     r_mixin_name,
@@ -1574,10 +2024,124 @@ namespace Katsu
         append(gc, r_module, r_key, rv_type);
     }
 
+    // receiver, extends are optional
+    // definitions: if given, the mixin definition is appended to it
+    void compile_mixin(VM& vm, Root<Assoc>& r_module, Root<Vector>& r_imports,
+                       const std::string& message, SourceSpan& span, Expr* receiver, Expr& name,
+                       Expr* extends, std::vector<CompileDefinition>* definitions)
+    {
+        if (receiver) {
+            std::stringstream ss;
+            ss << message << " takes no receiver";
+            throw compile_error(ss.str(), span);
+        }
+
+        NameExpr* name_expr = dynamic_cast<NameExpr*>(&name);
+        if (!name_expr) {
+            std::stringstream ss;
+            ss << message << " 'name' argument must be a name";
+            throw compile_error(ss.str(), name.span);
+        }
+        CompileDefinition definition{
+            .kind = CompileDefinition::Kind::MIXIN,
+            .name = std::string(std::get<std::string_view>(name_expr->name.value)),
+            .span = span,
+            .name_span = name.span,
+        };
+        if (extends) {
+            DataExpr* data_expr = dynamic_cast<DataExpr*>(extends);
+            if (!data_expr) {
+                std::stringstream ss;
+                ss << message << " 'extends' argument must be a vector of names";
+                throw compile_error(ss.str(), extends->span);
+            }
+            for (Expr* base_expr : data_expr->components) {
+                NameExpr* base_name_expr = dynamic_cast<NameExpr*>(base_expr);
+                if (!base_name_expr) {
+                    std::stringstream ss;
+                    ss << message << " 'extends' argument must be a sequence of names";
+                    throw compile_error(ss.str(), base_expr->span);
+                }
+                definition.bases.emplace_back(
+                    std::get<std::string_view>(base_name_expr->name.value));
+                definition.base_spans.push_back(base_expr->span);
+            }
+        }
+
+        define_mixin(vm, r_module, r_imports, message, definition);
+        if (definitions) {
+            definitions->push_back(std::move(definition));
+        }
+    }
+
+    // Make a module-level variable (see compile_into_module()), returning its Ref.
+    Value define_module_ref(VM& vm, Root<Assoc>& r_module, const std::string& name)
+    {
+        GC& gc = vm.gc;
+        Root<String> r_name(gc, intern(vm, name));
+        ValueRoot r_ref(gc, Value::null());
+        ValueRoot r_init(gc, Value::object(make_ref(gc, r_ref)));
+        ValueRoot r_key(gc, r_name.value());
+        append(gc, r_module, r_key, r_init);
+        return *r_init;
+    }
+
+    // Add an existing module to the imports (see compile_into_module()).
+    void import_existing_module(VM& vm, Root<Vector>& r_imports, const std::string& module_name,
+                                const SourceSpan& span)
+    {
+        Value* maybe_module = assoc_lookup(vm.v_modules.obj_assoc(), module_name);
+        if (!maybe_module) {
+            throw compile_error("IMPORT-EXISTING-MODULE: could not find existing module", span);
+        }
+        Value module = *maybe_module;
+        ValueRoot r_module(vm.gc, std::move(module));
+        append(vm.gc, r_imports, r_module);
+    }
+
+    void apply_definition(VM& vm, Root<Assoc>& r_module, Root<Vector>& r_imports,
+                          const CompileDefinition& definition)
+    {
+        switch (definition.kind) {
+            case CompileDefinition::Kind::MULTIMETHOD: {
+                Root<String> r_method_name(vm.gc, intern(vm, definition.name));
+                define_method_multimethod(vm,
+                                          r_module,
+                                          r_imports,
+                                          r_method_name,
+                                          definition.num_params,
+                                          definition.allow_existing,
+                                          definition.global,
+                                          definition.decl_only,
+                                          definition.span);
+                break;
+            }
+            case CompileDefinition::Kind::MODULE_REF: {
+                define_module_ref(vm, r_module, definition.name);
+                break;
+            }
+            case CompileDefinition::Kind::DATACLASS: {
+                define_dataclass(vm, r_module, r_imports, "data:extends:has:", definition);
+                break;
+            }
+            case CompileDefinition::Kind::MIXIN: {
+                define_mixin(vm, r_module, r_imports, "mixin:", definition);
+                break;
+            }
+            case CompileDefinition::Kind::IMPORT_EXISTING_MODULE: {
+                import_existing_module(vm, r_imports, definition.name, definition.span);
+                break;
+            }
+        }
+    }
+
     Code* compile_into_module(VM& vm, Root<Assoc>& r_module, Root<Vector>& r_imports,
                               SourceSpan& span,
-                              std::vector<std::unique_ptr<Expr>>& module_top_level_exprs)
+                              std::vector<Expr*>& module_top_level_exprs,
+                              CompileJournal* journal, std::shared_ptr<ExprArena> lazy_arena)
     {
+        // A journal can't name what a body which isn't compiled yet will refer to.
+        ASSERT_ARG_MSG(!journal || !lazy_arena, "can't journal lazily compiled method bodies");
         // TODO: for future -- first find all multimethod definitions, add them to module (with zero
         // methods defined), and then go and compile everything.
         GC& gc = vm.gc;
@@ -1600,7 +2164,13 @@ namespace Katsu
             .r_upreg_loading = r_upreg_loading,
             .bindings = {},
             .base = nullptr,
+            .lookups = journal ? &journal->lookups : nullptr,
+            .lazy_arena = std::move(lazy_arena),
         };
+        for (Expr* top_level_expr : module_top_level_exprs) {
+            collect_captured_names(*top_level_expr, /* in_block */ false, builder.captured_names);
+        }
+        std::vector<CompileDefinition>* definitions = journal ? &journal->definitions : nullptr;
         // TODO: something less hacky? All Code is built assuming that local @0 is the default
         // receiver. For top level code, there isn't really a default receiver (other than null, I
         // suppose).
@@ -1608,113 +2178,112 @@ namespace Katsu
         // The VM loads call frame registers with nulls when setting up a frame, so we don't need to
         // have bytecode actually write a null into local @0.
 
-        for (std::unique_ptr<Expr>& top_level_expr : module_top_level_exprs) {
+        for (Expr* top_level_expr : module_top_level_exprs) {
             // TODO: handle let:do:[::] as a builtin, looked up in module.
-            if (NAryMessageExpr* expr = dynamic_cast<NAryMessageExpr*>(top_level_expr.get())) {
+            if (NAryMessageExpr* expr = dynamic_cast<NAryMessageExpr*>(top_level_expr)) {
                 if (expr->messages.size() == 2 &&
-                    std::get<std::string>(expr->messages[0].value) == "let" &&
-                    std::get<std::string>(expr->messages[1].value) == "do") {
-                    compile_method(gc,
-                                   vm.v_multimethods,
+                    std::get<std::string_view>(expr->messages[0].value) == "let" &&
+                    std::get<std::string_view>(expr->messages[1].value) == "do") {
+                    compile_method(vm,
                                    true /* allow_existing */,
                                    true /* global */,
                                    builder,
                                    "let:do:",
                                    expr->span,
-                                   expr->target ? expr->target->get() : nullptr,
+                                   expr->target.value_or(nullptr),
                                    *expr->args[0],
-                                   expr->args[1].get(),
-                                   nullptr);
+                                   expr->args[1],
+                                   nullptr,
+                                   definitions);
                     continue;
                 } else if (expr->messages.size() == 3 &&
-                           std::get<std::string>(expr->messages[0].value) == "let" &&
-                           std::get<std::string>(expr->messages[1].value) == "do" &&
-                           std::get<std::string>(expr->messages[2].value) == ":"
+                           std::get<std::string_view>(expr->messages[0].value) == "let" &&
+                           std::get<std::string_view>(expr->messages[1].value) == "do" &&
+                           std::get<std::string_view>(expr->messages[2].value) == ":"
 
                 ) {
-                    compile_method(gc,
-                                   vm.v_multimethods,
+                    compile_method(vm,
                                    true /* allow_existing */,
                                    true /* global */,
                                    builder,
                                    "let:do:::",
                                    expr->span,
-                                   expr->target ? expr->target->get() : nullptr,
+                                   expr->target.value_or(nullptr),
                                    *expr->args[0],
-                                   expr->args[1].get(),
-                                   expr->args[2].get());
+                                   expr->args[1],
+                                   expr->args[2],
+                                   definitions);
                     continue;
                 } else if (expr->messages.size() == 2 &&
-                           std::get<std::string>(expr->messages[0].value) == "let/local" &&
-                           std::get<std::string>(expr->messages[1].value) == "do") {
-                    compile_method(gc,
-                                   vm.v_multimethods,
+                           std::get<std::string_view>(expr->messages[0].value) == "let/local" &&
+                           std::get<std::string_view>(expr->messages[1].value) == "do") {
+                    compile_method(vm,
                                    true /* allow_existing */,
                                    false /* global */,
                                    builder,
                                    "let/local:do:",
                                    expr->span,
-                                   expr->target ? expr->target->get() : nullptr,
+                                   expr->target.value_or(nullptr),
                                    *expr->args[0],
-                                   expr->args[1].get(),
-                                   nullptr);
+                                   expr->args[1],
+                                   nullptr,
+                                   definitions);
                     continue;
                 } else if (expr->messages.size() == 3 &&
-                           std::get<std::string>(expr->messages[0].value) == "let/local" &&
-                           std::get<std::string>(expr->messages[1].value) == "do" &&
-                           std::get<std::string>(expr->messages[2].value) == ":"
+                           std::get<std::string_view>(expr->messages[0].value) == "let/local" &&
+                           std::get<std::string_view>(expr->messages[1].value) == "do" &&
+                           std::get<std::string_view>(expr->messages[2].value) == ":"
 
                 ) {
-                    compile_method(gc,
-                                   vm.v_multimethods,
+                    compile_method(vm,
                                    true /* allow_existing */,
                                    false /* global */,
                                    builder,
                                    "let/local:do:::",
                                    expr->span,
-                                   expr->target ? expr->target->get() : nullptr,
+                                   expr->target.value_or(nullptr),
                                    *expr->args[0],
-                                   expr->args[1].get(),
-                                   expr->args[2].get());
+                                   expr->args[1],
+                                   expr->args[2],
+                                   definitions);
                     continue;
                 } else if (expr->messages.size() == 1 &&
-                           std::get<std::string>(expr->messages[0].value) == "generic") {
-                    compile_method(gc,
-                                   vm.v_multimethods,
+                           std::get<std::string_view>(expr->messages[0].value) == "generic") {
+                    compile_method(vm,
                                    false /* allow_existing */,
                                    true /* global */,
                                    builder,
                                    "generic:",
                                    expr->span,
-                                   expr->target ? expr->target->get() : nullptr,
+                                   expr->target.value_or(nullptr),
                                    *expr->args[0],
                                    nullptr,
-                                   nullptr);
+                                   nullptr,
+                                   definitions);
                     continue;
                 } else if (expr->messages.size() == 1 &&
-                           std::get<std::string>(expr->messages[0].value) == "defer") {
-                    compile_method(gc,
-                                   vm.v_multimethods,
+                           std::get<std::string_view>(expr->messages[0].value) == "defer") {
+                    compile_method(vm,
                                    true /* allow_existing */,
                                    true /* global */,
                                    builder,
                                    "defer:",
                                    expr->span,
-                                   expr->target ? expr->target->get() : nullptr,
+                                   expr->target.value_or(nullptr),
                                    *expr->args[0],
                                    nullptr,
-                                   nullptr);
+                                   nullptr,
+                                   definitions);
                     continue;
                 } else if (expr->messages.size() == 1 &&
-                           std::get<std::string>(expr->messages[0].value) == "let") {
+                           std::get<std::string_view>(expr->messages[0].value) == "let") {
                     if (expr->target) {
                         throw compile_error("let: requires no target", expr->span);
                     }
-                    if (BinaryOpExpr* b = dynamic_cast<BinaryOpExpr*>(expr->args[0].get())) {
-                        if (std::get<std::string>(b->op.value) == "=") {
-                            if (NameExpr* n = dynamic_cast<NameExpr*>(b->left.get())) {
-                                const std::string& name = std::get<std::string>(n->name.value);
-                                Root<String> r_name(gc, make_string(gc, name));
+                    if (BinaryOpExpr* b = dynamic_cast<BinaryOpExpr*>(expr->args[0])) {
+                        if (std::get<std::string_view>(b->op.value) == "=") {
+                            if (NameExpr* n = dynamic_cast<NameExpr*>(b->left)) {
+                                std::string name(std::get<std::string_view>(n->name.value));
                                 // Compile initial value _without_ the new binding established.
                                 compile_expr(gc,
                                              builder,
@@ -1725,16 +2294,21 @@ namespace Katsu
                                 // TODO: the module append should be done by the compiled code.
                                 // also don't make it a Ref, this is more like a module level
                                 // `mut:`.
-                                ValueRoot r_ref(gc, Value::null());
-                                ValueRoot r_init(gc, Value::object(make_ref(gc, r_ref)));
-                                ValueRoot r_key(gc, r_name.value());
-                                append(gc, r_module, r_key, r_init);
+                                ValueRoot r_init(gc, define_module_ref(vm, r_module, name));
+                                if (definitions) {
+                                    definitions->push_back(CompileDefinition{
+                                        .kind = CompileDefinition::Kind::MODULE_REF,
+                                        .name = name,
+                                        .span = n->name.span,
+                                    });
+                                }
                                 // STORE_MODULE: <ref value>
                                 builder.emit_op(gc,
                                                 OpCode::STORE_MODULE,
                                                 /* stack_height_delta */ -1,
                                                 n->name.span);
                                 builder.emit_arg(gc, r_init);
+                                builder.note_lookup(name);
                                 // LOAD:VALUE: null
                                 builder.emit_op(gc,
                                                 OpCode::LOAD_VALUE,
@@ -1746,79 +2320,79 @@ namespace Katsu
                         }
                     }
                 } else if (expr->messages.size() == 2 &&
-                           std::get<std::string>(expr->messages[0].value) == "data" &&
-                           std::get<std::string>(expr->messages[1].value) == "has") {
-                    compile_dataclass(gc,
-                                      vm.v_multimethods,
+                           std::get<std::string_view>(expr->messages[0].value) == "data" &&
+                           std::get<std::string_view>(expr->messages[1].value) == "has") {
+                    compile_dataclass(vm,
                                       r_module,
                                       r_imports,
                                       "data:extends:has:",
                                       expr->span,
-                                      expr->target ? expr->target->get() : nullptr,
+                                      expr->target.value_or(nullptr),
                                       *expr->args[0],
                                       nullptr,
-                                      *expr->args[1]);
+                                      *expr->args[1],
+                                      definitions);
                     continue;
                 } else if (expr->messages.size() == 3 &&
-                           std::get<std::string>(expr->messages[0].value) == "data" &&
-                           std::get<std::string>(expr->messages[1].value) == "extends" &&
-                           std::get<std::string>(expr->messages[2].value) == "has") {
-                    compile_dataclass(gc,
-                                      vm.v_multimethods,
+                           std::get<std::string_view>(expr->messages[0].value) == "data" &&
+                           std::get<std::string_view>(expr->messages[1].value) == "extends" &&
+                           std::get<std::string_view>(expr->messages[2].value) == "has") {
+                    compile_dataclass(vm,
                                       r_module,
                                       r_imports,
                                       "data:extends:has:",
                                       expr->span,
-                                      expr->target ? expr->target->get() : nullptr,
+                                      expr->target.value_or(nullptr),
                                       *expr->args[0],
-                                      expr->args[1].get(),
-                                      *expr->args[2]);
+                                      expr->args[1],
+                                      *expr->args[2],
+                                      definitions);
                     continue;
                 } else if (expr->messages.size() == 1 &&
-                           std::get<std::string>(expr->messages[0].value) == "mixin") {
-                    compile_mixin(gc,
+                           std::get<std::string_view>(expr->messages[0].value) == "mixin") {
+                    compile_mixin(vm,
                                   r_module,
                                   r_imports,
                                   "mixin:",
                                   expr->span,
-                                  expr->target ? expr->target->get() : nullptr,
+                                  expr->target.value_or(nullptr),
                                   *expr->args[0],
-                                  nullptr);
+                                  nullptr,
+                                     definitions);
                     continue;
                 } else if (expr->messages.size() == 2 &&
-                           std::get<std::string>(expr->messages[0].value) == "mixin" &&
-                           std::get<std::string>(expr->messages[1].value) == "extends") {
-                    compile_mixin(gc,
+                           std::get<std::string_view>(expr->messages[0].value) == "mixin" &&
+                           std::get<std::string_view>(expr->messages[1].value) == "extends") {
+                    compile_mixin(vm,
                                   r_module,
                                   r_imports,
                                   "mixin:",
                                   expr->span,
-                                  expr->target ? expr->target->get() : nullptr,
+                                  expr->target.value_or(nullptr),
                                   *expr->args[0],
-                                  expr->args[1].get());
+                                  expr->args[1],
+                                     definitions);
                     continue;
                 } else if (expr->messages.size() == 1 &&
-                           std::get<std::string>(expr->messages[0].value) ==
+                           std::get<std::string_view>(expr->messages[0].value) ==
                                "IMPORT-EXISTING-MODULE") {
                     if (expr->target) {
                         throw compile_error("IMPORT-EXISTING-MODULE: requires no target",
                                             expr->span);
                     }
-                    if (LiteralExpr* l = dynamic_cast<LiteralExpr*>(expr->args[0].get())) {
-                        const std::string* maybe_module_name =
-                            std::get_if<std::string>(&l->literal.value);
+                    if (LiteralExpr* l = dynamic_cast<LiteralExpr*>(expr->args[0])) {
+                        const std::string_view* maybe_module_name =
+                            std::get_if<std::string_view>(&l->literal.value);
                         if (maybe_module_name) {
-                            const std::string& module_name = *maybe_module_name;
-                            String* name = make_string(gc, module_name);
-                            Value* maybe_module = assoc_lookup(vm.v_modules.obj_assoc(), name);
-                            if (!maybe_module) {
-                                throw compile_error(
-                                    "IMPORT-EXISTING-MODULE: could not find existing module",
-                                    expr->span);
+                            std::string module_name(*maybe_module_name);
+                            import_existing_module(vm, r_imports, module_name, expr->span);
+                            if (definitions) {
+                                definitions->push_back(CompileDefinition{
+                                    .kind = CompileDefinition::Kind::IMPORT_EXISTING_MODULE,
+                                    .name = module_name,
+                                    .span = expr->span,
+                                });
                             }
-                            Value module = *maybe_module;
-                            ValueRoot r_module(vm.gc, std::move(module));
-                            append(vm.gc, r_imports, r_module);
                             continue;
                         } else {
                             throw compile_error("IMPORT-EXISTING-MODULE: requires a literal string",
@@ -5,6 +5,10 @@
 #include "gc.h"
 #include "value.h"
 
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace Katsu
 {
     class compile_error : public condition_error
@@ -24,10 +28,106 @@ namespace Katsu
         const SourceSpan span;
     };
 
+    enum LookupResult
+    {
+        SUCCESS,
+        NOT_FOUND,
+        AMBIGUOUS,
+    };
+    // Look up a name as compiled code would: in the module, and then in its imports (see
+    // compile_into_module()). The out-var `result` is only populated on SUCCESS.
+    LookupResult lookup_module_name(Assoc* module, Vector* imports, const std::string& name,
+                                    Value* result);
+
+    // Something compile_into_module() defines at compile time, rather than by way of the code it
+    // returns: a multimethod, module variable or type added to the module (or to the global
+    // multimethods), or a module added to the imports. Making the same definitions in the same
+    // state (see apply_definition()) has the same effects as compiling did.
+    struct CompileDefinition
+    {
+        enum class Kind
+        {
+            // A multimethod for let:do: and friends (with `num_params` and the three flags).
+            MULTIMETHOD,
+            // A module-level variable from let: (just the name).
+            MODULE_REF,
+            // A dataclass from data:, with `bases` and `slots`.
+            DATACLASS,
+            // A mixin from mixin:, with `bases`.
+            MIXIN,
+            // An existing module added to the imports by IMPORT-EXISTING-MODULE:.
+            IMPORT_EXISTING_MODULE,
+        };
+
+        Kind kind;
+        std::string name;
+        SourceSpan span;
+        // DATACLASS and MIXIN only: span of the type name.
+        SourceSpan name_span;
+        uint32_t num_params = 0;
+        bool allow_existing = false;
+        bool global = false;
+        bool decl_only = false;
+        std::vector<std::string> bases;
+        std::vector<SourceSpan> base_spans;
+        std::vector<std::string> slots;
+    };
+
+    // What compile_into_module() did besides returning code: the definitions it made, in order,
+    // and the names it looked up values for (which the code then refers to directly).
+    struct CompileJournal
+    {
+        std::vector<CompileDefinition> definitions;
+        std::vector<std::string> lookups;
+    };
+
+    // Make a definition in the module and its imports, exactly as compiling it first did.
+    void apply_definition(VM& vm, Root<Assoc>& r_module, Root<Vector>& r_imports,
+                          const CompileDefinition& definition);
+
     // The imports are a vector of (expected to be) assocs. Any non-assocs are ignored,
     // and assocs are used as extra names / values that are usable by the expression under
     // compilation.
+    // If `journal` is given, it is filled in as well.
+    // If `lazy_arena` is given (which must be the arena holding the expressions), method bodies
+    // aren't compiled yet, but on each method's first invocation instead (see LazyMethodBody).
     Code* compile_into_module(VM& vm, Root<Assoc>& r_module, Root<Vector>& r_imports,
                               SourceSpan& span,
-                              std::vector<std::unique_ptr<Expr>>& module_top_level_exprs);
+                              std::vector<Expr*>& module_top_level_exprs,
+                              CompileJournal* journal = nullptr,
+                              std::shared_ptr<ExprArena> lazy_arena = nullptr);
+
+    // A method body left to compile when the method is first invoked. Until then the method's
+    // code is a stub: a Tuple of [id, module, imports], where the id is this body's index in
+    // VM::lazy_method_bodies, and the imports are a copy of those at the definition. Compiling
+    // replaces the id with the Code, for any other method made from the same stub to pick up.
+    //
+    // Names in the body are looked up only then, but just among what the module had at the
+    // definition, so that they mean what they would have when compiling eagerly. (A compile error
+    // in the body is still raised from the invocation, though.)
+    struct LazyMethodBody
+    {
+        Value v_stub; // Tuple
+        // Keeps the body's expressions alive.
+        std::shared_ptr<ExprArena> arena;
+        Expr* body;
+        std::vector<std::string> param_names;
+        SourceSpan span;
+        // How many entries the module had at the definition.
+        uint64_t module_length;
+    };
+
+    inline bool is_lazy_code_stub(Value v_code)
+    {
+        return v_code.is_obj_tuple();
+    }
+
+    // Compile the body of a method whose code is a lazy stub, if that hasn't been done already,
+    // and give the method the resulting code. Returns the method (which may have moved). The
+    // arguments it's being invoked with are kept rooted meanwhile.
+    Method* compile_lazy_method(VM& vm, Method* method, int64_t num_args, Value* args);
+
+    // Compile every method body still waiting to be, such as before saving a heap image (which
+    // can't hold the waiting bodies). Methods pick up their code from their stubs when invoked.
+    void compile_lazy_methods(VM& vm);
 };
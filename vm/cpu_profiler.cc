@@ -0,0 +1,164 @@
+#include "cpu_profiler.h"
+
+#include "value_utils.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace Katsu
+{
+    // The running profiler, if any, and the flag its signal handler sets.
+    static CpuProfiler* running = nullptr;
+    static volatile std::sig_atomic_t* volatile running_sample_due = nullptr;
+    static struct sigaction previous_action;
+
+    static void handle_sigprof(int)
+    {
+        if (volatile std::sig_atomic_t* due = running_sample_due) {
+            *due = 1;
+        }
+    }
+
+    CpuProfiler::CpuProfiler(VM& vm, uint64_t interval_us)
+        : vm(vm)
+        , has_timer(false)
+        , timer{}
+        , locations{}
+        , location_ids{}
+        , spot_locations{}
+        , num_collections(vm.gc.num_collections)
+        , stacks{}
+        , total_samples(0)
+        , stack{}
+    {
+        if (running) {
+            throw std::runtime_error("a CPU profiler is already running");
+        }
+        running = this;
+        running_sample_due = &vm.cpu_sample_due;
+        if (interval_us == 0) {
+            return;
+        }
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = &handle_sigprof;
+        sigemptyset(&action.sa_mask);
+        // Otherwise blocking syscalls (say, in a native) would fail with EINTR.
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGPROF, &action, &previous_action);
+
+        // Count CPU time on this thread alone, and deliver the signal to this thread too, so it
+        // never interrupts (say) a GC worker thread instead.
+        struct sigevent event;
+        memset(&event, 0, sizeof(event));
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = SIGPROF;
+        event._sigev_un._tid = gettid();
+        struct itimerspec spec;
+        spec.it_interval.tv_sec = interval_us / 1000000;
+        spec.it_interval.tv_nsec = (interval_us % 1000000) * 1000;
+        spec.it_value = spec.it_interval;
+        if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &this->timer) != 0) {
+            sigaction(SIGPROF, &previous_action, nullptr);
+            running = nullptr;
+            running_sample_due = nullptr;
+            throw std::runtime_error("could not create a CPU profiling timer");
+        }
+        this->has_timer = true;
+        timer_settime(this->timer, 0, &spec, nullptr);
+    }
+
+    CpuProfiler::~CpuProfiler()
+    {
+        if (this->has_timer) {
+            timer_delete(this->timer);
+            sigaction(SIGPROF, &previous_action, nullptr);
+        }
+        running_sample_due = nullptr;
+        running = nullptr;
+        this->vm.cpu_sample_due = 0;
+    }
+
+    uint32_t CpuProfiler::location_of(Frame* frame, bool innermost)
+    {
+        // Each frame but the innermost is just past the call it's waiting on.
+        uint32_t inst_spot = frame->inst_spot;
+        if (!innermost && inst_spot > 0) {
+            inst_spot--;
+        }
+        auto key = std::make_pair(static_cast<Object*>(frame->v_code.obj_code()), inst_spot);
+        auto cached = this->spot_locations.find(key);
+        if (cached != this->spot_locations.end()) {
+            return cached->second;
+        }
+
+        Code* code = frame->v_code.obj_code();
+        Array* spans = code->v_inst_spans.obj_array();
+        // See convert_span() in compile.cc.
+        Value* span = (inst_spot < spans->length ? spans->components()[inst_spot] : code->v_span)
+                          .obj_tuple()
+                          ->components();
+        std::string location =
+            native_str(span[0].obj_string()) + ":" + std::to_string(span[2].fixnum() + 1);
+
+        uint32_t id;
+        auto it = this->location_ids.find(location);
+        if (it != this->location_ids.end()) {
+            id = it->second;
+        } else {
+            id = this->locations.size();
+            this->locations.push_back(location);
+            this->location_ids.emplace(std::move(location), id);
+        }
+        this->spot_locations.emplace(key, id);
+        return id;
+    }
+
+    void CpuProfiler::sample()
+    {
+        // Code may have moved since the last sample.
+        if (this->vm.gc.num_collections != this->num_collections) {
+            this->spot_locations.clear();
+            this->num_collections = this->vm.gc.num_collections;
+        }
+
+        this->stack.clear();
+        Frame* innermost = OpenVM(this->vm).frame();
+        for (Frame* frame = innermost; frame; frame = frame->caller) {
+            if (this->stack.size() == MAX_DEPTH) {
+                if (this->location_ids.find("...") == this->location_ids.end()) {
+                    this->location_ids.emplace("...", this->locations.size());
+                    this->locations.push_back("...");
+                }
+                this->stack.push_back(this->location_ids.at("..."));
+                break;
+            }
+            this->stack.push_back(this->location_of(frame, frame == innermost));
+        }
+        this->stacks[this->stack]++;
+        this->total_samples++;
+    }
+
+    void CpuProfiler::report_folded(std::ostream& out) const
+    {
+        std::vector<std::pair<std::string, uint64_t>> lines;
+        for (const auto& [stack, count] : this->stacks) {
+            std::string line;
+            for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+                if (!line.empty()) {
+                    line += ";";
+                }
+                line += this->locations[*it];
+            }
+            lines.emplace_back(line.empty() ? "<native>" : line, count);
+        }
+        std::sort(lines.begin(), lines.end());
+        for (const auto& [line, count] : lines) {
+            out << line << " " << count << "\n";
+        }
+    }
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "value.h"
+#include "vm.h"
+
+#include <ctime>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Katsu
+{
+    // Sampling CPU profiler over Katsu call stacks. A timer signal (SIGPROF) goes off for every
+    // `interval` of CPU time spent by the thread which started the profiler, and just marks a
+    // sample as due (see VM::cpu_sample_due); the VM then calls sample() at its next invocation,
+    // where the call stack is sure to be walkable. Each frame of a sample is resolved to the path
+    // and line of its current instruction's span (or for the innermost frame, of the call about to
+    // be made); since collections move code around, that's cached only until the next one.
+    //
+    // Samples are reported as folded stacks, as taken by flamegraph.pl and similar tools.
+    //
+    // Only one CpuProfiler may be running at a time in a process.
+    class CpuProfiler
+    {
+    public:
+        // Start profiling `vm` on the calling thread, sampling every `interval_us` microseconds of
+        // CPU time, until destroyed. An interval of 0 sets no timer, so that samples are only
+        // taken whenever something else sets vm.cpu_sample_due. Throws std::runtime_error if
+        // another profiler is running, or there is no timer to be had.
+        CpuProfiler(VM& vm, uint64_t interval_us);
+        ~CpuProfiler();
+
+        // Record the current call stack. Doesn't allocate in the GC.
+        void sample();
+
+        // Print one line per distinct stack sampled: its frames, outermost first and separated by
+        // ';', then the number of samples.
+        void report_folded(std::ostream& out) const;
+
+        uint64_t num_samples() const
+        {
+            return this->total_samples;
+        }
+
+    private:
+        // Frames past this many (counting from the innermost) are left out of a sample, and
+        // replaced with a single "..." frame.
+        static const size_t MAX_DEPTH = 1024;
+
+        // Index into `locations` of where a frame is.
+        uint32_t location_of(Frame* frame, bool innermost);
+
+        VM& vm;
+        bool has_timer;
+        timer_t timer;
+
+        std::vector<std::string> locations;
+        std::unordered_map<std::string, uint32_t> location_ids;
+        struct FrameSpotHash
+        {
+            size_t operator()(const std::pair<Object*, uint32_t>& key) const
+            {
+                return std::hash<Object*>()(key.first) ^ (static_cast<size_t>(key.second) << 1);
+            }
+        };
+        // (Code, instruction index) to location id, as of `num_collections`.
+        std::unordered_map<std::pair<Object*, uint32_t>, uint32_t, FrameSpotHash> spot_locations;
+        uint64_t num_collections;
+
+        // Number of samples of each stack (of location ids, innermost first).
+        std::map<std::vector<uint32_t>, uint64_t> stacks;
+        uint64_t total_samples;
+        // Scratch space for sample(), kept to save reallocating it.
+        std::vector<uint32_t> stack;
+    };
+};
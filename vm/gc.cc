@@ -3,35 +3,84 @@
 #include "assertions.h"
 #include "vm.h" // for Frame
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#if DEBUG_GC_VERIFY_REMEMBERED
+#include <set>
+#endif
 
 namespace Katsu
 {
-    GC::GC(uint64_t size)
+    GC::GC(uint64_t size, uint64_t nursery_size, uint64_t max_size)
         : root_providers{}
         , roots{}
+        , num_collections(0)
+        , stats{}
+        , num_types(0)
+        , target_occupancy(0.5)
+        , large_object_size(32 * 1024)
+        , num_threads(GC_DEFAULT_THREADS)
+        , parallel_collection_size(1024 * 1024)
         , mem(nullptr)
         , size(0)
+        , limit(0)
+        , initial_size(size)
+        , max_size(std::max(size, max_size))
         , mem_opp(nullptr)
         , spot(0)
+        , alloc_mark(0)
+        , nursery(nullptr)
+        , nursery_size(0)
+        , nursery_spot(0)
+        , nursery_limit(0)
+        , remembered{}
+        , large_objects{}
+        , large_bytes(0)
+        , large_limit(size)
+        , large_marked{}
+        , sampler(nullptr)
+        , sample_interval(0)
+        , sample_countdown(0)
+        , sampled{}
     {
         ASSERT_ARG_MSG((size & TAG_MASK) == 0, "size must be TAG_BITS-aligned");
+        ASSERT_ARG_MSG((nursery_size & TAG_MASK) == 0, "nursery_size must be TAG_BITS-aligned");
+        ASSERT_ARG_MSG((max_size & TAG_MASK) == 0, "max_size must be TAG_BITS-aligned");
 
         this->mem = reinterpret_cast<uint8_t*>(aligned_alloc(1 << TAG_BITS, size));
         if (!this->mem) {
             throw std::bad_alloc();
         }
         this->size = size;
+        this->limit = size;
 
         this->mem_opp = reinterpret_cast<uint8_t*>(aligned_alloc(1 << TAG_BITS, size));
         if (!this->mem_opp) {
             throw std::bad_alloc();
         }
 
+        if (nursery_size > 0) {
+            this->nursery = reinterpret_cast<uint8_t*>(aligned_alloc(1 << TAG_BITS, nursery_size));
+            if (!this->nursery) {
+                throw std::bad_alloc();
+            }
+            this->nursery_size = nursery_size;
+            this->reset_nursery_limit();
+        }
+        this->stats.peak_heap_size = this->size + this->nursery_size;
+
 #if DEBUG_GC_FILL
         memset(this->mem, 0x42, this->size);
         memset(this->mem_opp, 0x42, this->size);
+        if (this->nursery) {
+            memset(this->nursery, 0x42, this->nursery_size);
+        }
 #endif
     }
 
@@ -43,35 +92,509 @@ namespace Katsu
         if (this->mem_opp) {
             free(this->mem_opp);
         }
+        if (this->nursery) {
+            free(this->nursery);
+        }
+        for (LargeObject& large : this->large_objects) {
+            free(large.object);
+        }
     }
 
-    // Get the number of slots of a dataclass-kind type. May have to follow forwarding pointers!
-    uint64_t get_num_slots(Value v_type)
+    void GCStats::record_pause(uint64_t pause_ns)
+    {
+        int bucket = std::min((int)std::bit_width(pause_ns / 1000), NUM_PAUSE_BUCKETS - 1);
+        this->pause_histogram[bucket]++;
+        this->total_pause_ns += pause_ns;
+        this->max_pause_ns = std::max(this->max_pause_ns, pause_ns);
+    }
+
+    void GC::print_stats(std::ostream& out) const
+    {
+        const GCStats& stats = this->stats;
+        out << "GC stats:\n";
+        out << "  collections: " << stats.num_minor_collections << " minor, "
+            << stats.num_full_collections << " full (" << stats.num_parallel_collections
+            << " of them parallel)\n";
+        out << "  pause time: " << stats.total_pause_ns / 1000 << "us total, "
+            << stats.max_pause_ns / 1000 << "us max\n";
+        out << "  pauses by duration:";
+        for (int i = 0; i < GCStats::NUM_PAUSE_BUCKETS; i++) {
+            if (stats.pause_histogram[i] == 0) {
+                continue;
+            }
+            if (i == 0) {
+                out << " <1us";
+            } else if (i == GCStats::NUM_PAUSE_BUCKETS - 1) {
+                out << " >=" << (1ull << (i - 1)) << "us";
+            } else {
+                out << " " << (1ull << (i - 1)) << "-" << (1ull << i) << "us";
+            }
+            out << ": " << stats.pause_histogram[i] << ";";
+        }
+        out << "\n";
+        out << "  allocated: " << this->bytes_allocated() << " bytes\n";
+        out << "  survived: " << stats.bytes_survived << " bytes total, " << stats.last_survived
+            << " bytes in the last collection\n";
+        out << "  heap: " << this->size << " bytes main region, " << this->nursery_size
+            << " bytes nursery, " << this->large_bytes << " bytes large objects\n";
+        out << "  peak heap: " << stats.peak_heap_size << " bytes\n";
+    }
+
+    void GC::fold_allocated()
+    {
+        this->stats.bytes_allocated = this->bytes_allocated();
+    }
+
+    void GC::finish_stats(std::chrono::steady_clock::time_point start, uint64_t survived)
+    {
+        this->alloc_mark = this->spot;
+        this->stats.record_pause(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now() - start)
+                                     .count());
+        this->stats.bytes_survived += survived;
+        this->stats.last_survived = survived;
+        this->stats.peak_heap_size = std::max(this->stats.peak_heap_size,
+                                              this->size + this->nursery_size + this->large_bytes);
+    }
+
+    void GC::set_sampler(AllocationSampler* sampler, uint64_t interval)
+    {
+        ASSERT_ARG_MSG(!sampler || interval > 0, "sampling interval must be positive");
+        this->sampler = sampler;
+        this->sample_interval = interval;
+        this->sample_countdown = interval;
+        this->sampled.clear();
+    }
+
+    void GC::_sample(Object* object, uint64_t size)
+    {
+        if (size < this->sample_countdown) {
+            this->sample_countdown -= size;
+            return;
+        }
+        // The object may span several sampling points.
+        uint64_t past = size - this->sample_countdown;
+        uint64_t weight = (1 + past / this->sample_interval) * this->sample_interval;
+        this->sample_countdown = this->sample_interval - past % this->sample_interval;
+        uint32_t site = this->sampler->sample(object, size, weight);
+        this->sampled.push_back(SampledObject{object, site, weight});
+    }
+
+    void GC::update_samples(bool full)
+    {
+        size_t kept = 0;
+        for (SampledObject& sample : this->sampled) {
+            Object* obj = sample.object;
+            bool live;
+            if (obj->is_forwarding()) {
+                sample.object = reinterpret_cast<Object*>(obj->forwarding());
+                live = true;
+            } else if (full) {
+                // Large objects are only marked, but anything else live was copied.
+                live = obj->is_large() && obj->is_marked();
+            } else {
+                // Only young objects move (or die) in a minor collection.
+                live = !this->is_young(obj);
+            }
+            if (live) {
+                this->sampled[kept++] = sample;
+            }
+        }
+        this->sampled.resize(kept);
+    }
+
+    void GC::remember_roots()
+    {
+        for (Value* root : this->roots) {
+            if (root->is_object()) {
+                this->remember(root->object());
+            }
+        }
+    }
+
+    void GC::reset_nursery_limit()
     {
-        Type* _class;
+        this->nursery_limit = std::min(this->nursery_size, this->limit - this->spot);
+    }
+
+    uint64_t GC::heap_target(uint64_t usage)
+    {
+        // Also leave room to promote a full nursery.
+        double target = (double)usage / this->target_occupancy + (double)this->nursery_size;
+        if (target >= (double)this->max_size) {
+            return this->max_size;
+        }
+        return std::max(this->initial_size, align_up((uint64_t)target, TAG_BITS));
+    }
+
+    bool GC::grow_for(uint64_t size)
+    {
+        uint64_t needed = this->spot + this->nursery_spot + size;
+        if (needed > this->max_size) {
+            return false;
+        }
+        uint64_t target = std::max(this->heap_target(needed), needed);
+        if (target > this->size) {
+            this->collect_into(target, size);
+        }
+        this->limit = std::max(this->limit, std::min(target, this->size));
+        if (this->nursery) {
+            this->reset_nursery_limit();
+        }
+        return size <= this->limit - this->spot;
+    }
+
+    uint8_t* GC::_alloc_slow(uint64_t size)
+    {
+        if (size > this->max_size) [[unlikely]] {
+            throw std::bad_alloc();
+        }
+
+        if (!this->nursery) {
+            this->collect();
+            if (size > this->limit - this->spot && !this->grow_for(size)) {
+                // No room even after collection -- we're really out of memory!
+                throw std::bad_alloc();
+            }
+            uint8_t* allocation = &this->mem[this->spot];
+            this->spot += size;
+            return allocation;
+        }
+
+        if (size > this->nursery_size / 4) {
+            // Too large to be worth copying out of the nursery; allocate it directly in the main
+            // region. Leave enough room to still promote everything in the nursery.
+#if DEBUG_GC_COLLECT_EVERY_ALLOC
+            {
+#else
+            if (size + this->nursery_spot > this->limit - this->spot) {
+#endif
+                this->collect();
+                if (size > this->limit - this->spot && !this->grow_for(size)) {
+                    throw std::bad_alloc();
+                }
+            }
+            uint8_t* allocation = &this->mem[this->spot];
+            this->spot += size;
+            this->stats.bytes_allocated += size;
+            this->reset_nursery_limit();
+            // The new object will be initialized without write barriers, so it may well end up
+            // referring to young objects.
+            this->remembered.push_back(reinterpret_cast<Object*>(allocation));
+            return allocation;
+        }
+
+#if !DEBUG_GC_COLLECT_EVERY_ALLOC
+        if (size > this->nursery_limit - this->nursery_spot)
+#endif
         {
-            Object* o_type = v_type.value<Object*>();
-            if (o_type->is_forwarding()) {
-                o_type = reinterpret_cast<Object*>(o_type->forwarding());
+            this->collect_minor();
+            if (this->limit - this->spot < this->nursery_size) {
+                // Not enough room left to promote a full nursery; clean up the main region too.
+                this->collect();
+            }
+            if (size > this->nursery_limit - this->nursery_spot &&
+                !(this->grow_for(this->nursery_size) &&
+                  size <= this->nursery_limit - this->nursery_spot)) {
+                throw std::bad_alloc();
             }
-            _class = o_type->object<Type*>();
         }
-        return _class->num_total_slots;
+        uint8_t* allocation = &this->nursery[this->nursery_spot];
+        this->nursery_spot += size;
+        return allocation;
     }
 
-    void GC::collect()
+    uint8_t* GC::_alloc_large(uint64_t size, bool may_collect)
     {
-        uint8_t* to = this->mem_opp;
+        if (size > this->max_size) [[unlikely]] {
+            throw std::bad_alloc();
+        }
+        if (may_collect &&
+            (DEBUG_GC_COLLECT_EVERY_ALLOC || this->large_bytes + size > this->large_limit)) {
+            this->collect();
+            if (this->large_bytes + size > this->max_size) {
+                throw std::bad_alloc();
+            }
+        }
 
+        auto allocation = reinterpret_cast<uint8_t*>(aligned_alloc(1 << TAG_BITS, size));
+        if (!allocation) {
+            throw std::bad_alloc();
+        }
+        this->large_objects.push_back(LargeObject{reinterpret_cast<Object*>(allocation), size});
+        this->large_bytes += size;
+        this->stats.bytes_allocated += size;
+        this->stats.peak_heap_size = std::max(this->stats.peak_heap_size,
+                                              this->size + this->nursery_size + this->large_bytes);
+        if (this->nursery) {
+            // As for large objects in the main region (see _alloc_slow()), this may end up
+            // referring to young objects without a write barrier.
+            this->remembered.push_back(reinterpret_cast<Object*>(allocation));
+        }
+        return allocation;
+    }
+
+    void GC::sweep_large()
+    {
+        size_t kept = 0;
+        for (LargeObject& large : this->large_objects) {
+            if (large.object->is_marked()) {
+                large.object->set_marked(false);
+                // The remembered set was just cleared, and these don't get fresh copies.
+                large.object->set_remembered(false);
+                this->large_objects[kept++] = large;
+            } else {
 #if DEBUG_GC_LOG
-        std::cout << "GC: collecting...\n";
-        std::cout << "GC: from=" << reinterpret_cast<void*>(this->mem) << "\n";
-        std::cout << "GC:   to=" << reinterpret_cast<void*>(this->mem_opp) << "\n";
+                std::cout << "GC: freeing large obj size=" << large.size << " @" << large.object
+                          << "\n";
 #endif
+                free(large.object);
+                this->large_bytes -= large.size;
+            }
+        }
+        this->large_objects.resize(kept);
+
+        // Same policy as for the main region.
+        double target = (double)this->large_bytes / this->target_occupancy;
+        this->large_limit = target >= (double)this->max_size
+                                ? this->max_size
+                                : std::max(this->initial_size, (uint64_t)target);
+    }
+
+    // Get the number of slots of a dataclass-kind type. May have to follow forwarding pointers!
+    // Header of an object which a thread of a parallel collection is busy copying; it gets a proper
+    // forwarding pointer once the copy is complete.
+    const uint64_t BUSY_HEADER = 0x1;
+
+    uint64_t get_num_slots(Value v_type)
+    {
+        Object* o_type = v_type.value<Object*>();
+        // Another thread of a parallel collection may be forwarding the type right now (see
+        // ParallelWorker::forward()). Until it's done, the old copy is still intact.
+        uint64_t header = std::atomic_ref<uint64_t>(o_type->header).load(std::memory_order_acquire);
+        if ((header & 0x1) && header != BUSY_HEADER) {
+            o_type = reinterpret_cast<Object*>(header & ~0x1ULL);
+        }
+        return reinterpret_cast<Type*>(o_type)->num_total_slots;
+    }
+
+    // Size of an object (not yet aligned), given its tag. This is normally obj->tag(), but a
+    // parallel collection may have replaced the header in the meantime.
+    uint64_t object_size(Object* obj, ObjectTag tag)
+    {
+        switch (tag) {
+            case ObjectTag::REF: return reinterpret_cast<Ref*>(obj)->size();
+            case ObjectTag::TUPLE: return reinterpret_cast<Tuple*>(obj)->size();
+            case ObjectTag::ARRAY: return reinterpret_cast<Array*>(obj)->size();
+            case ObjectTag::VECTOR: return reinterpret_cast<Vector*>(obj)->size();
+            case ObjectTag::ASSOC: return reinterpret_cast<Assoc*>(obj)->size();
+            case ObjectTag::STRING: return reinterpret_cast<String*>(obj)->size();
+            case ObjectTag::CODE: return reinterpret_cast<Code*>(obj)->size();
+            case ObjectTag::CLOSURE: return reinterpret_cast<Closure*>(obj)->size();
+            case ObjectTag::METHOD: return reinterpret_cast<Method*>(obj)->size();
+            case ObjectTag::MULTIMETHOD: return reinterpret_cast<MultiMethod*>(obj)->size();
+            case ObjectTag::TYPE: return reinterpret_cast<Type*>(obj)->size();
+            case ObjectTag::INSTANCE: {
+                auto v = reinterpret_cast<DataclassInstance*>(obj);
+                // WARNING: special case here. To determine instance size, we look up the
+                // number of slots in the instance's v_type. However, the v_type (and its
+                // constituent fields) may be forwarding pointers now.
+                return DataclassInstance::size(get_num_slots(v->v_type));
+            }
+            case ObjectTag::CALL_SEGMENT: return reinterpret_cast<CallSegment*>(obj)->size();
+            case ObjectTag::FOREIGN: return reinterpret_cast<ForeignValue*>(obj)->size();
+            case ObjectTag::BYTE_ARRAY: return reinterpret_cast<ByteArray*>(obj)->size();
+            case ObjectTag::DEQUE: return reinterpret_cast<Deque*>(obj)->size();
+            case ObjectTag::IDENTITY_SET: return reinterpret_cast<IdentitySet*>(obj)->size();
+            case ObjectTag::F64_ARRAY: return reinterpret_cast<F64Array*>(obj)->size();
+            case ObjectTag::I64_ARRAY: return reinterpret_cast<I64Array*>(obj)->size();
+            default: [[unlikely]] ALWAYS_ASSERT_MSG(false, "missed an object tag?");
+        }
+    }
+
+    // Size of an object (not yet aligned). The object must not be a forwarding pointer.
+    uint64_t object_size(Object* obj)
+    {
+        return object_size(obj, obj->tag());
+    }
+
+    // Call `move_value` on each Value within the contiguous frames [first, past_end).
+    template <typename F> void scan_frames(Frame* first, Frame* past_end, F& move_value)
+    {
+        for (Frame* frame = first; frame < past_end; frame = frame->next()) {
+            move_value(&frame->v_code);
+            move_value(&frame->v_module);
+            move_value(&frame->v_marker);
+            move_value(&frame->v_dynamic);
+
+            Value* regs = frame->regs();
+            for (uint64_t i = 0; i < frame->num_regs; i++) {
+                move_value(&regs[i]);
+            }
+
+            // Note that we don't need to go visit all the way to num_data.
+            // Only up to data_depth is guaranteed valid.
+            Value* data = frame->data();
+            for (uint64_t i = 0; i < frame->data_depth; i++) {
+                move_value(&data[i]);
+            }
+        }
+    }
+
+    // Call `move_value` on each Value within an object. Returns the object's size (not yet
+    // aligned).
+    template <typename F> uint64_t scan_object(Object* obj, F& move_value)
+    {
+        switch (obj->tag()) {
+            case ObjectTag::REF: {
+                auto v = obj->object<Ref*>();
+                move_value(&v->v_ref);
+                return v->size();
+            }
+            case ObjectTag::TUPLE: {
+                auto v = obj->object<Tuple*>();
+                uint64_t length = v->length;
+                for (uint64_t i = 0; i < length; i++) {
+                    move_value(&v->components()[i]);
+                }
+                return v->size();
+            }
+            case ObjectTag::ARRAY: {
+                auto v = obj->object<Array*>();
+                uint64_t length = v->length;
+                for (uint64_t i = 0; i < length; i++) {
+                    move_value(&v->components()[i]);
+                }
+                return v->size();
+            }
+            case ObjectTag::VECTOR: {
+                auto v = obj->object<Vector*>();
+                move_value(&v->v_array);
+                return v->size();
+            }
+            case ObjectTag::ASSOC: {
+                auto v = obj->object<Assoc*>();
+                move_value(&v->v_array);
+                move_value(&v->v_index);
+                return v->size();
+            }
+            case ObjectTag::STRING: {
+                // No internal values to move.
+                return obj->object<String*>()->size();
+            }
+            case ObjectTag::CODE: {
+                auto v = obj->object<Code*>();
+                move_value(&v->v_module);
+                move_value(&v->v_upreg_map);
+                move_value(&v->v_insts);
+                move_value(&v->v_args);
+                move_value(&v->v_span);
+                move_value(&v->v_inst_spans);
+                return v->size();
+            }
+            case ObjectTag::CLOSURE: {
+                auto v = obj->object<Closure*>();
+                move_value(&v->v_code);
+                move_value(&v->v_upregs);
+                return v->size();
+            }
+            case ObjectTag::METHOD: {
+                auto v = obj->object<Method*>();
+                move_value(&v->v_param_matchers);
+                move_value(&v->v_return_type);
+                move_value(&v->v_code);
+                move_value(&v->v_attributes);
+                return v->size();
+            }
+            case ObjectTag::MULTIMETHOD: {
+                auto v = obj->object<MultiMethod*>();
+                move_value(&v->v_name);
+                move_value(&v->v_methods);
+                move_value(&v->v_attributes);
+                move_value(&v->v_value_methods);
+                move_value(&v->v_typed_params);
+                move_value(&v->v_dispatch_table);
+                return v->size();
+            }
+            case ObjectTag::TYPE: {
+                auto v = obj->object<Type*>();
+                move_value(&v->v_name);
+                move_value(&v->v_bases);
+                move_value(&v->v_linearization);
+                move_value(&v->v_subtypes);
+                move_value(&v->v_slots);
+                move_value(&v->v_ancestors);
+                return v->size();
+            }
+            case ObjectTag::INSTANCE: {
+                auto v = obj->object<DataclassInstance*>();
+                // WARNING: special case. Use a helper function to determine number of slots, as
+                // this may have to follow forwarding pointers to get there.
+                uint64_t num_slots = get_num_slots(v->v_type);
+                move_value(&v->v_type);
+                for (uint64_t i = 0; i < num_slots; i++) {
+                    move_value(&v->slots()[i]);
+                }
+                // WARNING: special case (as just above).
+                return DataclassInstance::size(num_slots);
+            }
+            case ObjectTag::CALL_SEGMENT: {
+                auto v = obj->object<CallSegment*>();
+                move_value(&v->v_next);
+                scan_frames(v->frames(),
+                            reinterpret_cast<Frame*>(reinterpret_cast<uint8_t*>(v->frames()) +
+                                                     v->length),
+                            move_value);
+                return v->size();
+            }
+            case ObjectTag::FOREIGN: {
+                // No internal values to move.
+                return obj->object<ForeignValue*>()->size();
+            }
+            case ObjectTag::BYTE_ARRAY: {
+                // No internal values to move.
+                return obj->object<ByteArray*>()->size();
+            }
+            case ObjectTag::DEQUE: {
+                auto v = obj->object<Deque*>();
+                move_value(&v->v_array);
+                return v->size();
+            }
+            case ObjectTag::IDENTITY_SET: {
+                auto v = obj->object<IdentitySet*>();
+                move_value(&v->v_table);
+                return v->size();
+            }
+            case ObjectTag::F64_ARRAY: {
+                // No internal values to move.
+                return obj->object<F64Array*>()->size();
+            }
+            case ObjectTag::I64_ARRAY: {
+                // No internal values to move.
+                return obj->object<I64Array*>()->size();
+            }
+            default: ALWAYS_ASSERT_MSG(false, "missed an object tag?");
+        }
+    }
+
+    // Mover for full collections: copies every reachable object into the to-space.
+    struct FullMover
+    {
+        uint8_t*& to;
+        std::vector<Object*>& large_marked;
 
         // Input *node must be an object reference (Tag::OBJECT).
-        const auto move_obj = [&to](Value* node) -> void {
+        inline void move_obj(Value* node)
+        {
             auto obj = node->object();
+            if (!obj->is_forwarding() && obj->is_large()) [[unlikely]] {
+                // Large objects stay put; just make sure they get scanned once.
+                if (!obj->is_marked()) {
+                    obj->set_marked(true);
+                    this->large_marked.push_back(obj);
+                }
+                return;
+            }
             // Follow the existing forwarding pointer if it exists; otherwise copy the object
             // and install a forwarding pointer.
 #if DEBUG_GC_LOG
@@ -83,98 +606,19 @@ namespace Katsu
             }
 #endif
             if (!obj->is_forwarding()) {
-                uint64_t obj_size;
-                switch (obj->tag()) {
-                    case ObjectTag::REF: {
-                        auto v = obj->object<Ref*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::TUPLE: {
-                        auto v = obj->object<Tuple*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::ARRAY: {
-                        auto v = obj->object<Array*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::VECTOR: {
-                        auto v = obj->object<Vector*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::ASSOC: {
-                        auto v = obj->object<Assoc*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::STRING: {
-                        auto v = obj->object<String*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::CODE: {
-                        auto v = obj->object<Code*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::CLOSURE: {
-                        auto v = obj->object<Closure*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::METHOD: {
-                        auto v = obj->object<Method*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::MULTIMETHOD: {
-                        auto v = obj->object<MultiMethod*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::TYPE: {
-                        auto v = obj->object<Type*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::INSTANCE: {
-                        auto v = obj->object<DataclassInstance*>();
-                        // WARNING: special case here. To determine instance size, we look up the
-                        // number of slots in the instance's v_type. However, the v_type (and its
-                        // constituent fields) may be forwarding pointers now.
-                        obj_size = DataclassInstance::size(get_num_slots(v->v_type));
-                        break;
-                    }
-                    case ObjectTag::CALL_SEGMENT: {
-                        auto v = obj->object<CallSegment*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::FOREIGN: {
-                        auto v = obj->object<ForeignValue*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    case ObjectTag::BYTE_ARRAY: {
-                        auto v = obj->object<ByteArray*>();
-                        obj_size = v->size();
-                        break;
-                    }
-                    default: [[unlikely]] ALWAYS_ASSERT_MSG(false, "missed an object tag?");
-                }
+                uint64_t obj_size = object_size(obj);
 #if DEBUG_GC_LOG
                 std::cout << "GC: copying obj size=" << obj_size << "(0x" << std::hex << obj_size
-                          << std::dec << ") from " << obj << " to " << reinterpret_cast<void*>(to)
-                          << "\n";
+                          << std::dec << ") from " << obj << " to "
+                          << reinterpret_cast<void*>(this->to) << "\n";
 #endif
-                memcpy(to, obj, obj_size);
-                obj->set_forwarding(to);
-                to += align_up(obj_size, TAG_BITS);
+                memcpy(this->to, obj, obj_size);
+                // Everything ends up in the main region, so nothing needs remembering anymore.
+                reinterpret_cast<Object*>(this->to)->set_remembered(false);
+                obj->set_forwarding(this->to);
+                this->to += align_up(obj_size, TAG_BITS);
 #if DEBUG_GC_LOG
-                std::cout << "GC: new to=" << reinterpret_cast<void*>(to) << "\n";
+                std::cout << "GC: new to=" << reinterpret_cast<void*>(this->to) << "\n";
 #endif
             }
 #if DEBUG_GC_LOG
@@ -182,221 +626,729 @@ namespace Katsu
                       << "\n";
 #endif
             *node = Value::object(reinterpret_cast<Object*>(obj->forwarding()));
-        };
+        }
 
-        const auto move_value = [&move_obj](Value* node) {
+        inline void operator()(Value* node)
+        {
 #if DEBUG_GC_LOG
             std::cout << "GC: moving value @" << node << ", tag=" << tag_str(node->tag())
                       << ", raw=0x" << std::hex << node->raw_value() << std::dec << "\n";
 #endif
             if (node->tag() == Tag::OBJECT) {
-                move_obj(node);
+                this->move_obj(node);
             } else if (!node->is_inline()) [[unlikely]] {
                 ALWAYS_ASSERT_MSG(false, "can only move object reference or inline value");
             }
-        };
+        }
+    };
 
-#if DEBUG_GC_LOG
-        uint32_t num_roots = 0;
-        const auto add_root = [&num_roots, &move_obj](Value* root) {
-#else
-        const auto add_root = [&move_obj](Value* root) {
-#endif
-#if DEBUG_GC_LOG
-            std::cout << "GC: adding root @" << root << "\n";
-            num_roots++;
-#endif
-            if (!root->is_inline()) {
-                move_obj(root);
+    // Mover for minor collections: only objects in the nursery move; everything else stays put.
+    struct MinorMover
+    {
+        GC& gc;
+        uint8_t*& to;
+
+        inline void operator()(Value* node)
+        {
+            if (node->tag() != Tag::OBJECT) {
+                return;
             }
-        };
+            auto obj = node->object();
+            if (!this->gc.is_young(obj)) {
+                return;
+            }
+            if (!obj->is_forwarding()) {
+                uint64_t obj_size = object_size(obj);
+                memcpy(this->to, obj, obj_size);
+                obj->set_forwarding(this->to);
+                this->to += align_up(obj_size, TAG_BITS);
+            }
+            *node = Value::object(reinterpret_cast<Object*>(obj->forwarding()));
+        }
+    };
 
-        std::function<void(Value*)> add_root_fn = add_root;
-        for (RootProvider* provider : this->root_providers) {
-            provider->visit_roots(add_root_fn);
+    // Parallel full collections hand each thread chunks of this many bytes of the to-space to
+    // copy into. Objects over an eighth of a chunk are copied straight into the shared to-space
+    // instead, so less than about an eighth of each chunk goes unused.
+    const uint64_t PARALLEL_CHUNK_SIZE = 16 * 1024;
+    const uint64_t PARALLEL_DIRECT_SIZE = PARALLEL_CHUNK_SIZE / 8;
+    // A thread with at least this many objects left to scan offers some to the others.
+    const size_t PARALLEL_SHARE_THRESHOLD = 64;
+
+    // Turn the unused to-space [start, end) into an (unreachable) ByteArray, so that the main
+    // region can still be walked object by object. The gap must be empty or fit a ByteArray.
+    void fill_gap(uint8_t* start, uint8_t* end)
+    {
+        if (start == end) {
+            return;
         }
-#if DEBUG_GC_LOG
-        std::cout << "GC: total root(s): " << num_roots << "\n";
-#endif
+        ASSERT(static_cast<uint64_t>(end - start) >= sizeof(ByteArray));
+        auto filler = reinterpret_cast<ByteArray*>(start);
+        filler->set_object(ObjectTag::BYTE_ARRAY);
+        filler->length = (end - start) - sizeof(ByteArray);
+    }
 
-        for (Value* root : this->roots) {
-            // There shouldn't be any inline roots, but we don't really guard against it.
-            add_root(root);
+    // State shared by all threads of a parallel full collection (see GC::copy_parallel()).
+    struct ParallelCollection
+    {
+        // Next unclaimed byte of the to-space, and the end of the to-space.
+        std::atomic<uint8_t*> top;
+        uint8_t* end;
+        std::vector<std::unique_ptr<ParallelWorker>> workers;
+        // Number of workers which found nothing left to scan. Once that's all of them, the
+        // collection is done.
+        std::atomic<size_t> num_idle;
+
+        ParallelCollection(uint8_t* to, uint64_t to_size)
+            : top(to)
+            , end(to + to_size)
+            , workers{}
+            , num_idle(0)
+        {}
+
+        // Claim `size` bytes of to-space.
+        uint8_t* claim(uint64_t size)
+        {
+            uint8_t* start = this->top.fetch_add(size);
+            ALWAYS_ASSERT_MSG(start + size <= this->end, "parallel collection ran out of to-space");
+            return start;
         }
 
-        uint8_t* queue = this->mem_opp;
-        while (queue < to) {
-            auto obj = reinterpret_cast<Object*>(queue);
-#if DEBUG_GC_LOG
-            std::cout << "GC: scanning object @" << obj << ", header=0x" << std::hex
-                      << obj->raw_header() << std::dec;
-            std::cout << ", tag=" << object_tag_str(obj->tag()) << "\n";
-#endif
-            uint64_t obj_size;
-            switch (obj->tag()) {
-                case ObjectTag::REF: {
-                    auto v = obj->object<Ref*>();
-                    move_value(&v->v_ref);
-                    obj_size = v->size();
-                    break;
-                }
-                case ObjectTag::TUPLE: {
-                    auto v = obj->object<Tuple*>();
-                    uint64_t length = v->length;
-                    for (uint64_t i = 0; i < length; i++) {
-                        move_value(&v->components()[i]);
-                    }
-                    obj_size = v->size();
-                    break;
-                }
-                case ObjectTag::ARRAY: {
-                    auto v = obj->object<Array*>();
-                    uint64_t length = v->length;
-                    for (uint64_t i = 0; i < length; i++) {
-                        move_value(&v->components()[i]);
-                    }
-                    obj_size = v->size();
-                    break;
-                }
-                case ObjectTag::VECTOR: {
-                    auto v = obj->object<Vector*>();
-                    move_value(&v->v_array);
-                    obj_size = v->size();
-                    break;
+        // Claim a whole chunk of to-space, or return nullptr if there isn't one left.
+        uint8_t* claim_chunk()
+        {
+            uint8_t* start = this->top.load();
+            do {
+                if (this->end - start < (ptrdiff_t)PARALLEL_CHUNK_SIZE) {
+                    return nullptr;
                 }
-                case ObjectTag::ASSOC: {
-                    auto v = obj->object<Assoc*>();
-                    move_value(&v->v_array);
-                    obj_size = v->size();
-                    break;
+            } while (!this->top.compare_exchange_weak(start, start + PARALLEL_CHUNK_SIZE));
+            return start;
+        }
+    };
+
+    // One thread's part in a parallel full collection. Objects are claimed for copying by
+    // installing BUSY_HEADER with a CAS, so each one is copied (and later scanned) by exactly one
+    // thread; large objects likewise by setting their mark bit.
+    struct ParallelWorker
+    {
+        ParallelCollection& collection;
+        // Unused rest of this worker's current chunk of to-space: either empty, or big enough to
+        // fill with a ByteArray.
+        uint8_t* chunk;
+        uint8_t* chunk_end;
+        // Objects copied (or marked) by this worker, not yet scanned. Only this worker touches
+        // `pending`; `shareable` is where the others can steal from, under `lock`.
+        std::vector<Object*> pending;
+        std::mutex lock;
+        std::vector<Object*> shareable;
+        std::atomic<size_t> num_shareable;
+
+        ParallelWorker(ParallelCollection& collection)
+            : collection(collection)
+            , chunk(nullptr)
+            , chunk_end(nullptr)
+            , pending{}
+            , lock{}
+            , shareable{}
+            , num_shareable(0)
+        {}
+
+        // Allocate `size` (aligned) bytes of to-space.
+        uint8_t* allocate(uint64_t size)
+        {
+            if (size <= PARALLEL_DIRECT_SIZE) {
+                uint64_t room = this->chunk_end - this->chunk;
+                // Never leave a gap too small to fill.
+                if (size == room || size + sizeof(ByteArray) <= room) {
+                    uint8_t* allocation = this->chunk;
+                    this->chunk += size;
+                    return allocation;
                 }
-                case ObjectTag::STRING: {
-                    // No internal values to move.
-                    auto v = obj->object<String*>();
-                    obj_size = v->size();
-                    break;
+                fill_gap(this->chunk, this->chunk_end);
+                this->chunk = this->chunk_end = this->collection.claim_chunk();
+                if (this->chunk) {
+                    this->chunk_end += PARALLEL_CHUNK_SIZE;
+                    uint8_t* allocation = this->chunk;
+                    this->chunk += size;
+                    return allocation;
                 }
-                case ObjectTag::CODE: {
-                    auto v = obj->object<Code*>();
-                    move_value(&v->v_module);
-                    move_value(&v->v_upreg_map);
-                    move_value(&v->v_insts);
-                    move_value(&v->v_args);
-                    move_value(&v->v_span);
-                    move_value(&v->v_inst_spans);
-                    obj_size = v->size();
-                    break;
+            }
+            return this->collection.claim(size);
+        }
+
+        // Return where `obj` lives after this collection, copying it (or marking it, if large)
+        // unless another thread already has.
+        Object* forward(Object* obj)
+        {
+            std::atomic_ref<uint64_t> header(obj->header);
+            uint64_t h = header.load(std::memory_order_acquire);
+            while (true) {
+                if (h == BUSY_HEADER) {
+                    // Someone else is copying it; the forwarding pointer follows shortly.
+                    h = header.load(std::memory_order_acquire);
+                    continue;
                 }
-                case ObjectTag::CLOSURE: {
-                    auto v = obj->object<Closure*>();
-                    move_value(&v->v_code);
-                    move_value(&v->v_upregs);
-                    obj_size = v->size();
-                    break;
+                if (h & 0x1) {
+                    return reinterpret_cast<Object*>(h & ~0x1ULL);
                 }
-                case ObjectTag::METHOD: {
-                    auto v = obj->object<Method*>();
-                    move_value(&v->v_param_matchers);
-                    move_value(&v->v_return_type);
-                    move_value(&v->v_code);
-                    move_value(&v->v_attributes);
-                    obj_size = v->size();
-                    break;
+                if (h & Object::LARGE_BIT) {
+                    // Nothing else changes a large object's header during the collection, so the
+                    // CAS only fails if someone else marked it first.
+                    if (!(h & Object::MARKED_BIT) &&
+                        header.compare_exchange_strong(h, h | Object::MARKED_BIT,
+                                                       std::memory_order_acquire)) {
+                        this->pending.push_back(obj);
+                    }
+                    return obj;
                 }
-                case ObjectTag::MULTIMETHOD: {
-                    auto v = obj->object<MultiMethod*>();
-                    move_value(&v->v_name);
-                    move_value(&v->v_methods);
-                    move_value(&v->v_attributes);
-                    obj_size = v->size();
+                if (header.compare_exchange_weak(h, BUSY_HEADER, std::memory_order_acquire)) {
                     break;
                 }
-                case ObjectTag::TYPE: {
-                    auto v = obj->object<Type*>();
-                    move_value(&v->v_name);
-                    move_value(&v->v_bases);
-                    move_value(&v->v_linearization);
-                    move_value(&v->v_subtypes);
-                    move_value(&v->v_slots);
-                    obj_size = v->size();
-                    break;
+            }
+
+            // The header is ours now (and `h` its old value); the rest of the object is unchanged.
+            uint64_t obj_size = align_up(
+                object_size(obj, static_cast<ObjectTag>((h & ~Object::FLAG_BITS) >> 1)), TAG_BITS);
+            uint8_t* to = this->allocate(obj_size);
+            memcpy(to + sizeof(Object), reinterpret_cast<uint8_t*>(obj) + sizeof(Object),
+                   obj_size - sizeof(Object));
+            auto copy = reinterpret_cast<Object*>(to);
+            // Everything ends up in the main region, so nothing needs remembering anymore.
+            copy->header = h & ~Object::REMEMBERED_BIT;
+            header.store(reinterpret_cast<uint64_t>(to) | 0x1, std::memory_order_release);
+            this->pending.push_back(copy);
+            return copy;
+        }
+
+        // Move half of `pending` (the oldest half, which tends to hold the most work) to
+        // `shareable`.
+        void share()
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            size_t count = this->pending.size() / 2;
+            this->shareable.insert(this->shareable.end(), this->pending.begin(),
+                                   this->pending.begin() + count);
+            this->pending.erase(this->pending.begin(), this->pending.begin() + count);
+            this->num_shareable.store(this->shareable.size());
+        }
+
+        // Move up to half of what `victim` (maybe this worker) has shared into `pending`. Returns
+        // whether that was anything.
+        bool steal_from(ParallelWorker& victim)
+        {
+            if (victim.num_shareable.load() == 0) {
+                return false;
+            }
+            std::lock_guard<std::mutex> guard(victim.lock);
+            size_t count = (victim.shareable.size() + 1) / 2;
+            if (count == 0) {
+                return false;
+            }
+            this->pending.insert(this->pending.end(), victim.shareable.end() - count,
+                                 victim.shareable.end());
+            victim.shareable.resize(victim.shareable.size() - count);
+            victim.num_shareable.store(victim.shareable.size());
+            return true;
+        }
+
+        // Find more objects to scan, waiting for other workers as needed. Returns false once
+        // there is nothing left to scan in the whole collection.
+        bool find_work()
+        {
+            // Idle workers never share anything, so once a worker finds its own `shareable` empty
+            // here, it stays empty until the collection is done.
+            if (this->steal_from(*this)) {
+                return true;
+            }
+            for (auto& other : this->collection.workers) {
+                if (this->steal_from(*other)) {
+                    return true;
                 }
-                case ObjectTag::INSTANCE: {
-                    auto v = obj->object<DataclassInstance*>();
-                    // WARNING: special case. Use a helper function to determine number of slots, as
-                    // this may have to follow forwarding pointers to get there.
-                    uint64_t num_slots = get_num_slots(v->v_type);
-                    move_value(&v->v_type);
-                    for (uint64_t i = 0; i < num_slots; i++) {
-                        move_value(&v->slots()[i]);
+            }
+            this->collection.num_idle++;
+            while (this->collection.num_idle.load() < this->collection.workers.size()) {
+                for (auto& other : this->collection.workers) {
+                    if (other->num_shareable.load() > 0) {
+                        this->collection.num_idle--;
+                        if (this->steal_from(*other)) {
+                            return true;
+                        }
+                        this->collection.num_idle++;
                     }
-                    // WARNING: special case (as just above).
-                    obj_size = DataclassInstance::size(num_slots);
-                    break;
                 }
-                case ObjectTag::CALL_SEGMENT: {
-                    auto v = obj->object<CallSegment*>();
-                    // This is effectively VM::visit_roots().
-                    Frame* frame = v->frames();
-                    Frame* past_end = reinterpret_cast<Frame*>(
-                        reinterpret_cast<uint8_t*>(v->frames()) + v->length);
-                    while (frame < past_end) {
-                        move_value(&frame->v_code);
-                        move_value(&frame->v_module);
-                        move_value(&frame->v_marker);
-                        move_value(&frame->v_dynamic);
-
-                        for (uint32_t i = 0; i < frame->num_regs; i++) {
-                            move_value(&frame->regs()[i]);
-                        }
+                std::this_thread::yield();
+            }
+            return false;
+        }
 
-                        // Note that we don't need to go visit all the way to num_data.
-                        // Only up to data_depth is guaranteed valid.
-                        for (uint32_t i = 0; i < frame->data_depth; i++) {
-                            move_value(&frame->data()[i]);
-                        }
+        // Scan objects (and everything they lead to) until the collection is done.
+        void run();
+    };
 
-                        frame = frame->next();
-                    }
-                    obj_size = v->size();
-                    break;
-                }
-                case ObjectTag::FOREIGN: {
-                    // No internal values to move.
-                    auto v = obj->object<ForeignValue*>();
-                    obj_size = v->size();
-                    break;
-                }
-                case ObjectTag::BYTE_ARRAY: {
-                    // No internal values to move.
-                    auto v = obj->object<ByteArray*>();
-                    obj_size = v->size();
-                    break;
+    // Mover for parallel full collections, on behalf of one worker.
+    struct ParallelMover
+    {
+        ParallelWorker& worker;
+
+        inline void operator()(Value* node)
+        {
+            if (node->tag() == Tag::OBJECT) {
+                *node = Value::object(this->worker.forward(node->object()));
+            } else if (!node->is_inline()) [[unlikely]] {
+                ALWAYS_ASSERT_MSG(false, "can only move object reference or inline value");
+            }
+        }
+    };
+
+    void ParallelWorker::run()
+    {
+        ParallelMover move_value{*this};
+        do {
+            while (!this->pending.empty()) {
+                Object* obj = this->pending.back();
+                this->pending.pop_back();
+                scan_object(obj, move_value);
+                if (this->pending.size() >= PARALLEL_SHARE_THRESHOLD &&
+                    this->num_shareable.load() == 0) {
+                    this->share();
                 }
-                default: ALWAYS_ASSERT_MSG(false, "missed an object tag?");
             }
-            queue += align_up(obj_size, TAG_BITS);
+        } while (this->find_work());
+        fill_gap(this->chunk, this->chunk_end);
+        this->chunk = this->chunk_end = nullptr;
+    }
+
+    template <typename F> void Tracer::with_mover(F&& body)
+    {
+        if (this->kind == Kind::MINOR) {
+            MinorMover mover{this->gc, *this->to};
+            body(mover);
+        } else if (this->kind == Kind::PARALLEL) {
+            ParallelMover mover{*this->worker};
+            body(mover);
+        } else {
+            FullMover mover{*this->to, this->gc.large_marked};
+            body(mover);
         }
+    }
+
+    void Tracer::trace_range(Value* roots, uint64_t count)
+    {
+#if DEBUG_GC_LOG
+        std::cout << "GC: adding " << count << " root(s) @" << roots << "\n";
+#endif
+        this->with_mover([roots, count](auto& mover) {
+            for (uint64_t i = 0; i < count; i++) {
+                mover(&roots[i]);
+            }
+        });
+    }
 
-        // We've copied all objects from `mem` to `mem_opp`. Now swap spaces so `mem` is the primary
-        // again.
+    void Tracer::trace_frames(Frame* first, Frame* past_end)
+    {
+#if DEBUG_GC_LOG
+        std::cout << "GC: adding frame roots @" << first << " to " << past_end << "\n";
+#endif
+        this->with_mover([first, past_end](auto& mover) { scan_frames(first, past_end, mover); });
+    }
+
+    void RootProvider::trace_roots(Tracer& tracer)
+    {
+        std::function<void(Value*)> visitor = [&tracer](Value* root) { tracer.trace(root); };
+        this->visit_roots(visitor);
+    }
+
+    void RootProvider::visit_roots(std::function<void(Value*)>&)
+    {
+        ALWAYS_ASSERT_MSG(false, "RootProvider must override trace_roots() or visit_roots()");
+    }
+
+    void GC::collect()
+    {
+        // Shrink lazily: only once the limit is well under the current size.
+        this->collect_into(this->limit <= this->size / 2 ? this->limit : this->size);
+
+        // Size the main region for the next cycle from how much survived this one.
+        uint64_t target = this->heap_target(this->spot);
+        if (target > this->size) {
+            // The room is needed now, so grow right away (at the cost of copying again).
+            this->collect_into(target);
+        }
+        this->limit = std::min(target, this->size);
+        if (this->nursery) {
+            this->reset_nursery_limit();
+        }
+    }
+
+    void GC::collect_into(uint64_t to_size, uint64_t reserve)
+    {
+        auto start = std::chrono::steady_clock::now();
+        this->fold_allocated();
+        ASSERT(this->spot + this->nursery_spot <= to_size);
+        if (to_size != this->size) {
+            free(this->mem_opp);
+            this->mem_opp = reinterpret_cast<uint8_t*>(aligned_alloc(1 << TAG_BITS, to_size));
+            if (!this->mem_opp) {
+                throw std::bad_alloc();
+            }
+        }
+        // Going parallel needs room to spare for the chunks each thread leaves partly unused.
+        uint64_t usage = this->spot + this->nursery_spot;
+        uint8_t* end;
+        if (this->num_threads > 1 && usage >= this->parallel_collection_size &&
+            usage + usage / 4 + this->num_threads * PARALLEL_CHUNK_SIZE + reserve <= to_size) {
+            end = this->copy_parallel(to_size);
+            this->stats.num_parallel_collections++;
+        } else {
+            end = this->copy_serial();
+        }
+        if (this->sampler) {
+            this->update_samples(/* full */ true);
+        }
+
+        // We've copied all objects from `mem` (and the nursery) to `mem_opp`. Now swap spaces so
+        // `mem` is the primary again.
         std::swap(this->mem, this->mem_opp);
-#if DEBUG_GC_NEW_SEMISPACE
-        uint8_t* old_mem_opp = this->mem_opp;
-        this->mem_opp = reinterpret_cast<uint8_t*>(aligned_alloc(1 << TAG_BITS, size));
-        if (!this->mem_opp) {
-            throw std::bad_alloc();
+        bool resized = to_size != this->size;
+        this->size = to_size;
+        this->limit = std::min(this->limit, this->size);
+        if (resized || DEBUG_GC_NEW_SEMISPACE) {
+            uint8_t* old_mem_opp = this->mem_opp;
+            this->mem_opp = reinterpret_cast<uint8_t*>(aligned_alloc(1 << TAG_BITS, this->size));
+            if (!this->mem_opp) {
+                throw std::bad_alloc();
+            }
+            free(old_mem_opp);
         }
-        free(old_mem_opp);
-#endif
 #if DEBUG_GC_FILL
         memset(this->mem_opp, 0x42, this->size);
+        if (this->nursery) {
+            memset(this->nursery, 0x42, this->nursery_spot);
+        }
 #endif
-        this->spot = queue - this->mem;
+        this->spot = end - this->mem;
+        this->nursery_spot = 0;
+        this->remembered.clear();
+        this->sweep_large();
+        if (this->nursery) {
+            this->remember_roots();
+            this->reset_nursery_limit();
+        }
+        this->num_collections++;
+        this->stats.num_full_collections++;
+        this->finish_stats(start, this->spot + this->large_bytes);
+        if (this->sampler) {
+            this->sampler->after_collection(/* full */ true, this->sampled);
+        }
 #if DEBUG_GC_LOG
         std::cout << "GC: finished collection - mem " << reinterpret_cast<void*>(this->mem)
                   << ", usage " << this->spot << "(0x" << std::hex << this->spot << std::dec
                   << ")\n";
 #endif
     }
+
+    uint8_t* GC::copy_serial()
+    {
+        uint8_t* to = this->mem_opp;
+
+#if DEBUG_GC_LOG
+        std::cout << "GC: collecting...\n";
+        std::cout << "GC: from=" << reinterpret_cast<void*>(this->mem) << "\n";
+        std::cout << "GC:   to=" << reinterpret_cast<void*>(this->mem_opp) << "\n";
+#endif
+
+        FullMover move_value{to, this->large_marked};
+        Tracer tracer(*this, Tracer::Kind::FULL, to);
+        for (RootProvider* provider : this->root_providers) {
+            provider->trace_roots(tracer);
+        }
+        for (Value* root : this->roots) {
+            move_value(root);
+        }
+
+        uint8_t* queue = this->mem_opp;
+        while (true) {
+            while (queue < to) {
+                auto obj = reinterpret_cast<Object*>(queue);
+#if DEBUG_GC_LOG
+                std::cout << "GC: scanning object @" << obj << ", header=0x" << std::hex
+                          << obj->raw_header() << std::dec;
+                std::cout << ", tag=" << object_tag_str(obj->tag()) << "\n";
+#endif
+                queue += align_up(scan_object(obj, move_value), TAG_BITS);
+            }
+            // Large objects aren't in the to-space, so they need their own worklist.
+            if (this->large_marked.empty()) {
+                break;
+            }
+            Object* large = this->large_marked.back();
+            this->large_marked.pop_back();
+            scan_object(large, move_value);
+        }
+        return queue;
+    }
+
+    uint8_t* GC::copy_parallel(uint64_t to_size)
+    {
+        ParallelCollection collection(this->mem_opp, to_size);
+        for (uint32_t i = 0; i < this->num_threads; i++) {
+            collection.workers.push_back(std::make_unique<ParallelWorker>(collection));
+        }
+
+        // Roots are copied on this thread, which then joins in scanning as the first worker.
+        ParallelWorker& first = *collection.workers[0];
+        ParallelMover move_value{first};
+        Tracer tracer(*this, first);
+        for (RootProvider* provider : this->root_providers) {
+            provider->trace_roots(tracer);
+        }
+        for (Value* root : this->roots) {
+            move_value(root);
+        }
+
+        std::vector<std::thread> threads;
+        for (uint32_t i = 1; i < this->num_threads; i++) {
+            threads.emplace_back([&collection, i] { collection.workers[i]->run(); });
+        }
+        first.run();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        return collection.top.load();
+    }
+
+    void GC::collect_minor()
+    {
+        auto start = std::chrono::steady_clock::now();
+        this->fold_allocated();
+        ASSERT_MSG(this->nursery, "minor collection requires a nursery");
+        // Guaranteed by nursery_limit.
+        ASSERT(this->nursery_spot <= this->size - this->spot);
+
+#if DEBUG_GC_VERIFY_REMEMBERED
+        {
+            std::set<Object*> remembered(this->remembered.begin(), this->remembered.end());
+            const auto verify = [this, &remembered](Object* obj) {
+                bool is_remembered = remembered.count(obj) > 0;
+                const auto check = [this, is_remembered](Value* node) {
+                    ALWAYS_ASSERT_MSG(is_remembered || !node->is_object() ||
+                                          !this->is_young(node->object()),
+                                      "object refers to the nursery but was not remembered");
+                };
+                return scan_object(obj, check);
+            };
+            uint8_t* scan = this->mem;
+            while (scan < this->mem + this->spot) {
+                scan += align_up(verify(reinterpret_cast<Object*>(scan)), TAG_BITS);
+            }
+            for (LargeObject& large : this->large_objects) {
+                verify(large.object);
+            }
+        }
+#endif
+
+#if DEBUG_GC_LOG
+        std::cout << "GC: collecting nursery...\n";
+#endif
+
+        uint8_t* promoted = this->mem + this->spot;
+        uint8_t* to = promoted;
+
+        MinorMover move_value{*this, to};
+        Tracer tracer(*this, Tracer::Kind::MINOR, to);
+        for (RootProvider* provider : this->root_providers) {
+            provider->trace_roots(tracer);
+        }
+        for (Value* root : this->roots) {
+            move_value(root);
+        }
+        for (Object* obj : this->remembered) {
+            obj->set_remembered(false);
+            scan_object(obj, move_value);
+        }
+        this->remembered.clear();
+
+        uint8_t* queue = promoted;
+        while (queue < to) {
+            queue += align_up(scan_object(reinterpret_cast<Object*>(queue), move_value), TAG_BITS);
+        }
+        if (this->sampler) {
+            this->update_samples(/* full */ false);
+        }
+
+        this->remember_roots();
+
+#if DEBUG_GC_FILL
+        memset(this->nursery, 0x42, this->nursery_spot);
+#endif
+        this->spot = to - this->mem;
+        this->nursery_spot = 0;
+        this->reset_nursery_limit();
+        this->num_collections++;
+        this->stats.num_minor_collections++;
+        this->finish_stats(start, to - promoted);
+        if (this->sampler) {
+            this->sampler->after_collection(/* full */ false, this->sampled);
+        }
+#if DEBUG_GC_LOG
+        std::cout << "GC: finished nursery collection - promoted " << (to - promoted)
+                  << ", usage " << this->spot << "\n";
+#endif
+    }
+
+    HeapCopy GC::copy_out(std::vector<Value>& roots, const std::function<void(Object*)>& fixup)
+    {
+        // First find everything reachable, and lay it out in the order found: large objects after
+        // all the rest.
+        std::unordered_map<Object*, uint64_t> offsets;
+        std::vector<Object*> found;
+        uint64_t main_size = 0;
+        uint64_t large_size = 0;
+        const auto find = [&offsets, &found, &main_size, &large_size](Value* node) {
+            if (!node->is_object()) {
+                return;
+            }
+            Object* obj = node->object();
+            auto [it, inserted] = offsets.try_emplace(obj, 0);
+            if (!inserted) {
+                return;
+            }
+            uint64_t& spot = obj->is_large() ? large_size : main_size;
+            it->second = spot;
+            spot += align_up(object_size(obj), TAG_BITS);
+            found.push_back(obj);
+        };
+        for (Value& root : roots) {
+            find(&root);
+        }
+        for (size_t i = 0; i < found.size(); i++) {
+            scan_object(found[i], find);
+        }
+        for (Object* obj : found) {
+            if (obj->is_large()) {
+                offsets[obj] += main_size;
+            }
+        }
+
+        // Then copy it all, and swap references for offsets.
+        HeapCopy copy{std::string(main_size + large_size, '\0'), main_size};
+        uint8_t* base = reinterpret_cast<uint8_t*>(copy.contents.data());
+        const auto to_offset = [&offsets](Value* node) {
+            if (node->is_object()) {
+                *node = Value::object(reinterpret_cast<Object*>(offsets.at(node->object())));
+            }
+        };
+        for (Object* obj : found) {
+            auto copied = reinterpret_cast<Object*>(base + offsets.at(obj));
+            memcpy(copied, obj, object_size(obj));
+            copied->header &= ~(Object::MARKED_BIT | Object::REMEMBERED_BIT);
+            // (For instances, this reads the number of slots from the original type, before the
+            // reference to it is replaced.)
+            scan_object(copied, to_offset);
+            fixup(copied);
+        }
+        for (Value& root : roots) {
+            to_offset(&root);
+        }
+        return copy;
+    }
+
+    // Size (aligned) of an object in a HeapCopy's contents, whose references are still offsets.
+    static uint64_t copied_object_size(const uint8_t* contents, uint64_t size, Object* obj)
+    {
+        if (obj->tag() != ObjectTag::INSTANCE) {
+            return align_up(object_size(obj), TAG_BITS);
+        }
+        Value v_type = reinterpret_cast<DataclassInstance*>(obj)->v_type;
+        ALWAYS_ASSERT_MSG(v_type.is_object(), "malformed heap copy");
+        uint64_t type_offset = reinterpret_cast<uint64_t>(v_type.object());
+        ALWAYS_ASSERT_MSG(size >= sizeof(Type) && type_offset <= size - sizeof(Type),
+                          "malformed heap copy");
+        auto type = reinterpret_cast<const Type*>(contents + type_offset);
+        return align_up(DataclassInstance::size(type->num_total_slots), TAG_BITS);
+    }
+
+    void GC::copy_in(const uint8_t* contents, uint64_t size, uint64_t main_size,
+                     std::vector<Value>& roots, const std::function<void(Object*)>& fixup)
+    {
+        ALWAYS_ASSERT_MSG(main_size <= size && (size & TAG_MASK) == 0 &&
+                              (main_size & TAG_MASK) == 0,
+                          "malformed heap copy");
+
+        // The main region gets everything but the large objects in one piece, as for a large
+        // allocation in _alloc_slow() (but without collecting once anything's copied).
+        if (main_size + this->nursery_spot > this->limit - this->spot) {
+            this->collect();
+            if (main_size > this->limit - this->spot && !this->grow_for(main_size)) {
+                throw std::bad_alloc();
+            }
+        }
+        uint8_t* main = &this->mem[this->spot];
+        memcpy(main, contents, main_size);
+        this->spot += main_size;
+        if (this->nursery) {
+            this->stats.bytes_allocated += main_size;
+            this->reset_nursery_limit();
+        }
+
+        struct Copied
+        {
+            Object* object;
+            uint64_t size;
+        };
+        std::vector<Copied> copied;
+        for (uint64_t offset = 0; offset < main_size;) {
+            auto obj = reinterpret_cast<Object*>(main + offset);
+            uint64_t obj_size = copied_object_size(contents, size, obj);
+            ALWAYS_ASSERT_MSG(obj_size <= main_size - offset, "malformed heap copy");
+            copied.push_back(Copied{obj, obj_size});
+            offset += obj_size;
+        }
+        std::unordered_map<uint64_t, Object*> large;
+        for (uint64_t offset = main_size; offset < size;) {
+            // Read the header (and size) straight from the contents, which are aligned enough.
+            auto original = reinterpret_cast<Object*>(const_cast<uint8_t*>(contents) + offset);
+            uint64_t obj_size = copied_object_size(contents, size, original);
+            ALWAYS_ASSERT_MSG(obj_size <= size - offset, "malformed heap copy");
+            auto obj = reinterpret_cast<Object*>(this->_alloc_large(obj_size, false));
+            memcpy(obj, original, obj_size);
+            obj->set_large();
+            large.emplace(offset, obj);
+            copied.push_back(Copied{obj, obj_size});
+            offset += obj_size;
+        }
+
+        const auto relocate = [main, main_size, &large](Value* node) {
+            if (!node->is_object()) {
+                return;
+            }
+            uint64_t offset = reinterpret_cast<uint64_t>(node->object());
+            if (offset < main_size) {
+                *node = Value::object(reinterpret_cast<Object*>(main + offset));
+                return;
+            }
+            auto it = large.find(offset);
+            ALWAYS_ASSERT_MSG(it != large.end(), "malformed heap copy");
+            *node = Value::object(it->second);
+        };
+        for (const Copied& c : copied) {
+            if (c.object->tag() == ObjectTag::INSTANCE) {
+                // scan_object() would look up the number of slots in the type, but the reference
+                // to that is still an offset.
+                auto instance = reinterpret_cast<DataclassInstance*>(c.object);
+                uint64_t num_slots = (c.size - sizeof(DataclassInstance)) / sizeof(Value);
+                relocate(&instance->v_type);
+                for (uint64_t i = 0; i < num_slots; i++) {
+                    relocate(&instance->slots()[i]);
+                }
+            } else {
+                scan_object(c.object, relocate);
+            }
+            fixup(c.object);
+        }
+        for (Value& root : roots) {
+            relocate(&root);
+        }
+    }
 };
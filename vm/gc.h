@@ -3,7 +3,10 @@
 #include "assertions.h"
 #include "value.h"
 
+#include <chrono>
 #include <functional>
+#include <ostream>
+#include <string>
 #include <vector>
 
 // Enable logging from the GC.
@@ -31,11 +34,24 @@
 #ifndef DEBUG_GC_NEW_SEMISPACE
 #define DEBUG_GC_NEW_SEMISPACE (0)
 #endif
+// Have the GC check, before each minor collection, that every object in the main region referring
+// to the nursery is in the remembered set. This is slow, but finds missing write barriers.
+// Default off.
+#ifndef DEBUG_GC_VERIFY_REMEMBERED
+#define DEBUG_GC_VERIFY_REMEMBERED (0)
+#endif
 // Have GC roots check the root stack for expected ordering when getting destructed.
 // Default on.
 #ifndef DEBUG_GC_VERIFY_ROOT_ORDERING
 #define DEBUG_GC_VERIFY_ROOT_ORDERING (1)
 #endif
+// Number of threads the GC runs full collections with unless told otherwise (see
+// GC::num_threads). Building with more than one puts the parallel collector through the test
+// suite, for those heaps big enough to collect in parallel (see GC::parallel_collection_size).
+// Default 1.
+#ifndef GC_DEFAULT_THREADS
+#define GC_DEFAULT_THREADS (1)
+#endif
 
 #if DEBUG_GC_LOG
 #include <iostream>
@@ -57,19 +73,148 @@ namespace Katsu
         return (x + mask_n) & ~mask_n;
     }
 
+    struct Frame;
+    class GC;
+    struct ParallelWorker;
+
+    // Visitor handed to RootProvider::trace_roots() during a collection. Calls are statically
+    // dispatched, and whole runs of roots can be handed over at once to keep the per-root cost
+    // down to a tight loop.
+    class Tracer
+    {
+    public:
+        inline void trace(Value* root)
+        {
+            this->trace_range(root, 1);
+        }
+
+        // Trace `count` contiguous roots starting at `roots`.
+        void trace_range(Value* roots, uint64_t count);
+
+        // Trace every frame from `first` up to (but not including) `past_end`, which must be laid
+        // out contiguously as on the call stack.
+        void trace_frames(Frame* first, Frame* past_end);
+
+    private:
+        friend class GC;
+
+        enum class Kind
+        {
+            FULL,
+            MINOR,
+            PARALLEL,
+        };
+
+        Tracer(GC& gc, Kind kind, uint8_t*& to)
+            : gc(gc)
+            , kind(kind)
+            , to(&to)
+            , worker(nullptr)
+        {}
+
+        Tracer(GC& gc, ParallelWorker& worker)
+            : gc(gc)
+            , kind(Kind::PARALLEL)
+            , to(nullptr)
+            , worker(&worker)
+        {}
+
+        // Call `body` with the mover for this kind of collection.
+        template <typename F> void with_mover(F&& body);
+
+        GC& gc;
+        Kind kind;
+        // Next free location in the to-space (FULL and MINOR only).
+        uint8_t** to;
+        // The worker copying roots (PARALLEL only).
+        ParallelWorker* worker;
+    };
+
+    // Running totals kept by a GC. Pause times count each copying pass: a full collection that
+    // resizes the main region right away (see GC::collect()) counts as two.
+    struct GCStats
+    {
+        // Bucket 0 counts pauses under 1us, and bucket i > 0 those of [2^(i-1), 2^i) us. The last
+        // bucket also takes anything longer.
+        static const int NUM_PAUSE_BUCKETS = 24;
+
+        uint64_t num_minor_collections = 0;
+        uint64_t num_full_collections = 0;
+        // How many of the full collections ran on several threads (see GC::num_threads).
+        uint64_t num_parallel_collections = 0;
+        uint64_t total_pause_ns = 0;
+        uint64_t max_pause_ns = 0;
+        uint64_t pause_histogram[NUM_PAUSE_BUCKETS] = {};
+        // Bytes allocated up until the last collection; see GC::bytes_allocated() for the total.
+        uint64_t bytes_allocated = 0;
+        // Bytes surviving collections, summed over all of them (minor collections only count
+        // what they promote), and for just the last one.
+        uint64_t bytes_survived = 0;
+        uint64_t last_survived = 0;
+        // Largest total heap footprint so far: the main region, nursery and large objects.
+        uint64_t peak_heap_size = 0;
+
+        void record_pause(uint64_t pause_ns);
+    };
+
+    // An allocation picked by the GC's sampler (see GC::set_sampler()), and tracked since.
+    struct SampledObject
+    {
+        Object* object;
+        // As returned by AllocationSampler::sample().
+        uint32_t site;
+        // Number of allocated bytes this sample stands for.
+        uint64_t weight;
+    };
+
+    class AllocationSampler
+    {
+    public:
+        virtual ~AllocationSampler() = default;
+
+        // Called with a newly allocated object of `size` bytes, just after its header is set (but
+        // before anything else is initialized), standing for `weight` allocated bytes. Returns a
+        // site number to keep with the object. This must not allocate in the GC.
+        virtual uint32_t sample(Object* object, uint64_t size, uint64_t weight) = 0;
+
+        // Called after each collection with all sampled objects which are still live.
+        virtual void after_collection(bool full, const std::vector<SampledObject>& live) = 0;
+    };
+
+    // Objects copied out of a GC in one relocatable block by GC::copy_out(), as for saving the heap
+    // to a file (see heap_image.h). References between the objects are offsets into `contents`.
+    struct HeapCopy
+    {
+        std::string contents;
+        // The objects before this offset go back into the main region in one piece; those from
+        // here on were in the large-object space, and go back there one by one.
+        uint64_t main_size;
+    };
+
     class RootProvider
     {
     public:
         virtual ~RootProvider() = default;
 
-        virtual void visit_roots(std::function<void(Value*)>& visitor) = 0;
+        // Trace all roots held by this provider. The default implementation defers to
+        // visit_roots(); providers should override this instead where scanning speed matters.
+        virtual void trace_roots(Tracer& tracer);
+
+        // Older, slower interface: call `visitor` on each root. Only used by the default
+        // trace_roots(), so a provider must override at least one of the two.
+        virtual void visit_roots(std::function<void(Value*)>& visitor);
     };
 
     class GC
     {
     public:
         // Create a GC managing a region of `size` bytes. The size must be TAG_BITS-aligned.
-        GC(uint64_t size);
+        // If `nursery_size` is nonzero (and also TAG_BITS-aligned), the GC is generational: new
+        // objects are allocated in a separate nursery of that many bytes, which is collected on
+        // its own (see collect_minor()) by promoting survivors into the main region.
+        // If `max_size` is larger than `size`, the main region grows (and shrinks back, but never
+        // below `size`) as needed to keep it at about `target_occupancy` after each collection.
+        GC(uint64_t size, uint64_t nursery_size = 0, uint64_t max_size = 0);
 
         ~GC();
 
@@ -81,14 +226,41 @@ namespace Katsu
         template <typename T, typename... S> T* alloc(S... size_args)
         {
             static_assert(!std::is_same_v<Object, T> && std::is_base_of_v<Object, T>);
-            uint64_t size = T::size(size_args...);
+            uint64_t size = align_up(T::size(size_args...), TAG_BITS);
             auto obj = reinterpret_cast<Object*>(this->_alloc_raw(size));
             obj->set_object(T::CLASS_TAG);
+            if (size >= this->large_object_size) [[unlikely]] {
+                obj->set_large();
+            }
+            if (this->sampler) [[unlikely]] {
+                this->_sample(obj, size);
+            }
+            return reinterpret_cast<T*>(obj);
+        }
+
+        // Like alloc(), but the object never moves: it comes from the large-object space whatever
+        // its size. If not `may_collect`, this doesn't collect even once that space is due (the
+        // next large allocation will), so it's safe while not everything is rooted.
+        template <typename T, typename... S> T* alloc_pinned(bool may_collect, S... size_args)
+        {
+            static_assert(!std::is_same_v<Object, T> && std::is_base_of_v<Object, T>);
+            uint64_t size = align_up(T::size(size_args...), TAG_BITS);
+            auto obj = reinterpret_cast<Object*>(this->_alloc_large(size, may_collect));
+#if DEBUG_GC_FILL
+            memset((void*)obj, 0x42, size);
+#endif
+            obj->set_object(T::CLASS_TAG);
+            obj->set_large();
+            if (this->sampler) [[unlikely]] {
+                this->_sample(obj, size);
+            }
             return reinterpret_cast<T*>(obj);
         }
 
         // Allocate a region of `size` bytes and return a pointer to the first byte.
-        // This may garbage-collect in order to free up space.
+        // This may garbage-collect in order to free up space. Regions of at least
+        // `large_object_size` bytes come from the large-object space, but it is up to the caller
+        // to then mark the object as large (see alloc()).
         // If DEBUG_GC_FILL is enabled, this furthermore fills the newly allocated region with a
         // repeating 0xFEEDBEEF pattern. Throws on allocation failure. Implemented here to allow
         // inlining the happy path.
@@ -102,29 +274,30 @@ namespace Katsu
             std::cout << " aligned=" << size << "\n";
 #endif
 
-            if (size > this->size) [[unlikely]] {
-                throw std::bad_alloc();
-            }
-
-            uint64_t remaining = this->size - this->spot;
-
+            uint8_t* allocation;
 #if DEBUG_GC_COLLECT_EVERY_ALLOC
-            {
+            if (size >= this->large_object_size) {
+                allocation = this->_alloc_large(size);
+            } else {
+                allocation = this->_alloc_slow(size);
+            }
 #else
-            if (size > remaining) [[unlikely]] {
-#endif
-                this->collect();
-
-                remaining = this->size - this->spot;
-                if (size > remaining) {
-                    // No room even after collection -- we're really out of memory!
-                    throw std::bad_alloc();
+            if (size >= this->large_object_size) [[unlikely]] {
+                allocation = this->_alloc_large(size);
+            } else if (this->nursery) {
+                if (size <= this->nursery_limit - this->nursery_spot) [[likely]] {
+                    allocation = &this->nursery[this->nursery_spot];
+                    this->nursery_spot += size;
+                } else {
+                    allocation = this->_alloc_slow(size);
                 }
+            } else if (size <= this->limit - this->spot) [[likely]] {
+                allocation = &this->mem[this->spot];
+                this->spot += size;
+            } else {
+                allocation = this->_alloc_slow(size);
             }
-
-            uint64_t spot = this->spot;
-            this->spot += size;
-            auto allocation = &this->mem[spot];
+#endif
 #if DEBUG_GC_LOG
             std::cout << "GC: allocated @" << reinterpret_cast<void*>(allocation) << "\n";
 #endif
@@ -134,25 +307,230 @@ namespace Katsu
             return allocation;
         }
 
+        // Collect the whole heap (nursery included, if any), and then resize the main region if
+        // warranted.
         void collect();
 
+        // Collect just the nursery, promoting all of its live objects into the main region. The
+        // GC must be generational.
+        void collect_minor();
+
+        // Current size of the main region, in bytes.
+        inline uint64_t heap_size() const
+        {
+            return this->size;
+        }
+
+        // Total size of the objects in the large-object space, in bytes.
+        inline uint64_t large_space_size() const
+        {
+            return this->large_bytes;
+        }
+
+        // Total bytes allocated over the GC's lifetime.
+        inline uint64_t bytes_allocated() const
+        {
+            return this->stats.bytes_allocated +
+                   (this->nursery ? this->nursery_spot : this->spot - this->alloc_mark);
+        }
+
+        // Print `stats` (and a few current sizes) in a human-readable form.
+        void print_stats(std::ostream& out) const;
+
+        // Hand roughly every `interval`th allocated byte (or rather, the object containing it) to
+        // `sampler`, and keep track of those objects until they die. Allocations through alloc()
+        // only. Pass nullptr to stop sampling.
+        void set_sampler(AllocationSampler* sampler, uint64_t interval);
+
+        // Copy everything reachable from `roots` out into a HeapCopy, replacing each root with (a
+        // reference to) the offset of its copy. `fixup` is called on each copy once its references
+        // are replaced, to take care of anything else in it which can't be copied as is; it may
+        // throw to give up. This doesn't allocate in the GC, nor change anything in it.
+        HeapCopy copy_out(std::vector<Value>& roots, const std::function<void(Object*)>& fixup);
+
+        // Copy the objects of a HeapCopy (given its `contents` and `main_size`) into the heap, and
+        // replace `roots` (offsets into the contents, as copy_out() left them) with references to
+        // the new copies. `fixup` is called on each new copy once its references are relocated.
+        // This may collect (before copying anything), but not afterwards.
+        void copy_in(const uint8_t* contents, uint64_t size, uint64_t main_size,
+                     std::vector<Value>& roots, const std::function<void(Object*)>& fixup);
+
+        // Whether `p` points into the nursery. Always false if the GC is not generational.
+        inline bool is_young(const void* p) const
+        {
+            return reinterpret_cast<uint64_t>(p) - reinterpret_cast<uint64_t>(this->nursery) <
+                   this->nursery_size;
+        }
+
+        // Must be called after storing `value` into `object`, unless `object` was allocated since
+        // the last possible collection, or is held by a GC root in `roots` and was allocated
+        // during that root's lifetime. (In other words: initializing new objects needs no
+        // barrier, but mutating existing ones does.) This keeps track of old objects which may
+        // refer to young objects, since collect_minor() doesn't otherwise scan the main region.
+        inline void write_barrier(Object* object, Value value)
+        {
+            if (value.is_object() && this->is_young(value.object()) && !this->is_young(object))
+                [[unlikely]] {
+                this->remember(object);
+            }
+        }
+
+        // Same as write_barrier(object, value), for when the stored value(s) aren't readily at
+        // hand (for instance, raw writes or several writes to the same object).
+        inline void write_barrier(Object* object)
+        {
+            if (this->nursery && !this->is_young(object)) {
+                this->remember(object);
+            }
+        }
+
         std::vector<RootProvider*> root_providers;
         // (Pointers to) object values indicating any GC roots, i.e. entry points to the graph
         // of live objects. This is intended more for ephemeral extra roots that are not covered
         // already by the root_providers.
         std::vector<Value*> roots;
 
+        // Number of completed collections (minor or full). Anything keyed on object addresses is
+        // invalid once this changes.
+        uint64_t num_collections;
+
+        GCStats stats;
+
+        // Number of Types allocated so far; the next Type gets this as its type_id.
+        uint32_t num_types;
+
+        // Fraction of the main region which should be occupied by live objects just after a full
+        // collection. Lower values trade memory for less frequent collections. Must be in (0, 1].
+        double target_occupancy;
+
+        // Objects of at least this many bytes are allocated individually in a separate
+        // large-object space, outside the main region and the nursery. They never move (so
+        // collections never copy them, and their addresses are stable), and are only freed by
+        // full collections. Must be TAG_BITS-aligned.
+        uint64_t large_object_size;
+
+        // Number of threads (the collecting thread included) to copy with in full collections.
+        // Must be at least 1. With more than one, objects end up in a different order than
+        // with the serial collector, and chunks of to-space left over by each thread are filled
+        // with unreachable ByteArrays; so usage comes out a little higher.
+        uint32_t num_threads;
+        // Full collections only run in parallel once at least this many bytes may survive them
+        // (and there is room in the to-space to spare). Smaller heaps are quicker to copy than
+        // to start threads for.
+        uint64_t parallel_collection_size;
+
     private:
+        // Count an allocation towards the next sample, and take it if due.
+        void _sample(Object* object, uint64_t size);
+
+        // Drop tracked samples which didn't survive the collection that's just finished copying,
+        // and follow forwarding pointers for the rest. Must run before the from-space is reused.
+        void update_samples(bool full);
+
+        // Allocation slow path: collects as necessary, and allocates objects too large for the
+        // nursery directly in the main region.
+        uint8_t* _alloc_slow(uint64_t size);
+
+        // Copy all live objects into a fresh main region of `to_size` bytes, which must be at
+        // least the current usage (spot + nursery_spot). A parallel copy leaves some of the
+        // to-space unused, so it's only done if that still leaves room for `reserve` more bytes
+        // past the current usage.
+        void collect_into(uint64_t to_size, uint64_t reserve = 0);
+
+        // Copy (or mark) everything reachable into the to-space `mem_opp`, and return the end of
+        // the copied objects. The parallel version uses `num_threads` threads and needs to know
+        // the size of the to-space.
+        uint8_t* copy_serial();
+        uint8_t* copy_parallel(uint64_t to_size);
+
+        // Size of main region to aim for, given this much usage.
+        uint64_t heap_target(uint64_t usage);
+
+        // Try to make room for an extra `size` bytes in the main region by growing it. Returns
+        // whether there is room now.
+        bool grow_for(uint64_t size);
+
+        // Allocate an object in the large-object space, collecting first if that space is due (and
+        // `may_collect`).
+        uint8_t* _alloc_large(uint64_t size, bool may_collect = true);
+
+        // After a full collection has marked all live large objects: free the unmarked ones and
+        // unmark the rest.
+        void sweep_large();
+
+        inline void remember(Object* object)
+        {
+            if (!object->is_remembered()) {
+                object->set_remembered(true);
+                this->remembered.push_back(object);
+            }
+        }
+
+        // C++ code may still be initializing newly allocated objects which it has rooted, and
+        // which are now outside the nursery after a collection (see write_barrier()). Keep an eye
+        // on them until the next minor collection.
+        void remember_roots();
+
+        // Account for allocations since the last collection, just before collecting.
+        void fold_allocated();
+        // Record the end of a collection which started at `start` and left `survived` bytes.
+        void finish_stats(std::chrono::steady_clock::time_point start, uint64_t survived);
+
+        // Make sure the nursery never holds more than the main region has room for, so that
+        // collect_minor() can always promote everything.
+        void reset_nursery_limit();
+
         // Core array of values.
         uint8_t* mem;
         uint64_t size;
+        // Limit for `spot` until the next full collection; at most `size`. This is lower than
+        // `size` just when the main region is due to shrink.
+        uint64_t limit;
+        // Bounds for `size`.
+        uint64_t initial_size;
+        uint64_t max_size;
 
         // Backup array of values to be used during semispace copying collection.
         uint8_t* mem_opp;
 
         // Next allocation location.
         uint64_t spot;
-
+        // `spot` just after the last collection. Without a nursery, everything past it has been
+        // allocated since.
+        uint64_t alloc_mark;
+
+        // Nursery region for new objects, or nullptr if not generational.
+        uint8_t* nursery;
+        uint64_t nursery_size;
+        // Next allocation location in the nursery.
+        uint64_t nursery_spot;
+        // Current limit for nursery_spot; at most nursery_size.
+        uint64_t nursery_limit;
+
+        // Objects outside the nursery which may refer to objects in the nursery. Objects here
+        // generally (but not necessarily) have their remembered bit set.
+        std::vector<Object*> remembered;
+
+        struct LargeObject
+        {
+            Object* object;
+            uint64_t size;
+        };
+        // Everything in the large-object space, and how many bytes that comes to.
+        std::vector<LargeObject> large_objects;
+        uint64_t large_bytes;
+        // Collect fully before large_bytes would exceed this.
+        uint64_t large_limit;
+        // Large objects marked live during the current full collection but not yet scanned.
+        std::vector<Object*> large_marked;
+
+        AllocationSampler* sampler;
+        uint64_t sample_interval;
+        // Bytes left to allocate until the next sample.
+        uint64_t sample_countdown;
+        std::vector<SampledObject> sampled;
+
+        friend class Tracer;
         friend uint8_t* TESTONLY_get_mem(GC& gc);
     };
 
@@ -199,6 +577,46 @@ namespace Katsu
         Value root;
     };
 
+    // Roots a range of values where they are (which mustn't move meanwhile), such as the arguments
+    // of a call.
+    class ValuesRoot
+    {
+    public:
+        ValuesRoot(GC& _gc, Value* _values, size_t _count)
+            : gc(_gc)
+            , values(_values)
+            , count(_count)
+        {
+            for (size_t i = 0; i < this->count; i++) {
+                this->gc.roots.push_back(&this->values[i]);
+            }
+        }
+
+        ValuesRoot(ValuesRoot&) = delete;
+        ValuesRoot(ValuesRoot&&) = delete;
+
+        ~ValuesRoot()
+#if DEBUG_GC_VERIFY_ROOT_ORDERING
+            noexcept(false)
+#endif
+        {
+            for (size_t i = this->count; i-- > 0;) {
+#if DEBUG_GC_VERIFY_ROOT_ORDERING
+                ASSERT_MSG(!this->gc.roots.empty(),
+                           "GC roots must be empty while destructing ValuesRoot");
+                ASSERT_MSG(this->gc.roots.back() == &this->values[i],
+                           "GC roots must be in order while destructing ValuesRoot");
+#endif
+                this->gc.roots.pop_back();
+            }
+        }
+
+    private:
+        GC& gc;
+        Value* values;
+        size_t count;
+    };
+
     template <typename T> class Root
     {
         static_assert(!std::is_same_v<Object, T> && std::is_base_of_v<Object, T>);
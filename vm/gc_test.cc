@@ -1,8 +1,10 @@
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
 
 #include "gc.h"
 
 #include "value_utils.h"
+#include <map>
 #include <sstream>
 
 using namespace Katsu;
@@ -82,7 +84,10 @@ TEST_CASE("walk GC through simple allocations, collection, and OOM", "[gc]")
 
 TEST_CASE("GC follows internal references", "[gc]")
 {
-    GC gc(10 * 1024);
+    // Big enough to collect in parallel, when asked to.
+    GC gc(256 * 1024);
+    gc.num_threads = GENERATE(1, 4);
+    gc.parallel_collection_size = 0;
 
     // Arbitrary, just needs to be at least as many as any SECTION needs.
     const size_t NUM_POINTEES = 10;
@@ -183,6 +188,7 @@ TEST_CASE("GC follows internal references", "[gc]")
         Assoc* obj = gc.alloc<Assoc>();
         obj->length = 0x12345678; // not actually used by the GC
         obj->v_array = v_pointees[0];
+        obj->v_index = v_pointees[1];
 
         Value v_obj = Value::object(obj);
         single_root_collect(&v_obj);
@@ -191,6 +197,7 @@ TEST_CASE("GC follows internal references", "[gc]")
         REQUIRE_NOTHROW(obj = v_obj.obj_assoc());
         CHECK(obj->length == 0x12345678);
         CHECK_POINTEE(0, obj->v_array);
+        CHECK_POINTEE(1, obj->v_index);
     }
 
     // Kind of already tested in other sections implicitly...
@@ -288,6 +295,9 @@ TEST_CASE("GC follows internal references", "[gc]")
         obj->v_name = v_pointees[0];
         obj->v_methods = v_pointees[1];
         obj->v_attributes = v_pointees[2];
+        obj->v_value_methods = v_pointees[3];
+        obj->v_typed_params = v_pointees[4];
+        obj->v_dispatch_table = v_pointees[5];
 
         Value v_obj = Value::object(obj);
         single_root_collect(&v_obj);
@@ -297,6 +307,9 @@ TEST_CASE("GC follows internal references", "[gc]")
         CHECK_POINTEE(0, obj->v_name);
         CHECK_POINTEE(1, obj->v_methods);
         CHECK_POINTEE(2, obj->v_attributes);
+        CHECK_POINTEE(3, obj->v_value_methods);
+        CHECK_POINTEE(4, obj->v_typed_params);
+        CHECK_POINTEE(5, obj->v_dispatch_table);
     }
 
     SECTION("Type")
@@ -311,6 +324,8 @@ TEST_CASE("GC follows internal references", "[gc]")
         obj->kind = Type::Kind::DATACLASS; // not used by GC
         obj->v_slots = v_pointees[4];
         obj->num_total_slots = 0x12345678;
+        obj->type_id = 0x1234;
+        obj->v_ancestors = v_pointees[5];
 
         Value v_obj = Value::object(obj);
         single_root_collect(&v_obj);
@@ -325,6 +340,8 @@ TEST_CASE("GC follows internal references", "[gc]")
         CHECK(obj->kind == Type::Kind::DATACLASS);
         CHECK_POINTEE(4, obj->v_slots);
         CHECK(obj->num_total_slots == 0x12345678);
+        CHECK(obj->type_id == 0x1234);
+        CHECK_POINTEE(5, obj->v_ancestors);
     }
 
     SECTION("DataclassInstance")
@@ -349,6 +366,8 @@ TEST_CASE("GC follows internal references", "[gc]")
         type->kind = Type::Kind::DATACLASS; // not used by GC
         type->v_slots = v_slots;
         type->num_total_slots = 2;
+        type->type_id = 0;
+        type->v_ancestors = v_pointees[7];
         Value v_type = Value::object(type);
         gc.roots.push_back(&v_type);
 
@@ -371,6 +390,7 @@ TEST_CASE("GC follows internal references", "[gc]")
             CHECK_POINTEE(2, type->v_bases);
             CHECK_POINTEE(3, type->v_linearization);
             CHECK_POINTEE(4, type->v_subtypes);
+            CHECK_POINTEE(7, type->v_ancestors);
             REQUIRE_NOTHROW(slots = type->v_slots.obj_vector());
             REQUIRE(slots->length == 2);
             CHECK_POINTEE(0, slots->v_array);
@@ -414,6 +434,414 @@ TEST_CASE("GC follows internal references", "[gc]")
     }
 }
 
+TEST_CASE("generational GC promotes survivors and tracks old-to-young references", "[gc]")
+{
+    GC gc(64 * 1024, 1024);
+
+    // Keep the ref alive only indirectly, so that only the write barrier can keep track of it.
+    Root<Array> r_holder(gc, make_array(gc, 1));
+    {
+        ValueRoot r_null(gc, Value::null());
+        Ref* ref = make_ref(gc, r_null);
+        r_holder->components()[0] = Value::object(ref);
+    }
+    CHECK(gc.is_young(r_holder->components()[0].obj_ref()));
+    gc.collect_minor();
+    Ref* old_ref = r_holder->components()[0].obj_ref();
+    CHECK(!gc.is_young(old_ref));
+
+    // Mutate the now-old ref to point at a young string.
+    {
+        String* s = make_string(gc, "young");
+        CHECK(gc.is_young(s));
+        old_ref->v_ref = Value::object(s);
+        gc.write_barrier(old_ref, old_ref->v_ref);
+    }
+
+    // Fill up the nursery several times over, so that it is collected on its own.
+    uint64_t collections_before = gc.num_collections;
+    for (int i = 0; i < 100; i++) {
+        make_string(gc, "garbage garbage garbage");
+    }
+    CHECK(gc.num_collections > collections_before);
+
+    // The ref stayed put, and the string survived (by way of the remembered ref).
+    REQUIRE(r_holder->components()[0].obj_ref() == old_ref);
+    REQUIRE(old_ref->v_ref.is_obj_string());
+    CHECK(!gc.is_young(old_ref->v_ref.obj_string()));
+    CHECK(string_eq(old_ref->v_ref.obj_string(), "young"));
+
+    // Large objects skip the nursery.
+    Array* large = make_array(gc, 100);
+    CHECK(!gc.is_young(large));
+
+    // A full collection still moves everything.
+    gc.collect();
+    CHECK(string_eq(r_holder->components()[0].obj_ref()->v_ref.obj_string(), "young"));
+}
+
+TEST_CASE("GC grows and shrinks its main region", "[gc]")
+{
+    GC gc(1024, 0, 64 * 1024);
+    CHECK(gc.heap_size() == 1024);
+
+    // Keep far more than the initial size alive.
+    uint64_t grown;
+    {
+        Root<Vector> r_keep(gc, make_vector(gc, 0));
+        for (int i = 0; i < 200; i++) {
+            ValueRoot r_s(gc, Value::object(make_string(gc, "kept alive for a while")));
+            append(gc, r_keep, r_s);
+        }
+        CHECK(gc.heap_size() > 1024);
+        CHECK(gc.heap_size() <= 64 * 1024);
+        grown = gc.heap_size();
+        for (Value v : *r_keep) {
+            CHECK(string_eq(v.obj_string(), "kept alive for a while"));
+        }
+
+        // Exceeding the maximum is still an error.
+        CHECK_THROWS_AS(gc.alloc<Array>(64 * 1024), std::bad_alloc);
+    }
+
+    // Once that's all garbage, the main region shrinks back down over a few collections.
+    for (int i = 0; i < 4; i++) {
+        gc.collect();
+    }
+    CHECK(gc.heap_size() < grown);
+    CHECK(gc.heap_size() >= 1024);
+}
+
 // TODO: test ValueRoot more (e.g. move semantics, destructor)
 // TODO: test Root<T> more
 // TODO: test OptionalRoot<T> more
+
+namespace
+{
+    // A provider using the older std::function interface.
+    class VisitingProvider : public RootProvider
+    {
+    public:
+        Value v_root = Value::null();
+
+        void visit_roots(std::function<void(Value*)>& visitor) override
+        {
+            visitor(&this->v_root);
+        }
+    };
+
+    // A provider handing over a run of roots at once.
+    class TracingProvider : public RootProvider
+    {
+    public:
+        Value roots[3] = {Value::null(), Value::fixnum(3), Value::null()};
+
+        void trace_roots(Tracer& tracer) override
+        {
+            tracer.trace_range(this->roots, 3);
+        }
+    };
+}
+
+TEST_CASE("GC traces roots from both RootProvider interfaces", "[gc]")
+{
+    GC gc(64 * 1024, 1024);
+    VisitingProvider visiting;
+    TracingProvider tracing;
+    gc.root_providers.push_back(&visiting);
+    gc.root_providers.push_back(&tracing);
+
+    visiting.v_root = Value::object(make_string(gc, "visited"));
+    tracing.roots[0] = Value::object(make_string(gc, "traced 0"));
+    tracing.roots[2] = Value::object(make_string(gc, "traced 2"));
+
+    gc.collect_minor();
+    CHECK(!gc.is_young(visiting.v_root.object()));
+    CHECK(!gc.is_young(tracing.roots[2].object()));
+    gc.collect();
+
+    CHECK(string_eq(visiting.v_root.obj_string(), "visited"));
+    CHECK(string_eq(tracing.roots[0].obj_string(), "traced 0"));
+    CHECK(tracing.roots[1] == Value::fixnum(3));
+    CHECK(string_eq(tracing.roots[2].obj_string(), "traced 2"));
+
+    gc.root_providers.clear();
+}
+
+TEST_CASE("GC keeps large objects in place and frees them once dead", "[gc]")
+{
+    GC gc(64 * 1024, 1024);
+    gc.large_object_size = 1024;
+
+    Root<Array> r_large(gc, make_array(gc, 200));
+    Array* large = *r_large;
+    CHECK(large->is_large());
+    CHECK(!gc.is_young(large));
+    CHECK(gc.large_space_size() == align_up(Array::size(200), TAG_BITS));
+    CHECK(!make_array(gc, 10)->is_large());
+
+    // A freshly allocated large object may refer to young objects without any write barrier.
+    large->length = 1;
+    large->components()[0] = Value::object(make_string(gc, "young"));
+    gc.collect_minor();
+    CHECK(*r_large == large);
+    CHECK(string_eq(large->components()[0].obj_string(), "young"));
+
+    // Old-to-young references from large objects go through the write barrier as usual.
+    large->components()[0] = Value::object(make_string(gc, "younger"));
+    gc.write_barrier(large, large->components()[0]);
+    gc.collect_minor();
+    CHECK(string_eq(large->components()[0].obj_string(), "younger"));
+
+    // Full collections don't move it either, but do trace through it.
+    {
+        Root<Array> r_dead(gc, make_array(gc, 300));
+        gc.collect();
+        CHECK(*r_large == large);
+        CHECK(!(*r_large)->is_marked());
+        CHECK(string_eq(large->components()[0].obj_string(), "younger"));
+    }
+
+    // Unreachable large objects are freed by the next full collection.
+    CHECK(gc.large_space_size() > align_up(Array::size(200), TAG_BITS));
+    gc.collect();
+    CHECK(gc.large_space_size() == align_up(Array::size(200), TAG_BITS));
+    CHECK(string_eq(large->components()[0].obj_string(), "younger"));
+}
+
+TEST_CASE("GC copies object graphs out and back in", "[gc]")
+{
+    std::vector<Value> roots;
+    HeapCopy copy;
+    {
+        GC gc(64 * 1024, 1024);
+        gc.large_object_size = 1024;
+
+        Root<String> r_name(gc, make_string(gc, "Point"));
+        Root<Array> r_bases(gc, make_array(gc, 0));
+        OptionalRoot<Array> r_slots(gc, make_array(gc, 2));
+        (*r_slots)->components()[0] = Value::object(make_string(gc, "x"));
+        (*r_slots)->components()[1] = Value::object(make_string(gc, "y"));
+        Root<Type> r_type(
+            gc, make_type(gc, r_name, r_bases, false, Type::Kind::DATACLASS, r_slots, 2));
+        Root<DataclassInstance> r_instance(gc, make_instance_nofill(gc, r_type));
+        (*r_instance)->slots()[0] = Value::fixnum(7);
+        (*r_instance)->slots()[1] = Value::object(make_string(gc, "shared"));
+
+        // A cycle, and a reference to the large array.
+        Root<Tuple> r_tuple(gc, make_tuple(gc, 3));
+        Root<Array> r_large(gc, make_array(gc, 200));
+        REQUIRE((*r_large)->is_large());
+        (*r_large)->components()[0] = (*r_instance)->slots()[1];
+        (*r_tuple)->components()[0] = r_tuple.value();
+        (*r_tuple)->components()[1] = r_large.value();
+        (*r_tuple)->components()[2] = Value::object(make_foreign(gc, (void*)0x1234));
+
+        roots = {r_tuple.value(), r_instance.value(), Value::fixnum(3)};
+        int num_foreign = 0;
+        copy = gc.copy_out(roots, [&num_foreign](Object* obj) {
+            if (obj->tag() == ObjectTag::FOREIGN) {
+                num_foreign++;
+                static_cast<ForeignValue*>(obj)->value = nullptr;
+            }
+        });
+        CHECK(num_foreign == 1);
+        CHECK(copy.main_size < copy.contents.size());
+        CHECK(copy.contents.size() - copy.main_size == align_up(Array::size(200), TAG_BITS));
+        // The originals are left alone.
+        CHECK((*r_tuple)->components()[2].obj_foreign()->value == (void*)0x1234);
+        CHECK(roots[2] == Value::fixnum(3));
+    }
+
+    GC gc(64 * 1024, 1024);
+    Root<String> r_existing(gc, make_string(gc, "existing"));
+    gc.copy_in(reinterpret_cast<const uint8_t*>(copy.contents.data()),
+               copy.contents.size(),
+               copy.main_size,
+               roots,
+               [](Object* obj) {
+                   if (obj->tag() == ObjectTag::FOREIGN) {
+                       static_cast<ForeignValue*>(obj)->value = (void*)0x5678;
+                   }
+               });
+    for (Value& root : roots) {
+        gc.roots.push_back(&root);
+    }
+
+    // Check the copies survive a collection, too.
+    for (int i = 0; i < 2; i++) {
+        Tuple* tuple = roots[0].obj_tuple();
+        CHECK(tuple->components()[0] == roots[0]);
+        Array* large = tuple->components()[1].obj_array();
+        CHECK(large->is_large());
+        CHECK(large->length == 200);
+        CHECK(tuple->components()[2].obj_foreign()->value == (void*)0x5678);
+
+        DataclassInstance* instance = roots[1].obj_instance();
+        REQUIRE(instance->v_type.obj_type()->num_total_slots == 2);
+        CHECK(string_eq(instance->v_type.obj_type()->v_name.obj_string(), "Point"));
+        CHECK(instance->slots()[0] == Value::fixnum(7));
+        CHECK(string_eq(instance->slots()[1].obj_string(), "shared"));
+        CHECK(large->components()[0] == instance->slots()[1]);
+        CHECK(roots[2] == Value::fixnum(3));
+        CHECK(string_eq(*r_existing, "existing"));
+        gc.collect();
+    }
+    gc.roots.resize(gc.roots.size() - roots.size());
+}
+
+TEST_CASE("GC keeps statistics on allocation and collections", "[gc]")
+{
+    // Exact counts depend on when the GC decides to collect.
+    if (DEBUG_GC_COLLECT_EVERY_ALLOC) {
+        SKIP();
+    }
+
+    GC gc(64 * 1024, 1024);
+    CHECK(gc.bytes_allocated() == 0);
+    CHECK(gc.stats.peak_heap_size == 64 * 1024 + 1024);
+
+    Root<String> r_kept(gc, make_string(gc, "kept"));
+    uint64_t kept_size = align_up(String::size(4), TAG_BITS);
+    CHECK(gc.bytes_allocated() == kept_size);
+
+    gc.collect_minor();
+    CHECK(gc.stats.num_minor_collections == 1);
+    CHECK(gc.stats.last_survived == kept_size);
+    CHECK(gc.bytes_allocated() == kept_size);
+
+    make_string(gc, "garbage");
+    gc.collect();
+    CHECK(gc.stats.num_full_collections == 1);
+    CHECK(gc.stats.last_survived == kept_size);
+    CHECK(gc.stats.bytes_survived == 2 * kept_size);
+    CHECK(gc.bytes_allocated() == kept_size + align_up(String::size(7), TAG_BITS));
+
+    uint64_t pauses = 0;
+    for (uint64_t count : gc.stats.pause_histogram) {
+        pauses += count;
+    }
+    CHECK(pauses == 2);
+    CHECK(gc.stats.max_pause_ns <= gc.stats.total_pause_ns);
+
+    std::stringstream out;
+    gc.print_stats(out);
+    CHECK(out.str().find("1 minor, 1 full") != std::string::npos);
+}
+
+namespace
+{
+    // Describe the object graph reachable from `root` in a way that doesn't depend on where the
+    // objects are: they are numbered in the order a breadth-first walk reaches them.
+    std::string describe_graph(Value root)
+    {
+        std::map<Object*, size_t> ids;
+        std::vector<Object*> order;
+        const auto describe = [&ids, &order](Value value) -> std::string {
+            if (!value.is_object()) {
+                return std::to_string(value.raw_value());
+            }
+            auto [it, added] = ids.try_emplace(value.object(), order.size());
+            if (added) {
+                order.push_back(value.object());
+            }
+            return "#" + std::to_string(it->second);
+        };
+
+        std::stringstream out;
+        describe(root);
+        for (size_t i = 0; i < order.size(); i++) {
+            Object* obj = order[i];
+            out << i << ":";
+            if (obj->tag() == ObjectTag::STRING) {
+                auto string = obj->object<String*>();
+                out << " '" << std::string(string->contents(), string->contents() + string->length)
+                    << "'";
+            } else if (obj->tag() == ObjectTag::TUPLE) {
+                auto tuple = obj->object<Tuple*>();
+                for (uint64_t j = 0; j < tuple->length; j++) {
+                    out << " " << describe(tuple->components()[j]);
+                }
+            } else {
+                auto array = obj->object<Array*>();
+                out << " [";
+                for (uint64_t j = 0; j < array->length; j++) {
+                    out << " " << describe(array->components()[j]);
+                }
+                out << " ]";
+            }
+            out << "\n";
+        }
+        return out.str();
+    }
+};
+
+TEST_CASE("parallel GC leaves the same object graph as the serial GC", "[gc]")
+{
+    // The same (pseudo-random) graph of strings, tuples and arrays, with plenty of sharing and
+    // cycles, goes through a few collections with each number of threads.
+    auto build_and_collect = [](uint32_t num_threads, uint64_t nursery_size) {
+        GC gc(4 * 1024 * 1024, nursery_size, 16 * 1024 * 1024);
+        gc.num_threads = num_threads;
+        gc.parallel_collection_size = 0;
+
+        // Large, so it stays put and is only marked.
+        const uint64_t NUM_OBJECTS = 20000;
+        Root<Array> r_objects(gc, make_array(gc, NUM_OBJECTS));
+        CHECK((*r_objects)->is_large());
+        uint64_t seed = 12345;
+        auto random = [&seed](uint64_t bound) {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            return (seed >> 33) % bound;
+        };
+        for (uint64_t i = 0; i < NUM_OBJECTS; i++) {
+            Value v_obj;
+            if (i % 3 == 0) {
+                v_obj = Value::object(make_string(gc, "object " + std::to_string(i)));
+            } else {
+                uint64_t length = random(8);
+                Value* components;
+                if (i % 3 == 1) {
+                    Tuple* tuple = make_tuple(gc, length);
+                    components = tuple->components();
+                    v_obj = Value::object(tuple);
+                } else {
+                    Array* array = make_array(gc, length);
+                    components = array->components();
+                    v_obj = Value::object(array);
+                }
+                for (uint64_t j = 0; j < length; j++) {
+                    uint64_t k = random(i + 1);
+                    components[j] = k == i ? Value::fixnum(j) : (*r_objects)->components()[k];
+                }
+            }
+            (*r_objects)->components()[i] = v_obj;
+            gc.write_barrier(*r_objects, v_obj);
+            if (i % 1000 == 999) {
+                // Leave some garbage, and refer back to later objects to make cycles.
+                make_array(gc, random(100));
+                Value v_later = (*r_objects)->components()[random(i + 1)];
+                Value v_earlier = (*r_objects)->components()[random(i + 1)];
+                if (v_earlier.is_obj_array() && v_earlier.obj_array()->length > 0) {
+                    v_earlier.obj_array()->components()[0] = v_later;
+                    gc.write_barrier(v_earlier.obj_array(), v_later);
+                }
+            }
+        }
+
+        std::vector<std::string> graphs;
+        for (int i = 0; i < 3; i++) {
+            gc.collect();
+            graphs.push_back(describe_graph(Value::object(*r_objects)));
+        }
+        CHECK(gc.stats.num_parallel_collections == (num_threads > 1 ? 3 : 0));
+        CHECK(graphs[0] == graphs[1]);
+        CHECK(graphs[1] == graphs[2]);
+        return graphs[0];
+    };
+
+    uint64_t nursery_size = GENERATE(0, 64 * 1024);
+    std::string serial = build_and_collect(1, nursery_size);
+    CHECK(build_and_collect(2, nursery_size) == serial);
+    CHECK(build_and_collect(8, nursery_size) == serial);
+}
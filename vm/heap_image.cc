@@ -0,0 +1,356 @@
+#include "heap_image.h"
+
+#include "assertions.h"
+#include "bytecode_cache.h"
+#include "compile.h"
+#include "value_utils.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace Katsu
+{
+    static void put_u32(std::string& out, uint32_t value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    static void put_u64(std::string& out, uint64_t value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    static void put_str(std::string& out, const std::string& str)
+    {
+        put_u64(out, str.size());
+        out.append(str);
+    }
+
+    // Reads back what the put_*() functions wrote. Running off the end of the data just reads
+    // zeroes and clears `ok`.
+    struct ImageReader
+    {
+        const std::string& data;
+        size_t offset;
+        bool ok;
+
+        const char* take(uint64_t length)
+        {
+            if (!this->ok || length > this->data.size() - this->offset) {
+                this->ok = false;
+                return nullptr;
+            }
+            const char* bytes = this->data.data() + this->offset;
+            this->offset += length;
+            return bytes;
+        }
+        uint32_t u32()
+        {
+            uint32_t value = 0;
+            if (const char* bytes = this->take(sizeof(value))) {
+                memcpy(&value, bytes, sizeof(value));
+            }
+            return value;
+        }
+        uint64_t u64()
+        {
+            uint64_t value = 0;
+            if (const char* bytes = this->take(sizeof(value))) {
+                memcpy(&value, bytes, sizeof(value));
+            }
+            return value;
+        }
+        std::string str()
+        {
+            uint64_t length = this->u64();
+            const char* bytes = this->take(length);
+            return bytes ? std::string(bytes, length) : std::string();
+        }
+    };
+
+    // Identify a source file by its size and modification time, or by zeroes if it's missing.
+    static void source_stamp(const std::string& path, uint64_t* mtime, uint64_t* size)
+    {
+        struct stat file;
+        if (stat(path.c_str(), &file) != 0) {
+            *mtime = 0;
+            *size = 0;
+            return;
+        }
+        *mtime = file.st_mtim.tv_sec * 1000000000ull + file.st_mtim.tv_nsec;
+        *size = file.st_size;
+    }
+
+    // Everything with a fixed place in the VM which the heap is reachable from, in the order an
+    // image saves it, along with the core module and imports.
+    static const size_t NUM_VM_ROOTS = BuiltinId::NUM_BUILTINS + 4;
+
+    // Handler and foreign pointers are saved as one more than their index into the BuiltinNames.
+    template <typename P> static P encode_index(size_t index)
+    {
+        return reinterpret_cast<P>(static_cast<uintptr_t>(index + 1));
+    }
+    template <typename P> static size_t decode_index(P encoded)
+    {
+        return static_cast<size_t>(reinterpret_cast<uintptr_t>(encoded)) - 1;
+    }
+
+    void HeapImage::save(VM& vm, const std::string& path, Root<Assoc>& r_module,
+                         Root<Vector>& r_imports, uint64_t position)
+    {
+        ASSERT(vm.current_frame == nullptr);
+        // Method bodies waiting to be compiled live outside the heap.
+        compile_lazy_methods(vm);
+        const BuiltinNames& names = vm.builtin_names;
+
+        // An image starts with a header saying what it was saved from, in order to tell whether it
+        // is stale without reading the rest.
+        std::string contents(HEAP_IMAGE_MAGIC, sizeof(HEAP_IMAGE_MAGIC));
+        put_u32(contents, HEAP_IMAGE_VERSION);
+        uint64_t mtime, size;
+        build_stamp(&mtime, &size);
+        put_u64(contents, mtime);
+        put_u64(contents, size);
+        put_u64(contents, vm.source_paths.size());
+        for (const std::string& source_path : vm.source_paths) {
+            source_stamp(source_path, &mtime, &size);
+            put_str(contents, source_path);
+            put_u64(contents, mtime);
+            put_u64(contents, size);
+        }
+
+        put_u64(contents, names.natives.size());
+        for (const auto& [name, handler] : names.natives) {
+            put_str(contents, name);
+        }
+        put_u64(contents, names.intrinsics.size());
+        for (const auto& [name, handler] : names.intrinsics) {
+            put_str(contents, name);
+        }
+        put_u64(contents, names.foreign_constants.size());
+        for (const auto& [name, value] : names.foreign_constants) {
+            put_str(contents, name);
+        }
+        std::unordered_map<NativeHandler, size_t> native_indices;
+        for (size_t i = names.natives.size(); i-- > 0;) {
+            native_indices[names.natives[i].second] = i;
+        }
+        std::unordered_map<IntrinsicHandler, size_t> intrinsic_indices;
+        for (size_t i = names.intrinsics.size(); i-- > 0;) {
+            intrinsic_indices[names.intrinsics[i].second] = i;
+        }
+        std::unordered_map<void*, size_t> foreign_indices;
+        for (size_t i = names.foreign_constants.size(); i-- > 0;) {
+            foreign_indices[names.foreign_constants[i].second] = i;
+        }
+
+        std::vector<Value> roots(vm.builtin_values, vm.builtin_values + BuiltinId::NUM_BUILTINS);
+        roots.push_back(vm.v_modules);
+        roots.push_back(vm.v_multimethods);
+        roots.push_back(vm.v_symbols);
+        roots.push_back(vm.v_condition_handler);
+        roots.push_back(r_module.value());
+        roots.push_back(r_imports.value());
+        HeapCopy copy = vm.gc.copy_out(roots, [&](Object* obj) {
+            switch (obj->tag()) {
+                case ObjectTag::METHOD: {
+                    auto method = static_cast<Method*>(obj);
+                    if (method->native_handler) {
+                        auto it = native_indices.find(method->native_handler);
+                        if (it == native_indices.end()) {
+                            throw std::runtime_error("a native handler has no name");
+                        }
+                        method->native_handler = encode_index<NativeHandler>(it->second);
+                    }
+                    if (method->intrinsic_handler) {
+                        auto it = intrinsic_indices.find(method->intrinsic_handler);
+                        if (it == intrinsic_indices.end()) {
+                            throw std::runtime_error("an intrinsic handler has no name");
+                        }
+                        method->intrinsic_handler = encode_index<IntrinsicHandler>(it->second);
+                    }
+                    break;
+                }
+                case ObjectTag::FOREIGN: {
+                    auto foreign = static_cast<ForeignValue*>(obj);
+                    if (foreign->value) {
+                        auto it = foreign_indices.find(foreign->value);
+                        if (it == foreign_indices.end()) {
+                            throw std::runtime_error("the heap holds a foreign value");
+                        }
+                        foreign->value = encode_index<void*>(it->second);
+                    }
+                    break;
+                }
+                case ObjectTag::CALL_SEGMENT:
+                    throw std::runtime_error("the heap holds a continuation");
+                default: break;
+            }
+        });
+
+        put_u64(contents, vm.type_hierarchy_version);
+        put_u32(contents, vm.gc.num_types);
+        put_u64(contents, position);
+        put_u64(contents, roots.size());
+        for (Value root : roots) {
+            uint64_t raw;
+            memcpy(&raw, &root, sizeof(raw));
+            put_u64(contents, raw);
+        }
+        put_u64(contents, copy.main_size);
+        put_u64(contents, copy.contents.size());
+        // Keep the heap contents 8-byte aligned within the file, for whoever maps it.
+        contents.append(align_up(contents.size(), TAG_BITS) - contents.size(), '\0');
+        contents.append(copy.contents);
+
+        // Write to a temporary file first, so that nothing ever reads a partially written one.
+        std::string tmp_path = path + ".tmp" + std::to_string(gettid());
+        {
+            std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+            if (file) {
+                file.write(contents.data(), contents.size());
+            }
+            if (!file) {
+                std::error_code ec;
+                std::filesystem::remove(tmp_path, ec);
+                throw std::runtime_error("could not write " + tmp_path);
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp_path, path, ec);
+        if (ec) {
+            std::filesystem::remove(tmp_path, ec);
+            throw std::runtime_error("could not rename " + tmp_path + " to " + path);
+        }
+    }
+
+    bool HeapImage::restore(VM& vm, const std::string& path, ValueRoot& r_module,
+                            ValueRoot& r_imports, uint64_t* position)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            return false;
+        }
+        std::streamsize file_size = file.tellg();
+        file.seekg(0);
+        std::string contents(file_size, '\0');
+        if (!file.read(contents.data(), file_size)) {
+            return false;
+        }
+        ImageReader in{contents, 0, true};
+
+        const char* magic = in.take(sizeof(HEAP_IMAGE_MAGIC));
+        if (!magic || memcmp(magic, HEAP_IMAGE_MAGIC, sizeof(HEAP_IMAGE_MAGIC)) != 0 ||
+            in.u32() != HEAP_IMAGE_VERSION) {
+            return false;
+        }
+        uint64_t mtime, size;
+        build_stamp(&mtime, &size);
+        if (in.u64() != mtime || in.u64() != size) {
+            return false;
+        }
+        std::vector<std::string> source_paths(in.u64());
+        for (std::string& source_path : source_paths) {
+            source_path = in.str();
+            source_stamp(source_path, &mtime, &size);
+            if (in.u64() != mtime || in.u64() != size || !in.ok) {
+                return false;
+            }
+        }
+
+        // Look up each handler and foreign constant the image names.
+        const BuiltinNames& names = vm.builtin_names;
+        const auto resolve = [&in](const auto& named, auto& resolved) -> bool {
+            using Pointer = std::remove_reference_t<decltype(resolved[0])>;
+            std::unordered_map<std::string, Pointer> by_name;
+            for (const auto& [name, pointer] : named) {
+                by_name.emplace(name, pointer);
+            }
+            resolved.resize(in.u64());
+            for (Pointer& pointer : resolved) {
+                auto it = by_name.find(in.str());
+                if (it == by_name.end()) {
+                    return false;
+                }
+                pointer = it->second;
+            }
+            return in.ok;
+        };
+        std::vector<NativeHandler> natives;
+        std::vector<IntrinsicHandler> intrinsics;
+        std::vector<void*> foreign_constants;
+        if (!resolve(names.natives, natives) || !resolve(names.intrinsics, intrinsics) ||
+            !resolve(names.foreign_constants, foreign_constants)) {
+            return false;
+        }
+
+        uint64_t type_hierarchy_version = in.u64();
+        uint32_t num_types = in.u32();
+        uint64_t saved_position = in.u64();
+        std::vector<Value> roots(in.u64());
+        if (roots.size() != NUM_VM_ROOTS + 2) {
+            return false;
+        }
+        for (Value& root : roots) {
+            uint64_t raw = in.u64();
+            memcpy(&root, &raw, sizeof(raw));
+        }
+        uint64_t main_size = in.u64();
+        uint64_t heap_size = in.u64();
+        in.take(align_up(in.offset, TAG_BITS) - in.offset);
+        const char* heap = in.take(heap_size);
+        if (!heap || in.offset != contents.size()) {
+            return false;
+        }
+
+        vm.gc.copy_in(reinterpret_cast<const uint8_t*>(heap),
+                      heap_size,
+                      main_size,
+                      roots,
+                      [&](Object* obj) {
+                          switch (obj->tag()) {
+                              case ObjectTag::METHOD: {
+                                  auto method = static_cast<Method*>(obj);
+                                  if (method->native_handler) {
+                                      method->native_handler =
+                                          natives.at(decode_index(method->native_handler));
+                                  }
+                                  if (method->intrinsic_handler) {
+                                      method->intrinsic_handler =
+                                          intrinsics.at(decode_index(method->intrinsic_handler));
+                                  }
+                                  break;
+                              }
+                              case ObjectTag::FOREIGN: {
+                                  auto foreign = static_cast<ForeignValue*>(obj);
+                                  if (foreign->value) {
+                                      foreign->value =
+                                          foreign_constants.at(decode_index(foreign->value));
+                                  }
+                                  break;
+                              }
+                              case ObjectTag::IDENTITY_SET:
+                                  // Everything has moved, so rehash on first use.
+                                  static_cast<IdentitySet*>(obj)->epoch = UINT64_MAX;
+                                  break;
+                              default: break;
+                          }
+                      });
+
+        std::copy(roots.begin(), roots.begin() + BuiltinId::NUM_BUILTINS, vm.builtin_values);
+        vm.v_modules = roots[BuiltinId::NUM_BUILTINS];
+        vm.v_multimethods = roots[BuiltinId::NUM_BUILTINS + 1];
+        vm.v_symbols = roots[BuiltinId::NUM_BUILTINS + 2];
+        vm.v_condition_handler = roots[BuiltinId::NUM_BUILTINS + 3];
+        *r_module = roots[NUM_VM_ROOTS];
+        *r_imports = roots[NUM_VM_ROOTS + 1];
+        vm.type_hierarchy_version = type_hierarchy_version;
+        vm.gc.num_types = num_types;
+        vm.source_paths = std::move(source_paths);
+        *position = saved_position;
+        return true;
+    }
+};
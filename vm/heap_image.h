@@ -0,0 +1,42 @@
+#pragma once
+
+#include "gc.h"
+#include "value.h"
+#include "vm.h"
+
+#include <string>
+
+namespace Katsu
+{
+    // Heap image files start with this, followed by a format version.
+    const char HEAP_IMAGE_MAGIC[8] = {'K', 'A', 'T', 'S', 'U', 'I', 'M', '\0'};
+    const uint32_t HEAP_IMAGE_VERSION = 1;
+
+    // A heap image is a snapshot of a VM partway through bootstrapping: everything reachable from
+    // its roots once core.katsu calls heap-image-point, along with the module core.katsu is run in
+    // and how far it got, so that a later run can restore all that and carry on from there rather
+    // than load core from scratch.
+    //
+    // Pointers mean nothing from one process to the next, so the image holds a relocatable copy of
+    // the heap (see GC::copy_out()), and refers to native and intrinsic handlers and foreign
+    // constants by name (see BuiltinNames). Anything else which lives outside the heap (any other
+    // foreign value, or a continuation) can't be saved.
+    //
+    // An image is only good for the exact executable which saved it, and for the same source
+    // files as it loaded (by path, size and modification time); otherwise it's stale.
+    class HeapImage
+    {
+    public:
+        // Save an image to `path`, given the core module and imports, and the number of top-level
+        // expressions (see TopLevelCompiler::position()) run so far. The call stack must be empty.
+        // Throws std::runtime_error if the heap can't be saved.
+        static void save(VM& vm, const std::string& path, Root<Assoc>& r_module,
+                         Root<Vector>& r_imports, uint64_t position);
+
+        // Restore an image from `path` into a VM which has had only register_builtins() run on it,
+        // and fill in the core module, imports and position as saved. Returns false (having
+        // changed nothing) if there is no image at `path`, or it's stale.
+        static bool restore(VM& vm, const std::string& path, ValueRoot& r_module,
+                            ValueRoot& r_imports, uint64_t* position);
+    };
+};
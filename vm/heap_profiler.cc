@@ -0,0 +1,139 @@
+#include "heap_profiler.h"
+
+#include "value_utils.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace Katsu
+{
+    // Most sites to list in a report.
+    static const size_t MAX_REPORTED_SITES = 20;
+
+    HeapProfiler::HeapProfiler(VM& vm, uint64_t interval, bool report_after_full,
+                               std::ostream& out)
+        : vm(vm)
+        , report_after_full(report_after_full)
+        , out(out)
+        , sites{}
+        , site_ids{}
+        , allocated_by_tag{}
+        , live_by_tag{}
+        , num_collections(0)
+    {
+        this->vm.gc.set_sampler(this, interval);
+    }
+
+    HeapProfiler::~HeapProfiler()
+    {
+        this->vm.gc.set_sampler(nullptr, 0);
+    }
+
+    uint32_t HeapProfiler::site_for_current_frame()
+    {
+        std::string location = "<native>";
+        Frame* frame = OpenVM(this->vm).frame();
+        if (frame) {
+            // This is only ever called part way through an allocation, so nothing has moved.
+            Array* spans = frame->v_code.obj_code()->v_inst_spans.obj_array();
+            if (frame->inst_spot < spans->length) {
+                // See convert_span() in compile.cc.
+                Value* span = spans->components()[frame->inst_spot].obj_tuple()->components();
+                std::stringstream s;
+                s << native_str(span[0].obj_string()) << ":" << span[2].fixnum() + 1 << ":"
+                  << span[3].fixnum() + 1 << "-" << span[5].fixnum() + 1 << "."
+                  << span[6].fixnum() + 1;
+                location = s.str();
+            }
+        }
+
+        auto it = this->site_ids.find(location);
+        if (it != this->site_ids.end()) {
+            return it->second;
+        }
+        uint32_t id = this->sites.size();
+        this->sites.push_back(Site{location, 0, 0});
+        this->site_ids.emplace(location, id);
+        return id;
+    }
+
+    uint32_t HeapProfiler::sample(Object* object, uint64_t size, uint64_t weight)
+    {
+        uint32_t site = this->site_for_current_frame();
+        this->sites[site].allocated += weight;
+        this->allocated_by_tag[static_cast<size_t>(object->tag())] += weight;
+        return site;
+    }
+
+    void HeapProfiler::after_collection(bool full, const std::vector<SampledObject>& live)
+    {
+        this->num_collections++;
+        for (Site& site : this->sites) {
+            site.live = 0;
+        }
+        std::fill_n(this->live_by_tag, NUM_TAGS, 0);
+        for (const SampledObject& sample : live) {
+            this->sites[sample.site].live += sample.weight;
+            this->live_by_tag[static_cast<size_t>(sample.object->tag())] += sample.weight;
+        }
+        if (full && this->report_after_full) {
+            this->report_live(this->out);
+        }
+    }
+
+    // Print the nonzero byte counts per tag and per site, largest first.
+    static void report(std::ostream& out, const uint64_t* bytes_by_tag, size_t num_tags,
+                       std::vector<std::pair<uint64_t, const std::string*>> by_site)
+    {
+        std::vector<std::pair<uint64_t, ObjectTag>> by_tag;
+        for (size_t i = 0; i < num_tags; i++) {
+            if (bytes_by_tag[i] > 0) {
+                by_tag.emplace_back(bytes_by_tag[i], static_cast<ObjectTag>(i));
+            }
+        }
+        std::sort(by_tag.rbegin(), by_tag.rend());
+        out << "  by type:\n";
+        for (auto& [bytes, tag] : by_tag) {
+            out << "    " << bytes << " " << object_tag_str(tag) << "\n";
+        }
+
+        std::erase_if(by_site, [](const auto& entry) { return entry.first == 0; });
+        std::sort(by_site.begin(), by_site.end(), [](const auto& a, const auto& b) {
+            return a.first > b.first || (a.first == b.first && *a.second < *b.second);
+        });
+        out << "  by site:\n";
+        for (size_t i = 0; i < by_site.size() && i < MAX_REPORTED_SITES; i++) {
+            out << "    " << by_site[i].first << " " << *by_site[i].second << "\n";
+        }
+        if (by_site.size() > MAX_REPORTED_SITES) {
+            out << "    (" << by_site.size() - MAX_REPORTED_SITES << " more sites)\n";
+        }
+    }
+
+    void HeapProfiler::report_allocations(std::ostream& out) const
+    {
+        std::vector<std::pair<uint64_t, const std::string*>> by_site;
+        for (const Site& site : this->sites) {
+            by_site.emplace_back(site.allocated, &site.location);
+        }
+        out << "Heap profile: estimated bytes allocated\n";
+        report(out, this->allocated_by_tag, NUM_TAGS, std::move(by_site));
+    }
+
+    void HeapProfiler::report_live(std::ostream& out) const
+    {
+        std::vector<std::pair<uint64_t, const std::string*>> by_site;
+        for (const Site& site : this->sites) {
+            by_site.emplace_back(site.live, &site.location);
+        }
+        out << "Heap profile: estimated bytes live after collection " << this->num_collections
+            << "\n";
+        report(out, this->live_by_tag, NUM_TAGS, std::move(by_site));
+    }
+
+    uint64_t HeapProfiler::allocated_at(const std::string& location) const
+    {
+        auto it = this->site_ids.find(location);
+        return it == this->site_ids.end() ? 0 : this->sites[it->second].allocated;
+    }
+};
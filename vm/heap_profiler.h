@@ -0,0 +1,59 @@
+#pragma once
+
+#include "gc.h"
+#include "value.h"
+#include "vm.h"
+
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Katsu
+{
+    // Sampling allocation profiler. Roughly every `interval`th allocated byte is attributed to the
+    // object tag and to the source span of the instruction running in the current frame at the
+    // time (or to a "<native>" site when there is no frame). Sampled objects are then followed
+    // across collections, to tell what survives.
+    class HeapProfiler : public AllocationSampler
+    {
+    public:
+        // Start sampling `vm`'s allocations, until destroyed. If `report_after_full`, print a
+        // report_live() to `out` after every full collection.
+        HeapProfiler(VM& vm, uint64_t interval, bool report_after_full, std::ostream& out);
+        ~HeapProfiler();
+
+        uint32_t sample(Object* object, uint64_t size, uint64_t weight) override;
+        void after_collection(bool full, const std::vector<SampledObject>& live) override;
+
+        // Print the estimated bytes allocated so far, per object tag and per site.
+        void report_allocations(std::ostream& out) const;
+        // Print the estimated bytes surviving the last collection, per object tag and per site.
+        void report_live(std::ostream& out) const;
+
+        // Estimated bytes allocated so far at `location` (as it appears in the reports), or 0.
+        uint64_t allocated_at(const std::string& location) const;
+
+    private:
+        static const size_t NUM_TAGS = static_cast<size_t>(ObjectTag::I64_ARRAY) + 1;
+
+        struct Site
+        {
+            std::string location;
+            uint64_t allocated;
+            uint64_t live;
+        };
+
+        uint32_t site_for_current_frame();
+
+        VM& vm;
+        bool report_after_full;
+        std::ostream& out;
+
+        std::vector<Site> sites;
+        std::unordered_map<std::string, uint32_t> site_ids;
+        uint64_t allocated_by_tag[NUM_TAGS];
+        uint64_t live_by_tag[NUM_TAGS];
+        uint64_t num_collections;
+    };
+};
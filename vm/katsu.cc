@@ -1,26 +1,32 @@
 #include "katsu.h"
 
+#include "assertions.h"
 #include "builtin.h"
+#include "bytecode_cache.h"
 #include "compile.h"
+#include "cpu_profiler.h"
 #include "gc.h"
+#include "heap_image.h"
+#include "heap_profiler.h"
 #include "lexer.h"
 #include "parser.h"
 #include "value.h"
 #include "value_utils.h"
 #include "vm.h"
+#include "worker.h"
 
 #include <fstream>
 #include <iostream>
-#include <sstream>
+#include <optional>
 
 #include <variant>
 
 namespace Katsu
 {
-    std::ostream& operator<<(std::ostream& s, Token token)
+    std::ostream& operator<<(std::ostream& s, const Token& token)
     {
         s << token.type;
-        if (const std::string* strval = std::get_if<std::string>(&token.value)) {
+        if (const std::string_view* strval = std::get_if<std::string_view>(&token.value)) {
             s << "(value=\"" << *strval << "\")";
         } else if (const long long* intval = std::get_if<long long>(&token.value)) {
             s << "(value=" << *intval << ")";
@@ -49,14 +55,14 @@ namespace Katsu
         void visit(UnaryOpExpr& e) override
         {
             prefix();
-            std::cout << "unary-op " << std::get<std::string>(e.op.value) << "\n";
+            std::cout << "unary-op " << std::get<std::string_view>(e.op.value) << "\n";
             ExprPrinter indented(depth + 1);
             e.arg->accept(indented);
         }
         void visit(BinaryOpExpr& e) override
         {
             prefix();
-            std::cout << "binary-op " << std::get<std::string>(e.op.value) << "\n";
+            std::cout << "binary-op " << std::get<std::string_view>(e.op.value) << "\n";
             ExprPrinter indented(depth + 1);
             e.left->accept(indented);
             e.right->accept(indented);
@@ -64,7 +70,7 @@ namespace Katsu
         void visit(NameExpr& e) override
         {
             prefix();
-            std::cout << "name " << std::get<std::string>(e.name.value) << "\n";
+            std::cout << "name " << std::get<std::string_view>(e.name.value) << "\n";
         }
         void visit(LiteralExpr& e) override
         {
@@ -74,7 +80,7 @@ namespace Katsu
         void visit(UnaryMessageExpr& e) override
         {
             prefix();
-            std::cout << "unary-msg " << std::get<std::string>(e.message.value) << "\n";
+            std::cout << "unary-msg " << std::get<std::string_view>(e.message.value) << "\n";
             ExprPrinter indented(depth + 1);
             e.target->accept(indented);
         }
@@ -83,14 +89,14 @@ namespace Katsu
             prefix();
             std::cout << "nary-msg (target=" << (e.target.has_value() ? "yes" : "no") << ")";
             for (const Token& message : e.messages) {
-                std::cout << " " << std::get<std::string>(message.value);
+                std::cout << " " << std::get<std::string_view>(message.value);
             }
             std::cout << "\n";
             ExprPrinter indented(depth + 1);
             if (e.target.has_value()) {
                 (*e.target)->accept(indented);
             }
-            for (const std::unique_ptr<Expr>& arg : e.args) {
+            for (Expr* arg : e.args) {
                 arg->accept(indented);
             }
         }
@@ -117,7 +123,7 @@ namespace Katsu
             prefix();
             std::cout << "data\n";
             ExprPrinter indented(depth + 1);
-            for (const std::unique_ptr<Expr>& component : e.components) {
+            for (Expr* component : e.components) {
                 component->accept(indented);
             }
         }
@@ -126,7 +132,7 @@ namespace Katsu
             prefix();
             std::cout << "sequence\n";
             ExprPrinter indented(depth + 1);
-            for (const std::unique_ptr<Expr>& component : e.components) {
+            for (Expr* component : e.components) {
                 component->accept(indented);
             }
         }
@@ -135,7 +141,7 @@ namespace Katsu
             prefix();
             std::cout << "tuple\n";
             ExprPrinter indented(depth + 1);
-            for (const std::unique_ptr<Expr>& component : e.components) {
+            for (Expr* component : e.components) {
                 component->accept(indented);
             }
         }
@@ -146,27 +152,55 @@ namespace Katsu
         std::ifstream file_stream;
         // Raise exceptions on logical error or read/write error.
         file_stream.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        file_stream.open(filepath.c_str());
+        file_stream.open(filepath.c_str(), std::ios::binary | std::ios::ate);
+        std::streamsize size = file_stream.tellg();
+        file_stream.seekg(0);
 
-        std::stringstream str_stream;
-        str_stream << file_stream.rdbuf();
-        std::string file_contents = str_stream.str();
+        // Read straight into place, rather than copying out of a stringstream.
+        std::string file_contents(size, '\0');
+        file_stream.read(file_contents.data(), size);
 
         return SourceFile{.path = std::make_shared<std::string>(filepath),
                           .source = std::make_shared<std::string>(std::move(file_contents))};
     }
 
-    Value run_source(const SourceFile source, const std::string& module_name, VM& vm)
+    // Compile and run the rest of a module's source, one top-level expression at a time. If given
+    // a `heap_image_path`, saves a heap image there once heap-image-point is called.
+    static Value run_toplevel(VM& vm, TopLevelCompiler& compiler, Root<Assoc>& r_module,
+                              Root<Vector>& r_imports, const std::string* heap_image_path)
     {
-        Lexer lexer(source);
-        TokenStream stream(lexer);
-        std::unique_ptr<PrattParser> parser = make_default_parser();
+        Value result = Value::null();
+        while (Code* code = compiler.next(r_module, r_imports)) {
+            Root<Code> r_code(vm.gc, std::move(code));
+            result = vm.eval_toplevel(r_code);
+            if (vm.reached_heap_image_point) {
+                vm.reached_heap_image_point = false;
+                if (heap_image_path) {
+                    ValueRoot r_result(vm.gc, std::move(result));
+                    try {
+                        HeapImage::save(
+                            vm, *heap_image_path, r_module, r_imports, compiler.position());
+                    } catch (const std::runtime_error& e) {
+                        std::cerr << "Warning: could not save heap image " << *heap_image_path
+                                  << ": " << e.what() << "\n";
+                    }
+                    heap_image_path = nullptr;
+                    result = *r_result;
+                }
+            }
+        }
+        return result;
+    }
 
+    // Run a module's source (as given to `compiler`) in a new module.
+    static Value run_new_module(VM& vm, TopLevelCompiler& compiler, const std::string& module_name,
+                                const std::string* heap_image_path)
+    {
         // Create a separate module for the source we're executing.
         Root<Assoc> r_module(vm.gc, make_assoc(vm.gc, /* capacity */ 0));
         {
             Root<Assoc> r_modules(vm.gc, vm.v_modules.obj_assoc());
-            ValueRoot r_name(vm.gc, Value::object(make_string(vm.gc, module_name)));
+            ValueRoot r_name(vm.gc, Value::object(intern(vm, module_name)));
             ValueRoot rv_module(vm.gc, r_module.value());
             append(vm.gc, r_modules, r_name, rv_module);
             vm.v_modules = r_modules.value();
@@ -175,107 +209,212 @@ namespace Katsu
         Root<Vector> r_imports(vm.gc, make_vector(vm.gc, /* capacity */ 0));
         use_default_imports(vm, r_imports);
 
-        // std::cout << "=== INITIAL MODULE STATE ===\n";
-        // pprint(r_module.value());
-
-        // Skip any leading semicolons / newlines to get to the meat.
-        while (stream.current_has_type(TokenType::SEMICOLON) ||
-               stream.current_has_type(TokenType::NEWLINE)) {
-            stream.consume();
-        }
-
-        Value result = Value::null();
-        while (!stream.current_has_type(TokenType::END)) {
-            std::unique_ptr<Expr> top_level_expr =
-                parser->parse(stream, 0 /* precedence */, true /* is_toplevel */);
-
-            // std::cout << "=== MODULE STATE ===\n";
-            // pprint(r_module.value());
-            // std::cout << "=== PARSED ===\n";
-            // ExprPrinter printer(0);
-            // top_level_expr->accept(printer);
-
-            std::vector<std::unique_ptr<Expr>> top_level_exprs;
-            top_level_exprs.emplace_back(std::move(top_level_expr));
-            // std::cout << "=== COMPILING INTO MODULE ===\n";
-            Root<Code> code(vm.gc,
-                            compile_into_module(vm,
-                                                r_module,
-                                                r_imports,
-                                                top_level_exprs[0]->span,
-                                                top_level_exprs));
-            // std::cout << "=== GENERATED CODE ===\n";
-            // pprint(code.value());
-            // std::cout << "=== EVALUATING ===\n";
-            result = vm.eval_toplevel(code);
-            // std::cout << "=== EVALUATION RESULT ===\n";
-            // std::cout << "-> ";
-            // pprint(result);
+        return run_toplevel(vm, compiler, r_module, r_imports, heap_image_path);
+    }
 
-            // std::cout << "\n\n\n";
+    Value run_source(const SourceFile source, const std::string& module_name, VM& vm)
+    {
+        TopLevelCompiler compiler(vm, source, vm.bytecode_cache_dir);
+        return run_new_module(vm, compiler, module_name, /* heap_image_path */ nullptr);
+    }
 
-            // Ratchet past any semicolons and newlines, since the parser explicitly stops
-            // when it sees either of these at the top level.
-            while (stream.current_has_type(TokenType::SEMICOLON) ||
-                   stream.current_has_type(TokenType::NEWLINE)) {
-                stream.consume();
-            }
+    // Make a module with some constants for bootstrap files to use in order to load the requested
+    // "user" source.
+    static Assoc* make_bootstrap_load_module(VM& vm, const SourceFile& source,
+                                             const std::string& module_name)
+    {
+        Root<Assoc> r_core_bootstrap_load(vm.gc, make_assoc(vm.gc, /* capacity */ 3));
+        {
+            ValueRoot r_name(vm.gc, Value::object(intern(vm, "user-module-name")));
+            ValueRoot r_value(vm.gc, Value::object(make_string(vm.gc, module_name)));
+            append(vm.gc, r_core_bootstrap_load, r_name, r_value);
         }
-        return result;
+        {
+            ValueRoot r_name(vm.gc, Value::object(intern(vm, "user-source-path")));
+            ValueRoot r_value(vm.gc, Value::object(make_string(vm.gc, *source.path)));
+            append(vm.gc, r_core_bootstrap_load, r_name, r_value);
+        }
+        {
+            ValueRoot r_name(vm.gc, Value::object(intern(vm, "user-source-contents")));
+            ValueRoot r_value(vm.gc, Value::object(make_string(vm.gc, *source.source)));
+            append(vm.gc, r_core_bootstrap_load, r_name, r_value);
+        }
+        return *r_core_bootstrap_load;
     }
 
-    Value bootstrap_and_run_source(const SourceFile source, const std::string& module_name, GC& gc,
-                                   uint64_t call_stack_size)
+    Value bootstrap_and_run_in_vm(const SourceFile source, const std::string& module_name, VM& vm,
+                                  const std::string& heap_image_path)
     {
-        VM vm(gc, call_stack_size);
+        GC& gc = vm.gc;
 
-        // Establish builtins in various core.builtin.* modules.
+        // Establish builtins in various core.builtin.* modules. (Even when restoring a heap image,
+        // which has its own copies of all of these, this names the handlers for it to use.)
         {
             Root<Assoc> r_modules(vm.gc, vm.v_modules.obj_assoc());
             register_builtins(vm, r_modules);
             vm.v_modules = r_modules.value();
         }
 
-        // Add a module with some constants for bootstrap files to use in order to load the
-        // requested "user" source.
-        {
-            Root<Assoc> r_core_bootstrap_load(gc, make_assoc(gc, /* capacity */ 3));
-            {
-                ValueRoot r_name(vm.gc, Value::object(make_string(vm.gc, "user-module-name")));
-                ValueRoot r_value(vm.gc, Value::object(make_string(vm.gc, module_name)));
-                append(vm.gc, r_core_bootstrap_load, r_name, r_value);
-            }
-            {
-                ValueRoot r_name(vm.gc, Value::object(make_string(vm.gc, "user-source-path")));
-                ValueRoot r_value(vm.gc, Value::object(make_string(vm.gc, *source.path)));
-                append(vm.gc, r_core_bootstrap_load, r_name, r_value);
-            }
-            {
-                ValueRoot r_name(vm.gc, Value::object(make_string(vm.gc, "user-source-contents")));
-                ValueRoot r_value(vm.gc, Value::object(make_string(vm.gc, *source.source)));
-                append(vm.gc, r_core_bootstrap_load, r_name, r_value);
+        TopLevelCompiler core_compiler(vm, load_file("src/core/core.katsu"), vm.bytecode_cache_dir);
+
+        if (!heap_image_path.empty()) {
+            ValueRoot r_core_module(gc, Value::null());
+            ValueRoot r_core_imports(gc, Value::null());
+            uint64_t position;
+            if (HeapImage::restore(vm, heap_image_path, r_core_module, r_core_imports, &position)) {
+                // Swap in this run's own core.bootstrap.load, which core.katsu hasn't imported
+                // yet as of the heap image point.
+                {
+                    Assoc* load = make_bootstrap_load_module(vm, source, module_name);
+                    ValueRoot r_load(gc, Value::object(load));
+                    Assoc* modules = vm.v_modules.obj_assoc();
+                    Value* existing = assoc_lookup(modules, "core.bootstrap.load");
+                    ALWAYS_ASSERT_MSG(existing, "heap image has no core.bootstrap.load module");
+                    *existing = *r_load;
+                    gc.write_barrier(modules->v_array.object(), *r_load);
+                }
+
+                core_compiler.skip(position);
+                Root<Assoc> r_module(gc, r_core_module->obj_assoc());
+                Root<Vector> r_imports(gc, r_core_imports->obj_vector());
+                return run_toplevel(vm, core_compiler, r_module, r_imports, nullptr);
             }
+        }
 
+        {
             Root<Assoc> r_modules(vm.gc, vm.v_modules.obj_assoc());
             {
-                ValueRoot r_name(vm.gc, Value::object(make_string(vm.gc, "core.bootstrap.load")));
-                ValueRoot rv_core_builtin(gc, r_core_bootstrap_load.value());
-                append(vm.gc, r_modules, r_name, rv_core_builtin);
+                ValueRoot r_name(vm.gc, Value::object(intern(vm, "core.bootstrap.load")));
+                Assoc* load = make_bootstrap_load_module(vm, source, module_name);
+                ValueRoot r_load(gc, Value::object(load));
+                append(vm.gc, r_modules, r_name, r_load);
             }
             vm.v_modules = r_modules.value();
         }
 
         // Run bootstrap files, which should run the user source.
-        return run_source(load_file("src/core/core.katsu"), "core", vm);
+        return run_new_module(vm,
+                              core_compiler,
+                              "core",
+                              heap_image_path.empty() ? nullptr : &heap_image_path);
+    }
+
+    Value bootstrap_and_run_source(const SourceFile source, const std::string& module_name, GC& gc,
+                                   uint64_t call_stack_size, const HeapProfileOptions& heap_profile,
+                                   const std::string& bytecode_cache_dir,
+                                   const std::string& heap_image_path,
+                                   const CpuProfileOptions& cpu_profile, bool lazy_methods)
+    {
+        VM vm(gc, call_stack_size);
+        vm.bytecode_cache_dir = bytecode_cache_dir;
+        vm.lazy_method_compilation = lazy_methods;
+        std::optional<HeapProfiler> profiler;
+        if (heap_profile.interval > 0) {
+            profiler.emplace(vm, heap_profile.interval, heap_profile.report_live, std::cerr);
+        }
+        if (!cpu_profile.path.empty()) {
+            vm.cpu_profiler = std::make_unique<CpuProfiler>(vm, cpu_profile.interval_us);
+        }
+        const auto report = [&vm, &profiler, &cpu_profile]() {
+            if (profiler) {
+                profiler->report_allocations(std::cerr);
+            }
+            // (Unless the program stopped the profiler itself.)
+            if (!cpu_profile.path.empty() && vm.cpu_profiler) {
+                std::ofstream out(cpu_profile.path);
+                vm.cpu_profiler->report_folded(out);
+                if (!out) {
+                    std::cerr << "Warning: could not write CPU profile to " << cpu_profile.path
+                              << "\n";
+                }
+            }
+        };
+        try {
+            Value result = bootstrap_and_run_in_vm(source, module_name, vm, heap_image_path);
+            report();
+            return result;
+        } catch (...) {
+            report();
+            throw;
+        }
+    }
+
+    uint64_t parse_size(const std::string& size)
+    {
+        if (size.empty() || size[0] < '0' || size[0] > '9') {
+            throw std::invalid_argument("invalid size: '" + size + "'");
+        }
+        size_t end = 0;
+        uint64_t value;
+        try {
+            value = std::stoull(size, &end);
+        } catch (const std::logic_error&) {
+            throw std::invalid_argument("invalid size: '" + size + "'");
+        }
+        uint64_t unit = 1;
+        if (end + 1 == size.size()) {
+            switch (size[end]) {
+                case 'k':
+                case 'K': unit = 1024; break;
+                case 'm':
+                case 'M': unit = 1024 * 1024; break;
+                case 'g':
+                case 'G': unit = 1024 * 1024 * 1024; break;
+                default: throw std::invalid_argument("invalid size: '" + size + "'");
+            }
+        } else if (end != size.size()) {
+            throw std::invalid_argument("invalid size: '" + size + "'");
+        }
+        if (value > (UINT64_MAX >> TAG_BITS) / unit) {
+            throw std::invalid_argument("size too large: '" + size + "'");
+        }
+        return align_up(value * unit, TAG_BITS);
+    }
+
+    uint32_t parse_thread_count(const std::string& count)
+    {
+        if (count.empty() || count[0] < '0' || count[0] > '9') {
+            throw std::invalid_argument("invalid thread count: '" + count + "'");
+        }
+        size_t end = 0;
+        uint64_t value;
+        try {
+            value = std::stoull(count, &end);
+        } catch (const std::logic_error&) {
+            throw std::invalid_argument("invalid thread count: '" + count + "'");
+        }
+        if (end != count.size() || value < 1 || value > MAX_THREAD_COUNT) {
+            throw std::invalid_argument("invalid thread count: '" + count + "'");
+        }
+        return value;
     }
 
-    void bootstrap_and_run_file(const std::string& filepath, const std::string& module_name)
+    void bootstrap_and_run_file(const std::string& filepath, const std::string& module_name,
+                                const RunOptions& options)
     {
         SourceFile source = load_file(filepath);
 
-        // 100 MiB GC-managed memory.
-        GC gc(100 * 1024 * 1024);
-        // 100 KiB call stack size.
-        bootstrap_and_run_source(source, module_name, gc, 100 * 1024);
+        WorkerScope workers(options);
+        GC gc(options.heap_size, options.nursery_size, options.max_heap_size);
+        gc.num_threads = options.gc_threads;
+        try {
+            bootstrap_and_run_source(source,
+                                     module_name,
+                                     gc,
+                                     options.call_stack_size,
+                                     options.heap_profile,
+                                     options.bytecode_cache_dir,
+                                     options.heap_image_path,
+                                     options.cpu_profile,
+                                     options.lazy_methods);
+        } catch (...) {
+            if (options.print_gc_stats) {
+                gc.print_stats(std::cerr);
+            }
+            throw;
+        }
+        if (options.print_gc_stats) {
+            gc.print_stats(std::cerr);
+        }
     }
 };
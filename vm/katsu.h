@@ -8,7 +8,67 @@
 
 namespace Katsu
 {
-    void bootstrap_and_run_file(const std::string& filepath, const std::string& module_name);
+    // Allocation profiling for a katsu process (see HeapProfiler). Reports go to stderr.
+    struct HeapProfileOptions
+    {
+        // Sample about once per this many bytes allocated, or 0 to not profile at all.
+        uint64_t interval = 0;
+        // Besides reporting allocations at the end, report what is live after every full
+        // collection.
+        bool report_live = false;
+    };
+
+    // CPU profiling for a katsu process (see CpuProfiler).
+    struct CpuProfileOptions
+    {
+        // File to write folded stacks to once done running, or empty to not profile at all.
+        std::string path;
+        // Microseconds of CPU time between samples.
+        uint64_t interval_us = 1000;
+    };
+
+    // Memory sizing and diagnostics for a katsu process. All sizes are in bytes.
+    struct RunOptions
+    {
+        // Initial (and minimum) size of the GC's main region.
+        uint64_t heap_size = 16 * 1024 * 1024;
+        // Size the GC's main region may grow to.
+        uint64_t max_heap_size = 1024 * 1024 * 1024;
+        // Size of the GC's nursery, or 0 for a non-generational GC.
+        uint64_t nursery_size = 4 * 1024 * 1024;
+        uint64_t call_stack_size = 100 * 1024;
+        // Number of threads for full collections (see GC::num_threads).
+        uint32_t gc_threads = GC_DEFAULT_THREADS;
+        // Whether to print GC statistics to stderr once done running.
+        bool print_gc_stats = false;
+        HeapProfileOptions heap_profile;
+        // Directory to cache compiled bytecode in, or empty to always compile from source.
+        std::string bytecode_cache_dir;
+        // Heap image to start from if it's fresh, or else to save once core has bootstrapped far
+        // enough (see heap_image.h); or empty for neither.
+        std::string heap_image_path;
+        CpuProfileOptions cpu_profile;
+        // Whether to compile method bodies on first invocation, rather than when defined (see
+        // VM::lazy_method_compilation).
+        bool lazy_methods = false;
+    };
+
+    // Parse a size such as "4096", "512K", "16M" or "1G" (binary units), rounded up to a multiple
+    // of 8 bytes. Throws std::invalid_argument if malformed.
+    uint64_t parse_size(const std::string& size);
+
+    // Parse a thread count from 1 to MAX_THREAD_COUNT. Throws std::invalid_argument if malformed
+    // or out of range.
+    const uint32_t MAX_THREAD_COUNT = 256;
+    uint32_t parse_thread_count(const std::string& count);
+
+    void bootstrap_and_run_file(const std::string& filepath, const std::string& module_name,
+                                const RunOptions& options = {});
     Value bootstrap_and_run_source(const SourceFile source, const std::string& module_name, GC& gc,
-                                   uint64_t call_stack_size);
+                                   uint64_t call_stack_size,
+                                   const HeapProfileOptions& heap_profile = {},
+                                   const std::string& bytecode_cache_dir = "",
+                                   const std::string& heap_image_path = "",
+                                   const CpuProfileOptions& cpu_profile = {},
+                                   bool lazy_methods = false);
 };
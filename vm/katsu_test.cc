@@ -14,6 +14,7 @@
 #include "value_utils.h"
 #include "vm.h"
 
+#include <filesystem>
 #include <iostream>
 #include <sstream>
 #include <variant>
@@ -68,10 +69,57 @@ Value testonly_handle_condition(VM& vm, int64_t nargs, Value* args)
     throw std::runtime_error(message);
 }
 
+TEST_CASE("parse_size", "[katsu]")
+{
+    CHECK(parse_size("0") == 0);
+    CHECK(parse_size("4096") == 4096);
+    CHECK(parse_size("13") == 16);
+    CHECK(parse_size("512K") == 512 * 1024);
+    CHECK(parse_size("16m") == 16 * 1024 * 1024);
+    CHECK(parse_size("2G") == 2ull * 1024 * 1024 * 1024);
+    CHECK_THROWS_AS(parse_size(""), std::invalid_argument);
+    CHECK_THROWS_AS(parse_size("M"), std::invalid_argument);
+    CHECK_THROWS_AS(parse_size("-1"), std::invalid_argument);
+    CHECK_THROWS_AS(parse_size("12MB"), std::invalid_argument);
+    CHECK_THROWS_AS(parse_size("99999999999999999999"), std::invalid_argument);
+}
+
+TEST_CASE("parse_thread_count", "[katsu]")
+{
+    CHECK(parse_thread_count("1") == 1);
+    CHECK(parse_thread_count("8") == 8);
+    CHECK(parse_thread_count("256") == 256);
+    CHECK_THROWS_AS(parse_thread_count(""), std::invalid_argument);
+    CHECK_THROWS_AS(parse_thread_count("0"), std::invalid_argument);
+    CHECK_THROWS_AS(parse_thread_count("257"), std::invalid_argument);
+    CHECK_THROWS_AS(parse_thread_count("-2"), std::invalid_argument);
+    CHECK_THROWS_AS(parse_thread_count("4K"), std::invalid_argument);
+}
+
+Value testonly_zero_plus(VM& vm, int64_t nargs, Value* args)
+{
+    ASSERT(nargs == 2);
+    return Value::fixnum(-1);
+}
+
+// Add a method (a: Fixnum) + (b = 0) to the global +: multimethod, which returns -1.
+Value testonly_add_zero_plus(VM& vm, int64_t nargs, Value* args)
+{
+    ASSERT(nargs == 1);
+    Root<Assoc> r_module(vm.gc, make_assoc(vm.gc, /* capacity */ 0));
+    ValueRoot r_zero(vm.gc, Value::fixnum(0));
+    Root<Ref> r_zero_matcher(vm.gc, make_ref(vm.gc, r_zero));
+    Root<Array> matchers(vm.gc, make_array(vm.gc, 2));
+    matchers->components()[0] = vm.builtin(BuiltinId::_Fixnum);
+    matchers->components()[1] = r_zero_matcher.value();
+    add_native(vm, true /* global */, r_module, "+:", 2, matchers, &testonly_zero_plus);
+    return Value::null();
+}
+
 TEST_CASE("integration - single top level expression", "[katsu]")
 {
-    // 100 KiB GC-managed memory.
-    GC gc(100 * 1024);
+    // 160 KiB GC-managed memory: room for the builtins, and not much more.
+    GC gc(160 * 1024);
 
     SourceFile source;
 
@@ -106,8 +154,7 @@ TEST_CASE("integration - single top level expression", "[katsu]")
             Root<Array> matchers2(vm.gc, make_array(vm.gc, 2));
             matchers2->components()[0] = vm.builtin(BuiltinId::_String);
             matchers2->components()[1] = vm.builtin(BuiltinId::_String);
-            add_native(vm.gc,
-                       vm.v_multimethods,
+            add_native(vm,
                        true /* global */,
                        r_module,
                        "handle-raw-condition-with-message:",
@@ -115,17 +162,26 @@ TEST_CASE("integration - single top level expression", "[katsu]")
                        matchers2,
                        &testonly_handle_condition);
 
-            String* name = make_string(vm.gc, "handle-raw-condition-with-message:");
-            Value* handler = assoc_lookup(*r_module, name);
+            Value* handler = assoc_lookup(*r_module, "handle-raw-condition-with-message:");
             ASSERT(handler);
             vm.v_condition_handler = *handler;
         }
+        {
+            Root<Array> matchers1(vm.gc, make_array(vm.gc, 1));
+            matchers1->components()[0] = Value::null();
+            add_native(vm,
+                       true /* global */,
+                       r_module,
+                       "add-zero-plus",
+                       1,
+                       matchers1,
+                       &testonly_add_zero_plus);
+        }
 
-        std::unique_ptr<Expr> top_level_expr =
-            parser->parse(stream, 0 /* precedence */, true /* is_toplevel */);
-
-        std::vector<std::unique_ptr<Expr>> top_level_exprs;
-        top_level_exprs.emplace_back(std::move(top_level_expr));
+        ExprArena arena;
+        std::vector<Expr*> top_level_exprs;
+        top_level_exprs.push_back(
+            parser->parse(stream, arena, 0 /* precedence */, true /* is_toplevel */));
         Root<Code> code(gc,
                         compile_into_module(vm,
                                             r_module,
@@ -319,7 +375,85 @@ TEST_CASE("integration - single top level expression", "[katsu]")
     bytecode:
     [0]: load_reg @0
     [1]: load_value: fixnum 1
-    [2]: invoke #2 *string: "+:"
+    [2]: fixnum_add
+    [3]: invoke #2 *string: "+:"
+  v_upregs = *array: length=0
+)");
+    }
+
+    SECTION("closure - load then invoke is fused")
+    {
+        input(R"([ it ~ "!" ])");
+        check_pprint(R"(*closure
+  v_code = *code
+    num_params = 1
+    num_regs = 1
+    num_data = 2
+    v_upreg_map = *array: length=0
+    bytecode:
+    [0]: load_reg @0
+    [1]: load_value_invoke #2 *string: "~:"
+      value = *string: "!"
+  v_upregs = *array: length=0
+)");
+    }
+
+    SECTION("closure - dropped values are optimized away")
+    {
+        input("[ 1; it; it ]");
+        check_pprint(R"(*closure
+  v_code = *code
+    num_params = 1
+    num_regs = 1
+    num_data = 1
+    v_upreg_map = *array: length=0
+    bytecode:
+    [0]: load_reg @0
+  v_upregs = *array: length=0
+)");
+    }
+
+    SECTION("closure - uncaptured mutable counter stays in its register")
+    {
+        // Its stores and loads aren't fused either, so that capturing a multi-shot continuation
+        // can box it after all (see VM::box_mut_bindings()).
+        input("[ mut: n = it; n: n + 1; n: n * 2; n ]");
+        check_pprint(R"(*closure
+  v_code = *code
+    num_params = 1
+    num_regs = 2
+    num_data = 2
+    v_upreg_map = *array: length=0
+    bytecode:
+    [0]: load_reg @0
+    [1]: init_reg @1
+    [2]: load_reg @1
+    [3]: load_value: fixnum 1
+    [4]: fixnum_add
+    [5]: invoke #2 *string: "+:"
+    [6]: store_reg @1
+    [7]: load_reg @1
+    [8]: load_value: fixnum 2
+    [9]: fixnum_mul
+    [10]: invoke #2 *string: "*:"
+    [11]: store_reg @1
+    [12]: load_reg @1
+  v_upregs = *array: length=0
+)");
+    }
+
+    SECTION("closure - store then load is fused")
+    {
+        input("[ let: x = it; x ]");
+        check_pprint(R"(*closure
+  v_code = *code
+    num_params = 1
+    num_regs = 2
+    num_data = 1
+    v_upreg_map = *array: length=0
+    bytecode:
+    [0]: load_reg @0
+    [1]: store_reg_keep @1
   v_upregs = *array: length=0
 )");
     }
@@ -712,6 +846,29 @@ TEST_CASE("integration - single top level expression", "[katsu]")
             Message("argument-count-mismatch: called a closure with wrong number of arguments"));
     }
 
+    SECTION("fixnum fast path gives way to value-matched methods")
+    {
+        // Warm up the fast path for 5 + it first. Afterwards, 5 + 0 must pick the new method, even
+        // once the guard has seen 5 + 1 pick the native one.
+        input(R"([
+            let: f = [ 5 + it ]
+            let: before = { f call: 0; f call: 1 }
+            add-zero-plus
+            { before; f call: 1; f call: 0 }
+        ] call)");
+        check_pprint(R"(*vector: length=3 [
+  v_array = *array: length=3
+    0 = *vector: length=2 [
+      v_array = *array: length=2
+        0 = fixnum 5
+        1 = fixnum 6
+    ]
+    1 = fixnum 6
+    2 = fixnum -1
+]
+)");
+    }
+
     SECTION("call: - closure")
     {
         input(R"(\x [x + 5] call: 10)");
@@ -816,9 +973,9 @@ TEST_CASE("integration - single top level expression", "[katsu]")
 
 TEST_CASE("integration - whole file", "[katsu]")
 {
-    // 2 MiB GC-managed memory.
+    // 2 MiB GC-managed memory, plus a 256 KiB nursery.
     // TODO: what's taking so much memory? probably source spans...
-    GC gc(2 * 1024 * 1024);
+    GC gc(2 * 1024 * 1024, 256 * 1024);
 
     SourceFile source;
 
@@ -923,6 +1080,75 @@ let: a = (adder: 3)
         check(Value::fixnum(71));
     }
 
+    SECTION("mutable bindings which no closure captures")
+    {
+        input(R"(
+let: (count-up: n) do: [
+    mut: total = n
+    total: total + 1
+    let: f = \x [ x * 2 ]
+    total: (f call: total) * 10
+    total
+]
+count-up: 4 # ((4 + 1) * 2) * 10 = 100
+        )");
+        check(Value::fixnum(100));
+    }
+
+    SECTION("only captured mutable bindings are boxed")
+    {
+        input(R"(
+[
+    mut: uncaptured = 1
+    uncaptured: uncaptured + 1
+    mut: captured = 2
+    [ captured: captured + 1 ]
+]
+        )");
+        std::stringstream ss;
+        ss << run();
+        std::string code = ss.str();
+        size_t first = code.find("init_ref");
+        REQUIRE(first != std::string::npos);
+        CHECK(code.find("init_ref", first + 1) == std::string::npos);
+        CHECK(code.find("init_ref @2") == first);
+        CHECK_THAT(code, ContainsSubstring("init_reg @1"));
+    }
+
+    SECTION("uncaptured mutable bindings are shared by multi-shot resumptions")
+    {
+        input(R"(
+IMPORT-EXISTING-MODULE: "core.builtin.misc" # for delimited continuations
+let: k = ([
+    mut: n = 0
+    let: r = (\k [ k ] call/dc: #t)
+    n: n + r
+    n
+] call/marked: #t)
+k call: 10 # n = 0 + 10
+k call: 20 # n = 10 + 20
+        )");
+        check(Value::fixnum(30));
+    }
+
+    SECTION("uncaptured mutable bindings of methods are shared by multi-shot resumptions")
+    {
+        input(R"(
+IMPORT-EXISTING-MODULE: "core.builtin.misc" # for delimited continuations
+let: (accumulate: x) do: [
+    mut: total = x
+    let: r = (\k [ k ] call/dc: #t)
+    total: total + r
+    total
+]
+let: k = ([ accumulate: 1 ] call/marked: #t)
+let: first = (k call: 10) # total = 1 + 10
+let: second = (k call: 20) # total = 11 + 20
+first * 100 + second
+        )");
+        check(Value::fixnum(1131));
+    }
+
     SECTION("method definition - non block")
     {
         input(R"(
@@ -1087,6 +1313,26 @@ let: ( a          mm-test:  b         ) do: [ "any - any"    ]
             check(Value::object(make_string(gc, "any - any")));
         }
 
+        SECTION("multimethod downselection - repeated and after adding methods")
+        {
+            input(R"(
+let: ((a: Fixnum) mm-test:  b         ) do: [ "Fixnum - any" ]
+let: ( a          mm-test: (b: Fixnum)) do: [ "any - Fixnum" ]
+let: ( a          mm-test:  b         ) do: [ "any - any"    ]
+let: (a call-mm-test: b) do: [ a mm-test: b ]
+
+let: before = (
+    (5 call-mm-test: "def") ~ ", " ~ ("abc" call-mm-test: 10) ~ ", " ~
+    (5 call-mm-test: "ghi") ~ ", " ~ ("abc" call-mm-test: "def")
+)
+let: ((a: Fixnum) mm-test: (b: String)) do: [ "Fixnum - String" ]
+before ~ "; " ~ (5 call-mm-test: "def") ~ ", " ~ ("abc" call-mm-test: 10)
+            )");
+            check(Value::object(make_string(gc,
+                                            "Fixnum - any, any - Fixnum, Fixnum - any, any - any; "
+                                            "Fixnum - String, any - Fixnum")));
+        }
+
         SECTION("multimethod downselection - case 3 (ambiguous)")
         {
             input(R"(
@@ -1284,4 +1530,185 @@ after call/marked: m1
 )");
         }
     }
+
+    SECTION("delimited continuation - one-shot")
+    {
+        cout_capture capture;
+        input(R"CODE(
+IMPORT-EXISTING-MODULE: "core.builtin.misc" # for delimited continuations, TEST-ASSERT:, and set-condition-handler-from-module
+let: (c handle-raw-condition-with-message: m) do: [
+    TEST-ASSERT: (c ~ ": " ~ m) = "continuation-already-resumed: cannot resume a one-shot continuation more than once"
+    12345
+]
+set-condition-handler-from-module
+[
+    let: input = (\k [
+        print: "result of k('abcdef'): " ~ (k call: "abcdef")
+        k call: "123456"
+    ] call/dc-once: #t)
+    "calcs(" ~ input ~ ")"
+] call/marked: #t
+        )CODE");
+        check(Value::fixnum(12345));
+        CHECK(capture.str() == "result of k('abcdef'): calcs(abcdef)\n");
+    }
+
+    SECTION("bytecode cache")
+    {
+        std::filesystem::path cache_dir =
+            std::filesystem::temp_directory_path() / "katsu-test-bytecode-cache";
+        std::filesystem::remove_all(cache_dir);
+        input(R"CODE(
+data: Point has: { x; y }
+let: ((p: Point) plus: (q: Point)) do: [ Point x: p .x + q .x y: p .y + q .y ]
+let: origin = (Point x: 1 y: 2)
+let: sum-to-three do: [
+    mut: total = 0
+    let: add = \i [ total: total + i ]
+    add call: 1
+    add call: 2
+    add call: 3
+    total
+]
+let: total = sum-to-three
+let: sum = (origin plus: (Point x: 10 y: 20))
+(sum .x * 100) + (sum .y * 10) + total
+        )CODE");
+        // Run once to write the cache file, then again to load from it.
+        std::stringstream ss_expected;
+        ss_expected << Value::fixnum(1326);
+        for (int i = 0; i < 2; i++) {
+            std::stringstream ss_actual;
+            ss_actual << bootstrap_and_run_source(
+                source, "test.integration", gc, call_stack_size, {}, cache_dir.string());
+            CHECK(ss_actual.str() == ss_expected.str());
+        }
+        CHECK(!std::filesystem::is_empty(cache_dir));
+        std::filesystem::remove_all(cache_dir);
+    }
+
+    SECTION("heap image")
+    {
+        std::filesystem::path image_path =
+            std::filesystem::temp_directory_path() / "katsu-test-heap-image";
+        std::filesystem::remove(image_path);
+        // The first run saves the image, and the second (of a different source) starts from it.
+        input("let: (double: n) do: [ n * 2 ]\ndouble: 21");
+        std::stringstream ss_expected;
+        ss_expected << Value::fixnum(42);
+        std::stringstream ss_actual;
+        ss_actual << bootstrap_and_run_source(
+            source, "test.integration", gc, call_stack_size, {}, "", image_path.string());
+        CHECK(ss_actual.str() == ss_expected.str());
+        REQUIRE(std::filesystem::exists(image_path));
+        auto saved_time = std::filesystem::last_write_time(image_path);
+
+        input("data: Pair has: { a; b }\nlet: p = (Pair a: 3 b: 4)\n(p .a * 10) + p .b");
+        ss_expected.str("");
+        ss_expected << Value::fixnum(34);
+        ss_actual.str("");
+        ss_actual << bootstrap_and_run_source(
+            source, "test.integration", gc, call_stack_size, {}, "", image_path.string());
+        CHECK(ss_actual.str() == ss_expected.str());
+        // (It's fresh, so isn't saved again.)
+        CHECK(std::filesystem::last_write_time(image_path) == saved_time);
+        std::filesystem::remove(image_path);
+    }
+
+    SECTION("delimited continuation - spanning many segments")
+    {
+        SECTION("multi-shot")
+        {
+            input(R"CODE(
+IMPORT-EXISTING-MODULE: "core.builtin.misc" # for delimited continuations
+let: (down: n) do: [
+    if: n = 0 then: [ \k [ (k call: 1) + (k call: 2) ] call/dc: #t ] else: [ 1 + (down: n - 1) ]
+]
+[ down: 100 ] call/marked: #t
+            )CODE");
+            check(Value::fixnum(203));
+        }
+
+        SECTION("one-shot")
+        {
+            input(R"CODE(
+IMPORT-EXISTING-MODULE: "core.builtin.misc" # for delimited continuations
+let: (down: n) do: [
+    if: n = 0 then: [ \k [ k call: 1 ] call/dc-once: #t ] else: [ 1 + (down: n - 1) ]
+]
+[ down: 100 ] call/marked: #t
+            )CODE");
+            check(Value::fixnum(101));
+        }
+    }
+}
+
+TEST_CASE("integration - lazily compiled methods", "[katsu]")
+{
+    // Same sizes as for "integration - whole file".
+    GC gc(2 * 1024 * 1024, 256 * 1024);
+
+    SourceFile source;
+
+    auto input = [&source](const std::string& source_str) {
+        source = SourceFile{
+            .path = std::make_shared<std::string>("fake.path"),
+            .source = std::make_shared<std::string>(source_str),
+        };
+    };
+
+    auto run = [&source, &gc](bool lazy_methods = true) {
+        return bootstrap_and_run_source(source,
+                                        "test.integration",
+                                        gc,
+                                        100 * 1024,
+                                        /* heap_profile */ {},
+                                        /* bytecode_cache_dir */ "",
+                                        /* heap_image_path */ "",
+                                        /* cpu_profile */ {},
+                                        lazy_methods);
+    };
+
+    SECTION("body only refers to names defined before it, as when compiled eagerly")
+    {
+        input(R"(
+let: (double: x) do: [ x * two ]
+let: two = 2
+double: 21
+        )");
+        // (Only the stack traces differ, since the lazy body compiles from within the call.)
+        for (bool lazy_methods : {false, true}) {
+            cout_capture capture;
+            CHECK_THROWS_MATCHES(
+                run(lazy_methods), terminate_error, Message("could not load module"));
+            CHECK_THAT(capture.str(),
+                       StartsWith("Error: could not load module test.integration.\n"
+                                  "compile-error: name is not defined in module or in local "
+                                  "scope\n"));
+        }
+    }
+
+    SECTION("compile error is raised only once invoked")
+    {
+        cout_capture capture;
+        input(R"(
+let: testing do: [
+    TAIL-CALL: testing
+    "but does something afterwards"
+]
+3
+        )");
+        CHECK(run() == Value::fixnum(3));
+
+        input(R"(
+let: testing do: [
+    TAIL-CALL: testing
+    "but does something afterwards"
+]
+testing
+        )");
+        CHECK_THROWS_MATCHES(run(), terminate_error, Message("could not load module"));
+        CHECK_THAT(capture.str(),
+                   ContainsSubstring("compile-error: TAIL-CALL: invoked not in tail position"));
+    }
 }
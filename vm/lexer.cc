@@ -3,6 +3,7 @@
 #include "assertions.h"
 
 #include <cctype>
+#include <charconv>
 #include <stdexcept>
 #include <string>
 
@@ -10,13 +11,13 @@ namespace Katsu
 {
     bool Lexer::eof()
     {
-        return this->loc.index == this->source_len;
+        return this->loc.index == static_cast<int>(this->text.size());
     }
 
     char Lexer::peek()
     {
         ASSERT(!this->eof());
-        return (*this->source.source)[this->loc.index];
+        return this->text[this->loc.index];
     }
 
     char Lexer::get()
@@ -38,7 +39,8 @@ namespace Katsu
 
     Token Lexer::next()
     {
-        ASSERT_MSG(this->loc.index <= this->source_len, "lexer got out of bounds");
+        ASSERT_MSG(this->loc.index <= static_cast<int>(this->text.size()),
+                   "lexer got out of bounds");
 
         if (this->eof()) {
             return Token{
@@ -83,16 +85,17 @@ namespace Katsu
             case '\\': return make_token(TokenType::BACKSLASH);
             case '"': {
                 // Consume string until terminating quote.
-                std::string str;
+                int contents_start = this->loc.index;
                 while (!this->eof() && this->peek() != '"') {
-                    c = this->get();
                     // TODO: handle escape sequences
-                    str += c;
+                    this->get();
                 }
                 if (this->eof()) {
                     // There wasn't any terminating quote.
                     return make_token(TokenType::ERROR);
                 }
+                std::string_view str =
+                    this->text.substr(contents_start, this->loc.index - contents_start);
                 // Skip over terminating quote.
                 this->get();
                 return make_token(TokenType::STRING, str);
@@ -114,11 +117,11 @@ namespace Katsu
                 };
 
                 // Collect word characters.
-                std::string word;
-                word.push_back(c);
                 while (!this->eof() && is_word_char(this->peek())) {
-                    word.push_back(this->get());
+                    this->get();
                 }
+                std::string_view word =
+                    this->text.substr(start.index, this->loc.index - start.index);
 
                 // Downselect to the token type, and pull out a value as necessary
                 // from the word.
@@ -140,7 +143,7 @@ namespace Katsu
                 }
 
                 // Symbols / messages:
-                if (word.find(':') != std::string::npos) {
+                if (word.find(':') != std::string_view::npos) {
                     if (word == ":") {
                         return make_token(TokenType::ERROR);
                     }
@@ -186,7 +189,16 @@ namespace Katsu
                     first = false;
                 }
                 if (all_digits) {
-                    return make_token(TokenType::INTEGER, std::stoll(word));
+                    // (from_chars() takes a leading '-', but not '+'.)
+                    std::string_view digits = word[0] == '+' ? word.substr(1) : word;
+                    long long value;
+                    auto [end, error] =
+                        std::from_chars(digits.data(), digits.data() + digits.size(), value);
+                    if (error != std::errc()) {
+                        // Out of range.
+                        return make_token(TokenType::ERROR);
+                    }
+                    return make_token(TokenType::INTEGER, value);
                 }
 
                 // TODO: non-integer number literals.
@@ -197,7 +209,7 @@ namespace Katsu
         }
     }
 
-    Token TokenStream::peek()
+    const Token& TokenStream::peek()
     {
         this->condense();
         // condense() should have ensured that there is a current token available.
@@ -213,7 +225,7 @@ namespace Katsu
     {
         this->condense();
         // condense() should have ensured that there is a current token available.
-        Token token = this->lookahead[0];
+        Token token = std::move(this->lookahead[0]);
         this->lookahead.pop_front();
         return token;
     }
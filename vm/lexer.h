@@ -2,6 +2,7 @@
 
 #include <deque>
 #include <optional>
+#include <string_view>
 
 #include "span.h"
 #include "token.h"
@@ -13,7 +14,7 @@ namespace Katsu
     public:
         Lexer(const SourceFile& _source)
             : source(_source)
-            , source_len(_source.source->size())
+            , text(*_source.source)
             , loc()
         {}
 
@@ -30,8 +31,9 @@ namespace Katsu
 
         // Source file to pull tokens from.
         const SourceFile source;
-        // Length of the source. (TODO: for future interactive use, need to delete this.)
-        const size_t source_len;
+        // Its contents, which token values are views into. (TODO: for future interactive use,
+        // this can't be fixed up front.)
+        const std::string_view text;
 
         // Current location in `source`.
         SourceLocation loc;
@@ -45,7 +47,8 @@ namespace Katsu
             , lookahead{}
         {}
 
-        Token peek();
+        // The reference is only good until the next consume().
+        const Token& peek();
 
         bool current_has_type(TokenType type);
 
@@ -2,6 +2,8 @@
 
 #include "lexer.h"
 
+#include <tuple>
+
 using namespace Katsu;
 
 TEST_CASE("lexer smoketest", "[lexer]")
@@ -28,3 +30,32 @@ TEST_CASE("lexer smoketest", "[lexer]")
         REQUIRE(std::get_if<std::monostate>(&t.value));
     }
 }
+
+TEST_CASE("lexer token text views into the source", "[lexer]")
+{
+    SourceFile source{.path = std::make_shared<std::string>("path"),
+                      .source = std::make_shared<std::string>("foo bar: \"baz\"")};
+    Lexer lexer(source);
+    const char* start = source.source->data();
+    for (auto [type, text, offset] : {std::tuple{TokenType::NAME, "foo", 0},
+                                      std::tuple{TokenType::MESSAGE, "bar", 4},
+                                      std::tuple{TokenType::STRING, "baz", 10}}) {
+        Token t = lexer.next();
+        while (t.type == TokenType::WHITESPACE) {
+            t = lexer.next();
+        }
+        CHECK(t.type == type);
+        REQUIRE(std::get_if<std::string_view>(&t.value));
+        CHECK(std::get<std::string_view>(t.value) == text);
+        CHECK(std::get<std::string_view>(t.value).data() == start + offset);
+    }
+    CHECK(lexer.next().type == TokenType::END);
+}
+
+TEST_CASE("lexer rejects out-of-range integers", "[lexer]")
+{
+    SourceFile source{.path = std::make_shared<std::string>("path"),
+                      .source = std::make_shared<std::string>("99999999999999999999")};
+    Lexer lexer(source);
+    CHECK(lexer.next().type == TokenType::ERROR);
+}
@@ -1,6 +1,9 @@
+#include <cstdlib>
 #include <iostream>
 #include <string>
+#include <vector>
 
+#include "bytecode_cache.h"
 #include "compile.h"
 #include "condition.h"
 #include "katsu.h"
@@ -8,7 +11,143 @@
 
 void usage()
 {
-    std::cerr << "Usage: ./katsu <module.name> <path/to/source.katsu>\n";
+    std::cerr << "Usage: ./katsu [options] <module.name> <path/to/source.katsu>\n";
+    std::cerr << "Options (each may also be set by the environment variable in parentheses):\n";
+    std::cerr << "  --heap=SIZE      initial heap size (KATSU_HEAP)\n";
+    std::cerr << "  --max-heap=SIZE  maximum heap size (KATSU_MAX_HEAP)\n";
+    std::cerr << "  --nursery=SIZE   nursery size, or 0 to disable (KATSU_NURSERY)\n";
+    std::cerr << "  --stack=SIZE     call stack size (KATSU_STACK)\n";
+    std::cerr << "  --gc-threads=N   threads to run full collections with (KATSU_GC_THREADS)\n";
+    std::cerr << "  --gc-stats       print GC statistics to stderr at exit (KATSU_GC_STATS=1)\n";
+    std::cerr << "  --heap-profile=SIZE\n";
+    std::cerr << "                   sample an allocation about every SIZE bytes, and report\n";
+    std::cerr << "                   allocation sites to stderr at exit (KATSU_HEAP_PROFILE)\n";
+    std::cerr << "  --heap-profile-live\n";
+    std::cerr << "                   with --heap-profile, also report what survives each full\n";
+    std::cerr << "                   collection\n";
+    std::cerr << "  --cpu-profile=FILE\n";
+    std::cerr << "                   sample call stacks every millisecond of CPU time, and\n";
+    std::cerr << "                   write them to FILE as folded stacks (KATSU_CPU_PROFILE)\n";
+    std::cerr << "  --cache-dir=DIR  cache compiled bytecode in DIR (KATSU_CACHE_DIR), by\n";
+    std::cerr << "                   default $XDG_CACHE_HOME/katsu or ~/.cache/katsu\n";
+    std::cerr << "  --no-cache       always compile from source (KATSU_CACHE_DIR= )\n";
+    std::cerr << "  --image=FILE     start from the heap image in FILE if it's up to date, or\n";
+    std::cerr << "                   else boot from source and save one there (KATSU_IMAGE)\n";
+    std::cerr << "  --lazy-methods   compile each method body on its first call, rather than\n";
+    std::cerr << "                   when it's defined (KATSU_LAZY_METHODS=1)\n";
+    std::cerr << "SIZE is a number of bytes, optionally followed by K, M or G.\n";
+}
+
+struct SizeOption
+{
+    const char* flag;
+    const char* env;
+    uint64_t Katsu::RunOptions::* field;
+};
+
+const SizeOption SIZE_OPTIONS[] = {
+    {"--heap=", "KATSU_HEAP", &Katsu::RunOptions::heap_size},
+    {"--max-heap=", "KATSU_MAX_HEAP", &Katsu::RunOptions::max_heap_size},
+    {"--nursery=", "KATSU_NURSERY", &Katsu::RunOptions::nursery_size},
+    {"--stack=", "KATSU_STACK", &Katsu::RunOptions::call_stack_size},
+};
+
+// Fill in options from the environment and then from command-line flags, and return the remaining
+// (positional) arguments. Throws std::invalid_argument on a malformed option.
+std::vector<std::string> parse_options(int argc, char** argv, Katsu::RunOptions& options)
+{
+    for (const SizeOption& option : SIZE_OPTIONS) {
+        if (const char* value = std::getenv(option.env)) {
+            options.*option.field = Katsu::parse_size(value);
+        }
+    }
+
+    if (const char* value = std::getenv("KATSU_GC_THREADS")) {
+        options.gc_threads = Katsu::parse_thread_count(value);
+    }
+    if (const char* value = std::getenv("KATSU_GC_STATS")) {
+        options.print_gc_stats = std::string(value) == "1";
+    }
+    if (const char* value = std::getenv("KATSU_HEAP_PROFILE")) {
+        options.heap_profile.interval = Katsu::parse_size(value);
+    }
+    if (const char* value = std::getenv("KATSU_CPU_PROFILE")) {
+        options.cpu_profile.path = value;
+    }
+    if (const char* value = std::getenv("KATSU_CACHE_DIR")) {
+        options.bytecode_cache_dir = value;
+    } else {
+        options.bytecode_cache_dir = Katsu::default_bytecode_cache_dir();
+    }
+    if (const char* value = std::getenv("KATSU_IMAGE")) {
+        options.heap_image_path = value;
+    }
+    if (const char* value = std::getenv("KATSU_LAZY_METHODS")) {
+        options.lazy_methods = std::string(value) == "1";
+    }
+
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.rfind("--", 0) != 0) {
+            positional.push_back(arg);
+            continue;
+        }
+        if (arg.rfind("--gc-threads=", 0) == 0) {
+            options.gc_threads =
+                Katsu::parse_thread_count(arg.substr(std::string("--gc-threads=").size()));
+            continue;
+        }
+        if (arg == "--gc-stats") {
+            options.print_gc_stats = true;
+            continue;
+        }
+        if (arg.rfind("--heap-profile=", 0) == 0) {
+            options.heap_profile.interval =
+                Katsu::parse_size(arg.substr(std::string("--heap-profile=").size()));
+            continue;
+        }
+        if (arg == "--heap-profile-live") {
+            options.heap_profile.report_live = true;
+            continue;
+        }
+        if (arg.rfind("--cpu-profile=", 0) == 0) {
+            options.cpu_profile.path = arg.substr(std::string("--cpu-profile=").size());
+            continue;
+        }
+        if (arg.rfind("--cache-dir=", 0) == 0) {
+            options.bytecode_cache_dir = arg.substr(std::string("--cache-dir=").size());
+            continue;
+        }
+        if (arg == "--no-cache") {
+            options.bytecode_cache_dir = "";
+            continue;
+        }
+        if (arg.rfind("--image=", 0) == 0) {
+            options.heap_image_path = arg.substr(std::string("--image=").size());
+            continue;
+        }
+        if (arg == "--lazy-methods") {
+            options.lazy_methods = true;
+            continue;
+        }
+        bool found = false;
+        for (const SizeOption& option : SIZE_OPTIONS) {
+            std::string flag(option.flag);
+            if (arg.rfind(flag, 0) == 0) {
+                options.*option.field = Katsu::parse_size(arg.substr(flag.size()));
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            throw std::invalid_argument("unknown option: '" + arg + "'");
+        }
+    }
+    if (options.max_heap_size < options.heap_size) {
+        options.max_heap_size = options.heap_size;
+    }
+    return positional;
 }
 
 std::ostream& operator<<(std::ostream& s, const Katsu::SourceSpan& span)
@@ -26,15 +165,24 @@ std::ostream& operator<<(std::ostream& s, const Katsu::SourceSpan& span)
 
 int main(int argc, char** argv)
 {
-    if (argc != 3) {
+    Katsu::RunOptions options;
+    std::vector<std::string> args;
+    try {
+        args = parse_options(argc, argv, options);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (args.size() != 2) {
         usage();
         return EXIT_FAILURE;
     }
     // TODO: determine path from module_name.
-    std::string module_name(argv[1]);
-    std::string path(argv[2]);
+    std::string module_name(args[0]);
+    std::string path(args[1]);
     try {
-        Katsu::bootstrap_and_run_file(path, module_name);
+        Katsu::bootstrap_and_run_file(path, module_name, options);
         return EXIT_SUCCESS;
     } catch (const std::ios_base::failure& e) {
         std::cerr << "Error: " << e.what() << "\n";
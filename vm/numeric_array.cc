@@ -0,0 +1,320 @@
+#include "numeric_array.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Katsu
+{
+#if NUMERIC_VECTOR_KERNELS
+    // 16 bytes' worth of lanes: one SSE2 or NEON register, which every x86-64 and AArch64 CPU
+    // has (and wider vectors would change the calling convention without, say, -mavx).
+    template <typename T> struct Lanes;
+    template <> struct Lanes<double>
+    {
+        typedef double V __attribute__((vector_size(16)));
+    };
+    template <> struct Lanes<int64_t>
+    {
+        typedef int64_t V __attribute__((vector_size(16)));
+    };
+    template <> struct Lanes<uint64_t>
+    {
+        typedef uint64_t V __attribute__((vector_size(16)));
+    };
+    template <> struct Lanes<uint8_t>
+    {
+        typedef uint8_t V __attribute__((vector_size(16)));
+    };
+
+    template <typename T> using Vec = typename Lanes<T>::V;
+    template <typename T> constexpr uint64_t LANES = sizeof(Vec<T>) / sizeof(T);
+
+    // Through memcpy, since the elements needn't be aligned to a whole vector.
+    template <typename T> static inline Vec<T> load(const T* p)
+    {
+        Vec<T> v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    template <typename T> static inline void store(T* p, Vec<T> v)
+    {
+        memcpy(p, &v, sizeof(v));
+    }
+    template <typename T> static inline Vec<T> splat(T x)
+    {
+        Vec<T> v;
+        for (uint64_t k = 0; k < LANES<T>; k++) {
+            v[k] = x;
+        }
+        return v;
+    }
+#endif
+
+    // Each kernel handles as many whole vectors as it can, then the rest one at a time. `T` is the
+    // type to do arithmetic in: the unsigned equivalent of signed element types, so as to wrap
+    // around on overflow.
+
+    template <typename T> static T sum(const T* xs, uint64_t n)
+    {
+        T total = 0;
+        uint64_t i = 0;
+#if NUMERIC_VECTOR_KERNELS
+        Vec<T> acc = splat<T>(0);
+        for (; i + LANES<T> <= n; i += LANES<T>) {
+            acc += load(xs + i);
+        }
+        for (uint64_t k = 0; k < LANES<T>; k++) {
+            total += acc[k];
+        }
+#endif
+        for (; i < n; i++) {
+            total += xs[i];
+        }
+        return total;
+    }
+
+    template <typename T> static T dot(const T* xs, const T* ys, uint64_t n)
+    {
+        T total = 0;
+        uint64_t i = 0;
+#if NUMERIC_VECTOR_KERNELS
+        Vec<T> acc = splat<T>(0);
+        for (; i + LANES<T> <= n; i += LANES<T>) {
+            acc += load(xs + i) * load(ys + i);
+        }
+        for (uint64_t k = 0; k < LANES<T>; k++) {
+            total += acc[k];
+        }
+#endif
+        for (; i < n; i++) {
+            total += xs[i] * ys[i];
+        }
+        return total;
+    }
+
+    template <typename T> static void axpy(T a, const T* xs, T* ys, uint64_t n)
+    {
+        uint64_t i = 0;
+#if NUMERIC_VECTOR_KERNELS
+        Vec<T> av = splat(a);
+        for (; i + LANES<T> <= n; i += LANES<T>) {
+            store(ys + i, load(ys + i) + av * load(xs + i));
+        }
+#endif
+        for (; i < n; i++) {
+            ys[i] += a * xs[i];
+        }
+    }
+
+    struct LessOp
+    {
+        template <typename A> auto operator()(A a, A b) const
+        {
+            return a < b;
+        }
+    };
+    struct GreaterOp
+    {
+        template <typename A> auto operator()(A a, A b) const
+        {
+            return a > b;
+        }
+    };
+    struct EqualOp
+    {
+        template <typename A> auto operator()(A a, A b) const
+        {
+            return a == b;
+        }
+    };
+
+    // The element which is Better than all the others.
+    template <typename T, typename Better> static T best(const T* xs, uint64_t n)
+    {
+        T best = xs[0];
+        uint64_t i = 1;
+#if NUMERIC_VECTOR_KERNELS
+        if (n >= LANES<T>) {
+            Vec<T> acc = load(xs);
+            for (i = LANES<T>; i + LANES<T> <= n; i += LANES<T>) {
+                Vec<T> x = load(xs + i);
+                acc = Better()(x, acc) ? x : acc;
+            }
+            for (uint64_t k = 0; k < LANES<T>; k++) {
+                best = Better()(acc[k], best) ? acc[k] : best;
+            }
+        }
+#endif
+        for (; i < n; i++) {
+            best = Better()(xs[i], best) ? xs[i] : best;
+        }
+        return best;
+    }
+
+    template <typename T, typename Op>
+    static void compare(const T* xs, const T* ys, uint8_t* out, uint64_t n)
+    {
+        uint64_t i = 0;
+#if NUMERIC_VECTOR_KERNELS
+        for (; i + LANES<T> <= n; i += LANES<T>) {
+            // Lanes of all ones (true) or all zeros (false).
+            auto mask = Op()(load(xs + i), load(ys + i));
+            for (uint64_t k = 0; k < LANES<T>; k++) {
+                out[i + k] = mask[k] & 1;
+            }
+        }
+#endif
+        for (; i < n; i++) {
+            out[i] = Op()(xs[i], ys[i]);
+        }
+    }
+
+    template <typename T, typename Op>
+    static void compare(const T* xs, T y, uint8_t* out, uint64_t n)
+    {
+        uint64_t i = 0;
+#if NUMERIC_VECTOR_KERNELS
+        Vec<T> yv = splat(y);
+        for (; i + LANES<T> <= n; i += LANES<T>) {
+            auto mask = Op()(load(xs + i), yv);
+            for (uint64_t k = 0; k < LANES<T>; k++) {
+                out[i + k] = mask[k] & 1;
+            }
+        }
+#endif
+        for (; i < n; i++) {
+            out[i] = Op()(xs[i], y);
+        }
+    }
+
+    // Signed and unsigned variants of a type may alias each other.
+    static inline const uint64_t* as_unsigned(const int64_t* xs)
+    {
+        return reinterpret_cast<const uint64_t*>(xs);
+    }
+
+    double bulk_sum(const double* xs, uint64_t n)
+    {
+        return sum(xs, n);
+    }
+    int64_t bulk_sum(const int64_t* xs, uint64_t n)
+    {
+        return static_cast<int64_t>(sum(as_unsigned(xs), n));
+    }
+    uint64_t bulk_sum(const uint8_t* xs, uint64_t n)
+    {
+        // Too narrow to add up in lanes of their own, so leave this to the compiler.
+        uint64_t total = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            total += xs[i];
+        }
+        return total;
+    }
+
+    double bulk_dot(const double* xs, const double* ys, uint64_t n)
+    {
+        return dot(xs, ys, n);
+    }
+    int64_t bulk_dot(const int64_t* xs, const int64_t* ys, uint64_t n)
+    {
+        return static_cast<int64_t>(dot(as_unsigned(xs), as_unsigned(ys), n));
+    }
+
+    void bulk_axpy(double a, const double* xs, double* ys, uint64_t n)
+    {
+        axpy(a, xs, ys, n);
+    }
+    void bulk_axpy(int64_t a, const int64_t* xs, int64_t* ys, uint64_t n)
+    {
+        axpy(static_cast<uint64_t>(a), as_unsigned(xs), reinterpret_cast<uint64_t*>(ys), n);
+    }
+
+    double bulk_min(const double* xs, uint64_t n)
+    {
+        return best<double, LessOp>(xs, n);
+    }
+    int64_t bulk_min(const int64_t* xs, uint64_t n)
+    {
+        return best<int64_t, LessOp>(xs, n);
+    }
+    uint8_t bulk_min(const uint8_t* xs, uint64_t n)
+    {
+        return best<uint8_t, LessOp>(xs, n);
+    }
+    double bulk_max(const double* xs, uint64_t n)
+    {
+        return best<double, GreaterOp>(xs, n);
+    }
+    int64_t bulk_max(const int64_t* xs, uint64_t n)
+    {
+        return best<int64_t, GreaterOp>(xs, n);
+    }
+    uint8_t bulk_max(const uint8_t* xs, uint64_t n)
+    {
+        return best<uint8_t, GreaterOp>(xs, n);
+    }
+
+    // Simple enough for the compiler to vectorize (or turn into memset) by itself.
+    void bulk_fill(double* xs, uint64_t n, double value)
+    {
+        std::fill_n(xs, n, value);
+    }
+    void bulk_fill(int64_t* xs, uint64_t n, int64_t value)
+    {
+        std::fill_n(xs, n, value);
+    }
+    void bulk_fill(uint8_t* xs, uint64_t n, uint8_t value)
+    {
+        memset(xs, value, n);
+    }
+
+    void bulk_less(const double* xs, const double* ys, uint8_t* out, uint64_t n)
+    {
+        compare<double, LessOp>(xs, ys, out, n);
+    }
+    void bulk_less(const int64_t* xs, const int64_t* ys, uint8_t* out, uint64_t n)
+    {
+        compare<int64_t, LessOp>(xs, ys, out, n);
+    }
+    void bulk_less(const uint8_t* xs, const uint8_t* ys, uint8_t* out, uint64_t n)
+    {
+        compare<uint8_t, LessOp>(xs, ys, out, n);
+    }
+    void bulk_less(const double* xs, double y, uint8_t* out, uint64_t n)
+    {
+        compare<double, LessOp>(xs, y, out, n);
+    }
+    void bulk_less(const int64_t* xs, int64_t y, uint8_t* out, uint64_t n)
+    {
+        compare<int64_t, LessOp>(xs, y, out, n);
+    }
+    void bulk_less(const uint8_t* xs, uint8_t y, uint8_t* out, uint64_t n)
+    {
+        compare<uint8_t, LessOp>(xs, y, out, n);
+    }
+
+    void bulk_equal(const double* xs, const double* ys, uint8_t* out, uint64_t n)
+    {
+        compare<double, EqualOp>(xs, ys, out, n);
+    }
+    void bulk_equal(const int64_t* xs, const int64_t* ys, uint8_t* out, uint64_t n)
+    {
+        compare<int64_t, EqualOp>(xs, ys, out, n);
+    }
+    void bulk_equal(const uint8_t* xs, const uint8_t* ys, uint8_t* out, uint64_t n)
+    {
+        compare<uint8_t, EqualOp>(xs, ys, out, n);
+    }
+    void bulk_equal(const double* xs, double y, uint8_t* out, uint64_t n)
+    {
+        compare<double, EqualOp>(xs, y, out, n);
+    }
+    void bulk_equal(const int64_t* xs, int64_t y, uint8_t* out, uint64_t n)
+    {
+        compare<int64_t, EqualOp>(xs, y, out, n);
+    }
+    void bulk_equal(const uint8_t* xs, uint8_t y, uint8_t* out, uint64_t n)
+    {
+        compare<uint8_t, EqualOp>(xs, y, out, n);
+    }
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+// Whether the bulk numeric kernels should work a vector of elements at a time (using the GNU
+// vector extensions), rather than one element at a time. Either way, they give the same results
+// for everything but floating-point sums and dot products, which then add in a different order.
+#ifndef NUMERIC_VECTOR_KERNELS
+#if defined(__GNUC__) || defined(__clang__)
+#define NUMERIC_VECTOR_KERNELS (1)
+#else
+#define NUMERIC_VECTOR_KERNELS (0)
+#endif
+#endif
+
+namespace Katsu
+{
+    // Bulk kernels over the `n` elements of unboxed arrays: the contents of an F64Array, I64Array
+    // or ByteArray. Pointers need not be aligned. Integer arithmetic wraps around on overflow
+    // (except in the u8 sum, which can't overflow).
+
+    double bulk_sum(const double* xs, uint64_t n);
+    int64_t bulk_sum(const int64_t* xs, uint64_t n);
+    uint64_t bulk_sum(const uint8_t* xs, uint64_t n);
+
+    double bulk_dot(const double* xs, const double* ys, uint64_t n);
+    int64_t bulk_dot(const int64_t* xs, const int64_t* ys, uint64_t n);
+
+    // ys[i] += a * xs[i], for each i.
+    void bulk_axpy(double a, const double* xs, double* ys, uint64_t n);
+    void bulk_axpy(int64_t a, const int64_t* xs, int64_t* ys, uint64_t n);
+
+    // Smallest / largest element, of at least one. Any NaN elements may or may not be skipped.
+    double bulk_min(const double* xs, uint64_t n);
+    int64_t bulk_min(const int64_t* xs, uint64_t n);
+    uint8_t bulk_min(const uint8_t* xs, uint64_t n);
+    double bulk_max(const double* xs, uint64_t n);
+    int64_t bulk_max(const int64_t* xs, uint64_t n);
+    uint8_t bulk_max(const uint8_t* xs, uint64_t n);
+
+    void bulk_fill(double* xs, uint64_t n, double value);
+    void bulk_fill(int64_t* xs, uint64_t n, int64_t value);
+    void bulk_fill(uint8_t* xs, uint64_t n, uint8_t value);
+
+    // out[i] = 1 if xs[i] < ys[i] (or y, for every i), and otherwise 0.
+    void bulk_less(const double* xs, const double* ys, uint8_t* out, uint64_t n);
+    void bulk_less(const int64_t* xs, const int64_t* ys, uint8_t* out, uint64_t n);
+    void bulk_less(const uint8_t* xs, const uint8_t* ys, uint8_t* out, uint64_t n);
+    void bulk_less(const double* xs, double y, uint8_t* out, uint64_t n);
+    void bulk_less(const int64_t* xs, int64_t y, uint8_t* out, uint64_t n);
+    void bulk_less(const uint8_t* xs, uint8_t y, uint8_t* out, uint64_t n);
+
+    // out[i] = 1 if xs[i] == ys[i] (or y, for every i), and otherwise 0.
+    void bulk_equal(const double* xs, const double* ys, uint8_t* out, uint64_t n);
+    void bulk_equal(const int64_t* xs, const int64_t* ys, uint8_t* out, uint64_t n);
+    void bulk_equal(const uint8_t* xs, const uint8_t* ys, uint8_t* out, uint64_t n);
+    void bulk_equal(const double* xs, double y, uint8_t* out, uint64_t n);
+    void bulk_equal(const int64_t* xs, int64_t y, uint8_t* out, uint64_t n);
+    void bulk_equal(const uint8_t* xs, uint8_t y, uint8_t* out, uint64_t n);
+};
@@ -0,0 +1,119 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "numeric_array.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+using namespace Katsu;
+
+// Lengths on either side of whole vectors, and offsets so that elements are misaligned (for
+// vectors) as well.
+const uint64_t LENGTHS[] = {1, 2, 3, 7, 16, 33, 100};
+
+TEST_CASE("bulk kernels over i64", "[numeric-array]")
+{
+    for (uint64_t n : LENGTHS) {
+        std::vector<int64_t> storage(n + 1);
+        std::vector<int64_t> other_storage(n + 1);
+        int64_t* xs = storage.data() + 1;
+        int64_t* ys = other_storage.data() + 1;
+        int64_t sum = 0, dot = 0, min = INT64_MAX, max = INT64_MIN;
+        for (uint64_t i = 0; i < n; i++) {
+            xs[i] = (static_cast<int64_t>(i) * 37) % 23 - 11;
+            ys[i] = static_cast<int64_t>(i) - 5;
+            sum += xs[i];
+            dot += xs[i] * ys[i];
+            min = std::min(min, xs[i]);
+            max = std::max(max, xs[i]);
+        }
+        CHECK(bulk_sum(xs, n) == sum);
+        CHECK(bulk_dot(xs, ys, n) == dot);
+        CHECK(bulk_min(xs, n) == min);
+        CHECK(bulk_max(xs, n) == max);
+
+        std::vector<uint8_t> less(n), equal(n), less_scalar(n);
+        bulk_less(xs, ys, less.data(), n);
+        bulk_equal(xs, ys, equal.data(), n);
+        bulk_less(xs, int64_t{0}, less_scalar.data(), n);
+        for (uint64_t i = 0; i < n; i++) {
+            CHECK(less[i] == (xs[i] < ys[i]));
+            CHECK(equal[i] == (xs[i] == ys[i]));
+            CHECK(less_scalar[i] == (xs[i] < 0));
+        }
+
+        std::vector<int64_t> expected(ys, ys + n);
+        for (uint64_t i = 0; i < n; i++) {
+            expected[i] += 3 * xs[i];
+        }
+        bulk_axpy(3, xs, ys, n);
+        CHECK(std::vector<int64_t>(ys, ys + n) == expected);
+
+        bulk_fill(xs, n, 42);
+        CHECK(std::vector<int64_t>(xs, xs + n) == std::vector<int64_t>(n, 42));
+        // The element before isn't touched.
+        CHECK(storage[0] == 0);
+    }
+}
+
+TEST_CASE("bulk i64 arithmetic wraps around", "[numeric-array]")
+{
+    std::vector<int64_t> xs(9, INT64_MAX);
+    CHECK(bulk_sum(xs.data(), xs.size()) == INT64_MAX - 8);
+    CHECK(bulk_dot(xs.data(), xs.data(), xs.size()) == 9);
+}
+
+TEST_CASE("bulk kernels over f64", "[numeric-array]")
+{
+    for (uint64_t n : LENGTHS) {
+        std::vector<double> storage(n + 1);
+        std::vector<double> other_storage(n + 1);
+        double* xs = storage.data() + 1;
+        double* ys = other_storage.data() + 1;
+        // Small integers, so that sums are exact in whichever order they're added.
+        double sum = 0, dot = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            xs[i] = static_cast<double>((i * 7) % 11) - 5.0;
+            ys[i] = 0.5 * static_cast<double>(i);
+            sum += xs[i];
+            dot += xs[i] * ys[i];
+        }
+        CHECK(bulk_sum(xs, n) == sum);
+        CHECK(bulk_dot(xs, ys, n) == dot);
+        CHECK(bulk_min(xs, n) == *std::min_element(xs, xs + n));
+        CHECK(bulk_max(xs, n) == *std::max_element(xs, xs + n));
+
+        std::vector<uint8_t> equal_scalar(n);
+        bulk_equal(xs, -5.0, equal_scalar.data(), n);
+        for (uint64_t i = 0; i < n; i++) {
+            CHECK(equal_scalar[i] == (xs[i] == -5.0));
+        }
+
+        bulk_axpy(-2.0, xs, ys, n);
+        for (uint64_t i = 0; i < n; i++) {
+            CHECK(ys[i] == 0.5 * static_cast<double>(i) - 2.0 * xs[i]);
+        }
+    }
+}
+
+TEST_CASE("bulk kernels over u8", "[numeric-array]")
+{
+    for (uint64_t n : LENGTHS) {
+        std::vector<uint8_t> xs(n);
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            xs[i] = 200 + (i * 13) % 56;
+            sum += xs[i];
+        }
+        CHECK(bulk_sum(xs.data(), n) == sum);
+        CHECK(bulk_min(xs.data(), n) == *std::min_element(xs.begin(), xs.end()));
+        CHECK(bulk_max(xs.data(), n) == *std::max_element(xs.begin(), xs.end()));
+
+        std::vector<uint8_t> less(n);
+        bulk_less(xs.data(), uint8_t{230}, less.data(), n);
+        for (uint64_t i = 0; i < n; i++) {
+            CHECK(less[i] == (xs[i] < 230));
+        }
+    }
+}
@@ -10,13 +10,13 @@
 namespace Katsu
 {
     // // TODO: deleteme
-    // std::ostream& operator<<(std::ostream& s, Token token);
+    // std::ostream& operator<<(std::ostream& s, const Token& token);
 
     // int depth = 0;
     // bool should_log = false;
 
-    std::unique_ptr<Expr> PrattParser::parse(TokenStream& stream, int precedence,
-                                             bool is_toplevel) const
+    Expr* PrattParser::parse(TokenStream& stream, ExprArena& arena, int precedence,
+                             bool is_toplevel) const
     {
         // depth += 1;
         Token token = stream.consume();
@@ -42,9 +42,9 @@ namespace Katsu
         //     std::cout << "parsing prefix " << token.type << ", prec=" << precedence << ", token="
         //               << token << "\n";
         // }
-        std::unique_ptr<Expr> expr = prefix.parse(stream, *this, token);
+        Expr* expr = prefix.parse(stream, *this, arena, token);
 
-        const auto active_precedence = [this](Token token) {
+        const auto active_precedence = [this](const Token& token) {
             const auto& infix_it = this->infix_parselets.find(token.type);
             if (infix_it == this->infix_parselets.end()) {
                 // TODO: throw a parse error? No infix parselets available to determine precedence
@@ -85,7 +85,7 @@ namespace Katsu
             //     }
             //     std::cout << "parsing infix " << token.type << ", prec=" << precedence << "\n";
             // }
-            expr = infix.parse(stream, *this, std::move(expr), token);
+            expr = infix.parse(stream, *this, arena, expr, token);
         }
 
         // if (should_log)
@@ -151,54 +151,57 @@ namespace Katsu
     class OperatorPrefixParselet : public PrefixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena,
+                    const Token& token) override
         {
-            std::unique_ptr<Expr> right =
-                parser.parse(stream, static_cast<int>(Precedence::PREFIX));
-            return std::make_unique<UnaryOpExpr>(SourceSpan::combine({token.span, right->span}),
-                                                 token,
-                                                 std::move(right));
+            Expr* right = parser.parse(stream, arena, static_cast<int>(Precedence::PREFIX));
+            return arena.make<UnaryOpExpr>(SourceSpan::combine(token.span, right->span),
+                                           token,
+                                           right);
         }
     };
 
+    // Parse the rest of an n-ary message, starting just after its first message token, and
+    // extend `span` to cover it.
+    void parse_nary_message_args(TokenStream& stream, const PrattParser& parser, ExprArena& arena,
+                                 std::vector<Token>& messages, std::vector<Expr*>& args,
+                                 SourceSpan& span)
+    {
+        args.push_back(
+            parser.parse(stream, arena, static_cast<int>(Precedence::N_ARY_MESSAGE) + 1));
+        span.extend(args.back()->span);
+        while (stream.current_has_type(TokenType::MESSAGE)) {
+            messages.push_back(stream.consume());
+            span.extend(messages.back().span);
+            args.push_back(
+                parser.parse(stream, arena, static_cast<int>(Precedence::N_ARY_MESSAGE) + 1));
+            span.extend(args.back()->span);
+        }
+    }
+
     class MessagePrefixParselet : public PrefixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena,
+                    const Token& token) override
         {
-            std::vector<Token> messages{};
-            std::vector<std::unique_ptr<Expr>> args{};
-
-            messages.push_back(token);
-            args.push_back(parser.parse(stream, static_cast<int>(Precedence::N_ARY_MESSAGE) + 1));
-            while (stream.current_has_type(TokenType::MESSAGE)) {
-                messages.push_back(stream.consume());
-                args.push_back(
-                    parser.parse(stream, static_cast<int>(Precedence::N_ARY_MESSAGE) + 1));
-            }
-
-            std::vector<SourceSpan> spans{};
-            for (const auto& token : messages) {
-                spans.push_back(token.span);
-            }
-            for (const auto& arg : args) {
-                spans.push_back(arg->span);
-            }
-
-            return std::make_unique<NAryMessageExpr>(SourceSpan::combine(spans),
-                                                     std::nullopt /* target */,
-                                                     messages,
-                                                     std::move(args));
+            std::vector<Token> messages{token};
+            std::vector<Expr*> args{};
+            SourceSpan span = token.span;
+            parse_nary_message_args(stream, parser, arena, messages, args, span);
+
+            return arena.make<NAryMessageExpr>(std::move(span),
+                                               std::nullopt /* target */,
+                                               std::move(messages),
+                                               std::move(args));
         }
     };
 
     class LParenPrefixParselet : public PrefixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena,
+                    const Token& token) override
         {
             // Support syntax `()` -> empty tuple.
             while (stream.current_has_type(TokenType::NEWLINE)) {
@@ -206,134 +209,113 @@ namespace Katsu
             }
             if (stream.current_has_type(TokenType::RPAREN)) {
                 Token rparen = stream.consume();
-                std::vector<std::unique_ptr<Expr>> components{};
-                return std::make_unique<TupleExpr>(SourceSpan::combine({token.span, rparen.span}),
-                                                   std::move(components));
+                return arena.make<TupleExpr>(SourceSpan::combine(token.span, rparen.span),
+                                             std::vector<Expr*>{});
             }
-            std::unique_ptr<Expr> inner = parser.parse(stream, 0 /* precedence */);
+            Expr* inner = parser.parse(stream, arena, 0 /* precedence */);
             Token rparen = expect(stream, TokenType::RPAREN);
-            return std::make_unique<ParenExpr>(
-                SourceSpan::combine({token.span, inner->span, rparen.span}),
-                std::move(inner));
+            return arena.make<ParenExpr>(SourceSpan::combine(token.span, inner->span, rparen.span),
+                                         inner);
         }
     };
 
     class LSquarePrefixParselet : public PrefixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena,
+                    const Token& token) override
         {
-            std::unique_ptr<Expr> body = parser.parse(stream, 0 /* precedence */);
+            Expr* body = parser.parse(stream, arena, 0 /* precedence */);
             Token rsquare = expect(stream, TokenType::RSQUARE);
-            std::vector<std::string> parameters{};
-            return std::make_unique<BlockExpr>(
-                SourceSpan::combine({token.span, body->span, rsquare.span}),
-                parameters,
-                std::move(body));
+            return arena.make<BlockExpr>(SourceSpan::combine(token.span, body->span, rsquare.span),
+                                         std::vector<std::string>{} /* parameters */,
+                                         body);
         }
     };
 
     class LCurlyPrefixParselet : public PrefixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena,
+                    const Token& token) override
         {
             while (stream.current_has_type(TokenType::NEWLINE)) {
                 stream.consume();
             }
             if (stream.current_has_type(TokenType::RCURLY)) {
                 Token rcurly = stream.consume();
-                std::vector<std::unique_ptr<Expr>> components{};
-                return std::make_unique<DataExpr>(SourceSpan::combine({token.span, rcurly.span}),
-                                                  std::move(components));
+                return arena.make<DataExpr>(SourceSpan::combine(token.span, rcurly.span),
+                                            std::vector<Expr*>{});
             }
 
-            std::vector<std::unique_ptr<Expr>> components{};
-            std::unique_ptr<Expr> inner = parser.parse(stream, 0 /* precedence */);
+            Expr* inner = parser.parse(stream, arena, 0 /* precedence */);
             Token rcurly = expect(stream, TokenType::RCURLY);
             // Lift the inner's sequence portions if it is a SequenceExpr; otherwise assume this
             // is a single-entry data structure. This is to support syntax like { 1; 2 } producing
             // a vector (1,2) as opposed to a vector (2), while { 1 } still will correctly produce
             // a vector (1); it also allows separating elements by newlines (like any other
             // sequencing expression).
-            std::vector<std::unique_ptr<Expr>>* sequence_components = inner->sequence_components();
-            SourceSpan inner_span = inner->span; // Since we might move `inner` into `components`.
-            if (sequence_components) {
-                for (std::unique_ptr<Expr>& component : *sequence_components) {
-                    components.push_back(std::move(component));
-                }
-            } else {
-                components.push_back(std::move(inner));
-            }
-            return std::make_unique<DataExpr>(
-                SourceSpan::combine({token.span, inner_span, rcurly.span}),
-                std::move(components));
+            std::vector<Expr*>* sequence_components = inner->sequence_components();
+            std::vector<Expr*> components =
+                sequence_components ? std::move(*sequence_components) : std::vector<Expr*>{inner};
+            return arena.make<DataExpr>(SourceSpan::combine(token.span, inner->span, rcurly.span),
+                                        std::move(components));
         }
     };
 
     class NamePrefixParselet : public PrefixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena,
+                    const Token& token) override
         {
-            return std::make_unique<NameExpr>(token.span, token);
+            return arena.make<NameExpr>(token.span, token);
         }
     };
 
     class BackslashPrefixParselet : public PrefixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena,
+                    const Token& token) override
         {
-            std::vector<Token> param_tokens{};
+            SourceSpan span = token.span;
             std::vector<std::string> parameters{};
             while (stream.current_has_type(TokenType::NAME)) {
                 Token param = stream.consume();
-                param_tokens.push_back(param);
-                parameters.push_back(std::get<std::string>(param.value));
+                span.extend(param.span);
+                parameters.emplace_back(std::get<std::string_view>(param.value));
             }
             Token lsquare = expect(stream, TokenType::LSQUARE);
-            std::unique_ptr<Expr> body = parser.parse(stream, 0 /* precedence */);
+            Expr* body = parser.parse(stream, arena, 0 /* precedence */);
             Token rsquare = expect(stream, TokenType::RSQUARE);
+            span.extend(lsquare.span);
+            span.extend(body->span);
+            span.extend(rsquare.span);
 
-            std::vector<SourceSpan> spans{};
-            spans.push_back(token.span);
-            for (const auto& token : param_tokens) {
-                spans.push_back(token.span);
-            }
-            spans.push_back(lsquare.span);
-            spans.push_back(body->span);
-            spans.push_back(rsquare.span);
-
-            return std::make_unique<BlockExpr>(SourceSpan::combine(spans),
-                                               parameters,
-                                               std::move(body));
+            return arena.make<BlockExpr>(std::move(span), std::move(parameters), body);
         }
     };
 
     class LiteralPrefixParselet : public PrefixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena,
+                    const Token& token) override
         {
-            return std::make_unique<LiteralExpr>(token.span, token);
+            return arena.make<LiteralExpr>(token.span, token);
         }
     };
 
     class NameInfixParselet : public InfixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    std::unique_ptr<Expr> left, const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena, Expr* left,
+                    const Token& token) override
         {
-            return std::make_unique<UnaryMessageExpr>(SourceSpan::combine({left->span, token.span}),
-                                                      std::move(left) /* target */,
-                                                      token /* message */
+            return arena.make<UnaryMessageExpr>(SourceSpan::combine(left->span, token.span),
+                                                left /* target */,
+                                                token /* message */
             );
         }
 
@@ -346,31 +328,18 @@ namespace Katsu
     class MessageInfixParselet : public InfixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    std::unique_ptr<Expr> left, const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena, Expr* left,
+                    const Token& token) override
         {
             std::vector<Token> messages{token};
-            std::vector<std::unique_ptr<Expr>> args{};
-            args.push_back(parser.parse(stream, static_cast<int>(Precedence::N_ARY_MESSAGE) + 1));
-            while (stream.current_has_type(TokenType::MESSAGE)) {
-                messages.push_back(stream.consume());
-                args.push_back(
-                    parser.parse(stream, static_cast<int>(Precedence::N_ARY_MESSAGE) + 1));
-            }
-
-            std::vector<SourceSpan> spans{};
-            spans.push_back(left->span);
-            for (const auto& token : messages) {
-                spans.push_back(token.span);
-            }
-            for (const auto& arg : args) {
-                spans.push_back(arg->span);
-            }
-
-            return std::make_unique<NAryMessageExpr>(SourceSpan::combine(spans),
-                                                     std::move(left) /* target */,
-                                                     messages,
-                                                     std::move(args));
+            std::vector<Expr*> args{};
+            SourceSpan span = SourceSpan::combine(left->span, token.span);
+            parse_nary_message_args(stream, parser, arena, messages, args, span);
+
+            return arena.make<NAryMessageExpr>(std::move(span),
+                                               left /* target */,
+                                               std::move(messages),
+                                               std::move(args));
         }
 
         int precedence(const Token& token) override
@@ -382,45 +351,33 @@ namespace Katsu
     class SequencingInfixParselet : public InfixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    std::unique_ptr<Expr> left, const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena, Expr* left,
+                    const Token& token) override
         {
-            std::vector<std::unique_ptr<Expr>> sequence{};
-            // We're moving `left` into `sequence`, so take a picture.
-            SourceSpan left_span = left->span;
-            sequence.push_back(std::move(left));
-
-            std::vector<Token> separators{token};
+            std::vector<Expr*> sequence{left};
+            SourceSpan span = SourceSpan::combine(left->span, token.span);
 
-            const auto parse_next_expr_or_trailing_semicolon = [&stream, &parser, &sequence]() {
+            const auto parse_next_expr_or_trailing_semicolon = [&]() {
                 // Hack: allow trailing semicolon. Check for a following token that cannot be a
                 // prefix.
-                Token token = stream.peek();
-                if (token.type == TokenType::RPAREN || token.type == TokenType::RCURLY ||
-                    token.type == TokenType::RSQUARE || token.type == TokenType::END) {
+                TokenType next = stream.peek().type;
+                if (next == TokenType::RPAREN || next == TokenType::RCURLY ||
+                    next == TokenType::RSQUARE || next == TokenType::END) {
                     return;
                 }
                 sequence.push_back(
-                    parser.parse(stream, static_cast<int>(Precedence::SEQUENCING) + 1));
+                    parser.parse(stream, arena, static_cast<int>(Precedence::SEQUENCING) + 1));
+                span.extend(sequence.back()->span);
             };
 
             parse_next_expr_or_trailing_semicolon();
             while (stream.current_has_type(TokenType::SEMICOLON) ||
                    stream.current_has_type(TokenType::NEWLINE)) {
-                separators.push_back(stream.consume());
+                span.extend(stream.consume().span);
                 parse_next_expr_or_trailing_semicolon();
             }
 
-            std::vector<SourceSpan> spans{};
-            spans.push_back(left_span);
-            for (const auto& expr : sequence) {
-                spans.push_back(expr->span);
-            }
-            for (const auto& sep : separators) {
-                spans.push_back(sep.span);
-            }
-
-            return std::make_unique<SequenceExpr>(SourceSpan::combine(spans), std::move(sequence));
+            return arena.make<SequenceExpr>(std::move(span), std::move(sequence));
         }
 
         int precedence(const Token& token) override
@@ -432,54 +389,29 @@ namespace Katsu
     class OperatorInfixParselet : public InfixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    std::unique_ptr<Expr> left, const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena, Expr* left,
+                    const Token& token) override
         {
             ASSERT(token.type == TokenType::OPERATOR);
 
-            const auto& prec_it = this->infix_precedence.find(std::get<std::string>(token.value));
-            if (prec_it == this->infix_precedence.end()) {
-                std::stringstream ss;
-                ss << "Missing infix precedence for operator '"
-                   << std::get<std::string>(token.value) << "'.";
-                throw parse_error(ss.str(), token.span);
-            }
-
-            const auto& assoc_it =
-                this->infix_associativity.find(std::get<std::string>(token.value));
-            if (assoc_it == this->infix_associativity.end()) {
-                std::stringstream ss;
-                ss << "Missing infix associativity for operator '"
-                   << std::get<std::string>(token.value) << "'.";
-                throw parse_error(ss.str(), token.span);
-            }
+            const OperatorInfo& info = this->info(token);
+            int op_prec = static_cast<int>(info.precedence);
+            Expr* right = parser.parse(stream,
+                                       arena,
+                                       info.associativity == Associativity::LEFT ? op_prec
+                                                                                 : (op_prec - 1));
 
-            int op_prec = static_cast<int>(prec_it->second);
-            Associativity op_assoc = assoc_it->second;
-
-            std::unique_ptr<Expr> right =
-                parser.parse(stream, op_assoc == Associativity::LEFT ? op_prec : (op_prec - 1));
-
-            return std::make_unique<BinaryOpExpr>(
-                SourceSpan::combine({left->span, token.span, right->span}),
+            return arena.make<BinaryOpExpr>(
+                SourceSpan::combine(left->span, token.span, right->span),
                 token /* op */,
-                std::move(left),
-                std::move(right));
+                left,
+                right);
         }
 
         int precedence(const Token& token) override
         {
             ASSERT(token.type == TokenType::OPERATOR);
-
-            const auto& prec_it = this->infix_precedence.find(std::get<std::string>(token.value));
-            if (prec_it == this->infix_precedence.end()) {
-                std::stringstream ss;
-                ss << "Missing infix precedence for operator '"
-                   << std::get<std::string>(token.value) << "'.";
-                throw parse_error(ss.str(), token.span);
-            }
-
-            return static_cast<int>(prec_it->second);
+            return static_cast<int>(this->info(token).precedence);
         }
 
     private:
@@ -489,80 +421,71 @@ namespace Katsu
             RIGHT
         };
 
-        std::unordered_map<std::string, Precedence> infix_precedence{
-            {"=",   Precedence::ASSIGNMENT    },
-            {"~",   Precedence::CONCATENATION },
-            {"and", Precedence::AND           },
-            {"or",  Precedence::OR            },
-            {"==",  Precedence::COMPARISON    },
-            {"!=",  Precedence::COMPARISON    },
-            {"<",   Precedence::COMPARISON    },
-            {"<=",  Precedence::COMPARISON    },
-            {">",   Precedence::COMPARISON    },
-            {">=",  Precedence::COMPARISON    },
-            {"+",   Precedence::SUM_DIFFERENCE},
-            {"-",   Precedence::SUM_DIFFERENCE},
-            {"*",   Precedence::PRODUCT       },
-            {"/",   Precedence::DIVISION      },
+        struct OperatorInfo
+        {
+            Precedence precedence;
+            Associativity associativity;
         };
 
-        std::unordered_map<std::string, Associativity> infix_associativity{
-            {"=",   Associativity::RIGHT},
-            {"~",   Associativity::LEFT },
-            {"and", Associativity::LEFT },
-            {"or",  Associativity::LEFT },
-            {"==",  Associativity::LEFT },
-            {"!=",  Associativity::LEFT },
-            {"<",   Associativity::LEFT },
-            {"<=",  Associativity::LEFT },
-            {">",   Associativity::LEFT },
-            {">=",  Associativity::LEFT },
-            {"+",   Associativity::LEFT },
-            {"-",   Associativity::LEFT },
-            {"*",   Associativity::LEFT },
-            {"/",   Associativity::LEFT },
+        const OperatorInfo& info(const Token& token)
+        {
+            std::string_view op = std::get<std::string_view>(token.value);
+            const auto& it = this->operators.find(op);
+            if (it == this->operators.end()) {
+                std::stringstream ss;
+                ss << "Missing infix precedence for operator '" << op << "'.";
+                throw parse_error(ss.str(), token.span);
+            }
+            return it->second;
+        }
+
+        // (Keyed by views of string literals, so that looking up a token's text needs no copy.)
+        std::unordered_map<std::string_view, OperatorInfo> operators{
+            {"=",   {Precedence::ASSIGNMENT, Associativity::RIGHT}    },
+            {"~",   {Precedence::CONCATENATION, Associativity::LEFT}  },
+            {"and", {Precedence::AND, Associativity::LEFT}            },
+            {"or",  {Precedence::OR, Associativity::LEFT}             },
+            {"==",  {Precedence::COMPARISON, Associativity::LEFT}     },
+            {"!=",  {Precedence::COMPARISON, Associativity::LEFT}     },
+            {"<",   {Precedence::COMPARISON, Associativity::LEFT}     },
+            {"<=",  {Precedence::COMPARISON, Associativity::LEFT}     },
+            {">",   {Precedence::COMPARISON, Associativity::LEFT}     },
+            {">=",  {Precedence::COMPARISON, Associativity::LEFT}     },
+            {"+",   {Precedence::SUM_DIFFERENCE, Associativity::LEFT} },
+            {"-",   {Precedence::SUM_DIFFERENCE, Associativity::LEFT} },
+            {"*",   {Precedence::PRODUCT, Associativity::LEFT}        },
+            {"/",   {Precedence::DIVISION, Associativity::LEFT}       },
         };
     };
 
     class CommaInfixParselet : public InfixParselet
     {
     public:
-        std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                    std::unique_ptr<Expr> left, const Token& token) override
+        Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena, Expr* left,
+                    const Token& token) override
         {
-            std::vector<std::unique_ptr<Expr>> components{};
-            // We're moving `left` into `components`, so take a picture.
-            SourceSpan left_span = left->span;
-            components.push_back(std::move(left));
-
-            std::vector<Token> separators{token};
+            std::vector<Expr*> components{left};
+            SourceSpan span = SourceSpan::combine(left->span, token.span);
 
-            const auto parse_next_expr_or_trailing_comma = [&stream, &parser, &components]() {
+            const auto parse_next_expr_or_trailing_comma = [&]() {
                 // Hack: allow trailing comma. Check for a following token that cannot be a prefix.
-                Token token = stream.peek();
-                if (token.type == TokenType::RPAREN || token.type == TokenType::RCURLY ||
-                    token.type == TokenType::RSQUARE || token.type == TokenType::END) {
+                TokenType next = stream.peek().type;
+                if (next == TokenType::RPAREN || next == TokenType::RCURLY ||
+                    next == TokenType::RSQUARE || next == TokenType::END) {
                     return;
                 }
-                components.push_back(parser.parse(stream, static_cast<int>(Precedence::COMMA) + 1));
+                components.push_back(
+                    parser.parse(stream, arena, static_cast<int>(Precedence::COMMA) + 1));
+                span.extend(components.back()->span);
             };
 
             parse_next_expr_or_trailing_comma();
             while (stream.current_has_type(TokenType::COMMA)) {
-                separators.push_back(stream.consume());
+                span.extend(stream.consume().span);
                 parse_next_expr_or_trailing_comma();
             }
 
-            std::vector<SourceSpan> spans{};
-            spans.push_back(left_span);
-            for (const auto& expr : components) {
-                spans.push_back(expr->span);
-            }
-            for (const auto& sep : separators) {
-                spans.push_back(sep.span);
-            }
-
-            return std::make_unique<TupleExpr>(SourceSpan::combine(spans), std::move(components));
+            return arena.make<TupleExpr>(std::move(span), std::move(components));
         }
 
         int precedence(const Token& token) override
@@ -27,8 +27,8 @@ namespace Katsu
     public:
         virtual ~PrefixParselet() = default;
 
-        virtual std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                            const Token& token) = 0;
+        virtual Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena,
+                            const Token& token) = 0;
     };
 
     class InfixParselet
@@ -36,8 +36,8 @@ namespace Katsu
     public:
         virtual ~InfixParselet() = default;
 
-        virtual std::unique_ptr<Expr> parse(TokenStream& stream, const PrattParser& parser,
-                                            std::unique_ptr<Expr> left, const Token& token) = 0;
+        virtual Expr* parse(TokenStream& stream, const PrattParser& parser, ExprArena& arena,
+                            Expr* left, const Token& token) = 0;
 
         virtual int precedence(const Token& token) = 0;
     };
@@ -53,8 +53,9 @@ namespace Katsu
         virtual ~PrattParser() = default;
 
         // Precondition: stream still has a remaining token other than NEWLINE and END.
-        std::unique_ptr<Expr> parse(TokenStream& stream, int precedence = 0,
-                                    bool is_toplevel = false) const;
+        // The expression (and its subexpressions) are allocated from `arena`.
+        Expr* parse(TokenStream& stream, ExprArena& arena, int precedence = 0,
+                    bool is_toplevel = false) const;
 
         void add_parselet(TokenType type, PrefixParselet& parselet);
         void add_parselet(TokenType type, InfixParselet& parselet);
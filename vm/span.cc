@@ -39,6 +39,17 @@ namespace Katsu
         return SourceSpan{.file = file, .start = min, .end = max};
     }
 
+    void SourceSpan::extend(const SourceSpan& other)
+    {
+        ASSERT_ARG_MSG(other.file == this->file, "spans must have the same .file");
+        if (other.start.index < this->start.index) {
+            this->start = other.start;
+        }
+        if (other.end.index > this->end.index) {
+            this->end = other.end;
+        }
+    }
+
     bool operator==(const SourceLocation& a, const SourceLocation& b)
     {
         return a.index == b.index && a.line == b.line && a.column == b.column;
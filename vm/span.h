@@ -41,5 +41,16 @@ namespace Katsu
         // Determines the minimal span combining each span in the input list.
         // All the input spans must have the same `file`.
         static SourceSpan combine(const std::vector<SourceSpan>& spans);
+        // Same, but for spans given directly, without building a vector of them.
+        template <typename... Spans>
+        static SourceSpan combine(const SourceSpan& first, const Spans&... rest)
+        {
+            SourceSpan span = first;
+            (span.extend(rest), ...);
+            return span;
+        }
+
+        // Grow this span to also cover `other`, which must have the same `file`.
+        void extend(const SourceSpan& other);
     };
 };
@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <optional>
+#include <string_view>
 #include <variant>
 
 #include "span.h"
@@ -34,7 +35,10 @@ namespace Katsu
 
     std::ostream& operator<<(std::ostream& s, TokenType type);
 
-    using TokenValue = std::variant<std::string, long long, std::monostate>;
+    // The text of a NAME, MESSAGE, SYMBOL, OPERATOR or STRING token, the value of an INTEGER, or
+    // nothing. Text is a view into the source file, which the token's span keeps alive; copy it
+    // out to keep it any longer than that.
+    using TokenValue = std::variant<std::string_view, long long, std::monostate>;
 
     struct Token
     {
@@ -119,6 +119,10 @@ namespace Katsu
         CALL_SEGMENT,
         FOREIGN,
         BYTE_ARRAY,
+        DEQUE,
+        IDENTITY_SET,
+        F64_ARRAY,
+        I64_ARRAY,
     };
 
     static const char* object_tag_str(ObjectTag tag)
@@ -139,6 +143,10 @@ namespace Katsu
             case ObjectTag::CALL_SEGMENT: return "call-segment";
             case ObjectTag::FOREIGN: return "foreign";
             case ObjectTag::BYTE_ARRAY: return "byte-array";
+            case ObjectTag::DEQUE: return "deque";
+            case ObjectTag::IDENTITY_SET: return "identity-set";
+            case ObjectTag::F64_ARRAY: return "f64-array";
+            case ObjectTag::I64_ARRAY: return "i64-array";
             default: return "!unknown!";
         }
     }
@@ -160,6 +168,10 @@ namespace Katsu
             case ObjectTag::CALL_SEGMENT: return "CALL_SEGMENT";
             case ObjectTag::FOREIGN: return "FOREIGN";
             case ObjectTag::BYTE_ARRAY: return "BYTE_ARRAY";
+            case ObjectTag::DEQUE: return "DEQUE";
+            case ObjectTag::IDENTITY_SET: return "IDENTITY_SET";
+            case ObjectTag::F64_ARRAY: return "F64_ARRAY";
+            case ObjectTag::I64_ARRAY: return "I64_ARRAY";
             default: return "!UNKNOWN!";
         }
     }
@@ -184,9 +196,18 @@ namespace Katsu
         // - if a forwarding pointer:
         //   - bits 1-63: forwarding pointer (shifted 1)
         // - if normal object:
-        //   - bits 1-63: ObjectTag   (TODO: lots of unused space here...)
+        //   - bits 1-60: ObjectTag   (TODO: lots of unused space here...)
+        //   - bit 61: mark bit for large objects, set only during a full collection
+        //   - bit 62: whether the object is in the GC's large-object space (see
+        //     GC::large_object_size)
+        //   - bit 63: whether the object is in the GC's remembered set (see GC::write_barrier())
         uint64_t header;
 
+        static const uint64_t MARKED_BIT = 1ULL << 61;
+        static const uint64_t LARGE_BIT = 1ULL << 62;
+        static const uint64_t REMEMBERED_BIT = 1ULL << 63;
+        static const uint64_t FLAG_BITS = MARKED_BIT | LARGE_BIT | REMEMBERED_BIT;
+
         inline uint64_t raw_header() const
         {
             return this->header;
@@ -219,7 +240,41 @@ namespace Katsu
         inline ObjectTag tag() const
         {
             ASSERT(this->is_object());
-            return static_cast<ObjectTag>(this->header >> 1);
+            return static_cast<ObjectTag>((this->header & ~FLAG_BITS) >> 1);
+        }
+
+        inline bool is_remembered() const
+        {
+            ASSERT(this->is_object());
+            return (this->header & REMEMBERED_BIT) != 0;
+        }
+        inline void set_remembered(bool remembered)
+        {
+            ASSERT(this->is_object());
+            this->header = remembered ? (this->header | REMEMBERED_BIT)
+                                      : (this->header & ~REMEMBERED_BIT);
+        }
+
+        inline bool is_large() const
+        {
+            ASSERT(this->is_object());
+            return (this->header & LARGE_BIT) != 0;
+        }
+        inline void set_large()
+        {
+            ASSERT(this->is_object());
+            this->header |= LARGE_BIT;
+        }
+
+        inline bool is_marked() const
+        {
+            ASSERT(this->is_object());
+            return (this->header & MARKED_BIT) != 0;
+        }
+        inline void set_marked(bool marked)
+        {
+            ASSERT(this->is_object());
+            this->header = marked ? (this->header | MARKED_BIT) : (this->header & ~MARKED_BIT);
         }
 
         template <typename T> T object() const
@@ -248,6 +303,10 @@ namespace Katsu
     struct CallSegment;
     struct ForeignValue;
     struct ByteArray;
+    struct Deque;
+    struct IdentitySet;
+    struct F64Array;
+    struct I64Array;
 
     // TODO: create related generic types which are guaranteed to have the right tag?
     // Like TaggedValue<int64_t>, guaranteed to be a fixnum.
@@ -376,6 +435,22 @@ namespace Katsu
         {
             return this->tag() == Tag::OBJECT && this->object()->tag() == ObjectTag::BYTE_ARRAY;
         }
+        bool is_obj_deque() const
+        {
+            return this->tag() == Tag::OBJECT && this->object()->tag() == ObjectTag::DEQUE;
+        }
+        bool is_obj_identity_set() const
+        {
+            return this->tag() == Tag::OBJECT && this->object()->tag() == ObjectTag::IDENTITY_SET;
+        }
+        bool is_obj_f64_array() const
+        {
+            return this->tag() == Tag::OBJECT && this->object()->tag() == ObjectTag::F64_ARRAY;
+        }
+        bool is_obj_i64_array() const
+        {
+            return this->tag() == Tag::OBJECT && this->object()->tag() == ObjectTag::I64_ARRAY;
+        }
 
         int64_t fixnum() const
         {
@@ -454,6 +529,22 @@ namespace Katsu
         {
             return this->object()->object<ByteArray*>();
         }
+        Deque* obj_deque() const
+        {
+            return this->object()->object<Deque*>();
+        }
+        IdentitySet* obj_identity_set() const
+        {
+            return this->object()->object<IdentitySet*>();
+        }
+        F64Array* obj_f64_array() const
+        {
+            return this->object()->object<F64Array*>();
+        }
+        I64Array* obj_i64_array() const
+        {
+            return this->object()->object<I64Array*>();
+        }
 
         static Value fixnum(int64_t num)
         {
@@ -588,6 +679,14 @@ namespace Katsu
 
         uint64_t length;
         Value v_array; // Array (of String/any pairs, stored consecutively)
+        // Hash index over the String keys, so lookups don't have to scan every entry. This is null
+        // while the backing array fits fewer than INDEX_MIN_CAPACITY entries; otherwise it's a
+        // ByteArray of uint64_t slots (at least twice as many as there is room for entries), used
+        // as an open-addressing hash table with linear probing. Each slot is either 0 (unused) or
+        // (<key hash> << 32) | (<entry index> + 1). Only the first entry with a given key is
+        // indexed, matching the first-match semantics of a linear scan.
+        Value v_index; // null or ByteArray
+        static const uint64_t INDEX_MIN_CAPACITY = 8;
 
         inline Entry* entries()
         {
@@ -633,7 +732,7 @@ namespace Katsu
         uint32_t num_data;
         Value v_upreg_map; // Null for methods; Array (of fixnums) for closures
         // TODO: byte array inline?
-        Value v_insts; // Array of fixnums
+        Value v_insts; // ByteArray (of 4-byte instruction words; see encode_inst())
         // TODO: arg array inline?
         Value v_args; // Array (of arbitrary values)
         // TODO: better representation of source spans.
@@ -717,6 +816,25 @@ namespace Katsu
         Value v_methods; // Vector of Methods
         // Arbitrary extra values attached by user.
         Value v_attributes; // Vector
+        // Bumped whenever v_methods changes (see add_method()), so that call-site inline caches
+        // can tell when their entries are stale.
+        uint64_t version;
+
+        // Dispatch acceleration, rebuilt whenever v_methods changes; see multimethod_dispatch().
+        // Methods which have any value matchers (or null if none). These are checked before
+        // consulting v_dispatch_table.
+        Value v_value_methods; // Null or Vector (of Methods)
+        // For each param, whether any method has a type matcher for it, i.e. whether the type of
+        // the corresponding argument is part of a v_dispatch_table key.
+        Value v_typed_params; // Array (of Bools)
+        // Open-addressed hash table from argument types to dispatch results, filled in lazily
+        // (or null if the multimethod has at most one method, so isn't worth a table). Each entry
+        // is [result, type 0, ..., type N-1], where the result is null (unused entry), a Method,
+        // or a fixnum DispatchFailure.
+        Value v_dispatch_table; // Null or Array
+        // Dispatch version (see VM::dispatch_version()) that the table's entries are valid for. The
+        // table must be cleared whenever this is out of date.
+        uint64_t dispatch_table_version;
 
         // Size in bytes.
         static inline uint64_t size()
@@ -749,6 +867,11 @@ namespace Katsu
         // If dataclass type, number of slots of this dataclass along with any recursive base
         // dataclasses. Otherwise unused.
         uint32_t num_total_slots;
+        // Dense id, unique among Types allocated by the same GC. Indexes into `v_ancestors`.
+        uint32_t type_id;
+        // Set of the type_ids of every type in the linearization, as a bitset (bit `id % 8` of byte
+        // `id / 8`). This makes subtype checks constant-time; keep it in sync with v_linearization.
+        Value v_ancestors; // ByteArray
 
         // Size in bytes.
         static inline uint64_t size()
@@ -793,27 +916,48 @@ namespace Katsu
 
     // From vm.h.
     struct Frame;
+    // A piece of call stack: either a segment of the VM's call stack itself (see VM::segments), or
+    // one detached from it as part of a delimited continuation.
+    // Keep in sync with stack-trace.katsu.
     struct CallSegment : public Object
     {
         static const ObjectTag CLASS_TAG = ObjectTag::CALL_SEGMENT;
 
-        // Total number of bytes of frame content.
+        enum State : uint64_t
+        {
+            // Part of the VM's call stack, which traces the frames itself.
+            ON_STACK,
+            // Detached; resuming relinks the frames themselves into the call stack.
+            ONE_SHOT,
+            // Detached; resuming copies the frames, so this can be resumed any number of times.
+            MULTI_SHOT,
+        };
+
+        // Number of bytes of frame content. Zero while ON_STACK.
         uint64_t length;
+        // Number of bytes of room for frames.
+        uint64_t capacity;
+        // The segment captured just above this one in the same continuation, or null.
+        Value v_next; // null or CallSegment
+        State state;
+
         inline Frame* frames()
         {
-            return reinterpret_cast<Frame*>(&this->length + 1);
+            return reinterpret_cast<Frame*>(this + 1);
         }
 
         // Size in bytes.
-        static inline uint64_t size(uint64_t length)
+        static inline uint64_t size(uint64_t capacity)
         {
-            return sizeof(CallSegment) + length;
+            return sizeof(CallSegment) + capacity;
         }
         inline uint64_t size() const
         {
-            return CallSegment::size(this->length);
+            return CallSegment::size(this->capacity);
         }
     };
+    // If this changes, update stack-trace.katsu.
+    static_assert(sizeof(CallSegment) == 40);
 
     struct ForeignValue : public Object
     {
@@ -849,6 +993,98 @@ namespace Katsu
         }
     };
 
+    // A double-ended queue, as a ring buffer: the `length` values start at index `head` of the
+    // backing array, and wrap around from its end back to its start.
+    struct Deque : public Object
+    {
+        static const ObjectTag CLASS_TAG = ObjectTag::DEQUE;
+
+        // Number of values in the deque.
+        uint64_t length;
+        // Index of the first value in the backing array.
+        uint64_t head;
+        // Backing array. Slots not holding one of the values are null.
+        Value v_array; // Array
+
+        // Length of the backing array.
+        uint64_t capacity()
+        {
+            return this->v_array.obj_array()->length;
+        }
+
+        // Size in bytes.
+        static inline uint64_t size()
+        {
+            return sizeof(Deque);
+        }
+    };
+
+    // A set of values, compared by identity: an open-addressed hash table of the values
+    // themselves. Objects hash by where they are in memory, and since collections move objects,
+    // the table is rehashed on first use after any collection (see GC::num_collections).
+    struct IdentitySet : public Object
+    {
+        static const ObjectTag CLASS_TAG = ObjectTag::IDENTITY_SET;
+
+        // Number of values in the set.
+        uint64_t count;
+        // GC::num_collections as of when the table was last hashed.
+        uint64_t epoch;
+        // Hash table with a power-of-two length. Null slots are empty.
+        Value v_table; // Array
+
+        // Size in bytes.
+        static inline uint64_t size()
+        {
+            return sizeof(IdentitySet);
+        }
+    };
+
+    // Unboxed numeric arrays, laid out like a ByteArray but with 8-byte elements. Unlike an Array,
+    // elements aren't Values: there is nothing for the GC to trace, and bulk operations (see
+    // numeric_array.h) can work on the elements directly. (ByteArray serves as the u8 variety.)
+    struct F64Array : public Object
+    {
+        static const ObjectTag CLASS_TAG = ObjectTag::F64_ARRAY;
+
+        uint64_t length;
+        inline double* contents()
+        {
+            return reinterpret_cast<double*>(&this->length + 1);
+        }
+
+        // Size in bytes.
+        static inline uint64_t size(uint64_t length)
+        {
+            return sizeof(F64Array) + length * sizeof(double);
+        }
+        inline uint64_t size() const
+        {
+            return F64Array::size(this->length);
+        }
+    };
+
+    struct I64Array : public Object
+    {
+        static const ObjectTag CLASS_TAG = ObjectTag::I64_ARRAY;
+
+        uint64_t length;
+        inline int64_t* contents()
+        {
+            return reinterpret_cast<int64_t*>(&this->length + 1);
+        }
+
+        // Size in bytes.
+        static inline uint64_t size(uint64_t length)
+        {
+            return sizeof(I64Array) + length * sizeof(int64_t);
+        }
+        inline uint64_t size() const
+        {
+            return I64Array::size(this->length);
+        }
+    };
+
 
     // Specializations for static_value():
     template <> inline int64_t static_value<int64_t>(Value value)
@@ -960,4 +1196,24 @@ namespace Katsu
         ASSERT(object.tag() == ObjectTag::BYTE_ARRAY);
         return reinterpret_cast<ByteArray*>(&object);
     }
+    template <> inline Deque* static_object<Deque*>(Object& object)
+    {
+        ASSERT(object.tag() == ObjectTag::DEQUE);
+        return reinterpret_cast<Deque*>(&object);
+    }
+    template <> inline IdentitySet* static_object<IdentitySet*>(Object& object)
+    {
+        ASSERT(object.tag() == ObjectTag::IDENTITY_SET);
+        return reinterpret_cast<IdentitySet*>(&object);
+    }
+    template <> inline F64Array* static_object<F64Array*>(Object& object)
+    {
+        ASSERT(object.tag() == ObjectTag::F64_ARRAY);
+        return reinterpret_cast<F64Array*>(&object);
+    }
+    template <> inline I64Array* static_object<I64Array*>(Object& object)
+    {
+        ASSERT(object.tag() == ObjectTag::I64_ARRAY);
+        return reinterpret_cast<I64Array*>(&object);
+    }
 };
@@ -172,7 +172,11 @@ TEST_CASE("object header distinguishes forwarding vs. reference types", "[object
     F(LEFT, DataclassInstance)     \
     F(LEFT, CallSegment)           \
     F(LEFT, ForeignValue)          \
-    F(LEFT, ByteArray)
+    F(LEFT, ByteArray)             \
+    F(LEFT, Deque)                 \
+    F(LEFT, IdentitySet)           \
+    F(LEFT, F64Array)              \
+    F(LEFT, I64Array)
 
 #define EACH_OBJECT_OUTER(INNER, F) \
     INNER(F, Ref)                   \
@@ -189,7 +193,11 @@ TEST_CASE("object header distinguishes forwarding vs. reference types", "[object
     INNER(F, DataclassInstance)     \
     INNER(F, CallSegment)           \
     INNER(F, ForeignValue)          \
-    INNER(F, ByteArray)
+    INNER(F, ByteArray)             \
+    INNER(F, Deque)                 \
+    INNER(F, IdentitySet)           \
+    INNER(F, F64Array)              \
+    INNER(F, I64Array)
 
 #define EACH_OBJECT_PAIR(F) EACH_OBJECT_OUTER(EACH_OBJECT_INNER, F)
 
@@ -232,3 +240,7 @@ TEST_CASE("object() helper checks object tags", "[object]")
 // TODO: test functions of CallSegment
 // TODO: test functions of ForeignValue
 // TODO: test functions of ByteArray
+// TODO: test functions of Deque
+// TODO: test functions of IdentitySet
+// TODO: test functions of F64Array
+// TODO: test functions of I64Array
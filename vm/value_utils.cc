@@ -4,6 +4,7 @@
 #include "condition.h"
 #include "vm.h"
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <optional>
@@ -74,20 +75,36 @@ namespace Katsu
         return make_vector(gc, length, r_array);
     }
 
+    // Number of Assoc::v_index slots to use for an assoc with this capacity (in entries).
+    uint64_t assoc_index_num_slots(uint64_t capacity)
+    {
+        uint64_t num_slots = 1;
+        while (num_slots < 2 * capacity) {
+            num_slots *= 2;
+        }
+        return num_slots;
+    }
+
     Assoc* make_assoc(GC& gc, uint64_t capacity)
     {
         Root<Array> r_array(gc, make_array(gc, /* length */ capacity * 2));
+        ValueRoot rv_index(gc, Value::null());
+        if (capacity >= Assoc::INDEX_MIN_CAPACITY) {
+            uint64_t num_slots = assoc_index_num_slots(capacity);
+            *rv_index = Value::object(make_byte_array(gc, num_slots * sizeof(uint64_t)));
+        }
         Assoc* assoc = gc.alloc<Assoc>();
         assoc->length = 0;
         assoc->v_array = r_array.value();
+        assoc->v_index = *rv_index;
         return assoc;
     }
 
-    String* make_string(GC& gc, const std::string& src)
+    String* make_string(GC& gc, std::string_view src)
     {
         size_t length = src.size();
         String* str = make_string_nofill(gc, length);
-        memcpy(str->contents(), src.c_str(), length);
+        memcpy(str->contents(), src.data(), length);
         return str;
     }
 
@@ -99,12 +116,13 @@ namespace Katsu
     }
 
     Code* make_code(GC& gc, Root<Assoc>& r_module, uint32_t num_params, uint32_t num_regs,
-                    uint32_t num_data, OptionalRoot<Array>& r_upreg_map, Root<Array>& r_insts,
-                    Root<Array>& r_args, Root<Tuple>& r_span, Root<Array>& r_inst_spans)
+                    uint32_t num_data, OptionalRoot<Array>& r_upreg_map,
+                    Root<ByteArray>& r_insts, Root<Array>& r_args, Root<Tuple>& r_span,
+                    Root<Array>& r_inst_spans)
     {
         ASSERT_ARG(num_params <= num_regs);
-        ASSERT_ARG(r_inst_spans->length == r_insts->length);
-        // TODO: check that insts are fixnums of the right range?
+        ASSERT_ARG(r_insts->length % INST_SIZE == 0);
+        ASSERT_ARG(r_inst_spans->length == num_insts(*r_insts));
         // TODO: check that insts refer to indices in r_args?
         ASSERT_ARG(r_span->length == 7);
 #if DEBUG_ASSERTIONS
@@ -172,6 +190,20 @@ namespace Katsu
         return method;
     }
 
+    Method* make_lazy_method(GC& gc, Root<Array>& r_param_matchers,
+                             OptionalRoot<Type>& r_return_type, Root<Tuple>& r_stub,
+                             Root<Vector>& r_attributes)
+    {
+        Method* method = gc.alloc<Method>();
+        method->v_param_matchers = r_param_matchers.value();
+        method->v_return_type = r_return_type.value();
+        method->v_code = r_stub.value();
+        method->v_attributes = r_attributes.value();
+        method->native_handler = nullptr;
+        method->intrinsic_handler = nullptr;
+        return method;
+    }
+
     MultiMethod* make_multimethod(GC& gc, Root<String>& r_name, uint32_t num_params,
                                   Root<Vector>& r_methods, Root<Vector>& r_attributes)
     {
@@ -187,7 +219,14 @@ namespace Katsu
         multimethod->num_params = num_params;
         multimethod->v_methods = r_methods.value();
         multimethod->v_attributes = r_attributes.value();
-        return multimethod;
+        multimethod->version = 0;
+        multimethod->v_value_methods = Value::null();
+        multimethod->v_typed_params = Value::null();
+        multimethod->v_dispatch_table = Value::null();
+        multimethod->dispatch_table_version = 0;
+        Root<MultiMethod> r_multimethod(gc, std::move(multimethod));
+        rebuild_dispatch_table(gc, r_multimethod);
+        return *r_multimethod;
     }
 
     Type* make_type_raw(GC& gc, Root<String>& r_name, Root<Array>& r_bases, bool sealed,
@@ -214,6 +253,8 @@ namespace Katsu
             ASSERT_ARG_MSG(!num_total_slots, "MIXIN type must not have num_total_slots");
         }
 
+        Root<ByteArray> r_ancestors(gc, make_ancestor_set(gc, r_linearization));
+
         Type* type = gc.alloc<Type>();
         type->v_name = r_name.value();
         type->v_bases = r_bases.value();
@@ -223,9 +264,33 @@ namespace Katsu
         type->kind = kind;
         type->v_slots = r_slots.value();
         type->num_total_slots = num_total_slots.value_or(0);
+        type->type_id = gc.num_types++;
+        type->v_ancestors = r_ancestors.value();
         return type;
     }
 
+    ByteArray* make_ancestor_set(GC& gc, Root<Array>& r_linearization)
+    {
+        uint64_t length = 0;
+        for (Value v_type : r_linearization) {
+            length = std::max(length, (uint64_t)v_type.obj_type()->type_id / 8 + 1);
+        }
+        ByteArray* ancestors = make_byte_array(gc, length);
+        for (Value v_type : r_linearization) {
+            uint32_t type_id = v_type.obj_type()->type_id;
+            ancestors->contents()[type_id / 8] |= 1 << (type_id % 8);
+        }
+        return ancestors;
+    }
+
+    void set_linearization(GC& gc, Root<Type>& r_type, Root<Array>& r_linearization)
+    {
+        ByteArray* ancestors = make_ancestor_set(gc, r_linearization);
+        r_type->v_linearization = r_linearization.value();
+        r_type->v_ancestors = Value::object(ancestors);
+        gc.write_barrier(*r_type);
+    }
+
     DataclassInstance* make_instance_nofill(GC& gc, Root<Type>& r_type)
     {
         Type* type = *r_type;
@@ -236,21 +301,14 @@ namespace Katsu
         return inst;
     }
 
-    CallSegment* make_call_segment(GC& gc, Frame* segment_bottom, uint64_t total_length)
+    CallSegment* make_call_segment(GC& gc, uint64_t capacity)
     {
-        ASSERT_ARG(segment_bottom);
-        ASSERT_ARG(total_length <= SIZE_MAX);
-        CallSegment* segment = gc.alloc<CallSegment>(total_length);
-        segment->length = total_length;
-        memcpy(segment->frames(), segment_bottom, total_length);
-        // Invalidate `caller` in each freshly copied frame.
-        Frame* past_end = reinterpret_cast<Frame*>(reinterpret_cast<uint8_t*>(segment->frames()) +
-                                                   segment->length);
-        Frame* frame;
-        for (frame = segment->frames(); frame < past_end; frame = frame->next()) {
-            frame->caller = nullptr;
-        }
-        ASSERT_ARG(frame == past_end);
+        ASSERT_ARG((capacity & TAG_MASK) == 0);
+        CallSegment* segment = gc.alloc_pinned<CallSegment>(/* may_collect */ false, capacity);
+        segment->length = 0;
+        segment->capacity = capacity;
+        segment->v_next = Value::null();
+        segment->state = CallSegment::State::ON_STACK;
         return segment;
     }
 
@@ -275,32 +333,369 @@ namespace Katsu
         return array;
     }
 
-    Vector* append(GC& gc, Root<Vector>& r_vector, ValueRoot& r_value)
+    ByteArray* make_pinned_byte_array(GC& gc, uint64_t length)
+    {
+        ByteArray* array = gc.alloc_pinned<ByteArray>(/* may_collect */ true, length);
+        array->length = length;
+        memset(array->contents(), 0, length);
+        return array;
+    }
+
+    F64Array* make_f64_array(GC& gc, uint64_t length)
+    {
+        F64Array* array = gc.alloc<F64Array>(length);
+        array->length = length;
+        std::fill_n(array->contents(), length, 0.0);
+        return array;
+    }
+
+    I64Array* make_i64_array(GC& gc, uint64_t length)
+    {
+        I64Array* array = gc.alloc<I64Array>(length);
+        array->length = length;
+        std::fill_n(array->contents(), length, 0);
+        return array;
+    }
+
+    Vector* vector_reserve(GC& gc, Root<Vector>& r_vector, uint64_t capacity)
     {
         Vector* vector = *r_vector;
 
-        uint64_t capacity = vector->capacity();
-        if (vector->length == capacity) {
-            // Reallocate the backing array! The original backing array (and vector) are kept alive
-            // by the r_vector root while we copy components over.
-            uint64_t new_capacity = capacity == 0 ? 1 : capacity * 2;
-            Array* new_array = make_array_nofill(gc, new_capacity);
-            vector = *r_vector;
-            // Copy components and null-fill the rest.
-            {
-                Array* array = vector->v_array.obj_array();
-                for (uint64_t i = 0; i < capacity; i++) {
-                    new_array->components()[i] = array->components()[i];
-                }
-                for (uint64_t i = capacity; i < new_capacity; i++) {
-                    new_array->components()[i] = Value::null();
+        uint64_t old_capacity = vector->capacity();
+        if (capacity <= old_capacity) {
+            return vector;
+        }
+        // At least double, so that reserving repeatedly (for instance one at a time, from append)
+        // still takes amortized constant time per element.
+        uint64_t new_capacity = std::max(capacity, old_capacity * 2);
+        // Reallocate the backing array! The original backing array (and vector) are kept alive by
+        // the r_vector root while we copy components over.
+        Array* new_array = make_array_nofill(gc, new_capacity);
+        vector = *r_vector;
+        // Copy components and null-fill the rest.
+        {
+            Array* array = vector->v_array.obj_array();
+            std::copy_n(array->components(), vector->length, new_array->components());
+            std::fill(new_array->components() + vector->length,
+                      new_array->components() + new_capacity,
+                      Value::null());
+        }
+        vector->v_array = Value::object(new_array);
+        gc.write_barrier(vector, vector->v_array);
+        return vector;
+    }
+
+    Vector* vector_grow_by(GC& gc, Root<Vector>& r_vector, uint64_t count)
+    {
+        Vector* vector = vector_reserve(gc, r_vector, r_vector->length + count);
+        // Shrinking a vector doesn't clear what was past its new length, so do that here.
+        Value* components = vector->v_array.obj_array()->components();
+        std::fill(components + vector->length, components + vector->length + count, Value::null());
+        vector->length += count;
+        return vector;
+    }
+
+    Vector* append(GC& gc, Root<Vector>& r_vector, ValueRoot& r_value)
+    {
+        Vector* vector = vector_reserve(gc, r_vector, r_vector->length + 1);
+        Array* array = vector->v_array.obj_array();
+        array->components()[vector->length++] = *r_value;
+        gc.write_barrier(array, *r_value);
+        return vector;
+    }
+
+    Deque* make_deque(GC& gc, uint64_t capacity)
+    {
+        Root<Array> r_array(gc, make_array(gc, /* length */ capacity));
+        Deque* deque = gc.alloc<Deque>();
+        deque->length = 0;
+        deque->head = 0;
+        deque->v_array = r_array.value();
+        return deque;
+    }
+
+    // Make sure a deque has room for one more value, reallocating its backing array (and moving
+    // the values to its start) if not.
+    Deque* deque_reserve(GC& gc, Root<Deque>& r_deque)
+    {
+        Deque* deque = *r_deque;
+
+        uint64_t capacity = deque->capacity();
+        if (deque->length < capacity) {
+            return deque;
+        }
+        uint64_t new_capacity = capacity == 0 ? 1 : capacity * 2;
+        Array* new_array = make_array_nofill(gc, new_capacity);
+        deque = *r_deque;
+        // Copy values in order, unwrapping them, and null-fill the rest.
+        {
+            Array* array = deque->v_array.obj_array();
+            for (uint64_t i = 0; i < capacity; i++) {
+                new_array->components()[i] = array->components()[(deque->head + i) % capacity];
+            }
+            for (uint64_t i = capacity; i < new_capacity; i++) {
+                new_array->components()[i] = Value::null();
+            }
+        }
+        deque->head = 0;
+        deque->v_array = Value::object(new_array);
+        gc.write_barrier(deque, deque->v_array);
+        return deque;
+    }
+
+    Deque* deque_push_back(GC& gc, Root<Deque>& r_deque, ValueRoot& r_value)
+    {
+        Deque* deque = deque_reserve(gc, r_deque);
+        Array* array = deque->v_array.obj_array();
+        array->components()[(deque->head + deque->length++) % array->length] = *r_value;
+        gc.write_barrier(array, *r_value);
+        return deque;
+    }
+
+    Deque* deque_push_front(GC& gc, Root<Deque>& r_deque, ValueRoot& r_value)
+    {
+        Deque* deque = deque_reserve(gc, r_deque);
+        Array* array = deque->v_array.obj_array();
+        deque->head = (deque->head + array->length - 1) % array->length;
+        deque->length++;
+        array->components()[deque->head] = *r_value;
+        gc.write_barrier(array, *r_value);
+        return deque;
+    }
+
+    Value deque_pop_front(Deque* deque)
+    {
+        ASSERT_ARG(deque->length > 0);
+        Array* array = deque->v_array.obj_array();
+        Value* slot = &array->components()[deque->head];
+        Value value = *slot;
+        // Null out the slot so the deque doesn't keep the value alive.
+        *slot = Value::null();
+        deque->head = (deque->head + 1) % array->length;
+        deque->length--;
+        return value;
+    }
+
+    Value deque_pop_back(Deque* deque)
+    {
+        ASSERT_ARG(deque->length > 0);
+        Array* array = deque->v_array.obj_array();
+        Value* slot = &array->components()[(deque->head + --deque->length) % array->length];
+        Value value = *slot;
+        // Null out the slot so the deque doesn't keep the value alive.
+        *slot = Value::null();
+        return value;
+    }
+
+    Value deque_at(Deque* deque, uint64_t index)
+    {
+        ASSERT_ARG(index < deque->length);
+        Array* array = deque->v_array.obj_array();
+        return array->components()[(deque->head + index) % array->length];
+    }
+
+    // Smallest table for an identity set.
+    static const uint64_t MIN_IDENTITY_SET_SLOTS = 8;
+
+    // Hash a value by identity. Objects hash by address, so this is only stable between
+    // collections.
+    uint64_t identity_hash(Value value)
+    {
+        uint64_t bits = (value.raw_value() << TAG_BITS) | static_cast<uint64_t>(value.tag());
+        // Fibonacci hashing; the high bits are the well-mixed ones.
+        return (bits * 0x9E3779B97F4A7C15ull) >> 32;
+    }
+
+    // Insert a value which isn't in an identity set yet into its table. The table must have room.
+    void identity_table_insert(Array* table, Value value)
+    {
+        uint64_t mask = table->length - 1;
+        for (uint64_t i = identity_hash(value) & mask;; i = (i + 1) & mask) {
+            if (table->components()[i].is_null()) {
+                table->components()[i] = value;
+                return;
+            }
+        }
+    }
+
+    // Rehash an identity set's table in place, if there has been a collection since it was last
+    // hashed. Doesn't allocate!
+    void identity_set_refresh(GC& gc, IdentitySet* set)
+    {
+        if (set->epoch == gc.num_collections) {
+            return;
+        }
+        Array* table = set->v_table.obj_array();
+        std::vector<Value> values;
+        values.reserve(set->count);
+        for (uint64_t i = 0; i < table->length; i++) {
+            Value& slot = table->components()[i];
+            if (!slot.is_null()) {
+                values.push_back(slot);
+                slot = Value::null();
+            }
+        }
+        for (Value value : values) {
+            identity_table_insert(table, value);
+        }
+        set->epoch = gc.num_collections;
+    }
+
+    // Find a value's slot in an (up-to-date) identity set's table, or return nullptr.
+    Value* identity_set_find(IdentitySet* set, Value value)
+    {
+        Array* table = set->v_table.obj_array();
+        uint64_t mask = table->length - 1;
+        for (uint64_t i = identity_hash(value) & mask;; i = (i + 1) & mask) {
+            Value& slot = table->components()[i];
+            if (slot.is_null()) {
+                return nullptr;
+            }
+            if (slot == value) {
+                return &slot;
+            }
+        }
+    }
+
+    IdentitySet* make_identity_set(GC& gc, uint64_t capacity)
+    {
+        // Keep the table at most 3/4 full.
+        uint64_t num_slots = MIN_IDENTITY_SET_SLOTS;
+        while (num_slots * 3 < capacity * 4) {
+            num_slots *= 2;
+        }
+        Root<Array> r_table(gc, make_array(gc, /* length */ num_slots));
+        IdentitySet* set = gc.alloc<IdentitySet>();
+        set->count = 0;
+        set->epoch = gc.num_collections;
+        set->v_table = r_table.value();
+        return set;
+    }
+
+    bool identity_set_add(GC& gc, Root<IdentitySet>& r_set, ValueRoot& r_value)
+    {
+        ASSERT_ARG(!r_value->is_null());
+        IdentitySet* set = *r_set;
+        identity_set_refresh(gc, set);
+        if (identity_set_find(set, *r_value)) {
+            return false;
+        }
+
+        uint64_t num_slots = set->v_table.obj_array()->length;
+        if ((set->count + 1) * 4 > num_slots * 3) {
+            // Reallocate the table! The old table is kept alive (through the r_set root) while
+            // we move values over, hashing them by wherever they are after any collection.
+            Array* new_table = make_array(gc, num_slots * 2);
+            set = *r_set;
+            Array* table = set->v_table.obj_array();
+            for (uint64_t i = 0; i < num_slots; i++) {
+                Value value = table->components()[i];
+                if (!value.is_null()) {
+                    identity_table_insert(new_table, value);
                 }
             }
-            vector->v_array = Value::object(new_array);
+            set->v_table = Value::object(new_table);
+            set->epoch = gc.num_collections;
+            gc.write_barrier(set, set->v_table);
         }
 
-        vector->v_array.obj_array()->components()[vector->length++] = *r_value;
-        return vector;
+        Array* table = set->v_table.obj_array();
+        identity_table_insert(table, *r_value);
+        gc.write_barrier(table, *r_value);
+        set->count++;
+        return true;
+    }
+
+    bool identity_set_remove(GC& gc, IdentitySet* set, Value value)
+    {
+        identity_set_refresh(gc, set);
+        Value* slot = identity_set_find(set, value);
+        if (!slot) {
+            return false;
+        }
+        // Backward-shift deletion: pull later values in the probe run back into the hole, as long
+        // as that doesn't move them before their home slot.
+        Array* table = set->v_table.obj_array();
+        uint64_t mask = table->length - 1;
+        uint64_t hole = slot - table->components();
+        for (uint64_t i = (hole + 1) & mask;; i = (i + 1) & mask) {
+            Value next = table->components()[i];
+            if (next.is_null()) {
+                break;
+            }
+            uint64_t home = identity_hash(next) & mask;
+            // Move `next` unless its home lies cyclically within (hole, i].
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                table->components()[hole] = next;
+                hole = i;
+            }
+        }
+        table->components()[hole] = Value::null();
+        set->count--;
+        return true;
+    }
+
+    bool identity_set_contains(GC& gc, IdentitySet* set, Value value)
+    {
+        identity_set_refresh(gc, set);
+        return identity_set_find(set, value) != nullptr;
+    }
+
+    // Add an entry to an assoc's index, unless an entry with the same key is already there.
+    // The index must have room.
+    void assoc_index_insert(Assoc* assoc, uint64_t entry_index, uint32_t hash)
+    {
+        ByteArray* index = assoc->v_index.obj_byte_array();
+        uint64_t* slots = reinterpret_cast<uint64_t*>(index->contents());
+        uint64_t mask = index->length / sizeof(uint64_t) - 1;
+        String* key = assoc->entries()[entry_index].v_key.obj_string();
+        for (uint64_t i = hash & mask;; i = (i + 1) & mask) {
+            uint64_t slot = slots[i];
+            if (slot == 0) {
+                slots[i] = ((uint64_t)hash << 32) | (entry_index + 1);
+                return;
+            }
+            if ((slot >> 32) == hash &&
+                string_eq(assoc->entries()[(slot & 0xffffffff) - 1].v_key.obj_string(), key)) {
+                return;
+            }
+        }
+    }
+
+    // Replace an assoc's index with a fresh one of the given size, re-adding every key. (This
+    // reuses the hashes cached in the old index where there is one.)
+    void assoc_rebuild_index(GC& gc, Root<Assoc>& r_assoc, uint64_t num_slots)
+    {
+        ByteArray* new_index = make_byte_array(gc, num_slots * sizeof(uint64_t));
+        Assoc* assoc = *r_assoc;
+        Value v_old_index = assoc->v_index;
+        assoc->v_index = Value::object(new_index);
+        gc.write_barrier(assoc, assoc->v_index);
+        if (v_old_index.is_obj_byte_array()) {
+            ByteArray* old_index = v_old_index.obj_byte_array();
+            uint64_t* old_slots = reinterpret_cast<uint64_t*>(old_index->contents());
+            uint64_t* slots = reinterpret_cast<uint64_t*>(new_index->contents());
+            uint64_t mask = num_slots - 1;
+            // Keys in the old index are already unique, so just find each one an empty slot.
+            for (uint64_t j = 0; j < old_index->length / sizeof(uint64_t); j++) {
+                uint64_t slot = old_slots[j];
+                if (slot == 0) {
+                    continue;
+                }
+                uint64_t i = (slot >> 32) & mask;
+                while (slots[i] != 0) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = slot;
+            }
+        } else {
+            for (uint64_t i = 0; i < assoc->length; i++) {
+                Value v_key = assoc->entries()[i].v_key;
+                if (v_key.is_obj_string()) {
+                    assoc_index_insert(assoc, i, string_hash(v_key.obj_string()));
+                }
+            }
+        }
     }
 
     Assoc* append(GC& gc, Root<Assoc>& r_assoc, ValueRoot& r_key, ValueRoot& r_value)
@@ -329,11 +724,27 @@ namespace Katsu
                 }
             }
             assoc->v_array = Value::object(new_array);
+            gc.write_barrier(assoc, assoc->v_array);
+
+            if (new_entries_capacity >= Assoc::INDEX_MIN_CAPACITY) {
+                uint64_t num_slots = assoc_index_num_slots(new_entries_capacity);
+                Value v_index = assoc->v_index;
+                if (!v_index.is_obj_byte_array() ||
+                    v_index.obj_byte_array()->length < num_slots * sizeof(uint64_t)) {
+                    assoc_rebuild_index(gc, r_assoc, num_slots);
+                    assoc = *r_assoc;
+                }
+            }
         }
 
-        Assoc::Entry& entry = assoc->entries()[assoc->length++];
+        uint64_t entry_index = assoc->length++;
+        Assoc::Entry& entry = assoc->entries()[entry_index];
         entry.v_key = *r_key;
         entry.v_value = *r_value;
+        gc.write_barrier(assoc->v_array.obj_array());
+        if (assoc->v_index.is_obj_byte_array() && entry.v_key.is_obj_string()) {
+            assoc_index_insert(assoc, entry_index, string_hash(entry.v_key.obj_string()));
+        }
         return assoc;
     }
 
@@ -347,10 +758,32 @@ namespace Katsu
         return array;
     }
 
-    Value* assoc_lookup(Assoc* assoc, String* name)
+    // Shared by the assoc_lookup() overloads.
+    Value* assoc_lookup(Assoc* assoc, const uint8_t* name, uint64_t name_length)
     {
-        uint64_t name_length = name->length;
-        // TODO: check against size_t?
+        if (assoc->v_index.is_obj_byte_array()) {
+            ByteArray* index = assoc->v_index.obj_byte_array();
+            uint64_t* slots = reinterpret_cast<uint64_t*>(index->contents());
+            uint64_t mask = index->length / sizeof(uint64_t) - 1;
+            uint32_t hash = string_hash(name, name_length);
+            for (uint64_t i = hash & mask;; i = (i + 1) & mask) {
+                uint64_t slot = slots[i];
+                if (slot == 0) {
+                    return nullptr;
+                }
+                if ((slot >> 32) == hash) {
+                    Assoc::Entry& entry = assoc->entries()[(slot & 0xffffffff) - 1];
+                    String* entry_name = entry.v_key.obj_string();
+                    if (entry_name->length == name_length &&
+                        (entry_name->contents() == name ||
+                         memcmp(entry_name->contents(), name, name_length) == 0)) {
+                        return &entry.v_value;
+                    }
+                }
+            }
+        }
+
+        // TODO: check name_length against size_t?
 
         uint64_t num_entries = assoc->length;
         for (uint64_t i = 0; i < num_entries; i++) {
@@ -363,7 +796,7 @@ namespace Katsu
             if (entry_name->length != name_length) {
                 continue;
             }
-            if (memcmp(entry_name->contents(), name->contents(), name_length) != 0) {
+            if (memcmp(entry_name->contents(), name, name_length) != 0) {
                 continue;
             }
             // Match!
@@ -373,9 +806,37 @@ namespace Katsu
         return nullptr;
     }
 
+    Value* assoc_lookup(Assoc* assoc, String* name)
+    {
+        return assoc_lookup(assoc, name->contents(), name->length);
+    }
+
+    Value* assoc_lookup(Assoc* assoc, const std::string& name)
+    {
+        return assoc_lookup(assoc, reinterpret_cast<const uint8_t*>(name.data()), name.size());
+    }
+
+    uint32_t string_hash(const uint8_t* contents, uint64_t length)
+    {
+        // FNV-1a.
+        uint32_t hash = 0x811c9dc5;
+        for (uint64_t i = 0; i < length; i++) {
+            hash = (hash ^ contents[i]) * 0x01000193;
+        }
+        return hash;
+    }
+
+    uint32_t string_hash(String* s)
+    {
+        return string_hash(s->contents(), s->length);
+    }
+
     bool string_eq(String* a, String* b)
     {
-        // TODO: store hashes?
+        // Cheap check first; this is what equal interned strings (see intern()) come down to.
+        if (a == b) {
+            return true;
+        }
         if (a->length != b->length) {
             return false;
         }
@@ -556,6 +1017,7 @@ namespace Katsu
                 Assoc* o = value.obj_assoc();
                 std::cout << "*assoc: length=" << o->length << "\n";
                 pchild(o->v_array, "v_array = ");
+                pchild(o->v_index, "v_index = ");
             } else if (value.is_obj_string()) {
                 String* o = value.obj_string();
                 std::cout << "*string: \"";
@@ -576,49 +1038,44 @@ namespace Katsu
                 // TODO: better error handling in case of any nonexpected values.
                 pnative() << "bytecode:\n";
                 Array* args = o->v_args.obj_array();
-                for (uint32_t inst_spot = 0; inst_spot < o->v_insts.obj_array()->length;
-                     inst_spot++) {
+                ByteArray* insts = o->v_insts.obj_byte_array();
+                for (uint32_t inst_spot = 0; inst_spot < num_insts(insts); inst_spot++) {
                     pnative() << "[" << inst_spot << "]: ";
-                    int64_t inst = o->v_insts.obj_array()->components()[inst_spot].fixnum();
-                    OpCode op = static_cast<OpCode>((uint32_t)inst & 0xFF);
-                    uint32_t arg_spot = (uint32_t)inst >> 8;
+                    uint32_t inst = read_inst(insts, inst_spot);
+                    OpCode op = inst_opcode(inst);
+                    uint32_t operand = inst_operand(inst);
                     switch (op) {
                         case LOAD_REG: {
-                            std::cout << "load_reg @" << args->components()[arg_spot++].fixnum()
-                                      << "\n";
+                            std::cout << "load_reg @" << operand << "\n";
                             break;
                         }
                         case STORE_REG: {
-                            std::cout << "store_reg @" << args->components()[arg_spot++].fixnum()
-                                      << "\n";
+                            std::cout << "store_reg @" << operand << "\n";
                             break;
                         }
                         case LOAD_REF: {
-                            std::cout << "load_ref @" << args->components()[arg_spot++].fixnum()
-                                      << "\n";
+                            std::cout << "load_ref @" << operand << "\n";
                             break;
                         }
                         case STORE_REF: {
-                            std::cout << "store_ref @" << args->components()[arg_spot++].fixnum()
-                                      << "\n";
+                            std::cout << "store_ref @" << operand << "\n";
                             break;
                         }
                         case LOAD_VALUE: {
                             std::cout << "load_value: ";
-                            pchild(args->components()[arg_spot++],
+                            pchild(args->components()[operand],
                                    "",
                                    /* initial_indent */ false,
                                    /* extra_depth */ +1);
                             break;
                         }
                         case INIT_REF: {
-                            std::cout << "init_ref @" << args->components()[arg_spot++].fixnum()
-                                      << "\n";
+                            std::cout << "init_ref @" << operand << "\n";
                             break;
                         }
                         case LOAD_MODULE: {
                             std::cout << "load_module ";
-                            pchild(args->components()[arg_spot++],
+                            pchild(args->components()[operand],
                                    "",
                                    /* initial_indent */ false,
                                    /* extra_depth */ +1);
@@ -626,7 +1083,7 @@ namespace Katsu
                         }
                         case STORE_MODULE: {
                             std::cout << "store_module ";
-                            pchild(args->components()[arg_spot++],
+                            pchild(args->components()[operand],
                                    "",
                                    /* initial_indent */ false,
                                    /* extra_depth */ +1);
@@ -635,12 +1092,11 @@ namespace Katsu
                         case INVOKE:
                         case INVOKE_TAIL: {
                             std::cout << "invoke" << (op == INVOKE ? "" : "-tail") << " #"
-                                      << args->components()[arg_spot + 1].fixnum() << " ";
-                            pchild(args->components()[arg_spot].obj_multimethod()->v_name,
+                                      << args->components()[operand + 1].fixnum() << " ";
+                            pchild(args->components()[operand].obj_multimethod()->v_name,
                                    "",
                                    /* initial_indent */ false,
                                    /* extra_depth */ +1);
-                            arg_spot += 2;
                             break;
                         }
                         case DROP: {
@@ -648,31 +1104,27 @@ namespace Katsu
                             break;
                         }
                         case MAKE_TUPLE: {
-                            std::cout << "make-tuple #" << args->components()[arg_spot++].fixnum()
-                                      << "\n";
+                            std::cout << "make-tuple #" << operand << "\n";
                             break;
                         }
                         case MAKE_ARRAY: {
-                            std::cout << "make-array #" << args->components()[arg_spot++].fixnum()
-                                      << "\n";
+                            std::cout << "make-array #" << operand << "\n";
                             break;
                         }
                         case MAKE_VECTOR: {
-                            std::cout << "make-vector #" << args->components()[arg_spot++].fixnum()
-                                      << "\n";
+                            std::cout << "make-vector #" << operand << "\n";
                             break;
                         }
                         case MAKE_CLOSURE: {
                             std::cout << "make-closure: ";
-                            pchild(args->components()[arg_spot++],
+                            pchild(args->components()[operand],
                                    "",
                                    /* initial_indent */ false,
                                    /* extra_depth */ +1);
                             break;
                         }
                         case MAKE_INSTANCE: {
-                            std::cout << "make-instance #"
-                                      << args->components()[arg_spot++].fixnum() << "\n";
+                            std::cout << "make-instance #" << operand << "\n";
                             break;
                         }
                         case VERIFY_IS_TYPE: {
@@ -680,13 +1132,75 @@ namespace Katsu
                             break;
                         }
                         case GET_SLOT: {
-                            std::cout << "get-slot $" << args->components()[arg_spot++].fixnum()
-                                      << "\n";
+                            std::cout << "get-slot $" << operand << "\n";
                             break;
                         }
                         case SET_SLOT: {
-                            std::cout << "set-slot $" << args->components()[arg_spot++].fixnum()
-                                      << "\n";
+                            std::cout << "set-slot $" << operand << "\n";
+                            break;
+                        }
+                        case STORE_REG_KEEP: {
+                            std::cout << "store_reg_keep @" << operand << "\n";
+                            break;
+                        }
+                        case LOAD_REG_GET_SLOT: {
+                            std::cout << "load_reg_get_slot @" << fused_reg(operand) << " $"
+                                      << fused_slot(operand) << "\n";
+                            break;
+                        }
+                        case LOAD_VALUE_INVOKE:
+                        case LOAD_VALUE_INVOKE_TAIL: {
+                            std::cout << "load_value_invoke"
+                                      << (op == LOAD_VALUE_INVOKE ? "" : "-tail") << " #"
+                                      << args->components()[operand + 2].fixnum() << " ";
+                            pchild(args->components()[operand + 1].obj_multimethod()->v_name,
+                                   "",
+                                   /* initial_indent */ false,
+                                   /* extra_depth */ +1);
+                            pchild(args->components()[operand],
+                                   "value = ",
+                                   /* initial_indent */ true,
+                                   /* extra_depth */ +2);
+                            break;
+                        }
+                        case FIXNUM_ADD: {
+                            std::cout << "fixnum_add\n";
+                            break;
+                        }
+                        case FIXNUM_SUB: {
+                            std::cout << "fixnum_sub\n";
+                            break;
+                        }
+                        case FIXNUM_MUL: {
+                            std::cout << "fixnum_mul\n";
+                            break;
+                        }
+                        case FIXNUM_LT: {
+                            std::cout << "fixnum_lt\n";
+                            break;
+                        }
+                        case FIXNUM_LTE: {
+                            std::cout << "fixnum_lte\n";
+                            break;
+                        }
+                        case FIXNUM_GT: {
+                            std::cout << "fixnum_gt\n";
+                            break;
+                        }
+                        case FIXNUM_GTE: {
+                            std::cout << "fixnum_gte\n";
+                            break;
+                        }
+                        case FIXNUM_EQ: {
+                            std::cout << "fixnum_eq\n";
+                            break;
+                        }
+                        case FIXNUM_NE: {
+                            std::cout << "fixnum_ne\n";
+                            break;
+                        }
+                        case INIT_REG: {
+                            std::cout << "init_reg @" << operand << "\n";
                             break;
                         }
                         default: {
@@ -734,6 +1248,7 @@ namespace Katsu
                     default: std::cout << "??? (raw=" << static_cast<int>(o->kind) << ")\n"; break;
                 }
                 pchild(o->v_slots, "v_slots = ");
+                pnative() << "type_id = " << o->type_id << "\n";
             } else if (value.is_obj_instance()) {
                 DataclassInstance* o = value.obj_instance();
                 std::cout << "*instance\n";
@@ -747,6 +1262,22 @@ namespace Katsu
                 ByteArray* o = value.obj_byte_array();
                 std::cout << "*byte-array: length=" << o->length << "\n";
                 // TODO: print contents?
+            } else if (value.is_obj_deque()) {
+                Deque* o = value.obj_deque();
+                std::cout << "*deque: length=" << o->length << ", head=" << o->head << " [\n";
+                pchild(o->v_array, "v_array = ");
+                indent(depth);
+                std::cout << "]\n";
+            } else if (value.is_obj_identity_set()) {
+                IdentitySet* o = value.obj_identity_set();
+                std::cout << "*identity-set: count=" << o->count << " [\n";
+                pchild(o->v_table, "v_table = ");
+                indent(depth);
+                std::cout << "]\n";
+            } else if (value.is_obj_f64_array()) {
+                std::cout << "*f64-array: length=" << value.obj_f64_array()->length << "\n";
+            } else if (value.is_obj_i64_array()) {
+                std::cout << "*i64-array: length=" << value.obj_i64_array()->length << "\n";
             } else {
                 std::cout << "object: ??? (object tag = " << static_cast<int>(value.object()->tag())
                           << ")\n";
@@ -957,7 +1488,7 @@ namespace Katsu
                                         num_total_slots));
 
         Root<Array> r_linearization(gc, c3_linearization(gc, r_type));
-        r_type->v_linearization = r_linearization.value();
+        set_linearization(gc, r_type, r_linearization);
 
         uint32_t linearization_length = r_linearization->length;
         // Ensure r_type is in the subtypes of each type in the linearization.
@@ -985,6 +1516,66 @@ namespace Katsu
         Root<Vector> r_methods(gc, r_multimethod->v_methods.obj_vector());
         ValueRoot rv_method(gc, r_method.value());
         append(gc, r_methods, rv_method);
+        // Invalidate any call-site inline caches which refer to this multimethod.
+        r_multimethod->version++;
+        rebuild_dispatch_table(gc, r_multimethod);
+    }
+
+    void rebuild_dispatch_table(GC& gc, Root<MultiMethod>& r_multimethod)
+    {
+        uint32_t num_params = r_multimethod->num_params;
+
+        Root<Array> r_typed_params(gc, make_array(gc, num_params));
+        // Null unless some method has value matchers.
+        ValueRoot rv_value_methods(gc, Value::null());
+        for (uint32_t i = 0; i < num_params; i++) {
+            r_typed_params->components()[i] = Value::_bool(false);
+        }
+
+        uint64_t num_methods = r_multimethod->v_methods.obj_vector()->length;
+        for (uint64_t i = 0; i < num_methods; i++) {
+            // Re-acquire the method each iteration, since append() may collect.
+            Value v_method =
+                r_multimethod->v_methods.obj_vector()->v_array.obj_array()->components()[i];
+            Array* matchers = v_method.obj_method()->v_param_matchers.obj_array();
+            bool has_value_matcher = false;
+            for (uint32_t j = 0; j < num_params; j++) {
+                Value matcher = matchers->components()[j];
+                if (matcher.is_obj_ref()) {
+                    has_value_matcher = true;
+                } else if (matcher.is_obj_type()) {
+                    r_typed_params->components()[j] = Value::_bool(true);
+                }
+            }
+            if (has_value_matcher) {
+                ValueRoot r_method(gc, std::move(v_method));
+                if (rv_value_methods->is_null()) {
+                    *rv_value_methods = Value::object(make_vector(gc, 1));
+                }
+                Root<Vector> r_value_methods(gc, rv_value_methods->obj_vector());
+                append(gc, r_value_methods, r_method);
+                *rv_value_methods = r_value_methods.value();
+            }
+        }
+
+        // Multimethods with just one method (of which there are many) gain little from a table.
+        // Otherwise, leave plenty of room for distinct argument-type combinations; the table never
+        // grows, and dispatch just skips using it once it fills up.
+        Value v_table = Value::null();
+        if (num_methods > 1) {
+            uint64_t num_entries = 8;
+            while (num_entries < 4 * num_methods && num_entries < 1024) {
+                num_entries *= 2;
+            }
+            v_table = Value::object(make_array(gc, num_entries * (1 + (uint64_t)num_params)));
+        }
+
+        r_multimethod->v_value_methods = *rv_value_methods;
+        r_multimethod->v_typed_params = r_typed_params.value();
+        r_multimethod->v_dispatch_table = v_table;
+        gc.write_barrier(*r_multimethod);
+        // (The new table is empty, so is valid for any version.)
+        r_multimethod->dispatch_table_version = 0;
     }
 
     Value* begin(Array* array)
@@ -1048,6 +1639,10 @@ namespace Katsu
                     case ObjectTag::CALL_SEGMENT: return vm.builtin(BuiltinId::_CallSegment);
                     case ObjectTag::FOREIGN: return vm.builtin(BuiltinId::_Foreign);
                     case ObjectTag::BYTE_ARRAY: return vm.builtin(BuiltinId::_ByteArray);
+                    case ObjectTag::DEQUE: return vm.builtin(BuiltinId::_Deque);
+                    case ObjectTag::IDENTITY_SET: return vm.builtin(BuiltinId::_IdentitySet);
+                    case ObjectTag::F64_ARRAY: return vm.builtin(BuiltinId::_F64Array);
+                    case ObjectTag::I64_ARRAY: return vm.builtin(BuiltinId::_I64Array);
                     default: ASSERT_MSG(false, "forgot an ObjectTag?");
                 }
             }
@@ -1057,22 +1652,11 @@ namespace Katsu
 
     bool is_subtype(Type* a, Type* b)
     {
-        ASSERT(a->v_linearization.is_obj_array());
-        // ASSERT(b->v_linearization.is_obj_array());
-        Array* lin_a = a->v_linearization.obj_array();
-        // Array* lin_b = b->v_linearization.obj_array();
-        // This trick totally doesn't work. TODO: is there a similarly optimized trick that does
-        // work?
-        // // Neat, eh?
-        // return lin_a->length >= lin_b->length &&
-        //        lin_a->components()[lin_a->length - lin_b->length] == lin_b->components()[0];
-        Value v_b = Value::object(b);
-        for (Value v_supertype : lin_a) {
-            if (v_supertype == v_b) {
-                return true;
-            }
-        }
-        return false;
+        ASSERT(a->v_ancestors.is_obj_byte_array());
+        ByteArray* ancestors = a->v_ancestors.obj_byte_array();
+        uint32_t type_id = b->type_id;
+        return type_id / 8 < ancestors->length &&
+               (ancestors->contents()[type_id / 8] & (1 << (type_id % 8))) != 0;
     }
 
     bool is_instance(VM& vm, Value value, Type* type)
@@ -1080,14 +1664,37 @@ namespace Katsu
         return is_subtype(type_of(vm, value).obj_type(), type);
     }
 
+    String* intern(VM& vm, const std::string& name)
+    {
+        Value* existing = assoc_lookup(vm.v_symbols.obj_assoc(), name);
+        if (existing) {
+            return existing->obj_string();
+        }
+        ValueRoot r_name(vm.gc, Value::object(make_string(vm.gc, name)));
+        Root<Assoc> r_symbols(vm.gc, vm.v_symbols.obj_assoc());
+        append(vm.gc, r_symbols, r_name, r_name);
+        return r_name->obj_string();
+    }
+
+    String* intern(VM& vm, Root<String>& r_name)
+    {
+        Value* existing = assoc_lookup(vm.v_symbols.obj_assoc(), *r_name);
+        if (existing) {
+            return existing->obj_string();
+        }
+        ValueRoot rv_name(vm.gc, r_name.value());
+        Root<Assoc> r_symbols(vm.gc, vm.v_symbols.obj_assoc());
+        append(vm.gc, r_symbols, rv_name, rv_name);
+        return *r_name;
+    }
+
     void use_default_imports(VM& vm, Root<Vector>& r_imports)
     {
         // Keep this in sync with *default-imports* in core.
 
         // Always use core.builtin.default.
         {
-            String* name = make_string(vm.gc, "core.builtin.default");
-            Value* maybe_module = assoc_lookup(vm.v_modules.obj_assoc(), name);
+            Value* maybe_module = assoc_lookup(vm.v_modules.obj_assoc(), "core.builtin.default");
             ASSERT(maybe_module);
             Value module = *maybe_module;
             ValueRoot r_module_default(vm.gc, std::move(module));
@@ -4,6 +4,7 @@
 #include "value.h"
 
 #include <optional>
+#include <string_view>
 
 namespace Katsu
 {
@@ -31,13 +32,14 @@ namespace Katsu
     // Make an Assoc with the given capacity (and zero length).
     Assoc* make_assoc(GC& gc, uint64_t capacity);
     // Make a String with contents copied from a source string.
-    String* make_string(GC& gc, const std::string& src);
+    String* make_string(GC& gc, std::string_view src);
     // Make a String of the given length, with contents uninitialized.
     String* make_string_nofill(GC& gc, uint64_t length);
     // Make a Code with specified fields.
     Code* make_code(GC& gc, Root<Assoc>& r_module, uint32_t num_params, uint32_t num_regs,
-                    uint32_t num_data, OptionalRoot<Array>& r_upreg_map, Root<Array>& r_insts,
-                    Root<Array>& r_args, Root<Tuple>& r_span, Root<Array>& r_inst_spans);
+                    uint32_t num_data, OptionalRoot<Array>& r_upreg_map,
+                    Root<ByteArray>& r_insts, Root<Array>& r_args, Root<Tuple>& r_span,
+                    Root<Array>& r_inst_spans);
     // Make a Closure with specified fields.
     Closure* make_closure(GC& gc, Root<Code>& r_code, Root<Array>& r_upregs);
     // Make a Method with specified fields.
@@ -45,6 +47,10 @@ namespace Katsu
     Method* make_method(GC& gc, Root<Array>& r_param_matchers, OptionalRoot<Type>& r_return_type,
                         OptionalRoot<Code>& r_code, Root<Vector>& r_attributes,
                         NativeHandler native_handler, IntrinsicHandler intrinsic_handler);
+    // Make a Method whose code is a stub, to be compiled on first invocation (see LazyMethodBody).
+    Method* make_lazy_method(GC& gc, Root<Array>& r_param_matchers,
+                             OptionalRoot<Type>& r_return_type, Root<Tuple>& r_stub,
+                             Root<Vector>& r_attributes);
     // Make a MultiMethod with specified fields.
     MultiMethod* make_multimethod(GC& gc, Root<String>& r_name, uint32_t num_params,
                                   Root<Vector>& r_methods, Root<Vector>& r_attributes);
@@ -53,13 +59,16 @@ namespace Katsu
     Type* make_type_raw(GC& gc, Root<String>& r_name, Root<Array>& r_bases, bool sealed,
                         Root<Array>& r_linearization, Root<Vector>& r_subtypes, Type::Kind kind,
                         OptionalRoot<Array>& r_slots, std::optional<uint32_t> num_total_slots);
+    // Make a Type::v_ancestors bitset for the Types in a linearization.
+    ByteArray* make_ancestor_set(GC& gc, Root<Array>& r_linearization);
+    // Replace a Type's linearization, updating its ancestor set to match.
+    void set_linearization(GC& gc, Root<Type>& r_type, Root<Array>& r_linearization);
     // Make a DataclassInstance with specified dataclass, with slots uninitialized.
     DataclassInstance* make_instance_nofill(GC& gc, Root<Type>& r_type);
 
-    struct Frame;
-    // Make a CallSegment with the specified lowest frame and total length (in bytes) of all frames
-    // in the segment.
-    CallSegment* make_call_segment(GC& gc, Frame* segment_bottom, uint64_t total_length);
+    // Make an empty, ON_STACK CallSegment with room for `capacity` bytes of frames. The segment is
+    // pinned (see GC::alloc_pinned()), and making it never collects.
+    CallSegment* make_call_segment(GC& gc, uint64_t capacity);
 
     // Make a foreign value with the specified field.
     ForeignValue* make_foreign(GC& gc, void* value);
@@ -68,7 +77,18 @@ namespace Katsu
     ByteArray* make_byte_array(GC& gc, uint64_t length);
     // Make a ByteArray of the given length, with contents uninitialized.
     ByteArray* make_byte_array_nofill(GC& gc, uint64_t length);
-
+    // Make a ByteArray of the given length, filled with zeros, which the GC never moves (see
+    // GC::alloc_pinned()). Its contents may be handed to foreign code across allocations.
+    ByteArray* make_pinned_byte_array(GC& gc, uint64_t length);
+    // Make an F64Array / I64Array of the given length, filled with zeros.
+    F64Array* make_f64_array(GC& gc, uint64_t length);
+    I64Array* make_i64_array(GC& gc, uint64_t length);
+
+    // Ensure a vector has room for at least `capacity` components without reallocating,
+    // null-filling any new room. Returns the (possibly moved) Vector, as append() does.
+    Vector* vector_reserve(GC& gc, Root<Vector>& r_vector, uint64_t capacity);
+    // Lengthen a vector by `count` null components, returning the (possibly moved) Vector.
+    Vector* vector_grow_by(GC& gc, Root<Vector>& r_vector, uint64_t count);
     // Append a value to a vector, reallocating if necessary to expand the vector.
     // For convenience, this returns a pointer to the resulting Vector (which may have been moved
     // due to reallocation).
@@ -80,10 +100,38 @@ namespace Katsu
 
     Array* vector_to_array(GC& gc, Root<Vector>& r_vector);
 
-    // Looks up an assoc entry by name. Returns a pointer into the relevant Assoc::Entry value, or
-    // nullptr if not found.
+    // Make an empty Deque with the given capacity (filling the backing array with nulls).
+    Deque* make_deque(GC& gc, uint64_t capacity);
+    // Add a value at either end of a deque, reallocating if necessary to expand the deque.
+    // For convenience, these return a pointer to the resulting Deque (which may have been moved
+    // due to reallocation).
+    Deque* deque_push_back(GC& gc, Root<Deque>& r_deque, ValueRoot& r_value);
+    Deque* deque_push_front(GC& gc, Root<Deque>& r_deque, ValueRoot& r_value);
+    // Remove and return the value at either end of a (nonempty) deque. Doesn't allocate!
+    Value deque_pop_front(Deque* deque);
+    Value deque_pop_back(Deque* deque);
+    // Get the value at some index (counting from the front) of a deque. Doesn't allocate!
+    Value deque_at(Deque* deque, uint64_t index);
+
+    // Make an empty IdentitySet with room for at least `capacity` values before growing.
+    IdentitySet* make_identity_set(GC& gc, uint64_t capacity);
+    // Add a (non-null) value to an identity set, reallocating if necessary to expand the set.
+    // Returns whether the value was newly added.
+    bool identity_set_add(GC& gc, Root<IdentitySet>& r_set, ValueRoot& r_value);
+    // Remove a value from an identity set. Returns whether it was there. Doesn't allocate!
+    bool identity_set_remove(GC& gc, IdentitySet* set, Value value);
+    // Determine if an identity set contains a value. Doesn't allocate!
+    bool identity_set_contains(GC& gc, IdentitySet* set, Value value);
+
+    // Looks up an assoc entry by name (using the assoc's index, if it has one). Returns a pointer
+    // into the relevant Assoc::Entry value, or nullptr if not found.
     Value* assoc_lookup(Assoc* assoc, String* name);
+    // Same, but doesn't need the name in a String.
+    Value* assoc_lookup(Assoc* assoc, const std::string& name);
 
+    // Hash a String's contents. Doesn't allocate!
+    uint32_t string_hash(String* s);
+    uint32_t string_hash(const uint8_t* contents, uint64_t length);
     // Determine if two Strings are equal, i.e. have the same contents.
     bool string_eq(String* a, String* b);
     // Determine if a String and string are equal, i.e. have the same contents.
@@ -141,6 +189,10 @@ namespace Katsu
     void add_method(GC& gc, Root<MultiMethod>& r_multimethod, Root<Method>& r_method,
                     bool require_unique);
 
+    // Recalculate a multimethod's dispatch acceleration (v_value_methods, v_typed_params, and an
+    // empty v_dispatch_table) from its current methods.
+    void rebuild_dispatch_table(GC& gc, Root<MultiMethod>& r_multimethod);
+
     // Iterators for arrays / vectors. These are invalidated by any GC collection!
     // ===========================================================================
     Value* begin(Array* array);
@@ -159,9 +211,16 @@ namespace Katsu
     class VM;
     // Doesn't allocate!
     Value type_of(VM& vm, Value value);
+    // Doesn't allocate! Constant-time (see Type::v_ancestors).
     bool is_subtype(Type* a, Type* b);
     // Doesn't allocate!
     bool is_instance(VM& vm, Value value, Type* type);
 
+    // Get the VM's canonical String with the given contents (see VM::v_symbols), adding it to the
+    // symbol table if needed. Equal names interned by the same VM are then the same object.
+    String* intern(VM& vm, const std::string& name);
+    // Same, but adds the given String itself if it's new, so it must not be modified afterwards.
+    String* intern(VM& vm, Root<String>& r_name);
+
     void use_default_imports(VM& vm, Root<Vector>& r_imports);
 };
\ No newline at end of file
@@ -48,6 +48,37 @@ TEST_CASE("vector append", "[value-utils]")
     CHECK(r_vector->v_array.obj_array()->components()[3] == Value::null());
 }
 
+TEST_CASE("vector reserve and grow", "[value-utils]")
+{
+    GC gc(1024 * 1024);
+
+    ValueRoot r_value(gc, Value::object(make_string(gc, "value")));
+    Root<Vector> r_vector(gc, make_vector(gc, /* capacity */ 2));
+    append(gc, r_vector, r_value);
+
+    // Already enough room.
+    vector_reserve(gc, r_vector, 2);
+    CHECK(r_vector->capacity() == 2);
+
+    // At least doubles...
+    vector_reserve(gc, r_vector, 3);
+    CHECK(r_vector->capacity() == 4);
+    // ... or grows straight to the requested capacity.
+    vector_reserve(gc, r_vector, 100);
+    CHECK(r_vector->capacity() == 100);
+    CHECK(r_vector->length == 1);
+    CHECK(r_vector->v_array.obj_array()->components()[0] == *r_value);
+    CHECK(r_vector->v_array.obj_array()->components()[99] == Value::null());
+
+    vector_grow_by(gc, r_vector, 200);
+    CHECK(r_vector->capacity() == 201);
+    CHECK(r_vector->length == 201);
+    CHECK(r_vector->v_array.obj_array()->components()[0] == *r_value);
+    for (uint64_t i = 1; i < 201; i++) {
+        CHECK(r_vector->v_array.obj_array()->components()[i] == Value::null());
+    }
+}
+
 TEST_CASE("assoc append", "[value-utils]")
 {
     GC gc(1024 * 1024);
@@ -65,6 +96,156 @@ TEST_CASE("assoc append", "[value-utils]")
     CHECK(*lookup == *r_value);
 }
 
+TEST_CASE("assoc index", "[value-utils]")
+{
+    GC gc(1024 * 1024);
+
+    const int NUM_KEYS = 100;
+    Root<Assoc> r_assoc(gc, make_assoc(gc, /* capacity */ 0));
+    for (int i = 0; i < NUM_KEYS; i++) {
+        ValueRoot rv_key(gc, Value::object(make_string(gc, "key " + std::to_string(i))));
+        ValueRoot r_value(gc, Value::fixnum(i));
+        append(gc, r_assoc, rv_key, r_value);
+    }
+    // Later entries with the same key are shadowed by the first.
+    {
+        ValueRoot rv_key(gc, Value::object(make_string(gc, "key 7")));
+        ValueRoot r_value(gc, Value::fixnum(-1));
+        append(gc, r_assoc, rv_key, r_value);
+    }
+    REQUIRE(r_assoc->v_index.is_obj_byte_array());
+
+    auto check_lookups = [&]() {
+        for (int i = 0; i < NUM_KEYS; i++) {
+            Root<String> r_key(gc, make_string(gc, "key " + std::to_string(i)));
+            Value* lookup = assoc_lookup(*r_assoc, *r_key);
+            REQUIRE(lookup != nullptr);
+            CHECK(*lookup == Value::fixnum(i));
+        }
+        Root<String> r_missing(gc, make_string(gc, "missing"));
+        CHECK(assoc_lookup(*r_assoc, *r_missing) == nullptr);
+    };
+    check_lookups();
+
+    // The index doesn't depend on where anything is in memory.
+    gc.collect();
+    check_lookups();
+
+    // Entries are still in insertion order.
+    REQUIRE(r_assoc->length == NUM_KEYS + 1);
+    CHECK(string_eq(r_assoc->entries()[0].v_key.obj_string(), "key 0"));
+    CHECK(string_eq(r_assoc->entries()[NUM_KEYS - 1].v_key.obj_string(), "key 99"));
+    CHECK(r_assoc->entries()[NUM_KEYS].v_value == Value::fixnum(-1));
+}
+
+TEST_CASE("deque push and pop", "[value-utils]")
+{
+    GC gc(1024 * 1024);
+
+    Root<Deque> r_deque(gc, make_deque(gc, /* capacity */ 0));
+    CHECK(r_deque->capacity() == 0);
+    CHECK(r_deque->length == 0);
+
+    // Wrap around the end of the backing array before growing it.
+    for (int i = 0; i < 3; i++) {
+        ValueRoot r_value(gc, Value::fixnum(i));
+        deque_push_back(gc, r_deque, r_value);
+    }
+    CHECK(deque_pop_front(*r_deque) == Value::fixnum(0));
+    {
+        ValueRoot r_value(gc, Value::fixnum(-1));
+        deque_push_front(gc, r_deque, r_value);
+    }
+    {
+        ValueRoot r_value(gc, Value::fixnum(3));
+        deque_push_back(gc, r_deque, r_value);
+    }
+    CHECK(r_deque->capacity() == 4);
+    {
+        ValueRoot r_value(gc, Value::fixnum(4));
+        deque_push_back(gc, r_deque, r_value);
+    }
+    CHECK(r_deque->capacity() == 8);
+    REQUIRE(r_deque->length == 5);
+    CHECK(deque_at(*r_deque, 0) == Value::fixnum(-1));
+    CHECK(deque_at(*r_deque, 1) == Value::fixnum(1));
+    CHECK(deque_at(*r_deque, 4) == Value::fixnum(4));
+
+    CHECK(deque_pop_back(*r_deque) == Value::fixnum(4));
+    CHECK(deque_pop_front(*r_deque) == Value::fixnum(-1));
+    CHECK(deque_pop_front(*r_deque) == Value::fixnum(1));
+    CHECK(deque_pop_back(*r_deque) == Value::fixnum(3));
+    CHECK(deque_pop_back(*r_deque) == Value::fixnum(2));
+    CHECK(r_deque->length == 0);
+    // Popped slots don't keep values alive.
+    Array* array = r_deque->v_array.obj_array();
+    for (uint64_t i = 0; i < array->length; i++) {
+        CHECK(array->components()[i] == Value::null());
+    }
+}
+
+TEST_CASE("identity set", "[value-utils]")
+{
+    GC gc(1024 * 1024);
+
+    const int NUM_VALUES = 100;
+    Root<IdentitySet> r_set(gc, make_identity_set(gc, /* capacity */ 0));
+    Root<Array> r_values(gc, make_array(gc, NUM_VALUES));
+    for (int i = 0; i < NUM_VALUES; i++) {
+        ValueRoot r_value(gc, Value::object(make_string(gc, "value " + std::to_string(i))));
+        r_values->components()[i] = *r_value;
+        CHECK(identity_set_add(gc, r_set, r_value));
+        CHECK_FALSE(identity_set_add(gc, r_set, r_value));
+    }
+    CHECK(r_set->count == NUM_VALUES);
+
+    // Equal contents aren't enough.
+    {
+        Root<String> r_other(gc, make_string(gc, "value 0"));
+        CHECK_FALSE(identity_set_contains(gc, *r_set, r_other.value()));
+    }
+
+    // Objects move, and the set follows.
+    gc.collect();
+    for (int i = 0; i < NUM_VALUES; i++) {
+        CHECK(identity_set_contains(gc, *r_set, r_values->components()[i]));
+    }
+
+    for (int i = 0; i < NUM_VALUES; i += 2) {
+        CHECK(identity_set_remove(gc, *r_set, r_values->components()[i]));
+        CHECK_FALSE(identity_set_remove(gc, *r_set, r_values->components()[i]));
+    }
+    CHECK(r_set->count == NUM_VALUES / 2);
+    for (int i = 0; i < NUM_VALUES; i++) {
+        CHECK(identity_set_contains(gc, *r_set, r_values->components()[i]) == (i % 2 == 1));
+    }
+}
+
+TEST_CASE("pinned byte array", "[value-utils]")
+{
+    GC gc(64 * 1024, 4 * 1024);
+
+    Root<ByteArray> r_pinned(gc, make_pinned_byte_array(gc, 16));
+    Root<ByteArray> r_moving(gc, make_byte_array(gc, 16));
+    ByteArray* pinned = *r_pinned;
+    ByteArray* moving = *r_moving;
+    CHECK(pinned->length == 16);
+    CHECK(pinned->is_large());
+    CHECK_FALSE(moving->is_large());
+    for (uint64_t i = 0; i < pinned->length; i++) {
+        CHECK(pinned->contents()[i] == 0);
+    }
+    pinned->contents()[3] = 42;
+
+    // Neither kind of collection moves it, unlike an ordinary byte array.
+    gc.collect_minor();
+    CHECK(*r_pinned == pinned);
+    CHECK(*r_moving != moving);
+    gc.collect();
+    CHECK(*r_pinned == pinned);
+    CHECK(pinned->contents()[3] == 42);
+}
+
 TEST_CASE("native_str", "[value-utils]")
 {
     GC gc(1024 * 1024);
@@ -363,6 +544,25 @@ TEST_CASE("c3 linearization", "[value-utils]")
             CHECK(L_A->components()[5] == F.value());
             CHECK(L_A->components()[6] == O.value());
         }
+
+        // Subtype checks agree with the linearization.
+        CHECK(is_subtype(*A, *A));
+        CHECK(is_subtype(*A, *B));
+        CHECK(is_subtype(*A, *F));
+        CHECK(is_subtype(*A, *O));
+        CHECK(is_subtype(*C, *F));
+        CHECK_FALSE(is_subtype(*C, *E));
+        CHECK_FALSE(is_subtype(*B, *C));
+        CHECK_FALSE(is_subtype(*O, *A));
+
+        // Replacing a linearization (as mixins do) updates subtype checks too.
+        Root<Array> L_E(gc, make_array(gc, 3));
+        L_E->components()[0] = E.value();
+        L_E->components()[1] = F.value();
+        L_E->components()[2] = O.value();
+        set_linearization(gc, E, L_E);
+        CHECK(is_subtype(*E, *F));
+        CHECK_FALSE(is_subtype(*E, *D));
     }
 
     SECTION("failed linearization")
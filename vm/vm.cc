@@ -1,7 +1,9 @@
 #include "vm.h"
 
 #include "assertions.h"
+#include "compile.h"
 #include "condition.h"
+#include "cpu_profiler.h"
 #include "value_utils.h"
 
 #include <algorithm>
@@ -23,16 +25,26 @@ namespace Katsu
             throw std::bad_alloc();
         }
         this->call_stack_size = call_stack_size;
+        this->update_top_region();
 
         this->current_frame = nullptr;
 
+        this->reached_heap_image_point = false;
+        this->lazy_method_compilation = false;
+        this->cpu_sample_due = 0;
+        this->type_hierarchy_version = 0;
+
         for (size_t i = 0; i < BuiltinId::NUM_BUILTINS; i++) {
             this->builtin_values[i] = Value::null();
         }
+        for (size_t i = 0; i < OpCode::NUM_OPCODES; i++) {
+            this->fast_path_handlers[i] = nullptr;
+        }
 
         // Don't use GC yet.
         this->v_modules = Value::null();
         this->v_multimethods = Value::null();
+        this->v_symbols = Value::null();
 
         this->v_condition_handler = Value::null();
 
@@ -41,6 +53,8 @@ namespace Katsu
         // Now we can use the GC.
         this->v_modules = Value::object(make_assoc(this->gc, 0));
         this->v_multimethods = Value::object(make_assoc(this->gc, 0));
+        // Bootstrapping alone interns many hundreds of names.
+        this->v_symbols = Value::object(make_assoc(this->gc, 256));
     }
 
     VM::~VM()
@@ -53,35 +67,36 @@ namespace Katsu
             std::find(this->gc.root_providers.begin(), this->gc.root_providers.end(), this));
     }
 
-    void VM::visit_roots(std::function<void(Value*)>& visitor)
+    void VM::trace_roots(Tracer& tracer)
     {
-        for (Value& builtin : this->builtin_values) {
-            visitor(&builtin);
-        }
-
-        visitor(&this->v_modules);
-        visitor(&this->v_multimethods);
-        visitor(&this->v_condition_handler);
-
-        Frame* frame = reinterpret_cast<Frame*>(this->call_stack_mem);
-        while (frame <= this->current_frame) {
-            visitor(&frame->v_code);
-            visitor(&frame->v_module);
-            visitor(&frame->v_marker);
-            visitor(&frame->v_dynamic);
-
-            for (uint32_t i = 0; i < frame->num_regs; i++) {
-                visitor(&frame->regs()[i]);
-            }
-
-            // Note that we don't need to go visit all the way to num_data.
-            // Only up to data_depth is guaranteed valid.
-            for (uint32_t i = 0; i < frame->data_depth; i++) {
-                visitor(&frame->data()[i]);
+        tracer.trace_range(this->builtin_values, BuiltinId::NUM_BUILTINS);
+
+        tracer.trace(&this->v_modules);
+        tracer.trace(&this->v_multimethods);
+        tracer.trace(&this->v_symbols);
+        tracer.trace(&this->v_condition_handler);
+        for (std::unique_ptr<LazyMethodBody>& body : this->lazy_method_bodies) {
+            if (body) {
+                tracer.trace(&body->v_stub);
             }
+        }
 
-            frame = frame->next();
+        tracer.trace_range(this->spare_segments.data(), this->spare_segments.size());
+        // Each region of the call stack holds frames up to the one just below the next region (or
+        // up to the current frame, for the top region), unless it's empty.
+        Frame* top = this->current_frame;
+        for (size_t i = this->segments.size(); i-- > 0;) {
+            StackSegment& s = this->segments[i];
+            tracer.trace(&s.v_segment);
+            CallSegment* segment = s.segment();
+            Frame* base = segment->frames();
+            bool empty = top < base || reinterpret_cast<uint8_t*>(top) >=
+                                           reinterpret_cast<uint8_t*>(base) + segment->capacity;
+            tracer.trace_frames(base, empty ? base : top->next());
+            top = s.below;
         }
+        tracer.trace_frames(reinterpret_cast<Frame*>(this->call_stack_mem),
+                            top ? top->next() : nullptr);
     }
 
     void VM::register_builtin(BuiltinId id, Value value)
@@ -91,12 +106,19 @@ namespace Katsu
         this->builtin_values[id] = value;
     }
 
+    void VM::register_fast_path(OpCode op, NativeHandler handler)
+    {
+        ASSERT(op >= OpCode::FIXNUM_ADD && op <= OpCode::FIXNUM_NE);
+        ASSERT(!this->fast_path_handlers[op]);
+        this->fast_path_handlers[op] = handler;
+    }
+
     Value VM::eval_toplevel(Root<Code>& r_code)
     {
         ASSERT_MSG(!this->current_frame,
                    "shouldn't already have a call frame if eval-ing at top level");
 
-        ASSERT_MSG(r_code->v_insts.obj_array()->length > 0, "code must not be empty");
+        ASSERT_MSG(num_insts(r_code->v_insts.obj_byte_array()) > 0, "code must not be empty");
 
         uint32_t code_num_regs = r_code->num_regs;
         uint32_t code_num_data = r_code->num_data;
@@ -107,37 +129,25 @@ namespace Katsu
                                          r_code->v_module,
                                          /* v_marker */ Value::null(),
                                          /* v_dynamic */ Value::null());
-        for (uint32_t i = 0; i < code_num_regs; i++) {
-            frame->regs()[i] = Value::null();
-        }
+        frame->init_regs(/* args */ nullptr, /* num_args */ 0);
         this->current_frame = frame;
 
-        while (true) {
-            if (this->verbose_logging) {
-                this->print_vm_state();
-            }
-
-            Code* frame_code = this->current_frame->v_code.obj_code();
-            Array* frame_insts = frame_code->v_insts.obj_array();
-            if (reinterpret_cast<uint8_t*>(this->current_frame) == this->call_stack_mem) {
-                // There is only a single frame in the call stack; check if we're done.
-                bool finished_instructions = this->current_frame->inst_spot == frame_insts->length;
-                if (finished_instructions) {
-                    ASSERT(this->current_frame->data_depth == 1);
-                    Value v_return_value = this->current_frame->data()[0];
-                    this->current_frame = nullptr;
-                    return v_return_value;
-                }
-            }
-            single_step();
+        if (this->verbose_logging) {
+            return this->run</* verbose */ true>();
+        } else {
+            return this->run</* verbose */ false>();
         }
     }
 
     void VM::print_vm_state()
     {
-        Frame* frame = reinterpret_cast<Frame*>(this->call_stack_mem);
+        std::vector<Frame*> frames;
+        for (Frame* frame = this->current_frame; frame; frame = frame->caller) {
+            frames.push_back(frame);
+        }
         std::cout << "=== CALL STACK (GROWING TOP TO BOTTOM) ===\n";
-        while (frame <= this->current_frame) {
+        for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+            Frame* frame = *it;
             std::cout << "--- CALL FRAME ---\n";
 
             std::cout << "v_code: ";
@@ -161,96 +171,230 @@ namespace Katsu
                 std::cout << "- " << i << " = ";
                 pprint(frame->data()[i], /* initial_indent */ false, /* depth */ 1);
             }
-
-            frame = frame->next();
         }
     }
 
-    inline void VM::single_step()
-    {
-        Code* frame_code = this->current_frame->v_code.obj_code();
-        Array* frame_insts = frame_code->v_insts.obj_array();
-        Array* frame_args = frame_code->v_args.obj_array();
+    // Defined below.
+    bool dispatches_to_handler(VM& vm, MultiMethod* multimethod, Value* args,
+                               NativeHandler handler);
 
-        uint64_t num_insts = frame_insts->length;
-        if (this->current_frame->inst_spot == num_insts) {
-            this->unwind_frame(/* tail_call */ false);
-            return;
+    // Compute a FIXNUM_* opcode's result inline. Returns false if the result isn't representable
+    // (so the caller should fall back to invoking the multimethod).
+    inline bool fixnum_fast_path(OpCode op, int64_t a, int64_t b, Value* result)
+    {
+        // Fixnums are narrower than int64_t, so only multiplication can overflow int64_t itself.
+        int64_t num;
+        switch (op) {
+            case OpCode::FIXNUM_ADD: num = a + b; break;
+            case OpCode::FIXNUM_SUB: num = a - b; break;
+            case OpCode::FIXNUM_MUL: {
+                if (__builtin_mul_overflow(a, b, &num)) {
+                    return false;
+                }
+                break;
+            }
+            case OpCode::FIXNUM_LT: *result = Value::_bool(a < b); return true;
+            case OpCode::FIXNUM_LTE: *result = Value::_bool(a <= b); return true;
+            case OpCode::FIXNUM_GT: *result = Value::_bool(a > b); return true;
+            case OpCode::FIXNUM_GTE: *result = Value::_bool(a >= b); return true;
+            case OpCode::FIXNUM_EQ: *result = Value::_bool(a == b); return true;
+            case OpCode::FIXNUM_NE: *result = Value::_bool(a != b); return true;
+            default: ALWAYS_ASSERT_MSG(false, "not a fixnum fast-path opcode");
         }
-
-        if (this->current_frame->inst_spot > num_insts) [[unlikely]] {
-            ASSERT_MSG(false, "shifted beyond instructions array in call frame");
+        if (num < FIXNUM_MIN || num > FIXNUM_MAX) {
+            return false;
         }
+        *result = Value::fixnum(num);
+        return true;
+    }
 
-        int64_t inst = frame_insts->components()[this->current_frame->inst_spot].fixnum();
-        ASSERT(0 <= inst && inst < UINT32_MAX);
-        OpCode op = static_cast<OpCode>((uint32_t)inst & 0xFF);
-        uint32_t arg_spot = (uint32_t)inst >> 8;
+    // Instruction dispatch. With VM_THREADED_DISPATCH, each handler jumps straight to the next
+    // instruction's handler through a table of label addresses ("direct threading"), which gives
+    // the branch predictor one indirect branch per handler rather than a single shared one.
+    // Otherwise, handlers are cases in a plain switch.
+#if VM_THREADED_DISPATCH
+#define CASE(name) op_##name
+#define DISPATCH()                        \
+    do {                                  \
+        FETCH();                          \
+        ASSERT(op < OpCode::NUM_OPCODES); \
+        goto* dispatch_labels[op];        \
+    } while (0)
+#else
+#define CASE(name) case OpCode::name
+#define DISPATCH() goto dispatch
+#endif
+
+    template <bool verbose> Value VM::run()
+    {
+#if VM_THREADED_DISPATCH
+        // Must match the order of OpCode.
+        static void* dispatch_labels[] = {
+            &&op_LOAD_REG,
+            &&op_STORE_REG,
+            &&op_LOAD_REF,
+            &&op_STORE_REF,
+            &&op_LOAD_VALUE,
+            &&op_INIT_REF,
+            &&op_LOAD_MODULE,
+            &&op_STORE_MODULE,
+            &&op_INVOKE,
+            &&op_INVOKE_TAIL,
+            &&op_DROP,
+            &&op_MAKE_TUPLE,
+            &&op_MAKE_ARRAY,
+            &&op_MAKE_VECTOR,
+            &&op_MAKE_CLOSURE,
+            &&op_MAKE_INSTANCE,
+            &&op_VERIFY_IS_TYPE,
+            &&op_GET_SLOT,
+            &&op_SET_SLOT,
+            &&op_STORE_REG_KEEP,
+            &&op_LOAD_REG_GET_SLOT,
+            &&op_LOAD_VALUE_INVOKE,
+            &&op_LOAD_VALUE_INVOKE_TAIL,
+            &&op_FIXNUM_ADD,
+            &&op_FIXNUM_SUB,
+            &&op_FIXNUM_MUL,
+            &&op_FIXNUM_LT,
+            &&op_FIXNUM_LTE,
+            &&op_FIXNUM_GT,
+            &&op_FIXNUM_GTE,
+            &&op_FIXNUM_EQ,
+            &&op_FIXNUM_NE,
+            &&op_INIT_REG,
+        };
+        static_assert(sizeof(dispatch_labels) / sizeof(dispatch_labels[0]) ==
+                      OpCode::NUM_OPCODES);
+#endif
 
-        auto shift_inst = [this]() -> void { this->current_frame->inst_spot++; };
-        auto arg = [frame_args, arg_spot](int offset = 0) -> Value {
-            ASSERT(arg_spot + offset >= 0 && arg_spot + offset < frame_args->length);
-            return frame_args->components()[arg_spot + offset];
+        // Interpreter state, cached from the current frame and its Code.
+        // - `insts` and `frame_args` point into the GC heap, so must be reloaded (RELOAD_CODE())
+        //   after anything that might allocate.
+        // - `frame` and `spot` must be reloaded (RELOAD_FRAME()) after anything that might change
+        //   the current frame, i.e. invoke() or unwind_frame().
+        // - `spot` is only written back to the frame (SAVE_SPOT()) when something else might look
+        //   at it: before invoke() / unwind_frame(), before raising an error, before allocating
+        //   (for the GC's allocation sampler), and for logging.
+        Frame* frame;
+        uint32_t spot;
+        ByteArray* insts;
+        uint64_t frame_num_insts;
+        Array* frame_args;
+
+        OpCode op;
+        // Either an immediate or an offset into frame_args, depending on the opcode.
+        uint32_t operand;
+
+        auto arg = [&](int offset = 0) -> Value {
+            ASSERT(operand + offset >= 0 && operand + offset < frame_args->length);
+            return frame_args->components()[operand + offset];
         };
 
+#define RELOAD_CODE()                                 \
+    do {                                              \
+        Code* frame_code = frame->v_code.obj_code();  \
+        insts = frame_code->v_insts.obj_byte_array(); \
+        frame_num_insts = num_insts(insts);           \
+        frame_args = frame_code->v_args.obj_array();  \
+    } while (0)
+#define RELOAD_FRAME()               \
+    do {                             \
+        frame = this->current_frame; \
+        spot = frame->inst_spot;     \
+        RELOAD_CODE();               \
+    } while (0)
+#define SAVE_SPOT() (frame->inst_spot = spot)
+#define FETCH()                                                                          \
+    do {                                                                                 \
+        if (spot == frame_num_insts) [[unlikely]] {                                      \
+            goto frame_finished;                                                         \
+        }                                                                                \
+        ASSERT_MSG(spot < frame_num_insts, "shifted beyond instructions in call frame"); \
+        if constexpr (verbose) {                                                         \
+            SAVE_SPOT();                                                                 \
+            this->print_vm_state();                                                      \
+        }                                                                                \
+        uint32_t fetched = read_inst(insts, spot);                                       \
+        op = inst_opcode(fetched);                                                       \
+        operand = inst_operand(fetched);                                                 \
+    } while (0)
+
+        // Note that a computed goto doesn't run destructors for the scopes it leaves, so handlers
+        // must not DISPATCH() while any Root is in scope.
+        RELOAD_FRAME();
+        DISPATCH();
+
+#if !VM_THREADED_DISPATCH
+    dispatch:
+        FETCH();
         switch (op) {
-            case OpCode::LOAD_REG: {
-                this->current_frame->push(this->current_frame->regs()[arg().fixnum()]);
-                shift_inst();
-                break;
+#endif
+            CASE(LOAD_REG): {
+                frame->push(frame->regs()[operand]);
+                spot++;
+                DISPATCH();
             }
-            case OpCode::STORE_REG: {
-                this->current_frame->regs()[arg().fixnum()] = this->current_frame->pop();
-                shift_inst();
-                break;
+            CASE(STORE_REG):
+            CASE(INIT_REG): {
+                frame->regs()[operand] = frame->pop();
+                spot++;
+                DISPATCH();
             }
-            case OpCode::LOAD_REF: {
-                this->current_frame->push(
-                    this->current_frame->regs()[arg().fixnum()].obj_ref()->v_ref);
-                shift_inst();
-                break;
+            CASE(LOAD_REF): {
+                frame->push(frame->regs()[operand].obj_ref()->v_ref);
+                spot++;
+                DISPATCH();
             }
-            case OpCode::STORE_REF: {
-                this->current_frame->regs()[arg().fixnum()].obj_ref()->v_ref =
-                    this->current_frame->pop();
-                shift_inst();
-                break;
+            CASE(STORE_REF): {
+                Ref* ref = frame->regs()[operand].obj_ref();
+                ref->v_ref = frame->pop();
+                this->gc.write_barrier(ref, ref->v_ref);
+                spot++;
+                DISPATCH();
             }
-            case OpCode::LOAD_VALUE: {
-                this->current_frame->push(arg());
-                shift_inst();
-                break;
+            CASE(LOAD_VALUE): {
+                frame->push(arg());
+                spot++;
+                DISPATCH();
             }
-            case OpCode::INIT_REF: {
-                // arg() is invalidated by any GC access, so acquire the local index ahead of time.
-                int64_t local_index = arg().fixnum();
-                ValueRoot r_ref(this->gc, this->current_frame->pop());
-                this->current_frame->regs()[local_index] = Value::object(make_ref(this->gc, r_ref));
-                shift_inst();
-                break;
+            CASE(INIT_REF): {
+                SAVE_SPOT();
+                {
+                    ValueRoot r_ref(this->gc, frame->pop());
+                    frame->regs()[operand] = Value::object(make_ref(this->gc, r_ref));
+                }
+                spot++;
+                RELOAD_CODE();
+                DISPATCH();
             }
-            case OpCode::LOAD_MODULE: {
-                this->current_frame->push(arg().obj_ref()->v_ref);
-                shift_inst();
-                break;
+            CASE(LOAD_MODULE): {
+                frame->push(arg().obj_ref()->v_ref);
+                spot++;
+                DISPATCH();
             }
-            case OpCode::STORE_MODULE: {
-                arg().obj_ref()->v_ref = this->current_frame->pop();
-                shift_inst();
-                break;
+            CASE(STORE_MODULE): {
+                Ref* ref = arg().obj_ref();
+                ref->v_ref = frame->pop();
+                this->gc.write_barrier(ref, ref->v_ref);
+                spot++;
+                DISPATCH();
             }
-            case OpCode::INVOKE:
-            case OpCode::INVOKE_TAIL: {
+            CASE(INVOKE):
+            CASE(INVOKE_TAIL): {
+            invoke:
+                SAVE_SPOT();
                 try {
                     Value v_method = arg(+0);
                     int64_t num_args = arg(+1).fixnum();
+                    Array* inline_cache = arg(+2).obj_array();
                     // TODO: check uint32_t
-                    Value* args = this->current_frame->pop_many(num_args);
+                    Value* args = frame->pop_many(num_args);
 
                     bool tail_call = op == OpCode::INVOKE_TAIL;
 
                     // invoke() takes care of shifting the instruction spot.
-                    this->invoke(v_method, tail_call, num_args, args);
+                    this->invoke(v_method, tail_call, num_args, args, inline_cache);
                 } catch (const condition_error& e) {
                     // TODO: pass extra info, e.g. compile_error has a span that would be good to
                     // provide.
@@ -264,140 +408,230 @@ namespace Katsu
                     Value args[2] = {r_condition_name.value(), r_message.value()};
                     this->invoke(*r_method, /* tail_call */ false, /* num_args */ 2, args);
                 }
-                break;
+                // The call may have pushed or popped frames, allocated, or both.
+                RELOAD_FRAME();
+                DISPATCH();
             }
-            case OpCode::DROP: {
-                this->current_frame->pop();
-                shift_inst();
-                break;
+            CASE(DROP): {
+                frame->pop();
+                spot++;
+                DISPATCH();
             }
-            case OpCode::MAKE_TUPLE: {
-                // arg() is invalidated by any GC access, so acquire num_components ahead of
-                // time.
-                auto num_components = arg().fixnum();
-                // TODO: check >= 0
+            CASE(MAKE_TUPLE): {
+                SAVE_SPOT();
+                int64_t num_components = operand;
                 Tuple* tuple = make_tuple_nofill(this->gc, num_components);
                 // TODO: check uint32_t
-                Value* components = this->current_frame->pop_many(num_components);
+                Value* components = frame->pop_many(num_components);
                 for (int64_t i = 0; i < num_components; i++) {
                     tuple->components()[i] = components[i];
                 }
-                this->current_frame->push(Value::object(tuple));
-                shift_inst();
-                break;
+                frame->push(Value::object(tuple));
+                spot++;
+                RELOAD_CODE();
+                DISPATCH();
             }
-            case OpCode::MAKE_ARRAY: {
-                // arg() is invalidated by any GC access, so acquire num_components ahead of
-                // time.
-                auto num_components = arg().fixnum();
-                // TODO: check >= 0
+            CASE(MAKE_ARRAY): {
+                SAVE_SPOT();
+                int64_t num_components = operand;
                 Array* array = make_array_nofill(this->gc, num_components);
                 // TODO: check uint32_t
-                Value* components = this->current_frame->pop_many(num_components);
+                Value* components = frame->pop_many(num_components);
                 for (int64_t i = 0; i < num_components; i++) {
                     array->components()[i] = components[i];
                 }
-                this->current_frame->push(Value::object(array));
-                shift_inst();
-                break;
+                frame->push(Value::object(array));
+                spot++;
+                RELOAD_CODE();
+                DISPATCH();
             }
-            case OpCode::MAKE_VECTOR: {
-                // arg() is invalidated by any GC access, so acquire num_components ahead of
-                // time.
-                auto num_components = arg().fixnum();
-                // TODO: check >= 0
+            CASE(MAKE_VECTOR): {
+                SAVE_SPOT();
+                int64_t num_components = operand;
                 Array* array = make_array_nofill(this->gc, num_components);
                 // TODO: check uint32_t
-                Value* components = this->current_frame->pop_many(num_components);
+                Value* components = frame->pop_many(num_components);
                 for (int64_t i = 0; i < num_components; i++) {
                     array->components()[i] = components[i];
                 }
                 Vector* vec = make_vector(this->gc, /* length */ num_components, array);
-                this->current_frame->push(Value::object(vec));
-                shift_inst();
-                break;
+                frame->push(Value::object(vec));
+                spot++;
+                RELOAD_CODE();
+                DISPATCH();
             }
-            case OpCode::MAKE_CLOSURE: {
-                // arg() is invalidated by any GC access, so acquire the closure's Code ahead of
-                // time.
-                Root<Code> r_code(this->gc, arg().obj_code());
-                uint64_t num_upregs = r_code->v_upreg_map.obj_array()->length;
-
-                Root<Array> r_upregs(this->gc,
-                                     make_array(this->gc, num_upregs)); // null-initialized
-                Closure* closure =
-                    make_closure(this->gc, /* r_code */ r_code, /* r_upregs */ r_upregs);
+            CASE(MAKE_CLOSURE): {
+                SAVE_SPOT();
+                {
+                    // arg() is invalidated by any GC access, so acquire the closure's Code ahead of
+                    // time.
+                    Root<Code> r_code(this->gc, arg().obj_code());
+                    uint64_t num_upregs = r_code->v_upreg_map.obj_array()->length;
+
+                    Root<Array> r_upregs(this->gc,
+                                         make_array(this->gc, num_upregs)); // null-initialized
+                    Closure* closure =
+                        make_closure(this->gc, /* r_code */ r_code, /* r_upregs */ r_upregs);
+
+                    // Copy from the current stack frame's data stack into the closure's upregs.
+                    // TODO: check uint32_t
+                    Value* upreg_vals = frame->pop_many(num_upregs);
+                    Array* upregs = *r_upregs;
+                    for (uint64_t i = 0; i < num_upregs; i++) {
+                        upregs->components()[i] = upreg_vals[i];
+                    }
 
-                // Copy from the current stack frame's data stack into the closure's upregs.
-                // TODO: check uint32_t
-                Value* upreg_vals = this->current_frame->pop_many(num_upregs);
-                Array* upregs = *r_upregs;
-                for (uint64_t i = 0; i < num_upregs; i++) {
-                    upregs->components()[i] = upreg_vals[i];
+                    frame->push(Value::object(closure));
                 }
-
-                this->current_frame->push(Value::object(closure));
-                shift_inst();
-                break;
+                spot++;
+                RELOAD_CODE();
+                DISPATCH();
             }
-            case OpCode::MAKE_INSTANCE: {
-                // arg() is invalidated by any GC access, so acquire num_slots ahead of time.
-                auto num_slots = arg().fixnum();
-                // TODO: check >= 0
-                // Peek instead of pop so we keep the values live.
-                Value* type_and_slots = this->current_frame->peek_many(1 + num_slots);
-                Root<Type> r_type(this->gc, type_and_slots[0].obj_type());
-                DataclassInstance* inst = make_instance_nofill(this->gc, r_type);
-                // Now we can pop, since there's no further allocation.
-                type_and_slots = this->current_frame->pop_many(1 + num_slots);
-                Value* slots = type_and_slots + 1;
-                for (int64_t i = 0; i < num_slots; i++) {
-                    inst->slots()[i] = slots[i];
+            CASE(MAKE_INSTANCE): {
+                SAVE_SPOT();
+                {
+                    int64_t num_slots = operand;
+                    // Peek instead of pop so we keep the values live.
+                    Value* type_and_slots = frame->peek_many(1 + num_slots);
+                    Root<Type> r_type(this->gc, type_and_slots[0].obj_type());
+                    DataclassInstance* inst = make_instance_nofill(this->gc, r_type);
+                    // Now we can pop, since there's no further allocation.
+                    type_and_slots = frame->pop_many(1 + num_slots);
+                    Value* slots = type_and_slots + 1;
+                    for (int64_t i = 0; i < num_slots; i++) {
+                        inst->slots()[i] = slots[i];
+                    }
+                    frame->push(Value::object(inst));
                 }
-                this->current_frame->push(Value::object(inst));
-                shift_inst();
-                break;
+                spot++;
+                RELOAD_CODE();
+                DISPATCH();
             }
-            case OpCode::VERIFY_IS_TYPE: {
-                Value value = this->current_frame->peek();
+            CASE(VERIFY_IS_TYPE): {
+                Value value = frame->peek();
                 if (!value.is_obj_type()) {
+                    SAVE_SPOT();
                     throw std::runtime_error("value must be a Type");
                 }
-                shift_inst();
-                break;
+                spot++;
+                DISPATCH();
             }
-            case OpCode::GET_SLOT: {
-                // arg() is invalidated by any GC access, so acquire slot_index ahead of time.
-                auto slot_index = arg().fixnum();
-                DataclassInstance* inst = this->current_frame->pop().obj_instance();
+            CASE(GET_SLOT): {
+                DataclassInstance* inst = frame->pop().obj_instance();
                 // TODO: check within bounds
-                this->current_frame->push(inst->slots()[slot_index]);
-                shift_inst();
-                break;
+                frame->push(inst->slots()[operand]);
+                spot++;
+                DISPATCH();
             }
-            case OpCode::SET_SLOT: {
-                // arg() is invalidated by any GC access, so acquire slot_index ahead of time.
-                auto slot_index = arg().fixnum();
-                Value value = this->current_frame->pop();
-                DataclassInstance* inst = this->current_frame->pop().obj_instance();
+            CASE(SET_SLOT): {
+                Value value = frame->pop();
+                DataclassInstance* inst = frame->pop().obj_instance();
                 // TODO: check within bounds
-                inst->slots()[slot_index] = value;
-                shift_inst();
-                break;
+                inst->slots()[operand] = value;
+                this->gc.write_barrier(inst, value);
+                spot++;
+                DISPATCH();
+            }
+            CASE(STORE_REG_KEEP): {
+                frame->regs()[operand] = frame->peek();
+                spot++;
+                DISPATCH();
             }
+            CASE(LOAD_REG_GET_SLOT): {
+                DataclassInstance* inst = frame->regs()[fused_reg(operand)].obj_instance();
+                // TODO: check within bounds
+                frame->push(inst->slots()[fused_slot(operand)]);
+                spot++;
+                DISPATCH();
+            }
+            CASE(LOAD_VALUE_INVOKE):
+            CASE(LOAD_VALUE_INVOKE_TAIL): {
+                frame->push(arg());
+                // The rest is just INVOKE, whose args directly follow the value.
+                operand++;
+                op = op == OpCode::LOAD_VALUE_INVOKE ? OpCode::INVOKE : OpCode::INVOKE_TAIL;
+                goto invoke;
+            }
+            CASE(FIXNUM_ADD):
+            CASE(FIXNUM_SUB):
+            CASE(FIXNUM_MUL):
+            CASE(FIXNUM_LT):
+            CASE(FIXNUM_LTE):
+            CASE(FIXNUM_GT):
+            CASE(FIXNUM_GTE):
+            CASE(FIXNUM_EQ):
+            CASE(FIXNUM_NE): {
+                // Guard for the INVOKE which directly follows, and whose args follow arg(+0).
+                // The state only records whether dispatch picks the native handler for fixnums in
+                // general, so (as with inline caches) can't stand in for methods with value
+                // matchers, which depend on the operands themselves.
+                Value* operands = frame->peek_many(2);
+                Value v_multimethod = arg(+1);
+                if (operands[0].is_fixnum() && operands[1].is_fixnum() &&
+                    v_multimethod.is_obj_multimethod() &&
+                    v_multimethod.obj_multimethod()->num_params == 2 &&
+                    v_multimethod.obj_multimethod()->v_value_methods.is_null()) {
+                    uint64_t version = this->dispatch_version(v_multimethod.obj_multimethod());
+                    Value v_applies = Value::fixnum(2 * version + 1);
+                    Value v_state = arg(+0);
+                    if (v_state != v_applies && v_state != Value::fixnum(2 * version)) {
+                        // Multimethod changed (or this is the first time here); check again.
+                        bool applies = dispatches_to_handler(*this,
+                                                             v_multimethod.obj_multimethod(),
+                                                             operands,
+                                                             this->fast_path_handlers[op]);
+                        v_state = Value::fixnum(2 * version + (applies ? 1 : 0));
+                        frame_args->components()[operand] = v_state;
+                    }
+                    Value result;
+                    if (v_state == v_applies &&
+                        fixnum_fast_path(op, operands[0].fixnum(), operands[1].fixnum(), &result)) {
+                        frame->pop_many(2);
+                        frame->push(result);
+                        // Skip the INVOKE, too.
+                        spot += 2;
+                        DISPATCH();
+                    }
+                }
+                spot++;
+                DISPATCH();
+            }
+#if !VM_THREADED_DISPATCH
             default: {
                 ALWAYS_ASSERT_MSG(false, "forgot an OpCode");
             }
         }
+#endif
+
+    frame_finished:
+        SAVE_SPOT();
+        if (reinterpret_cast<uint8_t*>(frame) == this->call_stack_mem) {
+            // This is the bottom frame in the call stack, so we're done.
+            ASSERT(frame->data_depth == 1);
+            Value v_return_value = frame->data()[0];
+            this->current_frame = nullptr;
+            return v_return_value;
+        }
+        this->unwind_frame(/* tail_call */ false);
+        RELOAD_FRAME();
+        DISPATCH();
+
+#undef FETCH
+#undef SAVE_SPOT
+#undef RELOAD_FRAME
+#undef RELOAD_CODE
     }
 
+#undef DISPATCH
+#undef CASE
+
     void VM::unwind_frame(bool tail_call)
     {
 #if DEBUG_ASSERTIONS
         Code* frame_code = this->current_frame->v_code.obj_code();
-        Array* frame_insts = frame_code->v_insts.obj_array();
+        ByteArray* frame_insts = frame_code->v_insts.obj_byte_array();
         // Make sure all instructions were used.
-        ASSERT(this->current_frame->inst_spot == frame_insts->length);
+        ASSERT(this->current_frame->inst_spot == num_insts(frame_insts));
 #endif
 
         // Unwind the frame!
@@ -416,6 +650,27 @@ namespace Katsu
             caller->push(this->current_frame->data()[0]);
         }
         this->current_frame = caller;
+        // Returning from the bottom frame of a segment leaves it empty. (A tail call leaves it to
+        // the next frame, instead.)
+        if (!tail_call && !this->in_top_region(caller)) [[unlikely]] {
+            this->pop_empty_segments();
+        }
+    }
+
+    Value* VM::unwind_frame_for_tail_call(Value* args, uint32_t num_args)
+    {
+        Frame* unwound = this->current_frame;
+        this->unwind_frame(/* tail_call */ true);
+        // The next frame will be allocated exactly where the unwound one was (even if that was the
+        // bottom of a segment, which stays on as an empty top region), so its regs() start just
+        // past the unwound frame's header. The arguments were above that point, in the unwound
+        // frame's data stack, so this is a move downward and can be done in place.
+        ASSERT(unwound == (this->in_top_region(this->current_frame) ? this->current_frame->next()
+                                                                    : this->region_base));
+        Value* dst = unwound->regs();
+        ASSERT(reinterpret_cast<uint8_t*>(dst + num_args) <= this->region_end);
+        std::memmove(dst, args, num_args * sizeof(Value));
+        return dst;
     }
 
     Value& VM::module_lookup_or_fail(Value v_module, String* name)
@@ -429,43 +684,22 @@ namespace Katsu
     Frame* VM::alloc_frame(uint32_t num_regs, uint32_t num_data, Value v_code, Value v_module,
                            Value v_marker, Value v_dynamic)
     {
-        Frame* frame = this->current_frame ? this->current_frame->next()
-                                           : reinterpret_cast<Frame*>(this->call_stack_mem);
         size_t frame_size = Frame::size(num_regs, num_data);
-        if (reinterpret_cast<uint8_t*>(frame) + frame_size >
-            this->call_stack_mem + this->call_stack_size) {
-
-            std::cerr << "Stack overflow:\n";
-            for (frame = OpenVM(*this).bottom_frame(); frame <= this->current_frame;
-                 frame = frame->next()) {
-                uint32_t inst_spot = frame->inst_spot;
-                if (frame < this->current_frame) {
-                    // Go back one instruction; each frame indicates where to _return_ to, and the
-                    // previous op is the caller.
-                    ASSERT(inst_spot > 0);
-                    inst_spot--;
+        Frame* frame;
+        if (!v_marker.is_null()) [[unlikely]] {
+            // Marked frames always start a segment (see `segments`).
+            frame = this->push_segment(frame_size);
+        } else {
+            frame = this->in_top_region(this->current_frame) ? this->current_frame->next()
+                                                             : this->region_base;
+            if (reinterpret_cast<uint8_t*>(frame) + frame_size > this->region_end) [[unlikely]] {
+                if (this->segments.empty()) {
+                    this->stack_overflow();
                 }
-
-                // See convert_span() in compile.cc.
-                Value* span = frame->v_code.obj_code()
-                                  ->v_inst_spans.obj_array()
-                                  ->components()[inst_spot]
-                                  .obj_tuple()
-                                  ->components();
-                // TODO: deduplicate with operator<< in main.cc.
-                std::cerr << "at <" << native_str(span[0].obj_string()) << ":"
-                          << span[2].fixnum() + 1 << ":" << span[3].fixnum() + 1 << "-"
-                          << span[5].fixnum() + 1 << "." << span[6].fixnum() + 1 << ">\n";
+                frame = this->push_segment(frame_size);
             }
-
-            std::cout.flush();
-            std::cerr.flush();
-            throw std::runtime_error("katsu stack overflow");
         }
 
-        // Help with debugging.
-        std::memset(frame, 0x56, frame_size);
-
         frame->caller = this->current_frame;
         frame->v_code = v_code;
         frame->inst_spot = 0;
@@ -475,19 +709,282 @@ namespace Katsu
         frame->v_module = v_module;
         frame->v_marker = v_marker;
         frame->v_dynamic = v_dynamic;
-        // regs() / data() is up to caller to initialize as desired.
+        frame->update_dynamic_frame();
+#if DEBUG_FRAME_FILL
+        // Help with debugging. Only fill data(), since for tail calls the caller may already have
+        // moved arguments into regs().
+        std::memset(frame->data(), 0x56, num_data * sizeof(Value));
+#endif
+        // regs() is up to caller to initialize as desired.
         return frame;
     }
 
-    Frame* VM::alloc_frames(uint64_t total_length)
+    void VM::stack_overflow()
+    {
+        std::vector<Frame*> frames;
+        for (Frame* frame = this->current_frame; frame; frame = frame->caller) {
+            frames.push_back(frame);
+        }
+
+        std::cerr << "Stack overflow:\n";
+        for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+            Frame* frame = *it;
+            uint32_t inst_spot = frame->inst_spot;
+            if (frame != this->current_frame) {
+                // Go back one instruction; each frame indicates where to _return_ to, and the
+                // previous op is the caller.
+                ASSERT(inst_spot > 0);
+                inst_spot--;
+            }
+
+            // See convert_span() in compile.cc.
+            Value* span = frame->v_code.obj_code()
+                              ->v_inst_spans.obj_array()
+                              ->components()[inst_spot]
+                              .obj_tuple()
+                              ->components();
+            // TODO: deduplicate with operator<< in main.cc.
+            std::cerr << "at <" << native_str(span[0].obj_string()) << ":"
+                      << span[2].fixnum() + 1 << ":" << span[3].fixnum() + 1 << "-"
+                      << span[5].fixnum() + 1 << "." << span[6].fixnum() + 1 << ">\n";
+        }
+
+        std::cout.flush();
+        std::cerr.flush();
+        throw std::runtime_error("katsu stack overflow");
+    }
+
+    uint64_t VM::stack_depth()
+    {
+        uint64_t depth = this->segments.empty() ? 0 : this->segments.back().depth;
+        if (this->in_top_region(this->current_frame)) {
+            depth += reinterpret_cast<uint8_t*>(this->current_frame->next()) -
+                     reinterpret_cast<uint8_t*>(this->region_base);
+        }
+        return depth;
+    }
+
+    void VM::update_top_region()
+    {
+        if (this->segments.empty()) {
+            this->region_base = reinterpret_cast<Frame*>(this->call_stack_mem);
+            this->region_end = this->call_stack_mem + this->call_stack_size;
+        } else {
+            CallSegment* segment = this->segments.back().segment();
+            this->region_base = segment->frames();
+            this->region_end = reinterpret_cast<uint8_t*>(segment->frames()) + segment->capacity;
+        }
+    }
+
+    Frame* VM::push_segment(uint64_t min_capacity)
+    {
+        if (!this->segments.empty() && !this->in_top_region(this->current_frame)) {
+            // The top segment is already empty (see unwind_frame_for_tail_call()).
+            if (min_capacity <= this->segments.back().segment()->capacity) {
+                return this->region_base;
+            }
+            this->pop_segment();
+        }
+
+        uint64_t depth = this->stack_depth();
+        if (depth + min_capacity > this->call_stack_size) {
+            this->stack_overflow();
+        }
+        uint64_t capacity = std::max(STACK_SEGMENT_SIZE, align_up(min_capacity, TAG_BITS));
+        Value v_segment;
+        if (capacity == STACK_SEGMENT_SIZE && !this->spare_segments.empty()) {
+            v_segment = this->spare_segments.back();
+            this->spare_segments.pop_back();
+        } else {
+            v_segment = Value::object(make_call_segment(this->gc, capacity));
+        }
+        this->segments.push_back(StackSegment{v_segment, this->current_frame, depth});
+        this->update_top_region();
+        return this->region_base;
+    }
+
+    void VM::pop_segment()
+    {
+        ASSERT(!this->segments.empty());
+        Value v_segment = this->segments.back().v_segment;
+        this->segments.pop_back();
+        if (v_segment.obj_call_segment()->capacity == STACK_SEGMENT_SIZE &&
+            this->spare_segments.size() < MAX_SPARE_SEGMENTS) {
+            this->spare_segments.push_back(v_segment);
+        }
+        this->update_top_region();
+    }
+
+    void VM::pop_empty_segments()
+    {
+        while (!this->in_top_region(this->current_frame)) {
+            this->pop_segment();
+        }
+    }
+
+    size_t VM::segment_starting_at(Frame* frame)
+    {
+        size_t i = this->segments.size();
+        while (i > 0 && this->segments[i - 1].segment()->frames() != frame) {
+            i--;
+        }
+        ASSERT_MSG(i > 0, "frame doesn't start a segment");
+        return i - 1;
+    }
+
+    void VM::box_mut_bindings(Frame* marked)
+    {
+        for (Frame* frame = this->current_frame;; frame = frame->caller) {
+            ByteArray* insts = frame->v_code.obj_code()->v_insts.obj_byte_array();
+            std::vector<bool> mut_regs(frame->num_regs, false);
+            bool any = false;
+            for (uint64_t i = 0; i < num_insts(insts); i++) {
+                uint32_t inst = read_inst(insts, i);
+                if (inst_opcode(inst) == OpCode::INIT_REG) {
+                    mut_regs[inst_operand(inst)] = true;
+                    any = true;
+                }
+            }
+
+            if (any) {
+                // Frames stay put (the call stack is pinned), so only the code needs rooting.
+                Root<Code> r_code(this->gc, frame->v_code.obj_code());
+                uint64_t length = r_code->v_insts.obj_byte_array()->length;
+                ByteArray* boxed_insts = make_byte_array_nofill(this->gc, length);
+                insts = r_code->v_insts.obj_byte_array();
+                for (uint64_t i = 0; i < num_insts(insts); i++) {
+                    uint32_t inst = read_inst(insts, i);
+                    OpCode op = inst_opcode(inst);
+                    uint32_t operand = inst_operand(inst);
+                    if (op == OpCode::INIT_REG) {
+                        inst = encode_inst(OpCode::INIT_REF, operand);
+                    } else if (op == OpCode::LOAD_REG && mut_regs[operand]) {
+                        inst = encode_inst(OpCode::LOAD_REF, operand);
+                    } else if (op == OpCode::STORE_REG && mut_regs[operand]) {
+                        inst = encode_inst(OpCode::STORE_REF, operand);
+                    }
+                    write_inst(boxed_insts, i, inst);
+                }
+
+                Root<ByteArray> r_insts(this->gc, std::move(boxed_insts));
+                Root<Assoc> r_module(this->gc, r_code->v_module.obj_assoc());
+                OptionalRoot<Array> r_upreg_map(this->gc,
+                                                r_code->v_upreg_map.is_null()
+                                                    ? nullptr
+                                                    : r_code->v_upreg_map.obj_array());
+                Root<Array> r_args(this->gc, r_code->v_args.obj_array());
+                Root<Tuple> r_span(this->gc, r_code->v_span.obj_tuple());
+                Root<Array> r_inst_spans(this->gc, r_code->v_inst_spans.obj_array());
+                frame->v_code = Value::object(make_code(this->gc,
+                                                        r_module,
+                                                        r_code->num_params,
+                                                        r_code->num_regs,
+                                                        r_code->num_data,
+                                                        r_upreg_map,
+                                                        r_insts,
+                                                        r_args,
+                                                        r_span,
+                                                        r_inst_spans));
+
+                // Bindings not yet initialized get boxed too, harmlessly, since INIT_REF replaces
+                // the Ref.
+                for (uint32_t reg = 0; reg < frame->num_regs; reg++) {
+                    if (mut_regs[reg]) {
+                        ValueRoot r_value(this->gc, Value(frame->regs()[reg]));
+                        frame->regs()[reg] = Value::object(make_ref(this->gc, r_value));
+                    }
+                }
+            }
+
+            if (frame == marked) {
+                break;
+            }
+        }
+    }
+
+    CallSegment* VM::detach_continuation(Frame* marked, CallSegment::State state)
+    {
+        ASSERT(state != CallSegment::State::ON_STACK);
+        this->pop_empty_segments();
+        size_t first = this->segment_starting_at(marked);
+        // Link up the segments from the top down, each ending at the frame just below the next.
+        Frame* top = this->current_frame;
+        Value v_next = Value::null();
+        for (size_t i = this->segments.size(); i-- > first;) {
+            StackSegment& s = this->segments[i];
+            CallSegment* segment = s.segment();
+            segment->length = reinterpret_cast<uint8_t*>(top->next()) -
+                              reinterpret_cast<uint8_t*>(segment->frames());
+            segment->v_next = v_next;
+            segment->state = state;
+            // The segment is an existing object, and its frames may well refer to young ones.
+            this->gc.write_barrier(segment);
+            v_next = s.v_segment;
+            top = s.below;
+        }
+        this->segments.erase(this->segments.begin() + first, this->segments.end());
+        this->update_top_region();
+        this->current_frame = top;
+        return v_next.obj_call_segment();
+    }
+
+    void VM::drop_continuation(Frame* marked)
     {
-        Frame* bottom_frame = this->current_frame ? this->current_frame->next()
-                                                  : reinterpret_cast<Frame*>(this->call_stack_mem);
-        if (reinterpret_cast<uint8_t*>(bottom_frame) + total_length >
-            this->call_stack_mem + this->call_stack_size) {
-            throw std::runtime_error("katsu stack overflow");
+        size_t first = this->segment_starting_at(marked);
+        while (this->segments.size() > first) {
+            this->pop_segment();
+        }
+        this->current_frame = marked->caller;
+    }
+
+    void VM::resume_continuation(CallSegment* segment)
+    {
+        this->pop_empty_segments();
+        bool copy = segment->state == CallSegment::State::MULTI_SHOT;
+        ASSERT(copy || segment->state == CallSegment::State::ONE_SHOT);
+        // Until some frame of the continuation has its own v_dynamic, its frames inherit their
+        // dynamic_frame from below, so those need updating even if the frames don't move.
+        bool inherits_dynamic = true;
+        while (segment) {
+            Value v_next = segment->v_next;
+            uint64_t length = segment->length;
+            Frame* base;
+            if (copy) {
+                base = this->push_segment(length);
+                std::memcpy(base, segment->frames(), length);
+            } else {
+                uint64_t depth = this->stack_depth();
+                if (depth + length > this->call_stack_size) {
+                    this->stack_overflow();
+                }
+                segment->length = 0;
+                segment->v_next = Value::null();
+                segment->state = CallSegment::State::ON_STACK;
+                this->segments.push_back(
+                    StackSegment{Value::object(segment), this->current_frame, depth});
+                this->update_top_region();
+                base = segment->frames();
+            }
+
+            Frame* past_end =
+                reinterpret_cast<Frame*>(reinterpret_cast<uint8_t*>(base) + length);
+            Frame* prev = this->current_frame;
+            Frame* frame;
+            for (frame = base; frame < past_end; frame = frame->next()) {
+                if (copy || frame == base) {
+                    frame->caller = prev;
+                }
+                if (copy || inherits_dynamic) {
+                    frame->update_dynamic_frame();
+                    inherits_dynamic = inherits_dynamic && frame->v_dynamic.is_null();
+                }
+                prev = frame;
+            }
+            ASSERT(frame == past_end);
+            this->current_frame = prev;
+
+            segment = v_next.is_null() ? nullptr : v_next.obj_call_segment();
         }
-        return reinterpret_cast<Frame*>(reinterpret_cast<uint8_t*>(bottom_frame) + total_length);
     }
 
     // Doesn't allocate.
@@ -564,8 +1061,30 @@ namespace Katsu
         return *matchers_a <= *matchers_b;
     }
 
+    enum DispatchFailure
+    {
+        NO_MATCHING_METHOD,
+        AMBIGUOUS_METHOD_RESOLUTION,
+    };
+
+    [[noreturn]] void throw_dispatch_failure(DispatchFailure failure)
+    {
+        switch (failure) {
+            case NO_MATCHING_METHOD:
+                throw condition_error("no-matching-method",
+                                      "multimethod has no methods matching the given arguments");
+            case AMBIGUOUS_METHOD_RESOLUTION:
+                throw condition_error(
+                    "ambiguous-method-resolution",
+                    "multimethod has multiple best methods matching the given arguments");
+        }
+        ALWAYS_ASSERT_MSG(false, "forgot a DispatchFailure?");
+    }
+
     // Doesn't allocate!
-    Method* multimethod_dispatch(VM& vm, MultiMethod* multimethod, Value* args)
+    // Returns the best method matching the arguments, or else returns nullptr and sets `failure`.
+    Method* dispatch_uncached(VM& vm, MultiMethod* multimethod, Value* args,
+                              DispatchFailure* failure)
     {
         Vector* methods = multimethod->v_methods.obj_vector();
 #if DEBUG_ASSERTIONS
@@ -576,7 +1095,6 @@ namespace Katsu
         }
 #endif
 
-        // TODO: optimize this (by a lot!).
         // Perform two passes:
         // 1) Find any minimum among methods matching the arguments -- assuming one even exists!
         //    (Otherwise, error: no matching method.)
@@ -600,8 +1118,8 @@ namespace Katsu
             }
         }
         if (!min) {
-            throw condition_error("no-matching-method",
-                                  "multimethod has no methods matching the given arguments");
+            *failure = NO_MATCHING_METHOD;
+            return nullptr;
         }
 
         // Pass 2:
@@ -612,24 +1130,201 @@ namespace Katsu
                 continue;
             }
             if (!(*min <= *method)) {
-                throw condition_error(
-                    "ambiguous-method-resolution",
-                    "multimethod has multiple best methods matching the given arguments");
+                *failure = AMBIGUOUS_METHOD_RESOLUTION;
+                return nullptr;
             }
         }
 
         return min;
     }
 
-    void VM::invoke(Value v_callable, bool tail_call, int64_t num_args, Value* args)
+    // Doesn't allocate or throw.
+    // Whether dispatching on the arguments picks a method with the given native handler.
+    bool dispatches_to_handler(VM& vm, MultiMethod* multimethod, Value* args,
+                               NativeHandler handler)
+    {
+        if (!handler) {
+            return false;
+        }
+        DispatchFailure failure;
+        Method* method = dispatch_uncached(vm, multimethod, args, &failure);
+        return method && method->native_handler == handler;
+    }
+
+    // Doesn't allocate!
+    Method* multimethod_dispatch(VM& vm, MultiMethod* multimethod, Value* args)
+    {
+        DispatchFailure failure;
+
+        // If any method with value matchers applies, dispatch doesn't just depend on argument
+        // types, so the dispatch table can't help. (Otherwise, those methods can't affect the
+        // result, and the table only has to key on argument types.)
+        bool use_table = multimethod->v_dispatch_table.is_obj_array();
+        if (use_table && multimethod->v_value_methods.is_obj_vector()) {
+            for (Value v_method : multimethod->v_value_methods.obj_vector()) {
+                Array* matchers = v_method.obj_method()->v_param_matchers.obj_array();
+                if (params_match(vm, matchers, args)) {
+                    use_table = false;
+                    break;
+                }
+            }
+        }
+        if (!use_table) {
+            Method* method = dispatch_uncached(vm, multimethod, args, &failure);
+            if (!method) {
+                throw_dispatch_failure(failure);
+            }
+            return method;
+        }
+
+        uint32_t num_params = multimethod->num_params;
+        uint64_t entry_length = 1 + (uint64_t)num_params;
+        Array* table = multimethod->v_dispatch_table.obj_array();
+        uint64_t num_entries = table->length / entry_length;
+        ASSERT(num_entries > 0 && (num_entries & (num_entries - 1)) == 0);
+
+        uint64_t version = vm.dispatch_version(multimethod);
+        if (multimethod->dispatch_table_version != version) {
+            // The type hierarchy has changed, so any entry could be wrong. Start over.
+            for (uint64_t i = 0; i < num_entries; i++) {
+                table->components()[i * entry_length] = Value::null();
+            }
+            multimethod->dispatch_table_version = version;
+        }
+
+        Value key[num_params];
+        Array* typed_params = multimethod->v_typed_params.obj_array();
+        uint64_t hash = 0xcbf29ce484222325;
+        for (uint32_t j = 0; j < num_params; j++) {
+            // Hash on type ids rather than addresses, so that the table survives collections.
+            uint64_t type_hash = 0;
+            if (typed_params->components()[j]._bool()) {
+                key[j] = type_of(vm, args[j]);
+                type_hash = 1 + (uint64_t)key[j].obj_type()->type_id;
+            } else {
+                key[j] = Value::null();
+            }
+            hash = (hash ^ type_hash) * 0x100000001b3;
+        }
+
+        for (uint64_t probe = 0; probe < num_entries; probe++) {
+            uint64_t index = (hash + probe) & (num_entries - 1);
+            Value* entry = table->components() + index * entry_length;
+            Value result = entry[0];
+            if (result.is_null()) {
+                // Unused entry; fill it in.
+                Method* method = dispatch_uncached(vm, multimethod, args, &failure);
+                entry[0] = method ? Value::object(method) : Value::fixnum(failure);
+                for (uint32_t j = 0; j < num_params; j++) {
+                    entry[1 + j] = key[j];
+                }
+                vm.gc.write_barrier(table);
+                if (!method) {
+                    throw_dispatch_failure(failure);
+                }
+                return method;
+            }
+            bool hit = true;
+            for (uint32_t j = 0; j < num_params; j++) {
+                if (entry[1 + j] != key[j]) {
+                    hit = false;
+                    break;
+                }
+            }
+            if (hit) {
+                if (result.is_fixnum()) {
+                    throw_dispatch_failure(static_cast<DispatchFailure>(result.fixnum()));
+                }
+                return result.obj_method();
+            }
+        }
+
+        // The table is full; fall back to a full search.
+        Method* method = dispatch_uncached(vm, multimethod, args, &failure);
+        if (!method) {
+            throw_dispatch_failure(failure);
+        }
+        return method;
+    }
+
+    // Doesn't allocate!
+    // Same as multimethod_dispatch(), but first checks the call site's inline cache (see
+    // INLINE_CACHE_ENTRIES), and records the result there on a miss.
+    Method* inline_cache_dispatch(VM& vm, MultiMethod* multimethod, Array* inline_cache,
+                                  Value* args)
+    {
+        uint32_t num_params = multimethod->num_params;
+        uint64_t entry_length = 2 + (uint64_t)num_params;
+        ASSERT(inline_cache->length == inline_cache_length(num_params));
+        Value v_version = Value::fixnum(vm.dispatch_version(multimethod));
+
+        Value* free_entry = nullptr;
+        for (uint32_t i = 0; i < INLINE_CACHE_ENTRIES; i++) {
+            Value* entry = inline_cache->components() + i * entry_length;
+            if (entry[0] != v_version) {
+                // Unused, or stale (the multimethod has changed since the entry was recorded).
+                if (!free_entry) {
+                    free_entry = entry;
+                }
+                continue;
+            }
+            if (entry[1].is_null()) {
+                // Not cacheable; don't bother checking the other entries.
+                return multimethod_dispatch(vm, multimethod, args);
+            }
+            bool hit = true;
+            for (uint32_t j = 0; j < num_params; j++) {
+                Value v_type = entry[2 + j];
+                if (!v_type.is_null() && type_of(vm, args[j]) != v_type) {
+                    hit = false;
+                    break;
+                }
+            }
+            if (hit) {
+                return entry[1].obj_method();
+            }
+        }
+
+        // Miss. Note that this throws (without recording anything) if dispatch fails.
+        Method* method = multimethod_dispatch(vm, multimethod, args);
+        if (!free_entry) {
+            // Megamorphic call site; keep the entries we have.
+            return method;
+        }
+
+        // Dispatch only depends on the argument types as long as there are no value matchers, and
+        // only on the types of arguments at positions where some method has a type matcher.
+        bool cacheable = multimethod->v_value_methods.is_null();
+        Array* typed_params = multimethod->v_typed_params.obj_array();
+        for (uint32_t j = 0; j < num_params; j++) {
+            free_entry[2 + j] =
+                typed_params->components()[j]._bool() ? type_of(vm, args[j]) : Value::null();
+        }
+        free_entry[0] = v_version;
+        free_entry[1] = cacheable ? Value::object(method) : Value::null();
+        vm.gc.write_barrier(inline_cache);
+        return method;
+    }
+
+    void VM::invoke(Value v_callable, bool tail_call, int64_t num_args, Value* args,
+                    Array* inline_cache)
     {
         if (!v_callable.is_obj_multimethod()) {
             throw condition_error("invoke-non-multimethod", "can only invoke a multimethod");
         }
         MultiMethod* multimethod = v_callable.obj_multimethod();
 
+        if (this->cpu_sample_due) [[unlikely]] {
+            this->cpu_sample_due = 0;
+            if (this->cpu_profiler) {
+                this->cpu_profiler->sample();
+            }
+        }
+
         ASSERT(num_args == multimethod->num_params);
-        Method* method = multimethod_dispatch(*this, multimethod, args);
+        Method* method = inline_cache
+                             ? inline_cache_dispatch(*this, multimethod, inline_cache, args)
+                             : multimethod_dispatch(*this, multimethod, args);
 
         if (method->v_code.is_null()) {
             // Native or intrinsic handler.
@@ -652,17 +1347,16 @@ namespace Katsu
                            "method must have v_code or a native_handler or intrinsic_handler");
             }
         } else {
+            if (is_lazy_code_stub(method->v_code)) [[unlikely]] {
+                // (Before anything else, since compiling can raise a compile error.)
+                method = compile_lazy_method(*this, method, num_args, args);
+            }
             this->current_frame->inst_spot++;
 
-            // In case of tail-call, we need to temporarily store the args as we unwind the current
-            // frame and replace it with a new frame.
-            Value args_copy[num_args];
+            // In case of tail-call, the new frame replaces the current one, and the args slide
+            // down into place as its first regs().
             if (tail_call) {
-                for (uint32_t i = 0; i < num_args; i++) {
-                    args_copy[i] = args[i];
-                }
-                this->unwind_frame(/* tail_call */ true);
-                args = args_copy;
+                args = this->unwind_frame_for_tail_call(args, num_args);
             }
 
             // Bytecode body.
@@ -676,12 +1370,7 @@ namespace Katsu
                                              code->v_module,
                                              /* v_marker */ Value::null(),
                                              /* v_dynamic */ Value::null());
-            for (uint32_t i = 0; i < num_args; i++) {
-                frame->regs()[i] = args[i];
-            }
-            for (uint32_t i = num_args; i < code->num_regs; i++) {
-                frame->regs()[i] = Value::null();
-            }
+            frame->init_regs(args, num_args);
             this->current_frame = frame;
         }
     }
@@ -3,6 +3,30 @@
 #include "gc.h"
 #include "value.h"
 
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Have the VM fill each new call frame's data stack with a fixed byte pattern.
+// Default off.
+#ifndef DEBUG_FRAME_FILL
+#define DEBUG_FRAME_FILL (0)
+#endif
+
+// Whether the interpreter loop should use computed-goto ("direct-threaded") dispatch, rather than
+// a portable switch. Requires the GNU labels-as-values extension.
+#ifndef VM_THREADED_DISPATCH
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_THREADED_DISPATCH (1)
+#else
+#define VM_THREADED_DISPATCH (0)
+#endif
+#endif
+
 namespace Katsu
 {
     // TODO: update this whole block!
@@ -25,47 +49,84 @@ namespace Katsu
      * - MAKE_CLOSURE: push a closure object (which refers to some closed-over variables) to the
      *      stack
      *
-     * Bytecode format: there are separate instruction and value regions (which should be right next
-     * to each other anyway to keep cache warm) -- and also an offside array of SourceSpan per
-     * instruction
-     * - instructions array: concatenated sequence of <1-byte opcode> <3-byte args offset>, where
-     *   the offsets are in terms of 8-byte Values in the value/argument region
+     * Bytecode format: there are separate instruction and value regions -- and also an offside
+     * array of SourceSpan per instruction
+     * - instructions byte array: concatenated sequence of 4-byte instruction words, each
+     *   <3-byte operand> <1-byte opcode> (see encode_inst()). Depending on the opcode, the operand
+     *   is either an immediate (e.g. a local index) or an offset into the value region, in terms of
+     *   8-byte Values. Instructions are addressed by index, not by byte offset.
      * - value array: aligned 8-byte Values (could be inline or reference), which should be
-     *   considered roots for the GC
+     *   considered roots for the GC. Only instructions which need a GC-visible argument use it.
      *
-     * +----------------+--------+----------------------------------------------------------+
-     * | Name           | Opcode | Arguments ...                                            |
-     * +----------------+--------+----------------------------------------------------------+
-     * | LOAD_REG       |  0x0   | (fixnum) local index                                     |
-     * | STORE_REG      |  0x1   | (fixnum) local index                                     |
-     * | LOAD_REF       |  0x2   | (fixnum) local index                                     |
-     * | STORE_REF      |  0x3   | (fixnum) local index                                     |
-     * | LOAD_VALUE     |  0x4   | value to load                                            |
-     * | INIT_REF       |  0x5   | (fixnum) local index                                     |
-     * | LOAD_MODULE    |  0x6   | (string) name                                            |
-     * | STORE_MODULE   |  0x7   | (string) name                                            |
-     * | INVOKE         |  0x8   | (string) name; (fixnum) num args                     (1) |
-     * | INVOKE_TAIL    |  0x9   | (string) name; (fixnum) num args                     (1) |
-     * | DROP           |  0xA   | none                                                     |
-     * | MAKE_TUPLE     |  0xB   | (fixnum) num components                                  |
-     * | MAKE_ARRAY     |  0xC   | (fixnum) num components                                  |
-     * | MAKE_VECTOR    |  0xD   | (fixnum) num components                                  |
-     * | MAKE_CLOSURE   |  0xE   | (closure) closure 'template'                         (2) |
-     * | MAKE_INSTANCE  |  0xF   | (fixnum) num slots                                       |
-     * | VERIFY_IS_TYPE |  0x10  | none                                                     |
-     * | GET_SLOT       |  0x11  | (fixnum) slot index                                      |
-     * | SET_SLOT       |  0x12  | (fixnum) slot index                                      |
-     * +----------------+--------+----------------------------------------------------------+
+     * +------------------------+--------+-------------------------------------------------------+
+     * | Name                   | Opcode | Operand                                               |
+     * +------------------------+--------+-------------------------------------------------------+
+     * | LOAD_REG               |  0x0   | (immediate) local index                               |
+     * | STORE_REG              |  0x1   | (immediate) local index                               |
+     * | LOAD_REF               |  0x2   | (immediate) local index                               |
+     * | STORE_REF              |  0x3   | (immediate) local index                               |
+     * | LOAD_VALUE             |  0x4   | (args) value to load                                  |
+     * | INIT_REF               |  0x5   | (immediate) local index                               |
+     * | LOAD_MODULE            |  0x6   | (args) (string) name                                  |
+     * | STORE_MODULE           |  0x7   | (args) (string) name                                  |
+     * | INVOKE                 |  0x8   | (args) (string) name; (fixnum) num args; IC   (1) (3) |
+     * | INVOKE_TAIL            |  0x9   | (args) (string) name; (fixnum) num args; IC   (1) (3) |
+     * | DROP                   |  0xA   | none                                                  |
+     * | MAKE_TUPLE             |  0xB   | (immediate) num components                            |
+     * | MAKE_ARRAY             |  0xC   | (immediate) num components                            |
+     * | MAKE_VECTOR            |  0xD   | (immediate) num components                            |
+     * | MAKE_CLOSURE           |  0xE   | (args) (closure) closure 'template'               (2) |
+     * | MAKE_INSTANCE          |  0xF   | (immediate) num slots                                 |
+     * | VERIFY_IS_TYPE         |  0x10  | none                                                  |
+     * | GET_SLOT               |  0x11  | (immediate) slot index                                |
+     * | SET_SLOT               |  0x12  | (immediate) slot index                                |
+     * +------------------------+--------+-------------------------------------------------------+
+     * | STORE_REG_KEEP         |  0x13  | (immediate) local index                           (4) |
+     * | LOAD_REG_GET_SLOT      |  0x14  | (immediate) local index, slot index           (4) (5) |
+     * | LOAD_VALUE_INVOKE      |  0x15  | (args) value; then as for INVOKE              (4) (6) |
+     * | LOAD_VALUE_INVOKE_TAIL |  0x16  | (args) value; then as for INVOKE_TAIL         (4) (6) |
+     * +------------------------+--------+-------------------------------------------------------+
+     * | FIXNUM_ADD             |  0x17  | (args) fast-path state                            (7) |
+     * | FIXNUM_SUB             |  0x18  | (args) fast-path state                            (7) |
+     * | FIXNUM_MUL             |  0x19  | (args) fast-path state                            (7) |
+     * | FIXNUM_LT              |  0x1A  | (args) fast-path state                            (7) |
+     * | FIXNUM_LTE             |  0x1B  | (args) fast-path state                            (7) |
+     * | FIXNUM_GT              |  0x1C  | (args) fast-path state                            (7) |
+     * | FIXNUM_GTE             |  0x1D  | (args) fast-path state                            (7) |
+     * | FIXNUM_EQ              |  0x1E  | (args) fast-path state                            (7) |
+     * | FIXNUM_NE              |  0x1F  | (args) fast-path state                            (7) |
+     * +------------------------+--------+-------------------------------------------------------+
+     * | INIT_REG               |  0x20  | (immediate) local index                           (8) |
+     * +------------------------+--------+-------------------------------------------------------+
      * Notes:
      * (1) This should probably refer to an actual multimethod object to avoid lookups...
      *     similarly load/store with module fields should be precomputed somehow.
      * (2) The closure template should host the closure's bytecode, upreg-mapping, and therefore
      *     also number of upregs. These are popped from the data stack, like making a vector.
+     * (3) Inline cache (IC): Array of length inline_cache_length(num args), initially all null. See
+     *     INLINE_CACHE_ENTRIES.
+     * (4) Superinstructions, only produced by the compiler's peephole pass. STORE_REG_KEEP stores
+     *     the top of the stack without popping it; the others behave like the two instructions
+     *     they replace, run back to back.
+     * (5) See encode_reg_and_slot().
+     * (6) The INVOKE's arguments directly follow the value in the value region.
+     * (7) Guarded fast path for an INVOKE of a binary operator, which must directly follow the
+     *     FIXNUM_* instruction (with its arguments directly following the fast-path state in the
+     *     value region). If both operands are fixnums, the multimethod has no methods with value
+     *     matchers, and dispatch on fixnums is known to pick the native handler which the opcode
+     *     implements (see VM::register_fast_path()), the result is computed inline and the INVOKE
+     *     is skipped. Otherwise (or on overflow), execution just continues with the INVOKE. The
+     *     fast-path state is null or the fixnum
+     *     2 * <dispatch version> + <1 if the fast path applies, 0 if not>.
+     * (8) Like STORE_REG, but initializes a mut: binding which no closure captures, and so which
+     *     lives directly in its register (accessed with LOAD_REG and STORE_REG, never fused).
+     *     Capturing a multi-shot continuation boxes such bindings, so that its resumptions share
+     *     them (see VM::box_mut_bindings()).
      *
      * Stack Frame:
-     * - array of 'registers' (arguments, 'let:' and 'mut:' bindings) ('mut:' variables are handled
-     *   as effectively Ref<T>, i.e. one extra layer of boxing and unboxing, and handled with
-     *   LOAD/STORE_REF instead of _REG)
+     * - array of 'registers' (arguments, 'let:' and 'mut:' bindings) ('mut:' variables which
+     *   closures capture are handled as effectively Ref<T>, i.e. one extra layer of boxing and
+     *   unboxing, and handled with LOAD/STORE_REF instead of _REG)
      * - data stack (statically known max size; can be implemented as fixed-size array)
      * - cleanup value (value to invoke/call when unwinding frame)
      * - is_cleanup (whether or not this frame is the result of calling a cleanup value -- only the
@@ -122,8 +183,88 @@ namespace Katsu
         VERIFY_IS_TYPE,
         GET_SLOT,
         SET_SLOT,
+        STORE_REG_KEEP,
+        LOAD_REG_GET_SLOT,
+        LOAD_VALUE_INVOKE,
+        LOAD_VALUE_INVOKE_TAIL,
+        FIXNUM_ADD,
+        FIXNUM_SUB,
+        FIXNUM_MUL,
+        FIXNUM_LT,
+        FIXNUM_LTE,
+        FIXNUM_GT,
+        FIXNUM_GTE,
+        FIXNUM_EQ,
+        FIXNUM_NE,
+        INIT_REG,
+
+        // Keep this last!
+        NUM_OPCODES,
     };
 
+    // Instructions are stored as 4-byte words in a Code's v_insts ByteArray:
+    //   <3-byte operand> <1-byte opcode>
+    static const uint32_t INST_SIZE = sizeof(uint32_t);
+    static const uint32_t MAX_INST_OPERAND = (1 << 24) - 1;
+    inline uint32_t encode_inst(OpCode op, uint32_t operand)
+    {
+        return (operand << 8) | static_cast<uint32_t>(op);
+    }
+    inline OpCode inst_opcode(uint32_t inst)
+    {
+        return static_cast<OpCode>(inst & 0xFF);
+    }
+    inline uint32_t inst_operand(uint32_t inst)
+    {
+        return inst >> 8;
+    }
+    // LOAD_REG_GET_SLOT packs both its local index and slot index into the operand:
+    //   <12-bit slot index> <12-bit local index>
+    static const uint32_t MAX_FUSED_REG = (1 << 12) - 1;
+    static const uint32_t MAX_FUSED_SLOT = (1 << 12) - 1;
+    inline uint32_t encode_reg_and_slot(uint32_t local_index, uint32_t slot_index)
+    {
+        return (slot_index << 12) | local_index;
+    }
+    inline uint32_t fused_reg(uint32_t operand)
+    {
+        return operand & MAX_FUSED_REG;
+    }
+    inline uint32_t fused_slot(uint32_t operand)
+    {
+        return operand >> 12;
+    }
+    // Number of instructions in an instructions ByteArray.
+    inline uint64_t num_insts(ByteArray* insts)
+    {
+        return insts->length / INST_SIZE;
+    }
+    // Read the instruction at index `spot` from an instructions ByteArray.
+    inline uint32_t read_inst(ByteArray* insts, uint64_t spot)
+    {
+        uint32_t inst;
+        memcpy(&inst, insts->contents() + spot * INST_SIZE, INST_SIZE);
+        return inst;
+    }
+    // Write the instruction at index `spot` into an instructions ByteArray.
+    inline void write_inst(ByteArray* insts, uint64_t spot, uint32_t inst)
+    {
+        memcpy(insts->contents() + spot * INST_SIZE, &inst, INST_SIZE);
+    }
+
+    // Each INVOKE / INVOKE_TAIL call site remembers the results of up to this many dispatches.
+    // An entry for a multimethod with N params is laid out as:
+    //   [version, method, type 0, ..., type N-1]
+    // where `version` is the multimethod's dispatch version (see VM::dispatch_version()), or null
+    // if the entry is unused, and `type i` is the type of the i'th argument (or null if no method
+    // has a type matcher for that param).
+    // If `method` is null, dispatch for the multimethod at `version` isn't cacheable at all.
+    static const uint32_t INLINE_CACHE_ENTRIES = 4;
+    inline uint64_t inline_cache_length(uint32_t num_params)
+    {
+        return INLINE_CACHE_ENTRIES * (2 + (uint64_t)num_params);
+    }
+
     // Keep in sync with stack-trace.katsu.
     struct Frame
     {
@@ -150,6 +291,19 @@ namespace Katsu
         // Any value, generally used for implementing dynamic variables.
         Value v_dynamic;
 
+        // Innermost frame with a non-null v_dynamic, out of this one and its callers, or nullptr
+        // if there is none. This saves walking the stack for each dynamic lookup; keep it up to
+        // date with update_dynamic_frame() after setting `caller` or `v_dynamic`. Like `caller`,
+        // it's only meaningful on the call stack.
+        Frame* dynamic_frame;
+
+        inline void update_dynamic_frame()
+        {
+            this->dynamic_frame = !this->v_dynamic.is_null() ? this
+                                  : this->caller             ? this->caller->dynamic_frame
+                                                             : nullptr;
+        }
+
         // Variable-length array of length `num_regs`.
         inline Value* regs()
         {
@@ -179,6 +333,17 @@ namespace Katsu
                 align_up(reinterpret_cast<uint64_t>(this) + this->size(), TAG_BITS));
         }
 
+        // Initialize regs(): the first `num_args` come from `args` (which may overlap regs()), and
+        // the rest are null.
+        inline void init_regs(const Value* args, uint32_t num_args)
+        {
+            ASSERT(num_args <= this->num_regs);
+            if (args != this->regs()) {
+                std::memmove(this->regs(), args, num_args * sizeof(Value));
+            }
+            std::fill_n(this->regs() + num_args, this->num_regs - num_args, Value::null());
+        }
+
         inline void push(Value value)
         {
             ASSERT_MSG(this->data_depth < this->num_data, "data stack overflow in frame");
@@ -208,7 +373,12 @@ namespace Katsu
     };
     static_assert(sizeof(Frame) % sizeof(Value) == 0);
     // If this changes, update stack-trace.katsu.
-    static_assert(sizeof(Frame) == 72);
+    static_assert(sizeof(Frame) == 80);
+
+    // Capacity (in bytes) of each call stack segment, unless a frame needs more. See VM::segments.
+    static const uint64_t STACK_SEGMENT_SIZE = 4 * 1024;
+    // Number of unused segments the VM keeps around for reuse.
+    static const size_t MAX_SPARE_SEGMENTS = 64;
 
     enum BuiltinId
     {
@@ -234,11 +404,28 @@ namespace Katsu
         _CallSegment,
         _Foreign,
         _ByteArray,
+        _Deque,
+        _IdentitySet,
+        _F64Array,
+        _I64Array,
 
         // Keep this last!
         NUM_BUILTINS,
     };
 
+    // Names for the native and intrinsic handlers and foreign constants which register_builtins()
+    // registers, which (unlike the pointers themselves) are the same from run to run. Heap images
+    // refer to them by these names (see heap_image.h).
+    struct BuiltinNames
+    {
+        std::vector<std::pair<std::string, NativeHandler>> natives;
+        std::vector<std::pair<std::string, IntrinsicHandler>> intrinsics;
+        std::vector<std::pair<std::string, void*>> foreign_constants;
+    };
+
+    class CpuProfiler;
+    struct LazyMethodBody;
+
     class VM : public RootProvider
     {
     public:
@@ -247,7 +434,7 @@ namespace Katsu
 
         Value eval_toplevel(Root<Code>& r_code);
 
-        void visit_roots(std::function<void(Value*)>& visitor) override;
+        void trace_roots(Tracer& tracer) override;
 
         inline Value builtin(BuiltinId id)
         {
@@ -257,6 +444,11 @@ namespace Katsu
 
         void register_builtin(BuiltinId id, Value value);
 
+        // Declare that a FIXNUM_* opcode computes the same thing as a native handler does for two
+        // fixnum arguments, so that the opcode can skip invoking a multimethod whenever dispatch on
+        // two fixnums would pick a method with that handler.
+        void register_fast_path(OpCode op, NativeHandler handler);
+
         // GC for values tracked by this VM.
         GC& gc;
 
@@ -266,49 +458,180 @@ namespace Katsu
         // All (global) multimethods, by name.
         Value v_multimethods; // Assoc
 
+        // Interned names, each mapped to itself. See intern().
+        Value v_symbols; // Assoc
+
         // Value to call in order to signal a condition in-langauge from e.g. a C++ condition_error.
         Value v_condition_handler;
 
+        // Directory to cache the compiled code of source files in, or empty to always compile
+        // from source (see TopLevelCompiler).
+        std::string bytecode_cache_dir;
+
+        BuiltinNames builtin_names;
+
+        // Paths of the source files compiled so far (see TopLevelCompiler), in order.
+        std::vector<std::string> source_paths;
+
+        // Whether to leave method bodies to compile on first invocation, where possible (see
+        // TopLevelCompiler).
+        bool lazy_method_compilation;
+        // Method bodies waiting to be compiled, by the id in their stub, or null once compiled.
+        // See LazyMethodBody.
+        std::vector<std::unique_ptr<LazyMethodBody>> lazy_method_bodies;
+
+        // Set by heap-image-point, for bootstrapping to notice (and save a heap image, if asked
+        // to) once the top-level expression which called it is done. See heap_image.h.
+        bool reached_heap_image_point;
+
+        // Profiler to record the call stack with whenever `cpu_sample_due`, or null if not
+        // profiling. The flag is set asynchronously (by a timer signal), and checked on each
+        // invocation, where the stack is in a fit state to walk. See cpu_profiler.h.
+        std::unique_ptr<CpuProfiler> cpu_profiler;
+        volatile std::sig_atomic_t cpu_sample_due;
+
+        // Bumped whenever an existing type's linearization changes (such as when mixing in a
+        // type), since that can change the result of any dispatch.
+        uint64_t type_hierarchy_version;
+
+        // Anything cached about dispatch on a multimethod is valid only while this is unchanged.
+        // (Both parts only ever increase, so the sum changes whenever either does.)
+        inline uint64_t dispatch_version(MultiMethod* multimethod)
+        {
+            return multimethod->version + this->type_hierarchy_version;
+        }
+
     private:
         friend class OpenVM;
+        friend class HeapImage;
 
         void print_vm_state();
 
-        void single_step();
+        // Run the interpreter loop, starting from the current frame, until the bottom frame of
+        // the call stack finishes. Returns its result and clears the call stack. If `verbose`,
+        // prints the VM state before each instruction.
+        template <bool verbose> Value run();
 
         void unwind_frame(bool tail_call);
 
+        // Unwind the current frame in preparation for a tail call, moving the `num_args` arguments
+        // (generally just past the unwound frame's data stack) to where the regs() of the next
+        // allocated frame will be. Returns the arguments' new location.
+        Value* unwind_frame_for_tail_call(Value* args, uint32_t num_args);
+
         // Look up the method_name in the module.
         static Value& module_lookup_or_fail(Value v_module, String* name);
 
-        // Allocates a call frame. The caller must initialize the new frame's regs() and
-        // data(), in particular before any GC operations. Returns the new frame, which the caller
-        // must set as the current_frame if desired. Raises runtime_error on stack overflow.
+        // Allocates a call frame. The caller must initialize the new frame's regs() (see
+        // Frame::init_regs()), in particular before any GC operations. The data() need not be
+        // initialized. Returns the new frame, which the caller must set as the current_frame if
+        // desired. Raises runtime_error on stack overflow.
         Frame* alloc_frame(uint32_t num_regs, uint32_t num_data, Value v_code, Value v_module,
                            Value v_marker, Value v_dynamic);
 
-        // Allocates a region for multiple call frames. The caller must initialize the entire region
-        // before further VM or GC operations. Returns just past the top-most frame. Does not update
-        // the VM's current_frame. Raises runtime_error on stack overflow.
-        Frame* alloc_frames(uint64_t total_length);
+        // Box the unboxed mut: bindings (see INIT_REG) of each frame from `marked` up to the top of
+        // the stack, ahead of detaching them as a multi-shot continuation: each resumption gets
+        // copies of the frames, which must still share their bindings. A boxed frame runs a copy
+        // of its code which uses LOAD_REF / STORE_REF / INIT_REF for those registers instead.
+        void box_mut_bindings(Frame* marked);
+
+        // Detach the segments from the one which `marked` starts up to the top of the stack, as a
+        // continuation in the given (detached) state, and return its bottom segment. The top of
+        // the stack goes back to `marked`'s caller.
+        CallSegment* detach_continuation(Frame* marked, CallSegment::State state);
+
+        // Same, but for a continuation which nothing can resume: the segments are just reused.
+        void drop_continuation(Frame* marked);
+
+        // Put a detached continuation's frames on top of the stack, and make its top frame the
+        // current one. A ONE_SHOT continuation's segments are relinked into the stack as they are,
+        // whereas a MULTI_SHOT one's are copied. Raises runtime_error on stack overflow.
+        void resume_continuation(CallSegment* segment);
+
+        // Whether the frame is in the top region of the call stack (the top segment, or else the
+        // base region).
+        inline bool in_top_region(Frame* frame) const
+        {
+            return frame >= this->region_base &&
+                   reinterpret_cast<uint8_t*>(frame) < this->region_end;
+        }
+
+        // Total bytes of frames on the call stack.
+        uint64_t stack_depth();
+
+        // Make the top region an empty segment with room for at least `min_capacity` bytes (reusing
+        // the top segment if it's already empty and big enough), and return its base. Never
+        // collects. Raises runtime_error on stack overflow.
+        Frame* push_segment(uint64_t min_capacity);
+
+        // Pop the top segment, whose frames must no longer be in use.
+        void pop_segment();
+
+        // Pop any segments left empty, so that the current frame is in the top region.
+        void pop_empty_segments();
+
+        // Index of the segment which the frame starts.
+        size_t segment_starting_at(Frame* frame);
+
+        // Set region_base / region_end from the top segment, or else the base region.
+        void update_top_region();
+
+        // Print a trace of the call stack and raise runtime_error.
+        [[noreturn]] void stack_overflow();
 
         // Invoke a value (which could be a closure or multimethod) with some arguments. The
         // arguments may be just past the end of the current frame's data stack. This also takes
-        // responsibility for updating the top call frame's instruction spot.
-        void invoke(Value v_callable, bool tail_call, int64_t num_args, Value* args);
+        // responsibility for updating the top call frame's instruction spot. If provided, the
+        // inline cache is used (and updated) to short-circuit multimethod dispatch.
+        void invoke(Value v_callable, bool tail_call, int64_t num_args, Value* args,
+                    Array* inline_cache = nullptr);
 
-        // Memory region for the call stack.
+        // Memory region for the base of the call stack.
         // Hosts contiguous `Frame`s.
         uint8_t* call_stack_mem;
+        // Size of that region, and also the most bytes of frames the whole call stack can hold.
         uint64_t call_stack_size;
 
-        // null, or points into the call_stack_mem.
+        // Segments of the call stack above the base region, from the bottom up. Each marked frame
+        // starts a new segment (as does any frame which doesn't fit in the top one), so that the
+        // frames from a marked frame up to the top of the stack are always whole segments, and
+        // capturing a delimited continuation (see call/dc:) only has to detach them. Each is a
+        // pinned CallSegment, ON_STACK.
+        struct StackSegment
+        {
+            Value v_segment; // CallSegment
+
+            // The frame just below the segment, which its bottom frame returns to.
+            Frame* below;
+
+            // Total bytes of frames below the segment.
+            uint64_t depth;
+
+            inline CallSegment* segment() const
+            {
+                return this->v_segment.obj_call_segment();
+            }
+        };
+        std::vector<StackSegment> segments;
+
+        // Unused segments of STACK_SEGMENT_SIZE, kept for reuse.
+        std::vector<Value> spare_segments; // CallSegment
+
+        // Bounds of the top region of the call stack. See in_top_region().
+        Frame* region_base;
+        uint8_t* region_end;
+
+        // null, or points into the top region or just below it (if a tail call has left the top
+        // segment empty; see unwind_frame_for_tail_call()).
         Frame* current_frame;
 
         // Builtin values that we need convenient access to (and which are GC'ed).
         // Indexed by BuiltinId.
         Value builtin_values[BuiltinId::NUM_BUILTINS];
 
+        // Native handlers implemented inline by fast-path opcodes (or nullptr), indexed by OpCode.
+        NativeHandler fast_path_handlers[OpCode::NUM_OPCODES];
+
         bool verbose_logging = false;
     };
 
@@ -344,10 +667,28 @@ namespace Katsu
             return this->vm.alloc_frame(num_regs, num_data, v_code, v_module, v_marker, v_dynamic);
         }
 
-        // See VM::alloc_frames().
-        inline Frame* alloc_frames(uint64_t total_length)
+        // See VM::box_mut_bindings().
+        inline void box_mut_bindings(Frame* marked)
+        {
+            this->vm.box_mut_bindings(marked);
+        }
+
+        // See VM::detach_continuation().
+        inline CallSegment* detach_continuation(Frame* marked, CallSegment::State state)
         {
-            return this->vm.alloc_frames(total_length);
+            return this->vm.detach_continuation(marked, state);
+        }
+
+        // See VM::drop_continuation().
+        inline void drop_continuation(Frame* marked)
+        {
+            this->vm.drop_continuation(marked);
+        }
+
+        // See VM::resume_continuation().
+        inline void resume_continuation(CallSegment* segment)
+        {
+            this->vm.resume_continuation(segment);
         }
 
         inline void unwind_frame(bool tail_call)
@@ -355,6 +696,11 @@ namespace Katsu
             this->vm.unwind_frame(tail_call);
         }
 
+        inline Value* unwind_frame_for_tail_call(Value* args, uint32_t num_args)
+        {
+            return this->vm.unwind_frame_for_tail_call(args, num_args);
+        }
+
         VM& vm;
         GC& gc;
     };
@@ -2,8 +2,11 @@
 
 #include "vm.h"
 
+#include "cpu_profiler.h"
+#include "heap_profiler.h"
 #include "span.h"
 #include "value_utils.h"
+#include <chrono>
 #include <cstring>
 
 using namespace Katsu;
@@ -15,6 +18,30 @@ TEST_CASE("VM smoketest", "[vm]")
     // Let destructors run.
 }
 
+TEST_CASE("VM interns names", "[vm]")
+{
+    GC gc(1024 * 1024);
+    VM vm(gc, 10 * 1024);
+
+    Root<String> r_a(gc, intern(vm, "some-name:"));
+    Root<String> r_other(gc, intern(vm, "other-name:"));
+    CHECK(*r_a != *r_other);
+    CHECK(intern(vm, "some-name:") == *r_a);
+
+    // An already-interned name wins over a new String with the same contents.
+    Root<String> r_copy(gc, make_string(gc, "some-name:"));
+    CHECK(intern(vm, r_copy) == *r_a);
+    // Otherwise the String itself becomes the interned one.
+    Root<String> r_new(gc, make_string(gc, "new-name"));
+    CHECK(intern(vm, r_new) == *r_new);
+    CHECK(intern(vm, "new-name") == *r_new);
+
+    // Interned names survive collections.
+    gc.collect();
+    CHECK(intern(vm, "some-name:") == *r_a);
+    CHECK(string_eq(*r_a, "some-name:"));
+}
+
 Tuple* make_span(GC& gc)
 {
     return make_tuple(gc, 7);
@@ -31,9 +58,9 @@ TEST_CASE("VM executes basic bytecode (no invocations)", "[vm]")
 
     OptionalRoot<Array> r_upreg_map(gc, nullptr);
 
-    Array* insts = make_array_nofill(gc, /* length */ 1);
-    insts->components()[0] = Value::fixnum(OpCode::LOAD_VALUE | (0 << 8));
-    Root<Array> r_insts(gc, std::move(insts));
+    ByteArray* insts = make_byte_array_nofill(gc, /* length */ 1 * INST_SIZE);
+    write_inst(insts, 0, encode_inst(OpCode::LOAD_VALUE, 0));
+    Root<ByteArray> r_insts(gc, std::move(insts));
 
     Array* args = make_array(gc, /* length */ 1);
     args->components()[0] = Value::fixnum(1234);
@@ -121,13 +148,15 @@ TEST_CASE("VM executes a native invocation", "[vm]")
 
     OptionalRoot<Array> r_upreg_map(gc, nullptr);
 
-    Array* insts = make_array(gc, /* length */ 3);
-    insts->components()[0] = Value::fixnum(OpCode::LOAD_VALUE | (0 << 8));
-    insts->components()[1] = Value::fixnum(OpCode::LOAD_VALUE | (1 << 8));
-    insts->components()[2] = Value::fixnum(OpCode::INVOKE | (2 << 8));
-    Root<Array> r_insts(gc, std::move(insts));
+    ByteArray* insts = make_byte_array_nofill(gc, /* length */ 3 * INST_SIZE);
+    write_inst(insts, 0, encode_inst(OpCode::LOAD_VALUE, 0));
+    write_inst(insts, 1, encode_inst(OpCode::LOAD_VALUE, 1));
+    write_inst(insts, 2, encode_inst(OpCode::INVOKE, 2));
+    Root<ByteArray> r_insts(gc, std::move(insts));
 
-    Array* args = make_array(gc, /* length */ 4);
+    Root<Array> r_inline_cache(gc, make_array(gc, inline_cache_length(/* num_params */ 2)));
+
+    Array* args = make_array(gc, /* length */ 5);
     // LOAD_VALUE: 5
     args->components()[0] = Value::fixnum(5);
     // LOAD_VALUE: 10
@@ -135,6 +164,7 @@ TEST_CASE("VM executes a native invocation", "[vm]")
     // INVOKE: +: with two args
     args->components()[2] = r_multimethod.value();
     args->components()[3] = Value::fixnum(2);
+    args->components()[4] = r_inline_cache.value();
     Root<Array> r_args(gc, std::move(args));
     Root<Tuple> r_span(gc, make_span(gc));
     Root<Array> r_inst_spans(gc, make_array(gc, /* length */ 3));
@@ -156,4 +186,190 @@ TEST_CASE("VM executes a native invocation", "[vm]")
 
     Value v_result = vm.eval_toplevel(r_code);
     CHECK(v_result == Value::fixnum(15));
+
+    // The call site should have cached the dispatch result.
+    CHECK(r_inline_cache->components()[0] == Value::fixnum(0));
+    CHECK(r_inline_cache->components()[1] == r_method.value());
+
+    // Evaluate again -- this time hitting the inline cache.
+    Value v_result_2 = vm.eval_toplevel(r_code);
+    CHECK(v_result_2 == Value::fixnum(15));
+}
+
+TEST_CASE("HeapProfiler attributes allocations to instruction spans", "[vm]")
+{
+    GC gc(1024 * 1024, 64 * 1024);
+    VM vm(gc, 10 * 1024);
+    std::stringstream out;
+    // Sample every allocation.
+    HeapProfiler profiler(vm, 1, /* report_after_full */ true, out);
+
+    Root<Assoc> r_module(gc, make_assoc(gc, /* capacity */ 0));
+    OptionalRoot<Array> r_upreg_map(gc, nullptr);
+
+    // Two instructions: LOAD_VALUE 1; MAKE_TUPLE 1.
+    ByteArray* insts = make_byte_array_nofill(gc, /* length */ 2 * INST_SIZE);
+    write_inst(insts, 0, encode_inst(OpCode::LOAD_VALUE, 0));
+    write_inst(insts, 1, encode_inst(OpCode::MAKE_TUPLE, 1));
+    Root<ByteArray> r_insts(gc, std::move(insts));
+
+    Array* args = make_array(gc, /* length */ 1);
+    args->components()[0] = Value::fixnum(1234);
+    Root<Array> r_args(gc, std::move(args));
+
+    // (path, start index, line, column, end index, line, column), all 0-based.
+    Root<String> r_path(gc, make_string(gc, "some/file.katsu"));
+    Root<Tuple> r_span(gc, make_tuple(gc, 7));
+    r_span->components()[0] = r_path.value();
+    for (int i = 1; i < 7; i++) {
+        r_span->components()[i] = Value::fixnum(i);
+    }
+    Root<Array> r_inst_spans(gc, make_array(gc, /* length */ 2));
+    r_inst_spans->components()[0] = r_span.value();
+    r_inst_spans->components()[1] = r_span.value();
+
+    Root<Code> r_code(gc,
+                      make_code(gc,
+                                /* r_module */ r_module,
+                                /* num_params */ 0,
+                                /* num_regs */ 1,
+                                /* num_data */ 1,
+                                /* r_upreg_map */ r_upreg_map,
+                                /* r_insts */ r_insts,
+                                /* r_args */ r_args,
+                                /* r_span */ r_span,
+                                /* r_inst_spans */ r_inst_spans));
+
+    CHECK(profiler.allocated_at("some/file.katsu:3:4-6.7") == 0);
+    CHECK(profiler.allocated_at("<native>") > 0);
+
+    ValueRoot r_result(gc, vm.eval_toplevel(r_code));
+    REQUIRE(r_result->is_obj_tuple());
+    uint64_t tuple_size = align_up(Tuple::size(1), TAG_BITS);
+    CHECK(profiler.allocated_at("some/file.katsu:3:4-6.7") == tuple_size);
+
+    // The tuple survives, and so shows up in the live report.
+    gc.collect();
+    CHECK(out.str().find("live after collection") != std::string::npos);
+    CHECK(out.str().find(std::to_string(tuple_size) + " some/file.katsu:3:4-6.7") !=
+          std::string::npos);
+
+    std::stringstream allocations;
+    profiler.report_allocations(allocations);
+    CHECK(allocations.str().find("tuple") != std::string::npos);
+}
+
+Value test__request_cpu_sample(VM& vm, int64_t num_args, Value* args)
+{
+    REQUIRE(num_args == 1);
+    vm.cpu_sample_due = 1;
+    return args[0];
+}
+
+TEST_CASE("CpuProfiler samples call stacks at invocations", "[vm]")
+{
+    GC gc(1024 * 1024, 64 * 1024);
+    VM vm(gc, 10 * 1024);
+    // No timer; the native requests each sample, which the next invocation takes.
+    vm.cpu_profiler = std::make_unique<CpuProfiler>(vm, 0);
+
+    Root<String> r_method_name(gc, make_string(gc, "request-sample"));
+    Root<Array> r_param_matchers(gc, make_array(gc, 1));
+    OptionalRoot<Type> r_return_type(gc, nullptr);
+    OptionalRoot<Code> r_method_code(gc, nullptr);
+    Root<Vector> r_method_attributes(gc, make_vector(gc, /* capacity */ 0));
+    Root<Method> r_method(gc,
+                          make_method(gc,
+                                      r_param_matchers,
+                                      r_return_type,
+                                      r_method_code,
+                                      r_method_attributes,
+                                      &test__request_cpu_sample,
+                                      /* intrinsic_handler */ nullptr));
+    Vector* methods = make_vector(gc, /* capacity */ 1);
+    methods->length = 1;
+    methods->v_array.obj_array()->components()[0] = r_method.value();
+    Root<Vector> r_methods(gc, std::move(methods));
+    Root<Vector> r_multimethod_attributes(gc, make_vector(gc, /* capacity */ 0));
+    Root<MultiMethod> r_multimethod(
+        gc, make_multimethod(gc, r_method_name, 1, r_methods, r_multimethod_attributes));
+
+    Root<Assoc> r_module(gc, make_assoc(gc, /* capacity */ 0));
+    OptionalRoot<Array> r_upreg_map(gc, nullptr);
+
+    // LOAD_VALUE null; INVOKE request-sample; INVOKE request-sample.
+    ByteArray* insts = make_byte_array_nofill(gc, /* length */ 3 * INST_SIZE);
+    write_inst(insts, 0, encode_inst(OpCode::LOAD_VALUE, 0));
+    write_inst(insts, 1, encode_inst(OpCode::INVOKE, 1));
+    write_inst(insts, 2, encode_inst(OpCode::INVOKE, 4));
+    Root<ByteArray> r_insts(gc, std::move(insts));
+
+    Root<Array> r_args(gc, make_array(gc, /* length */ 7));
+    for (int i : {1, 4}) {
+        Array* cache = make_array(gc, inline_cache_length(/* num_params */ 1));
+        r_args->components()[i] = r_multimethod.value();
+        r_args->components()[i + 1] = Value::fixnum(1);
+        r_args->components()[i + 2] = Value::object(cache);
+    }
+
+    // (path, start index, line, column, end index, line, column), all 0-based; each instruction
+    // on its own line.
+    Root<String> r_path(gc, make_string(gc, "some/file.katsu"));
+    Root<Array> r_inst_spans(gc, make_array(gc, /* length */ 3));
+    for (int i = 0; i < 3; i++) {
+        Tuple* span = make_tuple(gc, 7);
+        span->components()[0] = r_path.value();
+        for (int j = 1; j < 7; j++) {
+            span->components()[j] = Value::fixnum(j == 2 ? 10 + i : 0);
+        }
+        r_inst_spans->components()[i] = Value::object(span);
+    }
+    Root<Tuple> r_span(gc, make_span(gc));
+
+    Root<Code> r_code(gc,
+                      make_code(gc,
+                                r_module,
+                                /* num_params */ 0,
+                                /* num_regs */ 1,
+                                /* num_data */ 1,
+                                r_upreg_map,
+                                r_insts,
+                                r_args,
+                                r_span,
+                                r_inst_spans));
+
+    vm.eval_toplevel(r_code);
+    CHECK(vm.cpu_profiler->num_samples() == 1);
+    // The last invocation requested one more, which no invocation was left to take.
+    CHECK(vm.cpu_sample_due);
+    vm.cpu_sample_due = 0;
+    // Again, after a collection has moved the code.
+    gc.collect();
+    vm.eval_toplevel(r_code);
+    CHECK(vm.cpu_profiler->num_samples() == 2);
+
+    std::stringstream folded;
+    vm.cpu_profiler->report_folded(folded);
+    CHECK(folded.str() == "some/file.katsu:13 2\n");
+
+    // Only one profiler at a time.
+    CHECK_THROWS_AS(CpuProfiler(vm, 0), std::runtime_error);
+}
+
+TEST_CASE("CpuProfiler's timer requests samples", "[vm]")
+{
+    GC gc(1024 * 1024);
+    VM vm(gc, 10 * 1024);
+    vm.cpu_profiler = std::make_unique<CpuProfiler>(vm, 100);
+
+    // Spin until the timer goes off (after 100us of CPU time), or for at most a few seconds.
+    auto start = std::chrono::steady_clock::now();
+    while (!vm.cpu_sample_due &&
+           std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+    }
+    CHECK(vm.cpu_sample_due);
+
+    // Stopping leaves nothing due.
+    vm.cpu_profiler.reset();
+    CHECK(!vm.cpu_sample_due);
 }
@@ -0,0 +1,481 @@
+#include "worker.h"
+
+#include "assertions.h"
+#include "condition.h"
+#include "value_utils.h"
+
+#include <cstring>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace Katsu
+{
+    // Deepest nesting of Arrays, Vectors and Tuples in a message, which also stops encoding from
+    // following a cycle forever.
+    static const int MAX_MESSAGE_DEPTH = 1000;
+
+    enum class MessageKind : uint8_t
+    {
+        _NULL,
+        TRUE,
+        FALSE,
+        FIXNUM,
+        FLOAT,
+        STRING,
+        BYTE_ARRAY,
+        F64_ARRAY,
+        I64_ARRAY,
+        ARRAY,
+        VECTOR,
+        TUPLE,
+    };
+
+    static void put_u8(std::string& out, uint8_t value)
+    {
+        out.push_back(static_cast<char>(value));
+    }
+    static void put_u64(std::string& out, uint64_t value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    static void put_bytes(std::string& out, const void* bytes, uint64_t length, uint64_t size)
+    {
+        put_u64(out, length);
+        out.append(reinterpret_cast<const char*>(bytes), length * size);
+    }
+
+    static void encode(std::string& out, Value value, int depth)
+    {
+        if (depth > MAX_MESSAGE_DEPTH) {
+            throw condition_error("invalid-argument", "message is nested too deeply (or cyclic)");
+        }
+        const auto put_values = [&out, depth](MessageKind kind, Value* values, uint64_t length) {
+            put_u8(out, (uint8_t)kind);
+            put_u64(out, length);
+            for (uint64_t i = 0; i < length; i++) {
+                encode(out, values[i], depth + 1);
+            }
+        };
+
+        switch (value.tag()) {
+            case Tag::_NULL: put_u8(out, (uint8_t)MessageKind::_NULL); return;
+            case Tag::BOOL:
+                put_u8(out, (uint8_t)(value._bool() ? MessageKind::TRUE : MessageKind::FALSE));
+                return;
+            case Tag::FIXNUM:
+                put_u8(out, (uint8_t)MessageKind::FIXNUM);
+                put_u64(out, value.fixnum());
+                return;
+            case Tag::FLOAT: {
+                float f = value._float();
+                put_u8(out, (uint8_t)MessageKind::FLOAT);
+                out.append(reinterpret_cast<const char*>(&f), sizeof(f));
+                return;
+            }
+            case Tag::OBJECT: break;
+            default: throw condition_error("invalid-argument", "value cannot be sent as a message");
+        }
+
+        Object* object = value.object();
+        switch (object->tag()) {
+            case ObjectTag::STRING: {
+                String* s = static_cast<String*>(object);
+                put_u8(out, (uint8_t)MessageKind::STRING);
+                put_bytes(out, s->contents(), s->length, 1);
+                return;
+            }
+            case ObjectTag::BYTE_ARRAY: {
+                ByteArray* b = static_cast<ByteArray*>(object);
+                put_u8(out, (uint8_t)MessageKind::BYTE_ARRAY);
+                put_bytes(out, b->contents(), b->length, 1);
+                return;
+            }
+            case ObjectTag::F64_ARRAY: {
+                F64Array* a = static_cast<F64Array*>(object);
+                put_u8(out, (uint8_t)MessageKind::F64_ARRAY);
+                put_bytes(out, a->contents(), a->length, sizeof(double));
+                return;
+            }
+            case ObjectTag::I64_ARRAY: {
+                I64Array* a = static_cast<I64Array*>(object);
+                put_u8(out, (uint8_t)MessageKind::I64_ARRAY);
+                put_bytes(out, a->contents(), a->length, sizeof(int64_t));
+                return;
+            }
+            case ObjectTag::ARRAY: {
+                Array* a = static_cast<Array*>(object);
+                put_values(MessageKind::ARRAY, a->components(), a->length);
+                return;
+            }
+            case ObjectTag::VECTOR: {
+                Vector* v = static_cast<Vector*>(object);
+                put_values(MessageKind::VECTOR, v->v_array.obj_array()->components(), v->length);
+                return;
+            }
+            case ObjectTag::TUPLE: {
+                Tuple* t = static_cast<Tuple*>(object);
+                put_values(MessageKind::TUPLE, t->components(), t->length);
+                return;
+            }
+            default:
+                throw condition_error("invalid-argument",
+                                      std::string(object_tag_str(object->tag())) +
+                                          " cannot be sent as a message");
+        }
+    }
+
+    std::string encode_message(Value value)
+    {
+        std::string out;
+        encode(out, value, 0);
+        return out;
+    }
+
+    // Reads back what encode() wrote. Messages only ever come from encode_message(), so running
+    // off the end means the format itself is broken.
+    struct MessageReader
+    {
+        GC& gc;
+        const std::string& data;
+        size_t offset;
+
+        const char* take(uint64_t length)
+        {
+            ALWAYS_ASSERT_MSG(length <= this->data.size() - this->offset, "malformed message");
+            const char* bytes = this->data.data() + this->offset;
+            this->offset += length;
+            return bytes;
+        }
+        uint64_t u64()
+        {
+            uint64_t value;
+            memcpy(&value, this->take(sizeof(value)), sizeof(value));
+            return value;
+        }
+
+        // Each new object is rooted as soon as it's allocated, and only then filled in, so
+        // filling it needs no write barrier.
+        Value read()
+        {
+            MessageKind kind = static_cast<MessageKind>(*this->take(1));
+            switch (kind) {
+                case MessageKind::_NULL: return Value::null();
+                case MessageKind::TRUE: return Value::_bool(true);
+                case MessageKind::FALSE: return Value::_bool(false);
+                case MessageKind::FIXNUM: return Value::fixnum(static_cast<int64_t>(this->u64()));
+                case MessageKind::FLOAT: {
+                    float f;
+                    memcpy(&f, this->take(sizeof(f)), sizeof(f));
+                    return Value::_float(f);
+                }
+                case MessageKind::STRING: {
+                    uint64_t length = this->u64();
+                    String* s = make_string_nofill(this->gc, length);
+                    memcpy(s->contents(), this->take(length), length);
+                    return Value::object(s);
+                }
+                case MessageKind::BYTE_ARRAY: {
+                    uint64_t length = this->u64();
+                    ByteArray* b = make_byte_array_nofill(this->gc, length);
+                    memcpy(b->contents(), this->take(length), length);
+                    return Value::object(b);
+                }
+                case MessageKind::F64_ARRAY: {
+                    uint64_t length = this->u64();
+                    F64Array* a = make_f64_array(this->gc, length);
+                    uint64_t size = length * sizeof(double);
+                    memcpy(a->contents(), this->take(size), size);
+                    return Value::object(a);
+                }
+                case MessageKind::I64_ARRAY: {
+                    uint64_t length = this->u64();
+                    I64Array* a = make_i64_array(this->gc, length);
+                    uint64_t size = length * sizeof(int64_t);
+                    memcpy(a->contents(), this->take(size), size);
+                    return Value::object(a);
+                }
+                case MessageKind::ARRAY:
+                case MessageKind::VECTOR: {
+                    uint64_t length = this->u64();
+                    Root<Array> r_array(this->gc, make_array(this->gc, length));
+                    for (uint64_t i = 0; i < length; i++) {
+                        Value component = this->read();
+                        r_array->components()[i] = component;
+                    }
+                    if (kind == MessageKind::ARRAY) {
+                        return r_array.value();
+                    }
+                    return Value::object(make_vector(this->gc, length, r_array));
+                }
+                case MessageKind::TUPLE: {
+                    uint64_t length = this->u64();
+                    Root<Tuple> r_tuple(this->gc, make_tuple(this->gc, length));
+                    for (uint64_t i = 0; i < length; i++) {
+                        Value component = this->read();
+                        r_tuple->components()[i] = component;
+                    }
+                    return r_tuple.value();
+                }
+            }
+            throw std::logic_error("malformed message");
+        }
+    };
+
+    Value decode_message(GC& gc, const std::string& message)
+    {
+        MessageReader reader{gc, message, 0};
+        return reader.read();
+    }
+
+    struct Channel
+    {
+        std::mutex mutex;
+        std::deque<std::string> messages;
+        bool closed;
+        // An eventfd in semaphore mode, counting the messages waiting plus one once closed: so
+        // it's readable exactly when a receive wouldn't have to wait.
+        int event_fd;
+
+        Channel()
+            : mutex{}
+            , messages{}
+            , closed(false)
+            , event_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE))
+        {
+            if (this->event_fd < 0) {
+                throw condition_error("io-error", std::string("eventfd: ") + strerror(errno));
+            }
+        }
+        ~Channel()
+        {
+            close(this->event_fd);
+        }
+
+        void count_up()
+        {
+            uint64_t one = 1;
+            ALWAYS_ASSERT(write(this->event_fd, &one, sizeof(one)) == sizeof(one));
+        }
+        void count_down()
+        {
+            uint64_t one;
+            ALWAYS_ASSERT(read(this->event_fd, &one, sizeof(one)) == sizeof(one));
+        }
+    };
+
+    // Every channel not yet closed and drained. Once it is, the channel is forgotten (and its
+    // eventfd closed, once nothing is using it); any later receive reports it closed.
+    static std::mutex channels_mutex;
+    static int64_t next_channel = 1;
+    static std::unordered_map<int64_t, std::shared_ptr<Channel>> channels;
+
+    static std::shared_ptr<Channel> lookup_channel(int64_t id)
+    {
+        std::lock_guard<std::mutex> lock(channels_mutex);
+        if (id <= 0 || id >= next_channel) {
+            throw condition_error("invalid-argument", "no such channel");
+        }
+        auto it = channels.find(id);
+        return it == channels.end() ? nullptr : it->second;
+    }
+
+    int64_t channel_create()
+    {
+        auto channel = std::make_shared<Channel>();
+        std::lock_guard<std::mutex> lock(channels_mutex);
+        int64_t id = next_channel++;
+        channels.emplace(id, std::move(channel));
+        return id;
+    }
+
+    void channel_send(int64_t id, std::string message)
+    {
+        std::shared_ptr<Channel> channel = lookup_channel(id);
+        if (channel) {
+            std::lock_guard<std::mutex> lock(channel->mutex);
+            if (!channel->closed) {
+                channel->messages.push_back(std::move(message));
+                channel->count_up();
+                return;
+            }
+        }
+        throw condition_error("channel-closed", "cannot send on a closed channel");
+    }
+
+    static Receive try_receive(int64_t id, Channel& channel, std::string& message)
+    {
+        std::lock_guard<std::mutex> lock(channel.mutex);
+        if (!channel.messages.empty()) {
+            message = std::move(channel.messages.front());
+            channel.messages.pop_front();
+            channel.count_down();
+            return Receive::MESSAGE;
+        }
+        if (channel.closed) {
+            std::lock_guard<std::mutex> channels_lock(channels_mutex);
+            channels.erase(id);
+            return Receive::CLOSED;
+        }
+        return Receive::EMPTY;
+    }
+
+    Receive channel_try_receive(int64_t id, std::string& message)
+    {
+        std::shared_ptr<Channel> channel = lookup_channel(id);
+        return channel ? try_receive(id, *channel, message) : Receive::CLOSED;
+    }
+
+    bool channel_receive(int64_t id, std::string& message)
+    {
+        std::shared_ptr<Channel> channel = lookup_channel(id);
+        if (!channel) {
+            return false;
+        }
+        while (true) {
+            switch (try_receive(id, *channel, message)) {
+                case Receive::MESSAGE: return true;
+                case Receive::CLOSED: return false;
+                case Receive::EMPTY: break;
+            }
+            // Another receiver may get there first, so try again either way.
+            pollfd ready{channel->event_fd, POLLIN, 0};
+            if (poll(&ready, 1, -1) < 0 && errno != EINTR) {
+                throw condition_error("io-error", std::string("poll: ") + strerror(errno));
+            }
+        }
+    }
+
+    int channel_wait_fd(int64_t id)
+    {
+        std::shared_ptr<Channel> channel = lookup_channel(id);
+        if (!channel) {
+            return -1;
+        }
+        // A duplicate, which stays readable even if the channel is drained and forgotten before
+        // the caller is done waiting.
+        int fd = fcntl(channel->event_fd, F_DUPFD_CLOEXEC, 0);
+        if (fd < 0) {
+            throw condition_error("io-error", std::string("fcntl: ") + strerror(errno));
+        }
+        return fd;
+    }
+
+    void channel_close(int64_t id)
+    {
+        std::shared_ptr<Channel> channel = lookup_channel(id);
+        if (!channel) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(channel->mutex);
+        if (!channel->closed) {
+            channel->closed = true;
+            channel->count_up();
+        }
+    }
+
+    struct Worker
+    {
+        std::thread thread;
+        // Only read once the thread is joined.
+        bool succeeded = false;
+    };
+
+    // Every worker not yet joined.
+    static std::mutex workers_mutex;
+    static int64_t next_worker = 1;
+    static std::unordered_map<int64_t, std::unique_ptr<Worker>> workers;
+
+    // What each thread knows of the VM running on it.
+    struct ThreadState
+    {
+        RunOptions options;
+        // The channel this thread's worker was spawned with, if it's a worker.
+        int64_t channel = 0;
+        // Workers this thread spawned, which may not have been joined yet.
+        std::vector<int64_t> spawned;
+    };
+    static thread_local ThreadState thread_state;
+
+    int64_t worker_spawn(const std::string& path, const std::string& module_name,
+                         int64_t channel)
+    {
+        // (Just to check that it exists.)
+        lookup_channel(channel);
+        RunOptions options = thread_state.options;
+        options.cpu_profile = {};
+
+        std::lock_guard<std::mutex> lock(workers_mutex);
+        int64_t id = next_worker++;
+        auto worker = std::make_unique<Worker>();
+        Worker* w = worker.get();
+        w->thread = std::thread([w, id, path, module_name, options, channel]() {
+            thread_state.channel = channel;
+            try {
+                bootstrap_and_run_file(path, module_name, options);
+                w->succeeded = true;
+            } catch (const std::exception& e) {
+                std::cerr << "worker " << id << " failed: " << e.what() << "\n";
+            }
+        });
+        workers.emplace(id, std::move(worker));
+        thread_state.spawned.push_back(id);
+        return id;
+    }
+
+    // Returns nullptr (without waiting) if the worker was already joined.
+    static std::unique_ptr<Worker> join(int64_t id)
+    {
+        std::unique_ptr<Worker> worker;
+        {
+            std::lock_guard<std::mutex> lock(workers_mutex);
+            auto it = workers.find(id);
+            if (it == workers.end()) {
+                return nullptr;
+            }
+            worker = std::move(it->second);
+            workers.erase(it);
+        }
+        std::erase(thread_state.spawned, id);
+        worker->thread.join();
+        return worker;
+    }
+
+    bool worker_join(int64_t id)
+    {
+        std::unique_ptr<Worker> worker = join(id);
+        if (!worker) {
+            throw condition_error("invalid-argument", "no such worker (or it was already joined)");
+        }
+        return worker->succeeded;
+    }
+
+    int64_t worker_channel()
+    {
+        return thread_state.channel;
+    }
+
+    WorkerScope::WorkerScope(const RunOptions& options)
+    {
+        thread_state.options = options;
+    }
+
+    WorkerScope::~WorkerScope()
+    {
+        // (Copied, since each join removes its worker from the original.)
+        std::vector<int64_t> spawned = thread_state.spawned;
+        for (int64_t id : spawned) {
+            join(id);
+        }
+    }
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "gc.h"
+#include "katsu.h"
+#include "value.h"
+
+#include <cstdint>
+#include <string>
+
+namespace Katsu
+{
+    /*
+     * Workers and channels spread a katsu process across cores. A worker is a VM of its own, with
+     * its own GC, running a module on its own OS thread. It boots core just as the main VM did:
+     * from the same bytecode cache or heap image, if any, which are files every VM reads alike.
+     * VMs share no objects; they send each other messages through channels, which copy values
+     * out of one heap and into another.
+     *
+     * Channels and workers are named by ids, unique within the process and never reused, so any
+     * VM can refer to them. A channel is any number of senders' FIFO queue to any number of
+     * receivers.
+     */
+
+    // Encode a copy of a value, which any VM can decode (see decode_message()). Only #null,
+    // Bools, Fixnums, Floats, Strings, ByteArrays, and Arrays, Vectors and Tuples of these can
+    // be copied; throws invalid-argument for anything else (or for a cyclic value).
+    std::string encode_message(Value value);
+    // Allocate a copy of an encoded value.
+    Value decode_message(GC& gc, const std::string& message);
+
+    // Create a new, empty channel.
+    int64_t channel_create();
+    // Enqueue a message. Throws channel-closed if the channel has been closed.
+    void channel_send(int64_t channel, std::string message);
+
+    enum class Receive
+    {
+        MESSAGE,
+        EMPTY,
+        CLOSED,
+    };
+    // Dequeue a message if there is one. CLOSED once the channel is closed and all its messages
+    // have been received.
+    Receive channel_try_receive(int64_t channel, std::string& message);
+    // Dequeue a message, blocking this thread until there is one. Returns false (instead of a
+    // message) once the channel is closed and all its messages have been received.
+    bool channel_receive(int64_t channel, std::string& message);
+    // A new fd (for the caller to close) which is readable whenever channel_try_receive()
+    // wouldn't return EMPTY, for waiting on by epoll. Returns -1 if the channel is already
+    // closed and drained.
+    int channel_wait_fd(int64_t channel);
+    // Stop accepting messages. Those already sent are still received. Closing a closed channel
+    // does nothing.
+    void channel_close(int64_t channel);
+
+    // Start running a module on a new worker, which may receive from (and send to) `channel`
+    // (see worker_channel()). The worker starts with the options this thread's VM did, except
+    // without CPU profiling, which is per process.
+    int64_t worker_spawn(const std::string& path, const std::string& module_name,
+                         int64_t channel);
+    // Block until a worker finishes, and return whether it ran without error. Each worker can
+    // only be joined once.
+    bool worker_join(int64_t worker);
+    // The channel this thread's worker was spawned with, or 0 if this thread isn't a worker.
+    int64_t worker_channel();
+
+    // Records the options a VM is running with, for the workers it spawns. Once destroyed, joins
+    // any of those workers not yet joined: a VM finishes only after its workers have.
+    class WorkerScope
+    {
+    public:
+        WorkerScope(const RunOptions& options);
+        ~WorkerScope();
+    };
+};
@@ -0,0 +1,102 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "condition.h"
+#include "value_utils.h"
+#include "worker.h"
+
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace Katsu;
+
+static bool readable(int fd)
+{
+    pollfd ready{fd, POLLIN, 0};
+    return poll(&ready, 1, 0) == 1;
+}
+
+TEST_CASE("messages copy values between heaps", "[worker]")
+{
+    GC from(1024 * 1024);
+    GC to(1024 * 1024);
+
+    Root<Array> r_array(from, make_array(from, 4));
+    r_array->components()[0] = Value::fixnum(-7);
+    r_array->components()[1] = Value::_float(2.5);
+    r_array->components()[2] = Value::_bool(true);
+    {
+        ValueRoot r_string(from, Value::object(make_string(from, "hello")));
+        Root<Vector> r_vector(from, make_vector(from, /* capacity */ 2));
+        append(from, r_vector, r_string);
+        r_array->components()[3] = r_vector.value();
+    }
+    std::string message = encode_message(r_array.value());
+
+    ValueRoot r_copy(to, decode_message(to, message));
+    REQUIRE(r_copy->is_obj_array());
+    Array* copy = r_copy->obj_array();
+    REQUIRE(copy->length == 4);
+    CHECK(copy->components()[0] == Value::fixnum(-7));
+    CHECK(copy->components()[1]._float() == 2.5);
+    CHECK(copy->components()[2] == Value::_bool(true));
+    REQUIRE(copy->components()[3].is_obj_vector());
+    Vector* vector = copy->components()[3].obj_vector();
+    REQUIRE(vector->length == 1);
+    CHECK(string_eq(vector->v_array.obj_array()->components()[0].obj_string(), "hello"));
+
+    // Only plain data can be copied.
+    ValueRoot rv_array(from, r_array.value());
+    Root<Ref> r_ref(from, make_ref(from, rv_array));
+    CHECK_THROWS_AS(encode_message(r_ref.value()), condition_error);
+    // Nor anything cyclic.
+    r_array->components()[0] = r_array.value();
+    CHECK_THROWS_AS(encode_message(r_array.value()), condition_error);
+}
+
+TEST_CASE("channels queue messages until closed and drained", "[worker]")
+{
+    int64_t channel = channel_create();
+    std::string message;
+    CHECK(channel_try_receive(channel, message) == Receive::EMPTY);
+    int fd = channel_wait_fd(channel);
+    CHECK(!readable(fd));
+
+    channel_send(channel, "one");
+    channel_send(channel, "two");
+    CHECK(readable(fd));
+    CHECK(channel_try_receive(channel, message) == Receive::MESSAGE);
+    CHECK(message == "one");
+
+    channel_close(channel);
+    CHECK_THROWS_AS(channel_send(channel, "three"), condition_error);
+    // What was sent before closing is still received.
+    CHECK(channel_receive(channel, message));
+    CHECK(message == "two");
+    // Then the channel stays closed (and readable, so that no waiter is left waiting).
+    CHECK(readable(fd));
+    CHECK(!channel_receive(channel, message));
+    CHECK(channel_try_receive(channel, message) == Receive::CLOSED);
+    CHECK(channel_wait_fd(channel) == -1);
+    close(fd);
+
+    CHECK_THROWS_AS(channel_try_receive(0, message), condition_error);
+}
+
+TEST_CASE("channel receives block until another thread sends", "[worker]")
+{
+    int64_t channel = channel_create();
+    std::thread sender([channel]() {
+        for (int i = 0; i < 100; i++) {
+            channel_send(channel, std::to_string(i));
+        }
+        channel_close(channel);
+    });
+    std::string message;
+    int expected = 0;
+    while (channel_receive(channel, message)) {
+        CHECK(message == std::to_string(expected++));
+    }
+    CHECK(expected == 100);
+    sender.join();
+}